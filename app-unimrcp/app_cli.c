@@ -0,0 +1,666 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+#include "asterisk/cli.h"
+
+/* UniMRCP includes. */
+#include "ast_unimrcp_framework.h"
+#include "audio_queue.h"
+#include "stream_dump.h"
+#include "tts_cache.h"
+#include "energy_vad.h"
+#include "tts_store.h"
+#include "speech_channel.h"
+#include "slab.h"
+#include "content_cache.h"
+#include "batch_job.h"
+#include "app_cli.h"
+
+/* MRCPSynth pre-synthesis. */
+int mrcpsynth_warm_start(const char *path, const char *options, const char *codec, apr_uint16_t rate);
+int mrcpsynth_warm_stats_get(batch_job_stats_t *stats);
+
+/* MRCPSynth synthesis to file. */
+int mrcpsynth_file_start(const char *path, const char *prompt, const char *options);
+int mrcpsynth_file_stats_get(batch_job_stats_t *stats);
+
+/* MRCPRecog recognition of files. */
+int mrcprecog_files_start(const char *input, const char *grammar, const char *output_dir, const char *options);
+int mrcprecog_files_stats_get(batch_job_stats_t *stats);
+
+#if AST_VERSION_AT_LEAST(1,6,0)
+
+/* Convert speech channel state to a short string. */
+static const char *cli_channel_state(speech_channel_t *schannel)
+{
+	switch (speech_channel_get_state(schannel)) {
+		case SPEECH_CHANNEL_CLOSED: return "CLOSED";
+		case SPEECH_CHANNEL_READY: return "READY";
+		case SPEECH_CHANNEL_PROCESSING: return "PROCESSING";
+		case SPEECH_CHANNEL_ERROR: return "ERROR";
+		default: return "UNKNOWN";
+	}
+}
+
+/* Show the active speech channels. */
+static char *handle_cli_mrcp_show_channels(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	apr_hash_index_t *hi;
+	int count = 0;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp show channels";
+			e->usage =
+				"Usage: mrcp show channels\n"
+				"       Show the active MRCP speech channels along with the depth (msec)\n"
+				"       and clock drift (ppm) of their audio queues.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	ast_cli(a->fd, "%-24s %-11s %-16s %-10s %8s %8s %9s %9s\n", "Name", "Type", "Profile", "State", "Depth", "Drift", "Underruns", "Overflows");
+
+	apr_thread_mutex_lock(globals.mutex);
+	for (hi = apr_hash_first(NULL, globals.channels); hi; hi = apr_hash_next(hi)) {
+		void *val;
+		speech_channel_t *schannel;
+
+		apr_hash_this(hi, NULL, NULL, &val);
+		schannel = (speech_channel_t *)val;
+
+		ast_cli(a->fd, "%-24s %-11s %-16s %-10s %8u %8d %9u %9u\n",
+			schannel->name,
+			schannel->type == SPEECH_CHANNEL_SYNTHESIZER ? "SYNTHESIZER" : "RECOGNIZER",
+			schannel->profile ? schannel->profile->name : "-",
+			cli_channel_state(schannel),
+			apr_atomic_read32(&schannel->drift.depth_ms),
+			(apr_int32_t)apr_atomic_read32(&schannel->drift.drift_ppm),
+			apr_atomic_read32(&schannel->underruns),
+			schannel->audio_queue ? apr_atomic_read32(&schannel->audio_queue->overflows) : 0);
+		count++;
+	}
+	apr_thread_mutex_unlock(globals.mutex);
+
+	ast_cli(a->fd, "%d active speech channel%s, %u pending teardown, %u failed teardown\n", count, count == 1 ? "" : "s",
+		apr_atomic_read32(&globals.pending_teardowns), apr_atomic_read32(&globals.failed_teardowns));
+	return CLI_SUCCESS;
+}
+
+/* Show the slabs speech channels and audio queues are allocated from. */
+static char *handle_cli_mrcp_show_slabs(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	slab_t *slab;
+	apr_size_t total = 0;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp show slabs";
+			e->usage =
+				"Usage: mrcp show slabs\n"
+				"       Show the number of allocated, free and in use objects of the slabs\n"
+				"       speech channels and audio queues are allocated from.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	ast_cli(a->fd, "%-20s %10s %9s %9s %9s %9s\n", "Name", "ObjSize", "Allocated", "Free", "InUse", "Failures");
+
+	for (slab = slab_first(); slab; slab = slab->next) {
+		apr_uint32_t allocated, free, failures;
+
+		apr_thread_mutex_lock(slab->mutex);
+		allocated = slab->allocated;
+		free = slab->free;
+		failures = slab->failures;
+		apr_thread_mutex_unlock(slab->mutex);
+
+		ast_cli(a->fd, "%-20s %10"APR_SIZE_T_FMT" %9u %9u %9u %9u\n", slab->name, slab->object_size, allocated, free, allocated - free, failures);
+		total += slab->object_size * allocated;
+	}
+
+	ast_cli(a->fd, "%"APR_SIZE_T_FMT" bytes allocated, media path waited on a lock %u times\n", total, apr_atomic_read32(&globals.media_lock_waits));
+	return CLI_SUCCESS;
+}
+
+/* Show the session pools of the profiles. */
+static char *handle_cli_mrcp_show_session_pools(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	apr_hash_index_t *hi;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp show session-pools";
+			e->usage =
+				"Usage: mrcp show session-pools\n"
+				"       Show the number of idle established sessions per profile along with\n"
+				"       the number of sessions taken from and returned to the pool.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	ast_cli(a->fd, "%-24s %6s %6s %6s %8s %9s %9s %9s\n", "Profile", "Idle", "Min", "Max", "TTL", "Hits", "Misses", "Returned");
+
+	for (hi = apr_hash_first(NULL, globals.profiles); hi; hi = apr_hash_next(hi)) {
+		void *val;
+		ast_mrcp_profile_t *profile;
+		ast_mrcp_session_pool_t *spool;
+		apr_size_t idle;
+		apr_uint32_t hits, misses, checkins;
+
+		apr_hash_this(hi, NULL, NULL, &val);
+		profile = (ast_mrcp_profile_t *)val;
+		if ((profile == NULL) || ((spool = profile->session_pool) == NULL))
+			continue;
+
+		apr_thread_mutex_lock(spool->mutex);
+		idle = spool->idle_count;
+		hits = spool->hits;
+		misses = spool->misses;
+		checkins = spool->checkins;
+		apr_thread_mutex_unlock(spool->mutex);
+
+		ast_cli(a->fd, "%-24s %6"APR_SIZE_T_FMT" %6"APR_SIZE_T_FMT" %6"APR_SIZE_T_FMT" %8"APR_TIME_T_FMT" %9u %9u %9u\n",
+			profile->name,
+			idle,
+			profile->session_pool_min_idle,
+			profile->session_pool_max_idle,
+			apr_time_as_msec(profile->session_pool_idle_ttl),
+			hits,
+			misses,
+			checkins);
+	}
+
+	return CLI_SUCCESS;
+}
+
+/* Show the latency histograms of the profiles. */
+static char *handle_cli_mrcp_show_latency(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	apr_hash_index_t *hi;
+	int type, latency, bucket;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp show latency";
+			e->usage =
+				"Usage: mrcp show latency [profile]\n"
+				"       Show the histograms of the latencies (msec) of the speech channel\n"
+				"       requests per profile: setup of the session, IN-PROGRESS response,\n"
+				"       first audio frame, START-OF-INPUT and COMPLETE events.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if ((a->argc != 3) && (a->argc != 4))
+		return CLI_SHOWUSAGE;
+
+	ast_cli(a->fd, "%-24s %-6s %-19s %8s %6s %6s", "Profile", "Type", "Latency", "Count", "Avg", "Max");
+	for (bucket = 0; bucket < AST_MRCP_LATENCY_BUCKETS; bucket++)
+		ast_cli(a->fd, " %6s", profile_latency_bucket_to_string(bucket));
+	ast_cli(a->fd, "\n");
+
+	for (hi = apr_hash_first(NULL, globals.profiles); hi; hi = apr_hash_next(hi)) {
+		void *val;
+		ast_mrcp_profile_t *profile;
+
+		apr_hash_this(hi, NULL, NULL, &val);
+		profile = (ast_mrcp_profile_t *)val;
+		if ((profile == NULL) || ((a->argc == 4) && (strcasecmp(profile->name, a->argv[3]) != 0)))
+			continue;
+
+		for (type = 0; type < AST_MRCP_LATENCY_TYPES; type++) {
+			for (latency = 0; latency < AST_MRCP_LATENCY_COUNT; latency++) {
+				ast_mrcp_latency_histogram_t *histogram = &profile->latency[type][latency];
+				apr_uint32_t count = apr_atomic_read32(&histogram->count);
+
+				if (count == 0)
+					continue;
+
+				ast_cli(a->fd, "%-24s %-6s %-19s %8u %6u %6u",
+					profile->name,
+					(type == SPEECH_CHANNEL_SYNTHESIZER) ? "synth" : "recog",
+					profile_latency_to_string(latency),
+					count,
+					(apr_uint32_t)(profile_latency_sum(histogram) / count),
+					apr_atomic_read32(&histogram->max));
+				for (bucket = 0; bucket < AST_MRCP_LATENCY_BUCKETS; bucket++)
+					ast_cli(a->fd, " %6u", apr_atomic_read32(&histogram->buckets[bucket]));
+				ast_cli(a->fd, "\n");
+			}
+		}
+	}
+
+	return CLI_SUCCESS;
+}
+
+/* Show the counters of the cache and the store of synthesized prompts. */
+static char *handle_cli_mrcp_show_tts_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	tts_cache_stats_t stats;
+	tts_store_stats_t store_stats;
+	apr_uint32_t lookups;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp show tts-cache";
+			e->usage =
+				"Usage: mrcp show tts-cache\n"
+				"       Show the size and the hit, miss and eviction counters of the cache\n"
+				"       and the on-disk store of synthesized prompts.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	tts_cache_stats_get(&stats);
+	tts_store_stats_get(&store_stats);
+	if ((stats.max_size == 0) && (store_stats.max_size == 0)) {
+		ast_cli(a->fd, "TTS cache is disabled\n");
+		return CLI_SUCCESS;
+	}
+
+	lookups = stats.hits + stats.store_hits + stats.misses;
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT" of %"APR_SIZE_T_FMT" bytes\n", "Size", stats.size, stats.max_size);
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT"\n", "Prompts", stats.entries);
+	ast_cli(a->fd, "%-12s %u (%u%%)\n", "Hits", stats.hits, lookups ? (stats.hits * 100) / lookups : 0);
+	ast_cli(a->fd, "%-12s %u (%u%%)\n", "Store hits", stats.store_hits, lookups ? (stats.store_hits * 100) / lookups : 0);
+	ast_cli(a->fd, "%-12s %u\n", "Misses", stats.misses);
+	ast_cli(a->fd, "%-12s %u\n", "Inserts", stats.inserts);
+	ast_cli(a->fd, "%-12s %u\n", "Evictions", stats.evictions);
+	ast_cli(a->fd, "%-12s %u\n", "Rejects", stats.rejects);
+
+	if (store_stats.max_size == 0)
+		return CLI_SUCCESS;
+
+	ast_cli(a->fd, "\nStore\n");
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT" of %"APR_SIZE_T_FMT" bytes\n", "Size", store_stats.size, store_stats.max_size);
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT"\n", "Prompts", store_stats.files);
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT" bytes\n", "Pending", store_stats.pending);
+	ast_cli(a->fd, "%-12s %u\n", "Hits", store_stats.hits);
+	ast_cli(a->fd, "%-12s %u\n", "Misses", store_stats.misses);
+	ast_cli(a->fd, "%-12s %u\n", "Writes", store_stats.writes);
+	ast_cli(a->fd, "%-12s %u\n", "Evictions", store_stats.evictions);
+	ast_cli(a->fd, "%-12s %u\n", "Drops", store_stats.drops);
+	ast_cli(a->fd, "%-12s %u\n", "Failures", store_stats.failures);
+	return CLI_SUCCESS;
+}
+
+/* Show the counters of the cache of grammar and SSML files. */
+static char *handle_cli_mrcp_show_content_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	content_cache_stats_t stats;
+	apr_uint32_t lookups;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp show content-cache";
+			e->usage =
+				"Usage: mrcp show content-cache\n"
+				"       Show the size and the hit, miss and reload counters of the cache\n"
+				"       of grammar and SSML files.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	content_cache_stats_get(&stats);
+	if (stats.max_size == 0) {
+		ast_cli(a->fd, "Content cache is disabled\n");
+		return CLI_SUCCESS;
+	}
+
+	lookups = stats.hits + stats.misses + stats.reloads;
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT" of %"APR_SIZE_T_FMT" bytes\n", "Size", stats.size, stats.max_size);
+	ast_cli(a->fd, "%-12s %"APR_SIZE_T_FMT"\n", "Files", stats.entries);
+	ast_cli(a->fd, "%-12s %u (%u%%)\n", "Hits", stats.hits, lookups ? (stats.hits * 100) / lookups : 0);
+	ast_cli(a->fd, "%-12s %u\n", "Misses", stats.misses);
+	ast_cli(a->fd, "%-12s %u\n", "Reloads", stats.reloads);
+	ast_cli(a->fd, "%-12s %u\n", "Evictions", stats.evictions);
+	return CLI_SUCCESS;
+}
+
+/* Pre-synthesize a list of prompts into the TTS cache, or show the progress of the last list. */
+static char *handle_cli_mrcp_synth_warm(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	batch_job_stats_t stats;
+	const char *options = NULL;
+	char *codec = "PCMU";
+	char *rate_str;
+	apr_uint16_t rate = 8000;
+	int res;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp synth warm";
+			e->usage =
+				"Usage: mrcp synth warm [<file> [<options> [<codec>[/<rate>]]]]\n"
+				"       Synthesize the prompts listed in a file, one per line, into the TTS\n"
+				"       cache in the background. The options are those of MRCPSynth, such as\n"
+				"       p=ums2&v=Daniel, and must match the ones the prompts are played with.\n"
+				"       The codec defaults to PCMU/8000. Without arguments, show the progress\n"
+				"       of the last list.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if (a->argc > 6)
+		return CLI_SHOWUSAGE;
+
+	if (a->argc >= 4) {
+		if (a->argc >= 5)
+			options = a->argv[4];
+		if (a->argc == 6) {
+			codec = ast_strdupa(a->argv[5]);
+			if ((rate_str = strchr(codec, '/')) != NULL) {
+				*rate_str++ = '\0';
+				rate = (apr_uint16_t)atoi(rate_str);
+			} else if (strcasecmp(codec, "G722") == 0) {
+				rate = 16000;
+			}
+			if (rate == 0)
+				return CLI_SHOWUSAGE;
+		}
+
+		res = mrcpsynth_warm_start(a->argv[3], options, codec, rate);
+		if (res < 0) {
+			ast_cli(a->fd, "Unable to pre-synthesize %s, see the log for details\n", a->argv[3]);
+			return CLI_FAILURE;
+		}
+		if (res == 0) {
+			ast_cli(a->fd, "Pre-synthesizing %s\n", a->argv[3]);
+			return CLI_SUCCESS;
+		}
+		ast_cli(a->fd, "A list is being pre-synthesized already\n");
+	}
+
+	if (mrcpsynth_warm_stats_get(&stats) != 0) {
+		ast_cli(a->fd, "No prompts have been pre-synthesized\n");
+		return CLI_SUCCESS;
+	}
+
+	ast_cli(a->fd, "%-12s %s\n", "State", stats.running ? "running" : "done");
+	ast_cli(a->fd, "%-12s %u of %u\n", "Prompts", stats.done, stats.total);
+	ast_cli(a->fd, "%-12s %u\n", "Synthesized", stats.completed);
+	ast_cli(a->fd, "%-12s %u\n", "Cached", stats.skipped);
+	ast_cli(a->fd, "%-12s %u\n", "Failed", stats.failed);
+	ast_cli(a->fd, "%-12s %"APR_TIME_T_FMT" sec\n", "Elapsed", apr_time_sec(stats.elapsed));
+	return CLI_SUCCESS;
+}
+
+/* Synthesize a prompt to a file in the background, without an Asterisk channel, 
+ * or show the outcome of the last synthesis.
+ */
+static char *handle_cli_mrcp_synth_file(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	batch_job_stats_t stats;
+	int res;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp synth file";
+			e->usage =
+				"Usage: mrcp synth file [<file> <prompt> [<options>]]\n"
+				"       Synthesize a prompt to a file in the background, as fast as the MRCP\n"
+				"       server produces it. The extension of the file selects the format:\n"
+				"       ulaw, alaw, sln, sln16 or g722. The options are those of\n"
+				"       MRCPSynthToFile, such as p=ums2&v=Daniel. Without arguments, show the\n"
+				"       outcome of the last synthesis.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if ((a->argc != 3) && (a->argc != 5) && (a->argc != 6))
+		return CLI_SHOWUSAGE;
+
+	if (a->argc >= 5) {
+		res = mrcpsynth_file_start(a->argv[3], a->argv[4], (a->argc == 6) ? a->argv[5] : NULL);
+		if (res < 0) {
+			ast_cli(a->fd, "Unable to synthesize %s, see the log for details\n", a->argv[3]);
+			return CLI_FAILURE;
+		}
+		if (res == 0) {
+			ast_cli(a->fd, "Synthesizing %s\n", a->argv[3]);
+			return CLI_SUCCESS;
+		}
+		ast_cli(a->fd, "A prompt is being synthesized to a file already\n");
+	}
+
+	if (mrcpsynth_file_stats_get(&stats) != 0) {
+		ast_cli(a->fd, "No prompt has been synthesized to a file\n");
+		return CLI_SUCCESS;
+	}
+
+	ast_cli(a->fd, "%-12s %s\n", "State", stats.running ? "running" : (stats.completed ? "synthesized" : "failed"));
+	ast_cli(a->fd, "%-12s %"APR_TIME_T_FMT" sec\n", "Elapsed", apr_time_sec(stats.elapsed));
+	return CLI_SUCCESS;
+}
+
+/* Recognize recorded files in the background, or show the progress of the last files. */
+static char *handle_cli_mrcp_recog_files(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	batch_job_stats_t stats;
+	int res;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp recog files";
+			e->usage =
+				"Usage: mrcp recog files [<input> <grammar> <output-dir> [<options>]]\n"
+				"       Recognize a recorded file or the recordings of a directory in the\n"
+				"       background and write the NLSML results to the output directory, one\n"
+				"       <file>.xml per recording, such as a.wav.xml. Recordings are WAV\n"
+				"       files or raw files in ulaw, alaw, sln, sln16 or g722. The options\n"
+				"       are those of MRCPRecogFile, such as p=ums2&t=5000. Without arguments,\n"
+				"       show the progress of the last files.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if ((a->argc != 3) && (a->argc != 6) && (a->argc != 7))
+		return CLI_SHOWUSAGE;
+
+	if (a->argc >= 6) {
+		res = mrcprecog_files_start(a->argv[3], a->argv[4], a->argv[5], (a->argc == 7) ? a->argv[6] : NULL);
+		if (res < 0) {
+			ast_cli(a->fd, "Unable to recognize %s, see the log for details\n", a->argv[3]);
+			return CLI_FAILURE;
+		}
+		if (res == 0) {
+			ast_cli(a->fd, "Recognizing %s\n", a->argv[3]);
+			return CLI_SUCCESS;
+		}
+		ast_cli(a->fd, "Files are being recognized already\n");
+	}
+
+	if (mrcprecog_files_stats_get(&stats) != 0) {
+		ast_cli(a->fd, "No files have been recognized\n");
+		return CLI_SUCCESS;
+	}
+
+	ast_cli(a->fd, "%-12s %s\n", "State", stats.running ? "running" : "done");
+	ast_cli(a->fd, "%-12s %u of %u\n", "Files", stats.done, stats.total);
+	ast_cli(a->fd, "%-12s %u\n", "Results", stats.completed);
+	ast_cli(a->fd, "%-12s %u\n", "No result", stats.skipped);
+	ast_cli(a->fd, "%-12s %u\n", "Failed", stats.failed);
+	ast_cli(a->fd, "%-12s %"APR_TIME_T_FMT" sec\n", "Elapsed", apr_time_sec(stats.elapsed));
+	return CLI_SUCCESS;
+}
+
+/* Set or clear a debug flag in a set of flags. */
+static void cli_debug_flags_set(volatile apr_uint32_t *debug_flags, apr_uint32_t flags, int enable)
+{
+	apr_uint32_t prev;
+
+	do {
+		prev = apr_atomic_read32(debug_flags);
+	} while (apr_atomic_cas32(debug_flags, enable ? (prev | flags) : (prev & ~flags), prev) != prev);
+}
+
+/* Toggle stream dumps and traces of all channels, the channels of a profile or a single channel. */
+static char *handle_cli_mrcp_set_debug(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	apr_hash_index_t *hi;
+	ast_mrcp_profile_t *profile = NULL;
+	const char *channel_name = NULL;
+	apr_uint32_t flags;
+	int enable;
+	int count = 0;
+
+	switch (cmd) {
+		case CLI_INIT:
+			e->command = "mrcp set {dump|trace} {on|off}";
+			e->usage =
+				"Usage: mrcp set {dump|trace} {on|off} [channel <name>|profile <name>]\n"
+				"       Start or stop dumping the audio streams of speech channels to\n"
+				"       raw files in " SPEECH_CHANNEL_DUMP_DIR ", or tracing each read and\n"
+				"       write of the streams. Applies to the given channel, to the channels\n"
+				"       of the given profile including the ones opened later, or to all\n"
+				"       the channels if none is given.\n";
+			return NULL;
+		case CLI_GENERATE:
+			return NULL;
+	}
+
+	if ((a->argc != 4) && (a->argc != 6))
+		return CLI_SHOWUSAGE;
+
+	flags = (strcasecmp(a->argv[2], "dump") == 0) ? SPEECH_CHANNEL_DEBUG_DUMP : SPEECH_CHANNEL_DEBUG_TRACE;
+	enable = (strcasecmp(a->argv[3], "on") == 0);
+
+	if (a->argc == 6) {
+		if (strcasecmp(a->argv[4], "channel") == 0)
+			channel_name = a->argv[5];
+		else if (strcasecmp(a->argv[4], "profile") == 0) {
+			if ((profile = (ast_mrcp_profile_t *)apr_hash_get(globals.profiles, a->argv[5], APR_HASH_KEY_STRING)) == NULL) {
+				ast_cli(a->fd, "No such profile: %s\n", a->argv[5]);
+				return CLI_FAILURE;
+			}
+		} else
+			return CLI_SHOWUSAGE;
+	}
+
+	/* Apply the flag to the channels opened from now on. */
+	if (profile != NULL)
+		cli_debug_flags_set(&profile->debug_flags, flags, enable);
+	else if (channel_name == NULL) {
+		cli_debug_flags_set(&globals.debug_flags, flags, enable);
+		if (!enable) {
+			for (hi = apr_hash_first(NULL, globals.profiles); hi; hi = apr_hash_next(hi)) {
+				void *val;
+
+				apr_hash_this(hi, NULL, NULL, &val);
+				if (val != NULL)
+					cli_debug_flags_set(&((ast_mrcp_profile_t *)val)->debug_flags, flags, FALSE);
+			}
+		}
+	}
+
+	/* Apply the flag to the active channels. A registered channel is not released meanwhile. */
+	if (globals.channels != NULL) {
+		apr_thread_mutex_lock(globals.mutex);
+		for (hi = apr_hash_first(NULL, globals.channels); hi; hi = apr_hash_next(hi)) {
+			void *val;
+			speech_channel_t *schannel;
+
+			apr_hash_this(hi, NULL, NULL, &val);
+			schannel = (speech_channel_t *)val;
+			if (schannel == NULL)
+				continue;
+			if ((channel_name != NULL) && (strcasecmp(schannel->name, channel_name) != 0))
+				continue;
+			if ((profile != NULL) && (schannel->profile != profile))
+				continue;
+
+			if (speech_channel_debug_set(schannel, flags, enable) == 0)
+				count++;
+		}
+		apr_thread_mutex_unlock(globals.mutex);
+	}
+
+	if ((channel_name != NULL) && (count == 0)) {
+		ast_cli(a->fd, "No such channel: %s\n", channel_name);
+		return CLI_FAILURE;
+	}
+
+	ast_cli(a->fd, "Stream %s %s for %d active channel(s)\n", (flags == SPEECH_CHANNEL_DEBUG_DUMP) ? "dump" : "trace", enable ? "enabled" : "disabled", count);
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_unimrcp[] = {
+	AST_CLI_DEFINE(handle_cli_mrcp_show_channels, "Show active MRCP speech channels"),
+	AST_CLI_DEFINE(handle_cli_mrcp_show_slabs, "Show MRCP slab allocator usage"),
+	AST_CLI_DEFINE(handle_cli_mrcp_show_session_pools, "Show MRCP session pools"),
+	AST_CLI_DEFINE(handle_cli_mrcp_show_latency, "Show MRCP request latency histograms"),
+	AST_CLI_DEFINE(handle_cli_mrcp_show_tts_cache, "Show MRCP TTS cache statistics"),
+	AST_CLI_DEFINE(handle_cli_mrcp_show_content_cache, "Show MRCP grammar and SSML file cache statistics"),
+	AST_CLI_DEFINE(handle_cli_mrcp_synth_warm, "Pre-synthesize prompts into the MRCP TTS cache"),
+	AST_CLI_DEFINE(handle_cli_mrcp_synth_file, "Synthesize a prompt to a file"),
+	AST_CLI_DEFINE(handle_cli_mrcp_recog_files, "Recognize recorded files"),
+	AST_CLI_DEFINE(handle_cli_mrcp_set_debug, "Toggle MRCP stream dumps and traces"),
+};
+
+/* Register the CLI commands. */
+int app_cli_register(void)
+{
+	return ast_cli_register_multiple(cli_unimrcp, ARRAY_LEN(cli_unimrcp));
+}
+
+/* Unregister the CLI commands. */
+int app_cli_unregister(void)
+{
+	return ast_cli_unregister_multiple(cli_unimrcp, ARRAY_LEN(cli_unimrcp));
+}
+
+#else
+
+/* CLI commands are not supported by this version of Asterisk. */
+int app_cli_register(void)
+{
+	return 0;
+}
+
+int app_cli_unregister(void)
+{
+	return 0;
+}
+
+#endif
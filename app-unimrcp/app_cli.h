@@ -0,0 +1,27 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef APP_CLI_H
+#define APP_CLI_H
+
+/* Register the CLI commands. */
+int app_cli_register(void);
+
+/* Unregister the CLI commands. */
+int app_cli_unregister(void);
+
+#endif /* APP_CLI_H */
@@ -273,6 +273,7 @@ app_session_t* app_datastore_session_add(app_datastore_t* app_datastore, const c
 
 	session->prompts = NULL;
 	session->cur_prompt = 0;
+	session->prefetch = NULL;
 	session->filestream = NULL;
 	session->max_filelength = 0;
 	session->it_policy = 0;
@@ -26,6 +26,9 @@
 /* UniMRCP includes. */
 #include "ast_unimrcp_framework.h"
 #include "audio_queue.h"
+#include "stream_dump.h"
+#include "tts_cache.h"
+#include "energy_vad.h"
 #include "speech_channel.h"
 #include "apt_nlsml_doc.h"
 
@@ -43,6 +46,8 @@ enum nlsml_instance_format {
 	NLSML_INSTANCE_FORMAT_JSON       /* NLSML instance is represented in JSON */
 };
 
+struct sar_prefetch_t;
+
 /* The application session. */
 struct app_session_t {
 	apr_pool_t                 *pool;               /* memory pool */
@@ -58,6 +63,7 @@ struct app_session_t {
 	ast_format_compat          *nwriteformat;       /* new write format used for synthesis */
 	apr_array_header_t         *prompts;            /* list of prompt items */
 	int                         cur_prompt;         /* current prompt index */
+	struct sar_prefetch_t      *prefetch;           /* synthesis of upcoming prompts, if any */
 	struct ast_filestream      *filestream;         /* filestream, if any */
 	off_t                       max_filelength;     /* max file length used with file playing, if any */
 	int                         it_policy;          /* input timers policy (sar_it_policies) */
@@ -0,0 +1,348 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/*! \file
+ *
+ * \brief MRCPPrefetch application
+ *
+ * MRCPPrefetch application
+ * \ingroup applications
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include "asterisk/channel.h"
+#include "asterisk/pbx.h"
+#include "asterisk/app.h"
+
+/* UniMRCP includes. */
+#include "app_datastore.h"
+
+/*** DOCUMENTATION
+	<application name="MRCPPrefetch" language="en_US">
+		<synopsis>
+			MRCP prefetch application.
+		</synopsis>
+		<syntax>
+			<parameter name="application" required="true">
+				<para>The application to open the speech channels for (MRCPSynth, MRCPRecog or SynthAndRecog).</para>
+			</parameter>
+			<parameter name="options" required="false">
+				<optionlist>
+					<option name="p"> <para>Profile to use in mrcp.conf.</para> </option>
+					<option name="prec"> <para>Profile to use for the recognition channel of SynthAndRecog.</para> </option>
+					<option name="psyn"> <para>Profile to use for the synthesis channel of SynthAndRecog.</para> </option>
+					<option name="dse"> <para>Datastore entry.</para></option>
+				</optionlist>
+			</parameter>
+		</syntax>
+		<description>
+			<para>This application starts establishing the MRCP sessions used by the specified application and returns
+			without waiting for them. It does not answer the channel, so it can be used while the call is ringing or
+			before an earlier prompt is played. The next invocation of the specified application with the same datastore
+			entry uses the prefetched speech channels, waiting only for the rest of the session establishment, if any.
+			The session lifetime is determined by the application using the speech channels.</para>
+			<para>If the sessions are being established, the variable ${PREFETCHSTATUS} is set to "OK"; otherwise, if
+			an error occurred, the variable ${PREFETCHSTATUS} is set to "ERROR".</para>
+		</description>
+		<see-also>
+			<ref type="application">MRCPSynth</ref>
+			<ref type="application">MRCPRecog</ref>
+			<ref type="application">SynthAndRecog</ref>
+		</see-also>
+	</application>
+ ***/
+
+/* The name of the application. */
+static const char *app_prefetch = "MRCPPrefetch";
+
+/* The application instance. */
+static ast_mrcp_application_t *mrcpprefetch = NULL;
+
+/* The enumeration of application options. */
+enum mrcpprefetch_option_flags {
+	MRCPPREFETCH_RECOG_PROFILE   = (1 << 0),
+	MRCPPREFETCH_SYNTH_PROFILE   = (1 << 1),
+	MRCPPREFETCH_DATASTORE_ENTRY = (1 << 2)
+};
+
+/* The enumeration of option arguments. */
+enum mrcpprefetch_option_args {
+	OPT_ARG_RECOG_PROFILE   = 0,
+	OPT_ARG_SYNTH_PROFILE   = 1,
+	OPT_ARG_DATASTORE_ENTRY = 2,
+
+	/* This MUST be the last value in this enum! */
+	OPT_ARG_ARRAY_SIZE = 3
+};
+
+/* The structure which holds the application options. */
+struct mrcpprefetch_options_t {
+	int         flags;
+	const char *params[OPT_ARG_ARRAY_SIZE];
+};
+
+typedef struct mrcpprefetch_options_t mrcpprefetch_options_t;
+
+/* Apply application options. */
+static int mrcpprefetch_option_apply(mrcpprefetch_options_t *options, const char *key, const char *value)
+{
+	if (strcasecmp(key, "p") == 0) {
+		options->flags |= MRCPPREFETCH_RECOG_PROFILE | MRCPPREFETCH_SYNTH_PROFILE;
+		options->params[OPT_ARG_RECOG_PROFILE] = value;
+		options->params[OPT_ARG_SYNTH_PROFILE] = value;
+	} else if (strcasecmp(key, "prec") == 0) {
+		options->flags |= MRCPPREFETCH_RECOG_PROFILE;
+		options->params[OPT_ARG_RECOG_PROFILE] = value;
+	} else if (strcasecmp(key, "psyn") == 0) {
+		options->flags |= MRCPPREFETCH_SYNTH_PROFILE;
+		options->params[OPT_ARG_SYNTH_PROFILE] = value;
+	} else if (strcasecmp(key, "dse") == 0) {
+		options->flags |= MRCPPREFETCH_DATASTORE_ENTRY;
+		options->params[OPT_ARG_DATASTORE_ENTRY] = value;
+	} else {
+		ast_log(LOG_WARNING, "Unknown option: %s\n", key);
+	}
+	return 0;
+}
+
+/* Parse application options. */
+static int mrcpprefetch_options_parse(char *str, mrcpprefetch_options_t *options)
+{
+	char *s;
+	char *name, *value;
+	
+	if (!str)
+		return 0;
+
+	while ((s = strsep(&str, "&"))) {
+		value = s;
+		if ((name = strsep(&value, "=")) && value) {
+			ast_log(LOG_DEBUG, "Apply option %s: %s\n", name, value);
+			mrcpprefetch_option_apply(options, name, value);
+		}
+	}
+	return 0;
+}
+
+/* Exit the application. */
+static int mrcpprefetch_exit(struct ast_channel *chan, speech_channel_status_t status)
+{
+	const char *status_str = speech_channel_status_to_string(status);
+	pbx_builtin_setvar_helper(chan, "PREFETCHSTATUS", status_str);
+	ast_log(LOG_NOTICE, "%s() exiting status: %s on %s\n", app_prefetch, status_str, ast_channel_name(chan));
+	return 0;
+}
+
+/* Create a speech channel and start opening it. */
+static speech_channel_t *mrcpprefetch_channel_open(
+								app_session_t *app_session,
+								const char *name,
+								speech_channel_type_t type,
+								ast_mrcp_application_t *application,
+								ast_format_compat *format,
+								ast_mrcp_profile_t *profile,
+								struct ast_channel *chan)
+{
+	speech_channel_t *schannel;
+
+	if (!profile) {
+		ast_log(LOG_ERROR, "(%s) Can't find profile\n", name);
+		return NULL;
+	}
+
+	schannel = speech_channel_create(app_session->pool, name, type, application, format, NULL, chan);
+	if (!schannel) {
+		return NULL;
+	}
+
+	if (speech_channel_open_start(schannel, profile) != 0) {
+		speech_channel_destroy(schannel);
+		return NULL;
+	}
+
+	return schannel;
+}
+
+/* The entry point of the application. */
+static int app_prefetch_exec(struct ast_channel *chan, ast_app_data data)
+{
+	apr_hash_index_t *hi;
+	ast_mrcp_application_t *application = NULL;
+	mrcpprefetch_options_t mrcpprefetch_options;
+	char *parse;
+	int i;
+
+	AST_DECLARE_APP_ARGS(args,
+		AST_APP_ARG(application);
+		AST_APP_ARG(options);
+	);
+
+	if (ast_strlen_zero(data)) {
+		ast_log(LOG_WARNING, "%s() requires an argument (application[,options])\n", app_prefetch);
+		return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+	}
+
+	/* We need to make a copy of the input string if we are going to modify it! */
+	parse = ast_strdupa(data);
+	AST_STANDARD_APP_ARGS(args, parse);
+
+	if (ast_strlen_zero(args.application)) {
+		ast_log(LOG_WARNING, "%s() requires an application argument (application[,options])\n", app_prefetch);
+		return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+	}
+
+	/* Find the application to prefetch the speech channels for. */
+	for (hi = apr_hash_first(NULL, globals.apps); hi; hi = apr_hash_next(hi)) {
+		const void *key;
+		void *val;
+
+		apr_hash_this(hi, &key, NULL, &val);
+
+		/* Skip the applications which run no speech channels of their own. */
+		if ((((ast_mrcp_application_t *) val)->app != NULL) && (strcasecmp((const char *) key, args.application) == 0)) {
+			application = (ast_mrcp_application_t *) val;
+			break;
+		}
+	}
+
+	if (!application) {
+		ast_log(LOG_WARNING, "%s() unknown application: %s\n", app_prefetch, args.application);
+		return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+	}
+
+	app_datastore_t* datastore = app_datastore_get(chan);
+	if (!datastore) {
+		ast_log(LOG_ERROR, "Unable to retrieve data from app datastore on %s\n", ast_channel_name(chan));
+		return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+	}
+
+	mrcpprefetch_options.flags = 0;
+	for (i=0; i<OPT_ARG_ARRAY_SIZE; i++)
+		mrcpprefetch_options.params[i] = NULL;
+
+	if (!ast_strlen_zero(args.options)) {
+		args.options = normalize_input_string(args.options);
+		ast_log(LOG_NOTICE, "%s() options: %s\n", app_prefetch, args.options);
+		char *options_buf = apr_pstrdup(datastore->pool, args.options);
+		mrcpprefetch_options_parse(options_buf, &mrcpprefetch_options);
+	}
+
+	/* Get datastore entry. */
+	const char *entry = DEFAULT_DATASTORE_ENTRY;
+	if ((mrcpprefetch_options.flags & MRCPPREFETCH_DATASTORE_ENTRY) == MRCPPREFETCH_DATASTORE_ENTRY) {
+		if (!ast_strlen_zero(mrcpprefetch_options.params[OPT_ARG_DATASTORE_ENTRY])) {
+			entry = mrcpprefetch_options.params[OPT_ARG_DATASTORE_ENTRY];
+		}
+	}
+
+	/* Get application datastore. */
+	app_session_t *app_session = app_datastore_session_add(datastore, entry);
+	if (!app_session) {
+		return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+	}
+
+	int recog = (strcmp(application->name, "MRCPSynth") != 0);
+	int synth = (strcmp(application->name, "MRCPRecog") != 0);
+
+	if (recog && !app_session->recog_channel) {
+		const char *profile_name = mrcpprefetch_options.params[OPT_ARG_RECOG_PROFILE];
+		const char *name = apr_psprintf(app_session->pool, "ASR-%lu", (unsigned long int)app_session->schannel_number);
+
+		/* Get new read format. */
+		app_session->nreadformat = ast_channel_get_speechreadformat(chan, app_session->pool);
+
+		app_session->recog_channel = mrcpprefetch_channel_open(
+										app_session,
+										name,
+										SPEECH_CHANNEL_RECOGNIZER,
+										application,
+										app_session->nreadformat,
+										get_recog_profile(ast_strlen_zero(profile_name) ? NULL : profile_name),
+										chan);
+		if (!app_session->recog_channel) {
+			return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+		}
+	}
+
+	if (synth && !app_session->synth_channel) {
+		const char *profile_name = mrcpprefetch_options.params[OPT_ARG_SYNTH_PROFILE];
+		const char *name = apr_psprintf(app_session->pool, "TTS-%lu", (unsigned long int)app_session->schannel_number);
+
+		/* Get new write format. */
+		app_session->nwriteformat = ast_channel_get_speechwriteformat(chan, app_session->pool);
+
+		app_session->synth_channel = mrcpprefetch_channel_open(
+										app_session,
+										name,
+										SPEECH_CHANNEL_SYNTHESIZER,
+										application,
+										app_session->nwriteformat,
+										get_synth_profile(ast_strlen_zero(profile_name) ? NULL : profile_name),
+										chan);
+		if (!app_session->synth_channel) {
+			return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_ERROR);
+		}
+	}
+
+	return mrcpprefetch_exit(chan, SPEECH_CHANNEL_STATUS_OK);
+}
+
+/* Load MRCPPrefetch application. */
+int load_mrcpprefetch_app()
+{
+	apr_pool_t *pool = globals.pool;
+
+	if (pool == NULL) {
+		ast_log(LOG_ERROR, "Memory pool is NULL\n");
+		return -1;
+	}
+
+	if(mrcpprefetch) {
+		ast_log(LOG_ERROR, "Application %s is already loaded\n", app_prefetch);
+		return -1;
+	}
+
+	/* The speech channels are opened on behalf of the other applications, no MRCP application is needed. */
+	mrcpprefetch = (ast_mrcp_application_t*) apr_pcalloc(pool, sizeof(ast_mrcp_application_t));
+	mrcpprefetch->name = app_prefetch;
+	mrcpprefetch->exec = app_prefetch_exec;
+	mrcpprefetch->app = NULL;
+#if !AST_VERSION_AT_LEAST(1,6,2)
+	mrcpprefetch->synopsis = NULL;
+	mrcpprefetch->description = NULL;
+#endif
+
+	apr_hash_set(globals.apps, app_prefetch, APR_HASH_KEY_STRING, mrcpprefetch);
+
+	return 0;
+}
+
+/* Unload MRCPPrefetch application. */
+int unload_mrcpprefetch_app()
+{
+	if(!mrcpprefetch) {
+		ast_log(LOG_ERROR, "Application %s doesn't exist\n", app_prefetch);
+		return -1;
+	}
+
+	apr_hash_set(globals.apps, app_prefetch, APR_HASH_KEY_STRING, NULL);
+	mrcpprefetch = NULL;
+
+	return 0;
+}
@@ -56,7 +56,9 @@
 #include "asterisk/app.h"
 
 /* UniMRCP includes. */
+#include <apr_file_info.h>
 #include "app_datastore.h"
+#include "batch_job.h"
 
 /*** DOCUMENTATION
 	<application name="MRCPRecog" language="en_US">
@@ -130,6 +132,9 @@
 			<para>If recognition completed successfully, the variable ${RECOG_RESULT} is set to an NLSML result received
 			from the MRCP server. Alternatively, the recognition result data can be retrieved by using the following dialplan
 			functions RECOG_CONFIDENCE(), RECOG_GRAMMAR(), RECOG_INPUT(), and RECOG_INSTANCE().</para>
+			<para>The variables ${RECOG_SETUP_MS}, ${RECOG_RESPONSE_MS}, ${RECOG_FIRST_AUDIO_MS}, ${RECOG_SOI_MS} and ${RECOG_COMPLETE_MS}
+			are set to the time it took to establish the session, and from sending the RECOGNIZE request to the IN-PROGRESS response,
+			the first audio frame sent, the START-OF-INPUT and the RECOGNITION-COMPLETE events respectively, as far as measured.</para>
 		</description>
 		<see-also>
 			<ref type="application">MRCPSynth</ref>
@@ -138,6 +143,36 @@
 			<ref type="function">RECOG_GRAMMAR</ref>
 			<ref type="function">RECOG_INPUT</ref>
 			<ref type="function">RECOG_INSTANCE</ref>
+			<ref type="application">MRCPRecogFile</ref>
+		</see-also>
+	</application>
+	<application name="MRCPRecogFile" language="en_US">
+		<synopsis>
+			MRCP recognition of a recorded file application.
+		</synopsis>
+		<syntax>
+			<parameter name="file" required="true">
+				<para>Recorded file to recognize. Either a WAV file of mono 16-bit linear PCM, mu-law or A-law at 8 or
+				16 kHz, or a raw file whose extension selects the format: ulaw, alaw, sln, sln16 or g722.</para>
+			</parameter>
+			<parameter name="grammar" required="true">
+				<para>An inline or URI grammar to be used for recognition, as for MRCPRecog.</para>
+			</parameter>
+			<parameter name="options" required="false">
+				<para>The options of MRCPRecog which apply to the recognition, such as p, gd, t, ct, nb, nit, sct, mt, sit
+				or vsp. Input timers start with RECOGNIZE unless sit is 0.</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>This application feeds a recorded file to an MRCP recognizer as fast as the MRCP server takes it,
+			followed by silence for the end of speech to be detected, without reading from the channel. If tts-warm-rate
+			is set in mrcp.conf, the MRCP session runs on a media engine clocked faster than realtime.</para>
+			<para>The variables ${RECOGSTATUS}, ${RECOG_COMPLETION_CAUSE} and ${RECOG_RESULT} are set as for MRCPRecog.</para>
+			<para>The recordings of a whole directory can be recognized from the CLI with "mrcp recog files", which writes
+			the NLSML results to an output directory.</para>
+		</description>
+		<see-also>
+			<ref type="application">MRCPRecog</ref>
 		</see-also>
 	</application>
  ***/
@@ -148,6 +183,12 @@ static const char *app_recog = "MRCPRecog";
 /* The application instance. */
 static ast_mrcp_application_t *mrcprecog = NULL;
 
+/* The name of the application recognizing recorded files. */
+static const char *app_recog_file = "MRCPRecogFile";
+
+/* The application instance recognizing recorded files, which runs the speech channels of MRCPRecog. */
+static ast_mrcp_application_t *mrcprecogfile = NULL;
+
 /* The enumeration of application options (excluding the MRCP params). */
 enum mrcprecog_option_flags {
 	MRCPRECOG_PROFILE             = (1 << 0),
@@ -208,7 +249,7 @@ typedef struct mrcprecog_options_t mrcprecog_options_t;
 static APR_INLINE speech_channel_t * get_speech_channel(mrcp_session_t *session)
 {
 	if (session)
-		return (speech_channel_t *)mrcp_application_session_object_get(session);
+		return speech_channel_session_get(session);
 
 	return NULL;
 }
@@ -259,7 +300,7 @@ static apt_bool_t speech_on_channel_add(mrcp_application_t *application, mrcp_se
 		}
 
 		if (schannel->stream != NULL) {
-			schannel->dtmf_generator = mpf_dtmf_generator_create(schannel->stream, schannel->pool);
+			schannel->dtmf_generator = mpf_dtmf_generator_create(schannel->stream, session->pool);
 			/* schannel->dtmf_generator = mpf_dtmf_generator_create_ex(schannel->stream, MPF_DTMF_GENERATOR_OUTBAND, 70, 50, schannel->pool); */
 
 			if (schannel->dtmf_generator != NULL)
@@ -278,7 +319,7 @@ static apt_bool_t speech_on_channel_add(mrcp_application_t *application, mrcp_se
 		if (!schannel->session_id) {
 			const apt_str_t *session_id = mrcp_application_session_id_get(session);
 			if (session_id && session_id->buf) {
-				schannel->session_id = apr_pstrdup(schannel->pool, session_id->buf);
+				schannel->session_id = apr_pstrdup(session->pool, session_id->buf);
 			}
 		}
 		
@@ -359,12 +400,29 @@ static int recog_channel_set_start_of_input(speech_channel_t *schannel)
 		return -1;
 	}
 
+	if (!r->start_of_input)
+		r->start_of_input_time = speech_channel_clock();
 	r->start_of_input = 1;
+	if (!schannel->timing.start_of_input)
+		schannel->timing.start_of_input = speech_channel_clock();
 
 	apr_thread_mutex_unlock(schannel->mutex);
 	return status;
 }
 
+/* End recognition with no input, detected locally ahead of the no-input timeout of the recognizer. */
+static int recog_channel_set_no_input(speech_channel_t *schannel)
+{
+	recognizer_data_t *r;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	if (((r = (recognizer_data_t *)schannel->data) != NULL) && (r->completion_cause < 0))
+		r->completion_cause = RECOGNIZER_COMPLETION_CAUSE_NO_INPUT_TIMEOUT;
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	return speech_channel_stop(schannel);
+}
+
 /* Set the recognition results. */
 static int recog_channel_set_results(speech_channel_t *schannel, int completion_cause, const apt_str_t *result, const apt_str_t *waveform_uri)
 {
@@ -528,6 +586,8 @@ static int recog_channel_start(speech_channel_t *schannel, const char *name, int
 	r->result = NULL;
 	r->completion_cause = -1;
 	r->start_of_input = 0;
+	r->start_of_input_time = 0;
+	speech_channel_vad_reset(schannel);
 
 	r->timers_started = start_input_timers;
 
@@ -601,6 +661,7 @@ static int recog_channel_start(speech_channel_t *schannel, const char *name, int
 
 	/* Empty audio queue and send RECOGNIZE to MRCP server. */
 	audio_queue_clear(schannel->audio_queue);
+	speech_channel_timing_request(schannel);
 
 	if (mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message) == FALSE) {
 		apr_thread_mutex_unlock(schannel->mutex);
@@ -650,46 +711,58 @@ static int recog_channel_load_grammar(speech_channel_t *schannel, const char *na
 		}
 	}
 
-	/* If inline, use DEFINE-GRAMMAR to cache it on the server. */
+	/* If inline, use DEFINE-GRAMMAR to cache it on the server, unless it already is. */
 	if (type != GRAMMAR_TYPE_URI) {
 		mrcp_message_t *mrcp_message;
 		mrcp_generic_header_t *generic_header;
+		char digest_buf[GRAMMAR_DIGEST_BUFFER_SIZE];
+		const char *content_id;
+		const char *digest;
+		int defined;
 
-		/* Create MRCP message. */
-		if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, RECOGNIZER_DEFINE_GRAMMAR)) == NULL) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
-		}
+		content_id = grammar_defined_get(schannel, name, mime_type, data, &defined, digest_buf, &digest);
 
-		/* Set Content-Type and Content-ID in message. */
-		if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
-		}
+		if (defined) {
+			ast_log(LOG_DEBUG, "(%s) Grammar %s already defined as %s\n", schannel->name, name, content_id);
+		} else {
+			/* Create MRCP message. */
+			if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, RECOGNIZER_DEFINE_GRAMMAR)) == NULL) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
 
-		apt_string_assign(&generic_header->content_type, mime_type, mrcp_message->pool);
-		mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
-		apt_string_assign(&generic_header->content_id, name, mrcp_message->pool);
-		mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_ID);
+			/* Set Content-Type and Content-ID in message. */
+			if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
 
-		/* Put grammar in message body. */
-		apt_string_assign(&mrcp_message->body, data, mrcp_message->pool);
+			apt_string_assign(&generic_header->content_type, mime_type, mrcp_message->pool);
+			mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
+			apt_string_assign(&generic_header->content_id, content_id, mrcp_message->pool);
+			mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_ID);
 
-		/* Send message and wait for response. */
-		speech_channel_set_state_unlocked(schannel, SPEECH_CHANNEL_PROCESSING);
+			/* Put grammar in message body. */
+			speech_channel_body_set(schannel, mrcp_message, data);
 
-		if (mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message) == FALSE) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
-		}
+			/* Send message and wait for response. */
+			speech_channel_set_state_unlocked(schannel, SPEECH_CHANNEL_PROCESSING);
 
-		if (speech_channel_wait_for_ready(schannel) == FALSE) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
+			if (mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message) == FALSE) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
+
+			if (speech_channel_wait_for_ready(schannel) == FALSE) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
+
+			grammar_defined_set(schannel, content_id, digest);
 		}
 
 		/* Set up name, type for future RECOGNIZE requests.  We'll reference this cached grammar by name. */
-		apr_snprintf(ldata, sizeof(ldata) - 1, "session:%s", name);
+		apr_snprintf(ldata, sizeof(ldata) - 1, "session:%s", content_id);
 		ldata[sizeof(ldata) - 1] = '\0';
 
 		data = ldata;
@@ -1050,6 +1123,8 @@ static int mrcprecog_exit(struct ast_channel *chan, app_session_t *app_session,
 			if (app_session->recog_channel->session_id)
 				pbx_builtin_setvar_helper(chan, "RECOG_SID", app_session->recog_channel->session_id);
 
+			speech_channel_timing_export(app_session->recog_channel, chan);
+
 			if (app_session->lifetime == APP_SESSION_LIFETIME_DYNAMIC) {
 				speech_channel_destroy(app_session->recog_channel);
 				app_session->recog_channel = NULL;
@@ -1196,6 +1271,11 @@ static int app_recog_exec(struct ast_channel *chan, ast_app_data data)
 	}
 	else {
 		name = app_session->recog_channel->name;
+
+		/* Wait for the rest of the open, if the channel has been prefetched. */
+		if (speech_channel_open_wait(app_session->recog_channel) != 0) {
+			return mrcprecog_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		}
 	}
 
 	/* Get old read format. */
@@ -1330,6 +1410,9 @@ static int app_recog_exec(struct ast_channel *chan, ast_app_data data)
 		}
 	}
 
+	/* Start capturing caller audio, the pre-roll is replayed once recognition is in progress. */
+	speech_channel_preroll_clear(app_session->recog_channel);
+
 	int prompt_processing = (mrcprecog_prompts_available(app_session)) ? 1 : 0;
 	struct ast_filestream *filestream = NULL;
 	off_t max_filelength;
@@ -1470,6 +1553,7 @@ static int app_recog_exec(struct ast_channel *chan, ast_app_data data)
 					if (app_session->it_policy == IT_POLICY_AUTO) {
 						ast_log(LOG_DEBUG, "(%s) Start input timers\n", name);
 						recog_channel_start_input_timers(app_session->recog_channel);
+						speech_channel_vad_reset(app_session->recog_channel);
 					}
 					prompt_processing = 0;
 				}
@@ -1499,6 +1583,12 @@ static int app_recog_exec(struct ast_channel *chan, ast_app_data data)
 				ast_frfree(f);
 				break;
 			}
+
+			/* Release the recognizer ahead of its own no-input timeout. */
+			if ((speech_channel_vad_poll(app_session->recog_channel) == ENERGY_VAD_NO_INPUT) && r && r->timers_started) {
+				ast_log(LOG_DEBUG, "(%s) No input detected locally\n", name);
+				recog_channel_set_no_input(app_session->recog_channel);
+			}
 		} else if (f->frametype == AST_FRAME_VIDEO) {
 			/* Ignore. */
 		} else if ((dtmf_enable != 0) && (f->frametype == AST_FRAME_DTMF)) {
@@ -1582,6 +1672,452 @@ static int app_recog_exec(struct ast_channel *chan, ast_app_data data)
 	return mrcprecog_exit(chan, app_session, status);
 }
 
+/* --- RECOGNITION OF FILES --- */
+
+/* Silence fed after the recorded audio for the end of speech to be detected (msec). */
+#define MRCPRECOG_FILE_TAIL      10000
+
+/* Time the recognition of a file may take. */
+#define MRCPRECOG_FILE_TIMEOUT   apr_time_from_sec(600)
+
+/* Read a little-endian 16-bit value. */
+static APR_INLINE apr_uint16_t mrcprecog_le16(const apr_byte_t *p)
+{
+	return (apr_uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* Read a little-endian 32-bit value. */
+static APR_INLINE apr_uint32_t mrcprecog_le32(const apr_byte_t *p)
+{
+	return (apr_uint32_t)p[0] | ((apr_uint32_t)p[1] << 8) | ((apr_uint32_t)p[2] << 16) | ((apr_uint32_t)p[3] << 24);
+}
+
+/* Position a WAV file at its first sample, and return the size of its audio in 
+ * size, -1 if the size was not set by a recorder which did not finish the file. 
+ * Only mono 16-bit linear PCM, mu-law and A-law at 8 or 16 kHz are supported, 
+ * which the media engine takes as is.
+ */
+static int mrcprecog_wav_open(FILE *file, const char *path, const char **codec, apr_uint16_t *rate, apr_off_t *data_size)
+{
+	apr_byte_t header[16];
+	apr_uint32_t size;
+	int format = 0;
+
+	if ((fread(header, 1, 12, file) != 12) || (memcmp(header, "RIFF", 4) != 0) || (memcmp(header + 8, "WAVE", 4) != 0)) {
+		ast_log(LOG_WARNING, "%s is not a WAV file\n", path);
+		return -1;
+	}
+
+	while (fread(header, 1, 8, file) == 8) {
+		size = mrcprecog_le32(header + 4);
+
+		if (memcmp(header, "fmt ", 4) == 0) {
+			if ((size < 16) || (fread(header, 1, 16, file) != 16))
+				break;
+			format = mrcprecog_le16(header);
+			*rate = (apr_uint16_t)mrcprecog_le32(header + 4);
+			if ((mrcprecog_le16(header + 2) != 1) || ((*rate != 8000) && (*rate != 16000)))
+				break;
+			if ((format == 1) && (mrcprecog_le16(header + 14) == 16))
+				*codec = "LPCM";
+			else if ((format == 7) && (*rate == 8000))
+				*codec = "PCMU";
+			else if ((format == 6) && (*rate == 8000))
+				*codec = "PCMA";
+			else
+				break;
+			size -= 16;
+		} else if (memcmp(header, "data", 4) == 0) {
+			if (*codec == NULL)
+				break;
+			*data_size = ((size == 0) || (size == 0xFFFFFFFF)) ? -1 : (apr_off_t)size;
+			return 0;
+		}
+
+		/* Chunks are padded to an even size. */
+		if (fseek(file, (long)(size + (size & 1)), SEEK_CUR) != 0)
+			break;
+	}
+
+	ast_log(LOG_WARNING, "Unsupported WAV format %d of %s\n", format, path);
+	return -1;
+}
+
+/* Open a recorded file, either raw as named by its extension or a WAV file, 
+ * positioned at the first sample. Return the size of the audio in data_size, 
+ * -1 for the rest of the file.
+ */
+static FILE *mrcprecog_file_open(const char *path, const char **codec, apr_uint16_t *rate, apr_off_t *data_size)
+{
+	const char *extension = strrchr(path, '.');
+	int wav = (extension != NULL) && (strcasecmp(extension, ".wav") == 0);
+	FILE *file;
+
+	*codec = NULL;
+	*data_size = -1;
+	if (!wav && (speech_channel_file_format(path, codec, rate) != 0)) {
+		ast_log(LOG_WARNING, "Unsupported file format of %s\n", path);
+		return NULL;
+	}
+
+	if ((file = fopen(path, "rb")) == NULL) {
+		ast_log(LOG_WARNING, "Unable to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (wav && (mrcprecog_wav_open(file, path, codec, rate, data_size) != 0)) {
+		fclose(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+/* Recognize a recorded file, with options as given to MRCPRecog(). The speech 
+ * channel is not attached to a call and runs on the faster than realtime media 
+ * engine, if any. Return the completion cause and the NLSML result, if any, 
+ * allocated from the pool.
+ */
+int mrcprecog_file(const char *path, const char *grammar, const char *options, apr_pool_t *pool, const char **completion_cause, const char **result)
+{
+	speech_channel_t *schannel;
+	mrcprecog_options_t mrcprecog_options;
+	ast_mrcp_profile_t *profile;
+	const char *profile_name = NULL;
+	const char *grammar_delimiters = ",";
+	const char *codec;
+	const char *cause = NULL;
+	const char *nlsml = NULL;
+	apr_uint16_t rate;
+	apr_off_t data_size;
+	int start_input_timers = TRUE;
+	char *grammar_str;
+	char *last;
+	char grammar_name[32];
+	int grammar_id = 0;
+	int status = 0;
+	FILE *file;
+	int i;
+
+	*completion_cause = NULL;
+	*result = NULL;
+
+	if (mrcprecog == NULL)
+		return -1;
+
+	mrcprecog_options.recog_hfs = NULL;
+	mrcprecog_options.flags = 0;
+	for (i=0; i<OPT_ARG_ARRAY_SIZE; i++)
+		mrcprecog_options.params[i] = NULL;
+
+	if (!ast_strlen_zero(options))
+		mrcprecog_options_parse(apr_pstrdup(pool, options), &mrcprecog_options, pool);
+
+	if ((mrcprecog_options.flags & MRCPRECOG_PROFILE) == MRCPRECOG_PROFILE) {
+		if (!ast_strlen_zero(mrcprecog_options.params[OPT_ARG_PROFILE])) {
+			profile_name = mrcprecog_options.params[OPT_ARG_PROFILE];
+		}
+	}
+
+	if ((mrcprecog_options.flags & MRCPRECOG_GRAMMAR_DELIMITERS) == MRCPRECOG_GRAMMAR_DELIMITERS) {
+		if (!ast_strlen_zero(mrcprecog_options.params[OPT_ARG_GRAMMAR_DELIMITERS])) {
+			grammar_delimiters = mrcprecog_options.params[OPT_ARG_GRAMMAR_DELIMITERS];
+		}
+	}
+
+	/* There is no prompt, the input timers start with RECOGNIZE unless disabled. */
+	if ((mrcprecog_options.flags & MRCPRECOG_INPUT_TIMERS) == MRCPRECOG_INPUT_TIMERS) {
+		if (!ast_strlen_zero(mrcprecog_options.params[OPT_ARG_INPUT_TIMERS])) {
+			start_input_timers = (atoi(mrcprecog_options.params[OPT_ARG_INPUT_TIMERS]) != IT_POLICY_OFF);
+		}
+	}
+
+	if ((profile = get_recog_profile(profile_name)) == NULL) {
+		ast_log(LOG_WARNING, "Can't find profile, %s\n", profile_name);
+		return -1;
+	}
+
+	if ((file = mrcprecog_file_open(path, &codec, &rate, &data_size)) == NULL)
+		return -1;
+
+	if ((schannel = speech_channel_batch(profile, mrcprecog, SPEECH_CHANNEL_RECOGNIZER, codec, rate)) == NULL) {
+		fclose(file);
+		return -1;
+	}
+
+	/* Parse the grammar argument into a sequence of grammars. */
+	grammar_str = apr_strtok(apr_pstrdup(pool, grammar), grammar_delimiters, &last);
+	while (grammar_str && (status == 0)) {
+		const char *grammar_content = NULL;
+		grammar_type_t grammar_type = GRAMMAR_TYPE_UNKNOWN;
+
+		if (determine_grammar_type(schannel, grammar_str, &grammar_content, &grammar_type) != 0) {
+			ast_log(LOG_WARNING, "(%s) Unable to determine grammar type: %s\n", schannel->name, grammar_str);
+			status = -1;
+			break;
+		}
+
+		apr_snprintf(grammar_name, sizeof(grammar_name) - 1, "grammar-%d", grammar_id++);
+		grammar_name[sizeof(grammar_name) - 1] = '\0';
+		if (recog_channel_load_grammar(schannel, grammar_name, grammar_type, grammar_content) != 0) {
+			ast_log(LOG_ERROR, "(%s) Unable to load grammar\n", schannel->name);
+			recog_channel_get_results(schannel, &cause, NULL, NULL);
+			status = -1;
+		}
+
+		grammar_str = apr_strtok(NULL, grammar_delimiters, &last);
+	}
+
+	if (status == 0) {
+		if (recog_channel_start(schannel, schannel->name, start_input_timers, mrcprecog_options.recog_hfs) != 0) {
+			ast_log(LOG_ERROR, "(%s) Unable to start recognition\n", schannel->name);
+			recog_channel_get_results(schannel, &cause, NULL, NULL);
+			status = -1;
+		} else if (speech_channel_feed(schannel, file, data_size, MRCPRECOG_FILE_TAIL, MRCPRECOG_FILE_TIMEOUT) != 0) {
+			status = -1;
+		} else if (recog_channel_get_results(schannel, &cause, &nlsml, NULL) != 0) {
+			ast_log(LOG_WARNING, "(%s) Unable to retrieve result\n", schannel->name);
+			status = -1;
+		}
+	}
+
+	/* The results are allocated from the channel. */
+	if (cause)
+		*completion_cause = apr_pstrdup(pool, cause);
+	if (nlsml)
+		*result = apr_pstrdup(pool, nlsml);
+
+	fclose(file);
+	speech_channel_destroy(schannel);
+	return status;
+}
+
+/* The entry point of MRCPRecogFile. */
+static int app_recog_file_exec(struct ast_channel *chan, ast_app_data data)
+{
+	speech_channel_status_t status;
+	const char *completion_cause = NULL;
+	const char *result = NULL;
+	apr_pool_t *pool;
+	char *parse;
+
+	AST_DECLARE_APP_ARGS(args,
+		AST_APP_ARG(file);
+		AST_APP_ARG(grammar);
+		AST_APP_ARG(options);
+	);
+
+	if (ast_strlen_zero(data)) {
+		ast_log(LOG_WARNING, "%s() requires arguments (file,grammar[,options])\n", app_recog_file);
+		pbx_builtin_setvar_helper(chan, "RECOGSTATUS", speech_channel_status_to_string(SPEECH_CHANNEL_STATUS_ERROR));
+		return 0;
+	}
+
+	/* We need to make a copy of the input string if we are going to modify it! */
+	parse = ast_strdupa(data);
+	AST_STANDARD_APP_ARGS(args, parse);
+
+	if (ast_strlen_zero(args.file) || ast_strlen_zero(args.grammar)) {
+		ast_log(LOG_WARNING, "%s() requires a file and a grammar argument (file,grammar[,options])\n", app_recog_file);
+		pbx_builtin_setvar_helper(chan, "RECOGSTATUS", speech_channel_status_to_string(SPEECH_CHANNEL_STATUS_ERROR));
+		return 0;
+	}
+
+	if ((pool = apt_pool_create()) == NULL) {
+		pbx_builtin_setvar_helper(chan, "RECOGSTATUS", speech_channel_status_to_string(SPEECH_CHANNEL_STATUS_ERROR));
+		return 0;
+	}
+
+	args.file = normalize_input_string(args.file);
+	args.grammar = normalize_input_string(args.grammar);
+	if (!ast_strlen_zero(args.options))
+		args.options = normalize_input_string(args.options);
+	ast_log(LOG_NOTICE, "%s() file: %s grammar: %s\n", app_recog_file, args.file, args.grammar);
+
+	if (mrcprecog_file(args.file, args.grammar, args.options, pool, &completion_cause, &result) == 0)
+		status = SPEECH_CHANNEL_STATUS_OK;
+	else
+		status = SPEECH_CHANNEL_STATUS_ERROR;
+
+	if (completion_cause)
+		pbx_builtin_setvar_helper(chan, "RECOG_COMPLETION_CAUSE", completion_cause);
+	pbx_builtin_setvar_helper(chan, "RECOG_RESULT", result ? result : "");
+	pbx_builtin_setvar_helper(chan, "RECOGSTATUS", speech_channel_status_to_string(status));
+	ast_log(LOG_NOTICE, "%s() exiting status: %s on %s\n", app_recog_file, speech_channel_status_to_string(status), ast_channel_name(chan));
+
+	apr_pool_destroy(pool);
+	return 0;
+}
+
+/* Recognition of the recorded files of a directory, run as a batch job. */
+struct mrcprecog_files_t {
+	/* Grammars the files are recognized with. */
+	const char *grammar;
+	/* Options as given to MRCPRecog(). */
+	const char *options;
+	/* Directory the results are written to. */
+	const char *output_dir;
+	/* The files. */
+	apr_array_header_t *files;
+};
+typedef struct mrcprecog_files_t mrcprecog_files_t;
+
+/* The last job, synchronized by the globals mutex. */
+static batch_job_t *mrcprecog_files_job = NULL;
+
+/* Whether a file is a recording which can be recognized. */
+static int mrcprecog_files_accepts(const char *path)
+{
+	const char *extension = strrchr(path, '.');
+	const char *codec;
+	apr_uint16_t rate;
+
+	if ((extension != NULL) && (strcasecmp(extension, ".wav") == 0))
+		return TRUE;
+	return (speech_channel_file_format(path, &codec, &rate) == 0);
+}
+
+/* List the recordings of a directory, or the file itself. */
+static int mrcprecog_files_list(mrcprecog_files_t *files, const char *input, apr_pool_t *pool)
+{
+	apr_finfo_t finfo;
+	apr_dir_t *dir;
+
+	if (apr_stat(&finfo, input, APR_FINFO_TYPE, pool) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Unable to access %s\n", input);
+		return -1;
+	}
+
+	if (finfo.filetype != APR_DIR) {
+		APR_ARRAY_PUSH(files->files, const char *) = apr_pstrdup(pool, input);
+		return 0;
+	}
+
+	if (apr_dir_open(&dir, input, pool) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Unable to open directory %s\n", input);
+		return -1;
+	}
+
+	while (apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE, dir) == APR_SUCCESS) {
+		if ((finfo.filetype == APR_REG) && mrcprecog_files_accepts(finfo.name))
+			APR_ARRAY_PUSH(files->files, const char *) = apr_pstrcat(pool, input, "/", finfo.name, NULL);
+	}
+	apr_dir_close(dir);
+	return 0;
+}
+
+/* Write the result of a file to the output directory, named after the file 
+ * with its extension, so that recordings of the same name in different formats 
+ * do not overwrite the results of each other.
+ */
+static int mrcprecog_files_write(mrcprecog_files_t *files, const char *path, const char *result, apr_pool_t *pool)
+{
+	const char *base = strrchr(path, '/');
+	const char *name = base ? base + 1 : path;
+	const char *out_path;
+	const char *tmp_path;
+	apr_size_t len = strlen(result);
+	FILE *file;
+	int status = 0;
+
+	out_path = apr_psprintf(pool, "%s/%s.xml", files->output_dir, name);
+	tmp_path = apr_pstrcat(pool, out_path, ".tmp", NULL);
+	if ((file = fopen(tmp_path, "wb")) == NULL) {
+		ast_log(LOG_WARNING, "Unable to create %s: %s\n", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	if (fwrite(result, 1, len, file) != len)
+		status = -1;
+	if (fclose(file) != 0)
+		status = -1;
+
+	if ((status != 0) || (rename(tmp_path, out_path) != 0)) {
+		ast_log(LOG_WARNING, "Unable to write %s\n", out_path);
+		remove(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Recognize a file and write its result. */
+static batch_job_outcome_t mrcprecog_files_process(batch_job_t *job, apr_uint32_t index, void **worker)
+{
+	mrcprecog_files_t *files = (mrcprecog_files_t *)job->data;
+	const char *path = APR_ARRAY_IDX(files->files, index, const char *);
+	const char *completion_cause;
+	const char *result;
+	batch_job_outcome_t outcome;
+	apr_pool_t *pool;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return BATCH_JOB_FAILED;
+
+	if (mrcprecog_file(path, files->grammar, files->options, pool, &completion_cause, &result) != 0) {
+		ast_log(LOG_NOTICE, "Unable to recognize %s, completion cause %s\n", path, completion_cause ? completion_cause : "unknown");
+		outcome = BATCH_JOB_FAILED;
+	} else if (result == NULL) {
+		ast_log(LOG_NOTICE, "Recognized %s without result, completion cause %s\n", path, completion_cause);
+		outcome = BATCH_JOB_SKIPPED;
+	} else if (mrcprecog_files_write(files, path, result, pool) != 0) {
+		outcome = BATCH_JOB_FAILED;
+	} else {
+		outcome = BATCH_JOB_COMPLETED;
+	}
+
+	apr_pool_destroy(pool);
+	return outcome;
+}
+
+/* Start recognizing a recorded file or the recordings of a directory in the 
+ * background, writing the NLSML results to the output directory. Return 1 if a 
+ * job is running already.
+ */
+int mrcprecog_files_start(const char *input, const char *grammar, const char *output_dir, const char *options)
+{
+	batch_job_t *job;
+	mrcprecog_files_t *files;
+	apr_pool_t *pool;
+
+	if (mrcprecog == NULL)
+		return -1;
+
+	if (batch_job_claim(&mrcprecog_files_job) != 0)
+		return 1;
+
+	if ((job = batch_job_create(mrcprecog_files_process, NULL)) == NULL)
+		return -1;
+	pool = job->pool;
+	job->name = apr_psprintf(pool, "Recognition of %s", input);
+
+	job->data = files = apr_pcalloc(pool, sizeof(mrcprecog_files_t));
+	files->grammar = apr_pstrdup(pool, grammar);
+	files->options = options ? apr_pstrdup(pool, options) : NULL;
+	files->output_dir = apr_pstrdup(pool, output_dir);
+	files->files = apr_array_make(pool, 256, sizeof(const char *));
+
+	if ((mrcprecog_files_list(files, input, pool) != 0) || (files->files->nelts == 0)) {
+		ast_log(LOG_WARNING, "No files to recognize in %s\n", input);
+		batch_job_destroy(job);
+		return -1;
+	}
+
+	ast_log(LOG_NOTICE, "Recognizing %d files of %s\n", files->files->nelts, input);
+	return batch_job_start(&mrcprecog_files_job, job, (apr_uint32_t)files->files->nelts, globals.recog_file_channels);
+}
+
+/* Get the progress of the last job, return -1 if none has run. */
+int mrcprecog_files_stats_get(batch_job_stats_t *stats)
+{
+	return batch_job_stats_get(&mrcprecog_files_job, stats);
+}
+
+/* Cancel the running job, if any, and wait for it. */
+void mrcprecog_files_stop(void)
+{
+	batch_job_stop(&mrcprecog_files_job);
+}
+
 /* Load MRCPRecog application. */
 int load_mrcprecog_app()
 {
@@ -1638,6 +2174,18 @@ int load_mrcprecog_app()
 
 	apr_hash_set(globals.apps, app_recog, APR_HASH_KEY_STRING, mrcprecog);
 
+	/* Recognition of files runs on speech channels of MRCPRecog, no MRCP application of its own is needed. */
+	mrcprecogfile = (ast_mrcp_application_t*) apr_pcalloc(pool, sizeof(ast_mrcp_application_t));
+	mrcprecogfile->name = app_recog_file;
+	mrcprecogfile->exec = app_recog_file_exec;
+	mrcprecogfile->app = NULL;
+#if !AST_VERSION_AT_LEAST(1,6,2)
+	mrcprecogfile->synopsis = NULL;
+	mrcprecogfile->description = NULL;
+#endif
+
+	apr_hash_set(globals.apps, app_recog_file, APR_HASH_KEY_STRING, mrcprecogfile);
+
 	return 0;
 }
 
@@ -1649,6 +2197,9 @@ int unload_mrcprecog_app()
 		return -1;
 	}
 
+	apr_hash_set(globals.apps, app_recog_file, APR_HASH_KEY_STRING, NULL);
+	mrcprecogfile = NULL;
+
 	apr_hash_set(globals.apps, app_recog, APR_HASH_KEY_STRING, NULL);
 	mrcprecog = NULL;
 
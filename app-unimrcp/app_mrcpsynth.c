@@ -57,6 +57,7 @@
 
 /* UniMRCP includes. */
 #include "app_datastore.h"
+#include "batch_job.h"
 
 /*** DOCUMENTATION
 	<application name="MRCPSynth" language="en_US">
@@ -86,6 +87,9 @@
 					<option name="dse"> <para>Datastore entry.</para></option>
 					<option name="sbs"> <para>Always stop barged synthesis request.</para></option>
 					<option name="vsp"> <para>Vendor-specific parameters.</para></option>
+					<option name="sc"> <para>Sentence chunking (0: disabled [default], otherwise: the minimum length of a chunk in characters).
+						A plain text or SSML prompt is split at sentence boundaries into chunks, which are synthesized by SPEAK requests
+						queued back to back, so that the synthesis of the first sentence does not wait for the whole prompt.</para></option>
 				</optionlist>
 			</parameter>
 		</syntax>
@@ -96,10 +100,46 @@
 			the variable ${SYNTHSTATUS} is set to "INTERRUPTED".</para>
 			<para>The variable ${SYNTH_COMPLETION_CAUSE} indicates whether synthesis completed normally or with an error.
 			("000" - normal, "001" - barge-in, "002" - parse-failure, ...) </para>
+			<para>The variables ${SYNTH_SETUP_MS}, ${SYNTH_RESPONSE_MS}, ${SYNTH_TTFA_MS} and ${SYNTH_COMPLETE_MS} are set to the
+			time it took to establish the session, and from sending the SPEAK request to the IN-PROGRESS response, the first audio
+			frame and the SPEAK-COMPLETE event respectively, as far as measured. The time to first audio of prompts split into chunks
+			is reported by "mrcp show latency" as first-audio-chunked, apart from the one of prompts synthesized as a whole.</para>
+			<para>If tts-cache-size is set in mrcp.conf, a plain text or SSML prompt which was synthesized before with the same
+			profile and synthesizer parameters is played from the cache without an MRCP session, and ${SYNTH_COMPLETION_CAUSE}
+			is set to "000".</para>
 		</description>
 		<see-also>
 			<ref type="application">MRCPRecog</ref>
 			<ref type="application">SynthAndRecog</ref>
+			<ref type="application">MRCPSynthToFile</ref>
+		</see-also>
+	</application>
+	<application name="MRCPSynthToFile" language="en_US">
+		<synopsis>
+			MRCP synthesis to file application.
+		</synopsis>
+		<syntax>
+			<parameter name="prompt" required="true">
+				<para>A prompt specified as a plain text, an SSML content, or by means of a file or URI reference.</para>
+			</parameter>
+			<parameter name="file" required="true">
+				<para>File to store the synthesized speech to. The extension selects the format: ulaw, alaw, sln, sln16 or g722.</para>
+			</parameter>
+			<parameter name="options" required="false">
+				<para>The options of MRCPSynth which apply to the synthesis (p, l, ll, pv, pr, v, g, vv, a, vsp).</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>This application synthesizes a prompt to a file as fast as the MRCP server produces the speech, without
+			playing it out to the channel, which is neither answered nor read from. If tts-warm-rate is set in mrcp.conf,
+			the MRCP session runs on a media engine clocked faster than realtime, so that the synthesis does not take up
+			call capacity. The file is only created once the synthesis completed normally.</para>
+			<para>If synthesis completed, the variable ${SYNTHSTATUS} is set to "OK"; otherwise, if an error occurred,
+			the variable ${SYNTHSTATUS} is set to "ERROR". The variable ${SYNTH_COMPLETION_CAUSE} is set as for MRCPSynth.</para>
+			<para>The same is available from the CLI as "mrcp synth file".</para>
+		</description>
+		<see-also>
+			<ref type="application">MRCPSynth</ref>
 		</see-also>
 	</application>
  ***/
@@ -110,6 +150,12 @@ static const char *app_synth = "MRCPSynth";
 /* The application instance. */
 static ast_mrcp_application_t *mrcpsynth = NULL;
 
+/* The name of the application synthesizing to a file. */
+static const char *app_synth_to_file = "MRCPSynthToFile";
+
+/* The application instance synthesizing to a file, which runs the speech channels of MRCPSynth. */
+static ast_mrcp_application_t *mrcpsynthtofile = NULL;
+
 /* The enumeration of application options (excluding the MRCP params). */
 enum mrcpsynth_option_flags {
 	MRCPSYNTH_PROFILE             = (1 << 0),
@@ -117,7 +163,8 @@ enum mrcpsynth_option_flags {
 	MRCPSYNTH_FILENAME            = (1 << 2),
 	MRCPSYNTH_PERSISTENT_LIFETIME = (1 << 3),
 	MRCPSYNTH_DATASTORE_ENTRY     = (1 << 4),
-	MRCPSYNTH_STOP_BARGED_SYNTH   = (1 << 5)
+	MRCPSYNTH_STOP_BARGED_SYNTH   = (1 << 5),
+	MRCPSYNTH_SENTENCE_CHUNKS     = (1 << 6)
 };
 
 /* The enumeration of option arguments. */
@@ -128,9 +175,10 @@ enum mrcpsynth_option_args {
 	OPT_ARG_PERSISTENT_LIFETIME = 3,
 	OPT_ARG_DATASTORE_ENTRY     = 4,
 	OPT_ARG_STOP_BARGED_SYNTH   = 5,
+	OPT_ARG_SENTENCE_CHUNKS     = 6,
 
 	/* This MUST be the last value in this enum! */
-	OPT_ARG_ARRAY_SIZE = 6
+	OPT_ARG_ARRAY_SIZE = 7
 };
 
 /* The structure which holds the application options (including the MRCP params). */
@@ -149,7 +197,7 @@ typedef struct mrcpsynth_options_t mrcpsynth_options_t;
 static APR_INLINE speech_channel_t * get_speech_channel(mrcp_session_t *session)
 {
 	if (session)
-		return (speech_channel_t *)mrcp_application_session_object_get(session);
+		return speech_channel_session_get(session);
 
 	return NULL;
 }
@@ -244,7 +292,12 @@ static apt_bool_t synth_on_message_receive(mrcp_application_t *application, mrcp
 			if (message->start_line.request_state == MRCP_REQUEST_STATE_INPROGRESS) {
 				/* Waiting for SPEAK-COMPLETE event. */
 				ast_log(LOG_DEBUG, "(%s) REQUEST IN PROGRESS\n", schannel->name);
+				speech_channel_speak_accepted(schannel, message->start_line.request_id);
 				speech_channel_set_state(schannel, SPEECH_CHANNEL_PROCESSING);
+			} else if (message->start_line.request_state == MRCP_REQUEST_STATE_PENDING) {
+				/* The request for the next chunk of the prompt is queued. */
+				ast_log(LOG_DEBUG, "(%s) REQUEST PENDING\n", schannel->name);
+				speech_channel_speak_accepted(schannel, message->start_line.request_id);
 			} else {
 				/* Received unexpected request_state. */
 				ast_log(LOG_DEBUG, "(%s) Unexpected SPEAK response, request_state = %d\n", schannel->name, message->start_line.request_state);
@@ -281,9 +334,25 @@ static apt_bool_t synth_on_message_receive(mrcp_application_t *application, mrcp
 		/* Received MRCP event. */
 		if (message->start_line.method_id == SYNTHESIZER_SPEAK_COMPLETE) {
 			/* Got SPEAK-COMPLETE. */
-			const char *completion_cause = apr_psprintf(schannel->pool, "%03d", synth_header->completion_cause);
-			pbx_builtin_setvar_helper(schannel->chan, "SYNTH_COMPLETION_CAUSE", completion_cause);
+			int cause = synth_header->completion_cause;
+			int last = speech_channel_speak_completed(schannel, message->start_line.request_id, &cause);
+			if (last < 0) {
+				/* The request was stopped already. */
+				ast_log(LOG_DEBUG, "(%s) SPEAK-COMPLETE of a request no longer outstanding\n", schannel->name);
+				return TRUE;
+			}
+			if (!last) {
+				/* More chunks of the prompt are outstanding. */
+				ast_log(LOG_DEBUG, "(%s) SPEAK-COMPLETE of chunk\n", schannel->name);
+				return TRUE;
+			}
+			const char *completion_cause = apr_psprintf(schannel->pool, "%03d", cause);
+			if (schannel->chan)
+				pbx_builtin_setvar_helper(schannel->chan, "SYNTH_COMPLETION_CAUSE", completion_cause);
 			ast_log(LOG_DEBUG, "(%s) SPEAK-COMPLETE\n", schannel->name);
+			schannel->completion_cause = cause;
+			if (cause == SYNTHESIZER_COMPLETION_CAUSE_NORMAL)
+				speech_channel_cache_complete(schannel);
 			speech_channel_set_state(schannel, SPEECH_CHANNEL_READY);
 		} else {
 			ast_log(LOG_DEBUG, "(%s) Unexpected event, method_id = %d\n", schannel->name, (int)message->start_line.method_id);
@@ -326,14 +395,45 @@ static APR_INLINE apt_bool_t speech_channel_wait_for_ready(speech_channel_t *sch
 	return (schannel->state == SPEECH_CHANNEL_READY) ? TRUE : FALSE;
 }
 
-/* Send SPEAK request to synthesizer. */
-static int synth_channel_speak(speech_channel_t *schannel, const char *content, const char *content_type, apr_hash_t *header_fields)
+/* Create a SPEAK request, with the channel locked. */
+static mrcp_message_t *synth_channel_speak_message(speech_channel_t *schannel, const char *content, const char *content_type, apr_hash_t *header_fields)
 {
-	int status = 0;
 	mrcp_message_t *mrcp_message = NULL;
 	mrcp_generic_header_t *generic_header = NULL;
 	mrcp_synth_header_t *synth_header = NULL;
 
+	if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, SYNTHESIZER_SPEAK)) == NULL) {
+		ast_log(LOG_ERROR, "(%s) Failed to create SPEAK message\n", schannel->name);
+		return NULL;
+	}
+
+	/* Set generic header fields (content-type). */
+	if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {	
+		return NULL;
+	}
+
+	apt_string_assign(&generic_header->content_type, content_type, mrcp_message->pool);
+	mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
+
+	/* Set synthesizer header fields (voice, rate, etc.). */
+	if ((synth_header = (mrcp_synth_header_t *)mrcp_resource_header_prepare(mrcp_message)) == NULL) {
+		return NULL;
+	}
+
+	/* Add params to MRCP message. */
+	speech_channel_set_params(schannel, mrcp_message, header_fields);
+
+	/* Set body (plain text or SSML). */
+	speech_channel_body_set(schannel, mrcp_message, content);
+	return mrcp_message;
+}
+
+/* Send SPEAK request to synthesizer. */
+static int synth_channel_speak(speech_channel_t *schannel, const char *content, const char *content_type, apr_hash_t *header_fields, apr_uint32_t chunks)
+{
+	int status = 0;
+	mrcp_message_t *mrcp_message = NULL;
+
 	if (!schannel || !content || !content_type) {
 		ast_log(LOG_ERROR, "synth_channel_speak: unknown channel error!\n");
 		return -1;
@@ -351,37 +451,22 @@ static int synth_channel_speak(speech_channel_t *schannel, const char *content,
 		}
 	}
 
-	if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, SYNTHESIZER_SPEAK)) == NULL) {
-		ast_log(LOG_ERROR, "(%s) Failed to create SPEAK message\n", schannel->name);
-
-		apr_thread_mutex_unlock(schannel->mutex);
-		return -1;
-	}
-
-	/* Set generic header fields (content-type). */
-	if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {	
+	if ((mrcp_message = synth_channel_speak_message(schannel, content, content_type, header_fields)) == NULL) {
 		apr_thread_mutex_unlock(schannel->mutex);
 		return -1;
 	}
 
-	apt_string_assign(&generic_header->content_type, content_type, mrcp_message->pool);
-	mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
+	/* Empty audio queue, start the playout and send SPEAK to MRCP server. */
+	audio_queue_clear(schannel->audio_queue);
+	schannel->completion_cause = -1;
+	speech_channel_timing_request(schannel);
+	speech_channel_speak_start(schannel, chunks);
 
-	/* Set synthesizer header fields (voice, rate, etc.). */
-	if ((synth_header = (mrcp_synth_header_t *)mrcp_resource_header_prepare(mrcp_message)) == NULL) {
+	if (speech_channel_playout_start(schannel) != 0) {
 		apr_thread_mutex_unlock(schannel->mutex);
 		return -1;
 	}
 
-	/* Add params to MRCP message. */
-	speech_channel_set_params(schannel, mrcp_message, header_fields);
-
-	/* Set body (plain text or SSML). */
-	apt_string_assign(&mrcp_message->body, content, schannel->pool);
-
-	/* Empty audio queue and send SPEAK to MRCP server. */
-	audio_queue_clear(schannel->audio_queue);
-
 	if (!mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message)) {
 		ast_log(LOG_ERROR,"(%s) Failed to send SPEAK message", schannel->name);
 
@@ -401,6 +486,40 @@ static int synth_channel_speak(speech_channel_t *schannel, const char *content,
 	return status;
 }
 
+/* Send SPEAK requests for the chunks of a prompt back to back. The first one 
+ * starts the playout, the MRCP server queues the others and synthesizes them 
+ * in order, so that their audio follows without a gap.
+ */
+static int synth_channel_speak_chunks(speech_channel_t *schannel, apr_array_header_t *chunks, const char *content_type, apr_hash_t *header_fields)
+{
+	mrcp_message_t *mrcp_message = NULL;
+	int i;
+
+	if (synth_channel_speak(schannel, APR_ARRAY_IDX(chunks, 0, const char *), content_type, header_fields, (apr_uint32_t)chunks->nelts) != 0)
+		return -1;
+
+	for (i = 1; i < chunks->nelts; i++) {
+		apr_thread_mutex_lock(schannel->mutex);
+
+		if ((mrcp_message = synth_channel_speak_message(schannel, APR_ARRAY_IDX(chunks, i, const char *), content_type, header_fields)) == NULL) {
+			apr_thread_mutex_unlock(schannel->mutex);
+			return -1;
+		}
+
+		/* The response, PENDING unless the previous chunks completed already, is not waited for. */
+		if (!mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message)) {
+			ast_log(LOG_ERROR, "(%s) Failed to send SPEAK message for chunk %d\n", schannel->name, i + 1);
+			apr_thread_mutex_unlock(schannel->mutex);
+			return -1;
+		}
+		apr_thread_mutex_unlock(schannel->mutex);
+	}
+
+	if (chunks->nelts > 1)
+		ast_log(LOG_DEBUG, "(%s) Sent SPEAK requests for %d chunks\n", schannel->name, chunks->nelts);
+	return 0;
+}
+
 /* Apply application options. */
 static int mrcpsynth_option_apply(mrcpsynth_options_t *options, const char *key, const char *value)
 {
@@ -440,6 +559,9 @@ static int mrcpsynth_option_apply(mrcpsynth_options_t *options, const char *key,
 	} else if (strcasecmp(key, "sbs") == 0) {
 		options->flags |= MRCPSYNTH_STOP_BARGED_SYNTH;
 		options->params[OPT_ARG_STOP_BARGED_SYNTH] = value;
+	} else if (strcasecmp(key, "sc") == 0) {
+		options->flags |= MRCPSYNTH_SENTENCE_CHUNKS;
+		options->params[OPT_ARG_SENTENCE_CHUNKS] = value;
 	} else {
 		ast_log(LOG_WARNING, "Unknown option: %s\n", key);
 	}
@@ -473,10 +595,16 @@ static int mrcpsynth_options_parse(char *str, mrcpsynth_options_t *options, apr_
 static int mrcpsynth_exit(struct ast_channel *chan, app_session_t *app_session, speech_channel_status_t status)
 {
 	if (app_session) {
+		/* Stop the playout before the write format is restored. */
+		if (app_session->synth_channel)
+			speech_channel_playout_stop(app_session->synth_channel);
+
 		if (app_session->writeformat && app_session->rawwriteformat)
 			ast_set_write_format_path(chan, app_session->writeformat, app_session->rawwriteformat);
 
 		if (app_session->synth_channel) {
+			speech_channel_timing_export(app_session->synth_channel, chan);
+
 			if (app_session->lifetime == APP_SESSION_LIFETIME_DYNAMIC) {
 				if (app_session->stop_barged_synth == TRUE) {
 					speech_channel_stop(app_session->synth_channel);
@@ -598,6 +726,13 @@ static int app_synth_exec(struct ast_channel *chan, ast_app_data data)
 		}
 	}
 
+	const char *profile_name = NULL;
+	if ((mrcpsynth_options.flags & MRCPSYNTH_PROFILE) == MRCPSYNTH_PROFILE) {
+		if (!ast_strlen_zero(mrcpsynth_options.params[OPT_ARG_PROFILE])) {
+			profile_name = mrcpsynth_options.params[OPT_ARG_PROFILE];
+		}
+	}
+
 	if(!app_session->synth_channel) {
 		const char *filename = NULL;
 		if ((mrcpsynth_options.flags & MRCPSYNTH_FILENAME) == MRCPSYNTH_FILENAME) {
@@ -621,29 +756,28 @@ static int app_synth_exec(struct ast_channel *chan, ast_app_data data)
 		if (!app_session->synth_channel) {
 			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
 		}
-
-		const char *profile_name = NULL;
-		if ((mrcpsynth_options.flags & MRCPSYNTH_PROFILE) == MRCPSYNTH_PROFILE) {
-			if (!ast_strlen_zero(mrcpsynth_options.params[OPT_ARG_PROFILE])) {
-				profile_name = mrcpsynth_options.params[OPT_ARG_PROFILE];
-			}
-		}
-
-		/* Get synthesis profile. */
-		ast_mrcp_profile_t *profile = get_synth_profile(profile_name);
-		if (!profile) {
-			ast_log(LOG_ERROR, "(%s) Can't find profile, %s\n", name, profile_name);
-			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
-		}
-
-		/* Open synthesis channel. */
-		if (speech_channel_open(app_session->synth_channel, profile) != 0) {
-			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
-		}
 	}
 	else {
 		name = app_session->synth_channel->name;
 	}
+
+	/* Get synthesis profile, unless the channel has been opened already. */
+	ast_mrcp_profile_t *profile = app_session->synth_channel->profile;
+	if (!profile)
+		profile = get_synth_profile(profile_name);
+	if (!profile) {
+		ast_log(LOG_ERROR, "(%s) Can't find profile, %s\n", name, profile_name);
+		return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+	}
+
+	/* Look up the prompt in the TTS cache, a cached prompt is played out without an MRCP session. */
+	const char *cache_key = NULL;
+	tts_cache_entry_t *cached = speech_channel_cache_lookup(app_session->synth_channel, profile, args.prompt, mrcpsynth_options.synth_hfs, &cache_key);
+
+	/* Open synthesis channel, or wait for the rest of the open, if the channel has been prefetched. */
+	if (!cached && speech_channel_open_ready(app_session->synth_channel, profile) != 0) {
+		return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+	}
 	
 	/* Get old write format. */
 	ast_format_compat *owriteformat = ast_channel_get_writeformat(chan, app_session->pool);
@@ -656,18 +790,45 @@ static int app_synth_exec(struct ast_channel *chan, ast_app_data data)
 	app_session->writeformat = owriteformat;
 	app_session->rawwriteformat = orawwriteformat;
 
-	const char *content = NULL;
-	const char *content_type = NULL;
-	if (determine_synth_content_type(app_session->synth_channel, args.prompt, &content, &content_type) != 0) {
-		ast_log(LOG_WARNING, "(%s) Unable to determine synthesis content type\n", name);
-		return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+	if (cached) {
+		ast_log(LOG_NOTICE, "(%s) Playing cached prompt, enable DTMFs: %d\n", name, dtmf_enable);
+
+		pbx_builtin_setvar_helper(chan, "SYNTH_COMPLETION_CAUSE", "000");
+		if (speech_channel_playout_cached(app_session->synth_channel, cached) != 0) {
+			ast_log(LOG_WARNING, "(%s) Unable to play cached prompt\n", name);
+			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		}
 	}
+	else {
+		const char *content = NULL;
+		const char *content_type = NULL;
+		if (determine_synth_content_type(app_session->synth_channel, args.prompt, &content, &content_type) != 0) {
+			ast_log(LOG_WARNING, "(%s) Unable to determine synthesis content type\n", name);
+			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		}
+
+		/* Split the prompt into sentences synthesized back to back, if requested. */
+		apr_size_t chunk_len = 0;
+		if ((mrcpsynth_options.flags & MRCPSYNTH_SENTENCE_CHUNKS) == MRCPSYNTH_SENTENCE_CHUNKS) {
+			if (!ast_strlen_zero(mrcpsynth_options.params[OPT_ARG_SENTENCE_CHUNKS])) {
+				chunk_len = (apr_size_t)atol(mrcpsynth_options.params[OPT_ARG_SENTENCE_CHUNKS]);
+			}
+		}
 
-	ast_log(LOG_NOTICE, "(%s) Synthesizing, enable DTMFs: %d\n", name, dtmf_enable);
+		apr_array_header_t *chunks = NULL;
+		if (determine_synth_chunks(app_session->synth_channel, content, content_type, chunk_len, &chunks) != 0) {
+			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		}
 
-	if (synth_channel_speak(app_session->synth_channel, content, content_type, mrcpsynth_options.synth_hfs) != 0) {
-		ast_log(LOG_WARNING, "(%s) Unable to start synthesis\n", name);
-		return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		ast_log(LOG_NOTICE, "(%s) Synthesizing, chunks: %d, enable DTMFs: %d\n", name, chunks->nelts, dtmf_enable);
+
+		/* Capture the synthesized speech for the TTS cache. */
+		speech_channel_cache_capture(app_session->synth_channel, cache_key);
+
+		if (synth_channel_speak_chunks(app_session->synth_channel, chunks, content_type, mrcpsynth_options.synth_hfs) != 0) {
+			ast_log(LOG_WARNING, "(%s) Unable to start synthesis\n", name);
+			return mrcpsynth_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		}
 	}
 
 	int ms;
@@ -704,7 +865,7 @@ static int app_synth_exec(struct ast_channel *chan, ast_app_data data)
 
 		ast_frfree(f);
 
-		if (app_session->synth_channel->state != SPEECH_CHANNEL_PROCESSING) {
+		if ((app_session->synth_channel->state != SPEECH_CHANNEL_PROCESSING) && !speech_channel_playout_pending(app_session->synth_channel)) {
 			/* end of prompt */
 			running = 0;
 		}
@@ -714,6 +875,451 @@ static int app_synth_exec(struct ast_channel *chan, ast_app_data data)
 	return mrcpsynth_exit(chan, app_session, status);
 }
 
+/* --- SYNTHESIS TO FILE --- */
+
+/* Time the synthesis of a prompt to a file may take. */
+#define MRCPSYNTH_FILE_TIMEOUT apr_time_from_sec(600)
+
+/* Synthesize a prompt to a file, with options as given to MRCPSynth(). The 
+ * speech channel is not attached to a call and runs on the faster than realtime 
+ * media engine, if any. The file is only created if the synthesis completes 
+ * normally. Return the completion cause in completion_cause, -1 if unknown.
+ */
+int mrcpsynth_to_file(const char *prompt, const char *path, const char *options, int *completion_cause)
+{
+	speech_channel_t *schannel = NULL;
+	const char *codec;
+	apr_uint16_t rate;
+	mrcpsynth_options_t mrcpsynth_options;
+	ast_mrcp_profile_t *profile;
+	const char *profile_name = NULL;
+	const char *content = NULL;
+	const char *content_type = NULL;
+	const char *tmp_path;
+	apr_pool_t *pool;
+	FILE *file;
+	int status = -1;
+
+	*completion_cause = -1;
+
+	if (mrcpsynth == NULL)
+		return -1;
+
+	if (speech_channel_file_format(path, &codec, &rate) != 0) {
+		ast_log(LOG_WARNING, "Unsupported file format of %s\n", path);
+		return -1;
+	}
+
+	if ((pool = apt_pool_create()) == NULL)
+		return -1;
+
+	mrcpsynth_options.synth_hfs = NULL;
+	mrcpsynth_options.flags = 0;
+	if (!ast_strlen_zero(options))
+		mrcpsynth_options_parse(apr_pstrdup(pool, options), &mrcpsynth_options, pool);
+
+	if ((mrcpsynth_options.flags & MRCPSYNTH_PROFILE) == MRCPSYNTH_PROFILE) {
+		if (!ast_strlen_zero(mrcpsynth_options.params[OPT_ARG_PROFILE])) {
+			profile_name = mrcpsynth_options.params[OPT_ARG_PROFILE];
+		}
+	}
+
+	if ((profile = get_synth_profile(profile_name)) == NULL) {
+		ast_log(LOG_WARNING, "Can't find profile, %s\n", profile_name);
+		apr_pool_destroy(pool);
+		return -1;
+	}
+
+	if ((schannel = speech_channel_batch(profile, mrcpsynth, SPEECH_CHANNEL_SYNTHESIZER, codec, rate)) == NULL) {
+		apr_pool_destroy(pool);
+		return -1;
+	}
+
+	if (determine_synth_content_type(schannel, prompt, &content, &content_type) != 0) {
+		ast_log(LOG_WARNING, "(%s) Unable to determine synthesis content type\n", schannel->name);
+		speech_channel_destroy(schannel);
+		apr_pool_destroy(pool);
+		return -1;
+	}
+
+	/* Write to a temporary file, so that the file is never played out partially. */
+	tmp_path = apr_pstrcat(pool, path, ".tmp", NULL);
+	if ((file = fopen(tmp_path, "wb")) == NULL) {
+		ast_log(LOG_WARNING, "(%s) Unable to create %s: %s\n", schannel->name, tmp_path, strerror(errno));
+		speech_channel_destroy(schannel);
+		apr_pool_destroy(pool);
+		return -1;
+	}
+
+	if (synth_channel_speak(schannel, content, content_type, mrcpsynth_options.synth_hfs, 1) == 0) {
+		status = speech_channel_drain(schannel, MRCPSYNTH_FILE_TIMEOUT, file);
+	} else {
+		ast_log(LOG_WARNING, "(%s) Unable to start synthesis\n", schannel->name);
+		speech_channel_drain(schannel, 0, NULL);
+	}
+	*completion_cause = schannel->completion_cause;
+
+	if (fclose(file) != 0)
+		status = -1;
+
+	if ((status == 0) && (*completion_cause == SYNTHESIZER_COMPLETION_CAUSE_NORMAL) && (rename(tmp_path, path) == 0)) {
+		ast_log(LOG_NOTICE, "(%s) Synthesized %s\n", schannel->name, path);
+	} else {
+		ast_log(LOG_WARNING, "(%s) Unable to synthesize %s, completion cause %d\n", schannel->name, path, *completion_cause);
+		remove(tmp_path);
+		status = -1;
+	}
+
+	speech_channel_destroy(schannel);
+	apr_pool_destroy(pool);
+	return status;
+}
+
+/* The entry point of MRCPSynthToFile. */
+static int app_synth_to_file_exec(struct ast_channel *chan, ast_app_data data)
+{
+	speech_channel_status_t status;
+	int completion_cause;
+	char cause[16];
+	char *parse;
+
+	AST_DECLARE_APP_ARGS(args,
+		AST_APP_ARG(prompt);
+		AST_APP_ARG(file);
+		AST_APP_ARG(options);
+	);
+
+	if (ast_strlen_zero(data)) {
+		ast_log(LOG_WARNING, "%s() requires arguments (prompt,file[,options])\n", app_synth_to_file);
+		pbx_builtin_setvar_helper(chan, "SYNTHSTATUS", speech_channel_status_to_string(SPEECH_CHANNEL_STATUS_ERROR));
+		return 0;
+	}
+
+	/* We need to make a copy of the input string if we are going to modify it! */
+	parse = ast_strdupa(data);
+	AST_STANDARD_APP_ARGS(args, parse);
+
+	if (ast_strlen_zero(args.prompt) || ast_strlen_zero(args.file)) {
+		ast_log(LOG_WARNING, "%s() requires a prompt and a file argument (prompt,file[,options])\n", app_synth_to_file);
+		pbx_builtin_setvar_helper(chan, "SYNTHSTATUS", speech_channel_status_to_string(SPEECH_CHANNEL_STATUS_ERROR));
+		return 0;
+	}
+
+	args.prompt = normalize_input_string(args.prompt);
+	args.file = normalize_input_string(args.file);
+	if (!ast_strlen_zero(args.options))
+		args.options = normalize_input_string(args.options);
+	ast_log(LOG_NOTICE, "%s() prompt: %s file: %s\n", app_synth_to_file, args.prompt, args.file);
+
+	if (mrcpsynth_to_file(args.prompt, args.file, args.options, &completion_cause) == 0)
+		status = SPEECH_CHANNEL_STATUS_OK;
+	else
+		status = SPEECH_CHANNEL_STATUS_ERROR;
+
+	if (completion_cause >= 0) {
+		snprintf(cause, sizeof(cause), "%03d", completion_cause);
+		pbx_builtin_setvar_helper(chan, "SYNTH_COMPLETION_CAUSE", cause);
+	}
+	pbx_builtin_setvar_helper(chan, "SYNTHSTATUS", speech_channel_status_to_string(status));
+	ast_log(LOG_NOTICE, "%s() exiting status: %s on %s\n", app_synth_to_file, speech_channel_status_to_string(status), ast_channel_name(chan));
+	return 0;
+}
+
+/* Synthesis of a prompt to a file from the CLI, run as a batch job of one item. */
+struct mrcpsynth_file_t {
+	/* The prompt. */
+	const char *prompt;
+	/* The file. */
+	const char *path;
+	/* Options as given to MRCPSynthToFile(). */
+	const char *options;
+};
+typedef struct mrcpsynth_file_t mrcpsynth_file_t;
+
+/* The last synthesis to a file from the CLI, synchronized by the globals mutex. */
+static batch_job_t *mrcpsynth_file_job = NULL;
+
+/* Synthesize the prompt of the job to its file. */
+static batch_job_outcome_t mrcpsynth_file_process(batch_job_t *job, apr_uint32_t index, void **worker)
+{
+	mrcpsynth_file_t *synth_file = (mrcpsynth_file_t *)job->data;
+	int completion_cause;
+
+	if (mrcpsynth_to_file(synth_file->prompt, synth_file->path, synth_file->options, &completion_cause) != 0)
+		return BATCH_JOB_FAILED;
+	return BATCH_JOB_COMPLETED;
+}
+
+/* Start synthesizing a prompt to a file in the background, with options as 
+ * given to MRCPSynthToFile(). Return 1 if a synthesis is running already.
+ */
+int mrcpsynth_file_start(const char *path, const char *prompt, const char *options)
+{
+	batch_job_t *job;
+	mrcpsynth_file_t *synth_file;
+
+	if (mrcpsynth == NULL)
+		return -1;
+
+	if (batch_job_claim(&mrcpsynth_file_job) != 0)
+		return 1;
+
+	if ((job = batch_job_create(mrcpsynth_file_process, NULL)) == NULL)
+		return -1;
+	job->name = apr_psprintf(job->pool, "Synthesis to %s", path);
+
+	job->data = synth_file = apr_pcalloc(job->pool, sizeof(mrcpsynth_file_t));
+	synth_file->prompt = apr_pstrdup(job->pool, prompt);
+	synth_file->path = apr_pstrdup(job->pool, path);
+	synth_file->options = options ? apr_pstrdup(job->pool, options) : NULL;
+
+	return batch_job_start(&mrcpsynth_file_job, job, 1, 1);
+}
+
+/* Get the progress of the last synthesis to a file, return -1 if none has run. */
+int mrcpsynth_file_stats_get(batch_job_stats_t *stats)
+{
+	return batch_job_stats_get(&mrcpsynth_file_job, stats);
+}
+
+/* Cancel the running synthesis to a file, if any, and wait for it. */
+void mrcpsynth_file_stop(void)
+{
+	batch_job_stop(&mrcpsynth_file_job);
+}
+
+/* --- PRE-SYNTHESIS --- */
+
+/* Maximum size of a list of prompts to pre-synthesize. */
+#define MRCPSYNTH_WARM_MAX_FILE_SIZE (64 * 1024 * 1024)
+
+/* Time a single prompt may take to be pre-synthesized. */
+#define MRCPSYNTH_WARM_TIMEOUT       apr_time_from_sec(120)
+
+/* Pre-synthesis of a list of prompts into the TTS cache, run as a batch job. */
+struct mrcpsynth_warm_t {
+	/* File the prompts were read from. */
+	const char *path;
+	/* Profile the prompts are synthesized with. */
+	ast_mrcp_profile_t *profile;
+	/* Synthesizer header fields applied to the prompts. */
+	apr_hash_t *synth_hfs;
+	/* Codec the prompts are synthesized to. */
+	const char *codec;
+	/* Rate the prompts are synthesized at. */
+	apr_uint16_t rate;
+	/* The prompts. */
+	apr_array_header_t *prompts;
+};
+typedef struct mrcpsynth_warm_t mrcpsynth_warm_t;
+
+/* The last pre-synthesis job, synchronized by the globals mutex. */
+static batch_job_t *mrcpsynth_warm = NULL;
+
+/* Split the list into prompts. A prompt is a line of plain text or SSML, an 
+ * XML document may span several lines up to its closing tag. Empty lines and 
+ * lines starting with '#' are skipped.
+ */
+static void mrcpsynth_warm_parse(mrcpsynth_warm_t *warm, char *text, apr_pool_t *pool)
+{
+	char *line;
+	char *last = NULL;
+	char *document = NULL;
+	apr_size_t len;
+
+	for (line = apr_strtok(text, "\n", &last); line; line = apr_strtok(NULL, "\n", &last)) {
+		len = strlen(line);
+		if ((len > 0) && (line[len - 1] == '\r'))
+			line[--len] = '\0';
+
+		if (document != NULL) {
+			document = apr_pstrcat(pool, document, "\n", line, NULL);
+			if (strstr(line, "</speak>") != NULL) {
+				APR_ARRAY_PUSH(warm->prompts, const char *) = document;
+				document = NULL;
+			}
+			continue;
+		}
+
+		line = ast_strip(line);
+		if ((*line == '\0') || (*line == '#'))
+			continue;
+
+		if ((*line == '<') && (strstr(line, "</speak>") == NULL))
+			document = apr_pstrdup(pool, line);
+		else
+			APR_ARRAY_PUSH(warm->prompts, const char *) = apr_pstrdup(pool, line);
+	}
+
+	if (document != NULL)
+		APR_ARRAY_PUSH(warm->prompts, const char *) = document;
+}
+
+/* Read the list of prompts. */
+static int mrcpsynth_warm_load(mrcpsynth_warm_t *warm, apr_pool_t *pool)
+{
+	apr_file_t *file = NULL;
+	apr_finfo_t finfo;
+	char *text;
+
+	if (apr_file_open(&file, warm->path, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Unable to open prompt list %s\n", warm->path);
+		return -1;
+	}
+
+	if ((apr_file_info_get(&finfo, APR_FINFO_SIZE, file) != APR_SUCCESS) || (finfo.size > MRCPSYNTH_WARM_MAX_FILE_SIZE)) {
+		ast_log(LOG_WARNING, "Prompt list %s is too large\n", warm->path);
+		apr_file_close(file);
+		return -1;
+	}
+
+	text = apr_palloc(pool, (apr_size_t)finfo.size + 1);
+	if ((finfo.size > 0) && (apr_file_read_full(file, text, (apr_size_t)finfo.size, NULL) != APR_SUCCESS)) {
+		ast_log(LOG_WARNING, "Unable to read prompt list %s\n", warm->path);
+		apr_file_close(file);
+		return -1;
+	}
+	text[finfo.size] = '\0';
+	apr_file_close(file);
+
+	mrcpsynth_warm_parse(warm, text, pool);
+	return 0;
+}
+
+/* Synthesize a prompt into the TTS cache. Return 1 if the prompt is cached already. */
+static int mrcpsynth_warm_prompt(mrcpsynth_warm_t *warm, speech_channel_t *schannel, const char *prompt)
+{
+	tts_cache_entry_t *cached;
+	const char *key = NULL;
+	const char *content = NULL;
+	const char *content_type = NULL;
+
+	if ((cached = speech_channel_cache_lookup(schannel, warm->profile, prompt, warm->synth_hfs, &key)) != NULL) {
+		tts_cache_entry_release(cached);
+		return 1;
+	}
+
+	if (key == NULL) {
+		ast_log(LOG_WARNING, "(%s) Prompt cannot be cached: %s\n", schannel->name, prompt);
+		return -1;
+	}
+
+	if (determine_synth_content_type(schannel, prompt, &content, &content_type) != 0) {
+		ast_log(LOG_WARNING, "(%s) Unable to determine synthesis content type\n", schannel->name);
+		return -1;
+	}
+
+	speech_channel_cache_capture(schannel, key);
+	if (synth_channel_speak(schannel, content, content_type, warm->synth_hfs, 1) != 0) {
+		ast_log(LOG_WARNING, "(%s) Unable to start synthesis\n", schannel->name);
+		speech_channel_cache_drain(schannel, 0);
+		return -1;
+	}
+
+	return speech_channel_cache_drain(schannel, MRCPSYNTH_WARM_TIMEOUT);
+}
+
+/* Synthesize a prompt through the speech channel of the worker thread. */
+static batch_job_outcome_t mrcpsynth_warm_process(batch_job_t *job, apr_uint32_t index, void **worker)
+{
+	mrcpsynth_warm_t *warm = (mrcpsynth_warm_t *)job->data;
+	speech_channel_t *schannel = (speech_channel_t *)*worker;
+	int res;
+
+	/* Open a channel of the faster than realtime media engine, again if the previous one failed. */
+	if ((schannel != NULL) && (speech_channel_get_state(schannel) != SPEECH_CHANNEL_READY)) {
+		speech_channel_destroy(schannel);
+		schannel = NULL;
+	}
+	if (schannel == NULL)
+		schannel = speech_channel_batch(warm->profile, mrcpsynth, SPEECH_CHANNEL_SYNTHESIZER, warm->codec, warm->rate);
+	*worker = schannel;
+
+	res = (schannel != NULL) ? mrcpsynth_warm_prompt(warm, schannel, APR_ARRAY_IDX(warm->prompts, index, const char *)) : -1;
+	if (res == 0)
+		return BATCH_JOB_COMPLETED;
+	return (res == 1) ? BATCH_JOB_SKIPPED : BATCH_JOB_FAILED;
+}
+
+/* Release the speech channel of a worker thread. */
+static void mrcpsynth_warm_worker_done(batch_job_t *job, void *worker)
+{
+	speech_channel_destroy((speech_channel_t *)worker);
+}
+
+/* Start pre-synthesizing the prompts listed in a file into the TTS cache, with 
+ * options as given to MRCPSynth(). Return 1 if a job is running already.
+ */
+int mrcpsynth_warm_start(const char *path, const char *options, const char *codec, apr_uint16_t rate)
+{
+	batch_job_t *job;
+	mrcpsynth_warm_t *warm;
+	mrcpsynth_options_t mrcpsynth_options;
+	const char *profile_name = NULL;
+	apr_pool_t *pool;
+
+	if ((mrcpsynth == NULL) || !tts_cache_enabled()) {
+		ast_log(LOG_WARNING, "Pre-synthesis requires the TTS cache\n");
+		return -1;
+	}
+
+	if (batch_job_claim(&mrcpsynth_warm) != 0)
+		return 1;
+
+	if ((job = batch_job_create(mrcpsynth_warm_process, mrcpsynth_warm_worker_done)) == NULL)
+		return -1;
+	pool = job->pool;
+	job->name = apr_psprintf(pool, "Pre-synthesis of %s", path);
+
+	job->data = warm = apr_pcalloc(pool, sizeof(mrcpsynth_warm_t));
+	warm->path = apr_pstrdup(pool, path);
+	warm->codec = apr_pstrdup(pool, codec);
+	warm->rate = rate;
+	warm->prompts = apr_array_make(pool, 256, sizeof(const char *));
+
+	mrcpsynth_options.synth_hfs = NULL;
+	mrcpsynth_options.flags = 0;
+	if (!ast_strlen_zero(options))
+		mrcpsynth_options_parse(apr_pstrdup(pool, options), &mrcpsynth_options, pool);
+	warm->synth_hfs = mrcpsynth_options.synth_hfs;
+
+	if ((mrcpsynth_options.flags & MRCPSYNTH_PROFILE) == MRCPSYNTH_PROFILE) {
+		if (!ast_strlen_zero(mrcpsynth_options.params[OPT_ARG_PROFILE])) {
+			profile_name = mrcpsynth_options.params[OPT_ARG_PROFILE];
+		}
+	}
+
+	if ((warm->profile = get_synth_profile(profile_name)) == NULL) {
+		ast_log(LOG_WARNING, "Can't find profile, %s\n", profile_name);
+		batch_job_destroy(job);
+		return -1;
+	}
+
+	if ((mrcpsynth_warm_load(warm, pool) != 0) || (warm->prompts->nelts == 0)) {
+		ast_log(LOG_WARNING, "No prompts to pre-synthesize in %s\n", warm->path);
+		batch_job_destroy(job);
+		return -1;
+	}
+
+	if (warm->profile->batch_name == NULL)
+		ast_log(LOG_NOTICE, "Pre-synthesizing with %s in realtime, set tts-warm-rate to speed it up\n", warm->profile->name);
+
+	ast_log(LOG_NOTICE, "Pre-synthesizing %d prompts of %s with %s\n", warm->prompts->nelts, warm->path, warm->profile->name);
+	return batch_job_start(&mrcpsynth_warm, job, (apr_uint32_t)warm->prompts->nelts, globals.tts_warm_channels);
+}
+
+/* Get the progress of the last pre-synthesis job, return -1 if none has run. */
+int mrcpsynth_warm_stats_get(batch_job_stats_t *stats)
+{
+	return batch_job_stats_get(&mrcpsynth_warm, stats);
+}
+
+/* Cancel the running pre-synthesis job, if any, and wait for it. */
+void mrcpsynth_warm_stop(void)
+{
+	batch_job_stop(&mrcpsynth_warm);
+}
+
 int load_mrcpsynth_app()
 {
 	apr_pool_t *pool = globals.pool;
@@ -769,6 +1375,18 @@ int load_mrcpsynth_app()
 
 	apr_hash_set(globals.apps, app_synth, APR_HASH_KEY_STRING, mrcpsynth);
 
+	/* Synthesis to a file runs on speech channels of MRCPSynth, no MRCP application of its own is needed. */
+	mrcpsynthtofile = (ast_mrcp_application_t*) apr_pcalloc(pool, sizeof(ast_mrcp_application_t));
+	mrcpsynthtofile->name = app_synth_to_file;
+	mrcpsynthtofile->exec = app_synth_to_file_exec;
+	mrcpsynthtofile->app = NULL;
+#if !AST_VERSION_AT_LEAST(1,6,2)
+	mrcpsynthtofile->synopsis = NULL;
+	mrcpsynthtofile->description = NULL;
+#endif
+
+	apr_hash_set(globals.apps, app_synth_to_file, APR_HASH_KEY_STRING, mrcpsynthtofile);
+
 	return 0;
 }
 
@@ -779,6 +1397,9 @@ int unload_mrcpsynth_app()
 		return -1;
 	}
 
+	apr_hash_set(globals.apps, app_synth_to_file, APR_HASH_KEY_STRING, NULL);
+	mrcpsynthtofile = NULL;
+
 	apr_hash_set(globals.apps, app_synth, APR_HASH_KEY_STRING, NULL);
 	mrcpsynth = NULL;
 
@@ -94,6 +94,12 @@
 					<option name="vsp"> <para>Vendor-specific parameters.</para></option>
 					<option name="nif"> <para>NLSML instance format (either "xml" or "json") used by RECOG_INSTANCE().</para></option>
 					<option name="rnl"> <para>Replace new lines (0: disabled, otherwise: the character to replace new lines with) used by RECOG_INSTANCE().</para></option>
+					<option name="sc"> <para>Sentence chunking (0: disabled [default], otherwise: the minimum length of a chunk in characters),
+						as for MRCPSynth.</para></option>
+					<option name="pfp"> <para>Number of upcoming prompts synthesized through a second synthesis session while the current prompt
+						is played (0: disabled [default], otherwise: the number of prompts).</para></option>
+					<option name="mp"> <para>Merge prompts (0: disabled [default], 1: enabled), adjacent plain text and SSML prompts
+						are synthesized through a single SPEAK request.</para></option>
 				</optionlist>
 			</parameter>
 		</syntax>
@@ -109,6 +115,21 @@
 			<para>If recognition completed successfully, the variable ${RECOG_RESULT} is set to an NLSML result received
 			from the MRCP server. Alternatively, the recognition result data can be retrieved by using the following dialplan
 			functions RECOG_CONFIDENCE(), RECOG_GRAMMAR(), RECOG_INPUT(), and RECOG_INSTANCE().</para>
+			<para>The variables ${RECOG_SETUP_MS}, ${RECOG_RESPONSE_MS}, ${RECOG_FIRST_AUDIO_MS}, ${RECOG_SOI_MS} and ${RECOG_COMPLETE_MS}
+			are set to the time it took to establish the session, and from sending the RECOGNIZE request to the IN-PROGRESS response,
+			the first audio frame sent, the START-OF-INPUT and the RECOGNITION-COMPLETE events respectively, as far as measured.</para>
+			<para>The variables ${SYNTH_SETUP_MS}, ${SYNTH_RESPONSE_MS}, ${SYNTH_TTFA_MS} and ${SYNTH_COMPLETE_MS} are set likewise
+			for the last prompt synthesized.</para>
+			<para>If several prompts are specified and prefetching is enabled, the upcoming synthesized prompts are prefetched while the current prompt, either
+			synthesized or an audio file, is played, so that they are played back to back. A prompt which is not prefetched by the time
+			it is due is synthesized as usual.</para>
+			<para>If prompts are merged, adjacent plain text and SSML prompts are combined into a single SSML document, as long as the
+			root elements of the SSML prompts match and are in the language of the plain text prompts, with a mark
+			named "prompt-N" inserted ahead of the Nth prompt. If barge-in occurred, the variable ${RECOG_BARGEIN_PROMPT} is set to
+			the number of the prompt being played, starting at 1, as reported by the last SPEECH-MARKER event for merged prompts.</para>
+			<para>A synthesized prompt is silenced as soon as the START-OF-INPUT event is received, ahead of the synthesis request being
+			stopped. If barge-in occurred, the variable ${RECOG_BARGEIN_MS} is set to the time from the START-OF-INPUT event to the
+			prompt being silenced.</para>
 		</description>
 		<see-also>
 			<ref type="application">MRCPSynth</ref>
@@ -140,7 +161,10 @@ enum sar_option_flags {
 	SAR_DATASTORE_ENTRY        = (1 << 8),
 	SAR_STOP_BARGED_SYNTH      = (1 << 9),
 	SAR_INSTANCE_FORMAT        = (1 << 10),
-	SAR_REPLACE_NEW_LINES      = (1 << 11)
+	SAR_REPLACE_NEW_LINES      = (1 << 11),
+	SAR_PREFETCH_PROMPTS       = (1 << 12),
+	SAR_SENTENCE_CHUNKS        = (1 << 13),
+	SAR_MERGE_PROMPTS          = (1 << 14)
 };
 
 /* The enumeration of option arguments. */
@@ -157,9 +181,12 @@ enum sar_option_args {
 	OPT_ARG_STOP_BARGED_SYNTH   = 9,
 	OPT_ARG_INSTANCE_FORMAT     = 10,
 	OPT_ARG_REPLACE_NEW_LINES   = 11,
+	OPT_ARG_PREFETCH_PROMPTS    = 12,
+	OPT_ARG_SENTENCE_CHUNKS     = 13,
+	OPT_ARG_MERGE_PROMPTS       = 14,
 	
 	/* This MUST be the last value in this enum! */
-	OPT_ARG_ARRAY_SIZE          = 12
+	OPT_ARG_ARRAY_SIZE          = 15
 };
 
 /* The enumeration of plocies for the use of input timers. */
@@ -184,6 +211,8 @@ typedef struct sar_options_t sar_options_t;
 struct sar_prompt_item_t {
 	const char *content;
 	int         is_audio_file;
+	int         index;  /* number of the (first) prompt, starting at 1 */
+	int         count;  /* number of prompts merged into the item */
 };
 
 typedef struct sar_prompt_item_t sar_prompt_item_t;
@@ -196,7 +225,7 @@ static apt_bool_t recog_on_message_receive(speech_channel_t *schannel, mrcp_mess
 static APR_INLINE speech_channel_t * get_speech_channel(mrcp_session_t *session)
 {
 	if (session)
-		return (speech_channel_t *)mrcp_application_session_object_get(session);
+		return speech_channel_session_get(session);
 
 	return NULL;
 }
@@ -252,7 +281,7 @@ static apt_bool_t speech_on_channel_add(mrcp_application_t *application, mrcp_se
 		}
 
 		if (schannel->type == SPEECH_CHANNEL_RECOGNIZER && schannel->stream != NULL) {
-			schannel->dtmf_generator = mpf_dtmf_generator_create(schannel->stream, schannel->pool);
+			schannel->dtmf_generator = mpf_dtmf_generator_create(schannel->stream, session->pool);
 			/* schannel->dtmf_generator = mpf_dtmf_generator_create_ex(schannel->stream, MPF_DTMF_GENERATOR_OUTBAND, 70, 50, schannel->pool); */
 
 			if (schannel->dtmf_generator != NULL)
@@ -271,7 +300,7 @@ static apt_bool_t speech_on_channel_add(mrcp_application_t *application, mrcp_se
 		if (!schannel->session_id) {
 			const apt_str_t *session_id = mrcp_application_session_id_get(session);
 			if (session_id && session_id->buf) {
-				schannel->session_id = apr_pstrdup(schannel->pool, session_id->buf);
+				schannel->session_id = apr_pstrdup(session->pool, session_id->buf);
 			}
 		}
 		
@@ -318,7 +347,12 @@ static apt_bool_t synth_on_message_receive(speech_channel_t *schannel, mrcp_mess
 			if (message->start_line.request_state == MRCP_REQUEST_STATE_INPROGRESS) {
 				/* Waiting for SPEAK-COMPLETE event. */
 				ast_log(LOG_DEBUG, "(%s) REQUEST IN PROGRESS\n", schannel->name);
+				speech_channel_speak_accepted(schannel, message->start_line.request_id);
 				speech_channel_set_state(schannel, SPEECH_CHANNEL_PROCESSING);
+			} else if (message->start_line.request_state == MRCP_REQUEST_STATE_PENDING) {
+				/* The request for the next chunk of the prompt is queued. */
+				ast_log(LOG_DEBUG, "(%s) REQUEST PENDING\n", schannel->name);
+				speech_channel_speak_accepted(schannel, message->start_line.request_id);
 			} else {
 				/* Received unexpected request_state. */
 				ast_log(LOG_DEBUG, "(%s) Unexpected SPEAK response, request_state = %d\n", schannel->name, message->start_line.request_state);
@@ -355,8 +389,30 @@ static apt_bool_t synth_on_message_receive(speech_channel_t *schannel, mrcp_mess
 		/* Received MRCP event. */
 		if (message->start_line.method_id == SYNTHESIZER_SPEAK_COMPLETE) {
 			/* Got SPEAK-COMPLETE. */
+			mrcp_synth_header_t *synth_header = (mrcp_synth_header_t *)mrcp_resource_header_get(message);
+			int cause = synth_header ? synth_header->completion_cause : SYNTHESIZER_COMPLETION_CAUSE_UNKNOWN;
+			int last = speech_channel_speak_completed(schannel, message->start_line.request_id, &cause);
+			if (last < 0) {
+				/* The request was stopped already. */
+				ast_log(LOG_DEBUG, "(%s) SPEAK-COMPLETE of a request no longer outstanding\n", schannel->name);
+				return TRUE;
+			}
+			if (!last) {
+				/* More chunks of the prompt are outstanding. */
+				ast_log(LOG_DEBUG, "(%s) SPEAK-COMPLETE of chunk\n", schannel->name);
+				return TRUE;
+			}
 			ast_log(LOG_DEBUG, "(%s) SPEAK-COMPLETE\n", schannel->name);
+			if (cause == SYNTHESIZER_COMPLETION_CAUSE_NORMAL)
+				speech_channel_cache_complete(schannel);
 			speech_channel_set_state(schannel, SPEECH_CHANNEL_READY);
+		} else if (message->start_line.method_id == SYNTHESIZER_SPEECH_MARKER) {
+			/* Got SPEECH-MARKER of a merged prompt. */
+			mrcp_synth_header_t *synth_header = (mrcp_synth_header_t *)mrcp_resource_header_get(message);
+			if (synth_header && mrcp_resource_header_property_check(message, SYNTHESIZER_HEADER_SPEECH_MARKER) == TRUE) {
+				ast_log(LOG_DEBUG, "(%s) SPEECH-MARKER %.*s\n", schannel->name, (int)synth_header->speech_marker.length, synth_header->speech_marker.buf);
+				speech_channel_mark_reached(schannel, &synth_header->speech_marker);
+			}
 		} else {
 			ast_log(LOG_DEBUG, "(%s) Unexpected event, method_id = %d\n", schannel->name, (int)message->start_line.method_id);
 			speech_channel_set_state(schannel, SPEECH_CHANNEL_ERROR);
@@ -398,14 +454,45 @@ static APR_INLINE apt_bool_t speech_channel_wait_for_ready(speech_channel_t *sch
 	return (schannel->state == SPEECH_CHANNEL_READY) ? TRUE : FALSE;
 }
 
-/* Send SPEAK request to synthesizer. */
-static int synth_channel_speak(speech_channel_t *schannel, const char *content, const char *content_type, apr_hash_t *header_fields)
+/* Create a SPEAK request, with the channel locked. */
+static mrcp_message_t *synth_channel_speak_message(speech_channel_t *schannel, const char *content, const char *content_type, apr_hash_t *header_fields)
 {
-	int status = 0;
 	mrcp_message_t *mrcp_message = NULL;
 	mrcp_generic_header_t *generic_header = NULL;
 	mrcp_synth_header_t *synth_header = NULL;
 
+	if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, SYNTHESIZER_SPEAK)) == NULL) {
+		ast_log(LOG_ERROR, "(%s) Failed to create SPEAK message\n", schannel->name);
+		return NULL;
+	}
+
+	/* Set generic header fields (content-type). */
+	if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {	
+		return NULL;
+	}
+
+	apt_string_assign(&generic_header->content_type, content_type, mrcp_message->pool);
+	mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
+
+	/* Set synthesizer header fields (voice, rate, etc.). */
+	if ((synth_header = (mrcp_synth_header_t *)mrcp_resource_header_prepare(mrcp_message)) == NULL) {
+		return NULL;
+	}
+
+	/* Add params to MRCP message. */
+	speech_channel_set_params(schannel, mrcp_message, header_fields);
+
+	/* Set body (plain text or SSML). */
+	speech_channel_body_set(schannel, mrcp_message, content);
+	return mrcp_message;
+}
+
+/* Send SPEAK request to synthesizer. */
+static int synth_channel_speak(speech_channel_t *schannel, const char *content, const char *content_type, apr_hash_t *header_fields, apr_uint32_t chunks)
+{
+	int status = 0;
+	mrcp_message_t *mrcp_message = NULL;
+
 	if (!schannel || !content || !content_type) {
 		ast_log(LOG_ERROR, "synth_channel_speak: unknown channel error!\n");
 		return -1;
@@ -423,37 +510,21 @@ static int synth_channel_speak(speech_channel_t *schannel, const char *content,
 		}
 	}
 
-	if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, SYNTHESIZER_SPEAK)) == NULL) {
-		ast_log(LOG_ERROR, "(%s) Failed to create SPEAK message\n", schannel->name);
-
-		apr_thread_mutex_unlock(schannel->mutex);
-		return -1;
-	}
-
-	/* Set generic header fields (content-type). */
-	if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {	
+	if ((mrcp_message = synth_channel_speak_message(schannel, content, content_type, header_fields)) == NULL) {
 		apr_thread_mutex_unlock(schannel->mutex);
 		return -1;
 	}
 
-	apt_string_assign(&generic_header->content_type, content_type, mrcp_message->pool);
-	mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
+	/* Empty audio queue, start the playout and send SPEAK to MRCP server. */
+	audio_queue_clear(schannel->audio_queue);
+	speech_channel_timing_request(schannel);
+	speech_channel_speak_start(schannel, chunks);
 
-	/* Set synthesizer header fields (voice, rate, etc.). */
-	if ((synth_header = (mrcp_synth_header_t *)mrcp_resource_header_prepare(mrcp_message)) == NULL) {
+	if (speech_channel_playout_start(schannel) != 0) {
 		apr_thread_mutex_unlock(schannel->mutex);
 		return -1;
 	}
 
-	/* Add params to MRCP message. */
-	speech_channel_set_params(schannel, mrcp_message, header_fields);
-
-	/* Set body (plain text or SSML). */
-	apt_string_assign(&mrcp_message->body, content, schannel->pool);
-
-	/* Empty audio queue and send SPEAK to MRCP server. */
-	audio_queue_clear(schannel->audio_queue);
-
 	if (!mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message)) {
 		ast_log(LOG_ERROR,"(%s) Failed to send SPEAK message", schannel->name);
 
@@ -473,6 +544,40 @@ static int synth_channel_speak(speech_channel_t *schannel, const char *content,
 	return status;
 }
 
+/* Send SPEAK requests for the chunks of a prompt back to back. The first one 
+ * starts the playout, the MRCP server queues the others and synthesizes them 
+ * in order, so that their audio follows without a gap.
+ */
+static int synth_channel_speak_chunks(speech_channel_t *schannel, apr_array_header_t *chunks, const char *content_type, apr_hash_t *header_fields)
+{
+	mrcp_message_t *mrcp_message = NULL;
+	int i;
+
+	if (synth_channel_speak(schannel, APR_ARRAY_IDX(chunks, 0, const char *), content_type, header_fields, (apr_uint32_t)chunks->nelts) != 0)
+		return -1;
+
+	for (i = 1; i < chunks->nelts; i++) {
+		apr_thread_mutex_lock(schannel->mutex);
+
+		if ((mrcp_message = synth_channel_speak_message(schannel, APR_ARRAY_IDX(chunks, i, const char *), content_type, header_fields)) == NULL) {
+			apr_thread_mutex_unlock(schannel->mutex);
+			return -1;
+		}
+
+		/* The response, PENDING unless the previous chunks completed already, is not waited for. */
+		if (!mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message)) {
+			ast_log(LOG_ERROR, "(%s) Failed to send SPEAK message for chunk %d\n", schannel->name, i + 1);
+			apr_thread_mutex_unlock(schannel->mutex);
+			return -1;
+		}
+		apr_thread_mutex_unlock(schannel->mutex);
+	}
+
+	if (chunks->nelts > 1)
+		ast_log(LOG_DEBUG, "(%s) Sent SPEAK requests for %d chunks\n", schannel->name, chunks->nelts);
+	return 0;
+}
+
 /* Send BARGE-IN-OCCURRED. */
 int synth_channel_bargein_occurred(speech_channel_t *schannel) 
 {
@@ -483,6 +588,9 @@ int synth_channel_bargein_occurred(speech_channel_t *schannel)
 		return -1;
 	}
 
+	/* Silence the prompt at once, the queued audio is discarded. */
+	speech_channel_playout_stop(schannel);
+
 	apr_thread_mutex_lock(schannel->mutex);
 
 	if (schannel->state == SPEECH_CHANNEL_PROCESSING) {
@@ -553,8 +661,8 @@ static int recog_channel_start_input_timers(speech_channel_t *schannel)
 	return status;
 }
 
-/* Flag that input has started. */
-static int recog_channel_set_start_of_input(speech_channel_t *schannel)
+/* Flag that input has started, as reported by the recognizer or detected locally. */
+static int recog_channel_set_start_of_input(speech_channel_t *schannel, int local)
 {
 	int status = 0;
 
@@ -574,12 +682,69 @@ static int recog_channel_set_start_of_input(speech_channel_t *schannel)
 		return -1;
 	}
 
+	if (!r->start_of_input)
+		r->start_of_input_time = speech_channel_clock();
 	r->start_of_input = 1;
+	if (!local && !schannel->timing.start_of_input)
+		schannel->timing.start_of_input = speech_channel_clock();
+
+	/* Silence the prompt right away, the main loop stops the request. */
+	if (r->bargein_channel && !r->bargein_time) {
+		speech_channel_playout_mute(r->bargein_channel);
+		r->bargein_time = speech_channel_clock();
+	}
 
 	apr_thread_mutex_unlock(schannel->mutex);
 	return status;
 }
 
+/* Set the synthesizer channel to silence on START-OF-INPUT, NULL if none. */
+static void recog_channel_set_bargein_channel(speech_channel_t *schannel, speech_channel_t *synth_channel)
+{
+	recognizer_data_t *r;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	if ((r = (recognizer_data_t *)schannel->data) != NULL)
+		r->bargein_channel = synth_channel;
+	apr_thread_mutex_unlock(schannel->mutex);
+}
+
+/* Get the time from the start of input, reported by the recognizer or detected 
+ * locally, to the prompt being silenced, marking the prompt silenced now unless 
+ * done on the start of input already. Local is set if the recognizer has not 
+ * reported the start of input yet.
+ */
+static apr_interval_time_t recog_channel_bargein_latency(speech_channel_t *schannel, int *local)
+{
+	recognizer_data_t *r;
+	apr_interval_time_t latency = 0;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	if ((r = (recognizer_data_t *)schannel->data) != NULL) {
+		if (!r->bargein_time)
+			r->bargein_time = speech_channel_clock();
+		if (r->start_of_input_time && (r->bargein_time > r->start_of_input_time))
+			latency = r->bargein_time - r->start_of_input_time;
+	}
+	*local = (schannel->timing.start_of_input == 0);
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	return latency;
+}
+
+/* End recognition with no input, detected locally ahead of the no-input timeout of the recognizer. */
+static int recog_channel_set_no_input(speech_channel_t *schannel)
+{
+	recognizer_data_t *r;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	if (((r = (recognizer_data_t *)schannel->data) != NULL) && (r->completion_cause < 0))
+		r->completion_cause = RECOGNIZER_COMPLETION_CAUSE_NO_INPUT_TIMEOUT;
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	return speech_channel_stop(schannel);
+}
+
 /* Set the recognition results. */
 static int recog_channel_set_results(speech_channel_t *schannel, int completion_cause, const apt_str_t *result, const apt_str_t *waveform_uri)
 {
@@ -736,6 +901,10 @@ static int recog_channel_start(speech_channel_t *schannel, const char *name, int
 	r->result = NULL;
 	r->completion_cause = -1;
 	r->start_of_input = 0;
+	r->start_of_input_time = 0;
+	r->bargein_channel = NULL;
+	r->bargein_time = 0;
+	speech_channel_vad_reset(schannel);
 
 	r->timers_started = start_input_timers;
 
@@ -809,6 +978,7 @@ static int recog_channel_start(speech_channel_t *schannel, const char *name, int
 
 	/* Empty audio queue and send RECOGNIZE to MRCP server. */
 	audio_queue_clear(schannel->audio_queue);
+	speech_channel_timing_request(schannel);
 
 	if (mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message) == FALSE) {
 		apr_thread_mutex_unlock(schannel->mutex);
@@ -858,46 +1028,58 @@ static int recog_channel_load_grammar(speech_channel_t *schannel, const char *na
 		}
 	}
 
-	/* If inline, use DEFINE-GRAMMAR to cache it on the server. */
+	/* If inline, use DEFINE-GRAMMAR to cache it on the server, unless it already is. */
 	if (type != GRAMMAR_TYPE_URI) {
 		mrcp_message_t *mrcp_message;
 		mrcp_generic_header_t *generic_header;
+		char digest_buf[GRAMMAR_DIGEST_BUFFER_SIZE];
+		const char *content_id;
+		const char *digest;
+		int defined;
 
-		/* Create MRCP message. */
-		if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, RECOGNIZER_DEFINE_GRAMMAR)) == NULL) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
-		}
+		content_id = grammar_defined_get(schannel, name, mime_type, data, &defined, digest_buf, &digest);
 
-		/* Set Content-Type and Content-ID in message. */
-		if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
-		}
+		if (defined) {
+			ast_log(LOG_DEBUG, "(%s) Grammar %s already defined as %s\n", schannel->name, name, content_id);
+		} else {
+			/* Create MRCP message. */
+			if ((mrcp_message = mrcp_application_message_create(schannel->unimrcp_session, schannel->unimrcp_channel, RECOGNIZER_DEFINE_GRAMMAR)) == NULL) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
 
-		apt_string_assign(&generic_header->content_type, mime_type, mrcp_message->pool);
-		mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
-		apt_string_assign(&generic_header->content_id, name, mrcp_message->pool);
-		mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_ID);
+			/* Set Content-Type and Content-ID in message. */
+			if ((generic_header = (mrcp_generic_header_t *)mrcp_generic_header_prepare(mrcp_message)) == NULL) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
 
-		/* Put grammar in message body. */
-		apt_string_assign(&mrcp_message->body, data, mrcp_message->pool);
+			apt_string_assign(&generic_header->content_type, mime_type, mrcp_message->pool);
+			mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_TYPE);
+			apt_string_assign(&generic_header->content_id, content_id, mrcp_message->pool);
+			mrcp_generic_header_property_add(mrcp_message, GENERIC_HEADER_CONTENT_ID);
 
-		/* Send message and wait for response. */
-		speech_channel_set_state_unlocked(schannel, SPEECH_CHANNEL_PROCESSING);
+			/* Put grammar in message body. */
+			speech_channel_body_set(schannel, mrcp_message, data);
 
-		if (mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message) == FALSE) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
-		}
+			/* Send message and wait for response. */
+			speech_channel_set_state_unlocked(schannel, SPEECH_CHANNEL_PROCESSING);
 
-		if (speech_channel_wait_for_ready(schannel) == FALSE) {
-			apr_thread_mutex_unlock(schannel->mutex);
-			return -1;
+			if (mrcp_application_message_send(schannel->unimrcp_session, schannel->unimrcp_channel, mrcp_message) == FALSE) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
+
+			if (speech_channel_wait_for_ready(schannel) == FALSE) {
+				apr_thread_mutex_unlock(schannel->mutex);
+				return -1;
+			}
+
+			grammar_defined_set(schannel, content_id, digest);
 		}
 
 		/* Set up name, type for future RECOGNIZE requests.  We'll reference this cached grammar by name. */
-		apr_snprintf(ldata, sizeof(ldata) - 1, "session:%s", name);
+		apr_snprintf(ldata, sizeof(ldata) - 1, "session:%s", content_id);
 		ldata[sizeof(ldata) - 1] = '\0';
 
 		data = ldata;
@@ -994,7 +1176,7 @@ static apt_bool_t recog_on_message_receive(speech_channel_t *schannel, mrcp_mess
 			speech_channel_set_state(schannel, SPEECH_CHANNEL_READY);
 		} else if (message->start_line.method_id == RECOGNIZER_START_OF_INPUT) {
 			ast_log(LOG_DEBUG, "(%s) START OF INPUT\n", schannel->name);
-			recog_channel_set_start_of_input(schannel);
+			recog_channel_set_start_of_input(schannel, FALSE);
 		} else {
 			ast_log(LOG_DEBUG, "(%s) Unexpected event, method_id = %d\n", schannel->name, (int)message->start_line.method_id);
 			speech_channel_set_state(schannel, SPEECH_CHANNEL_ERROR);
@@ -1171,6 +1353,15 @@ static int synthandrecog_option_apply(sar_options_t *options, const char *key, c
 	} else if (strcasecmp(key, "rnl") == 0) {
 		options->flags |= SAR_REPLACE_NEW_LINES;
 		options->params[OPT_ARG_REPLACE_NEW_LINES] = value;
+	} else if (strcasecmp(key, "pfp") == 0) {
+		options->flags |= SAR_PREFETCH_PROMPTS;
+		options->params[OPT_ARG_PREFETCH_PROMPTS] = value;
+	} else if (strcasecmp(key, "sc") == 0) {
+		options->flags |= SAR_SENTENCE_CHUNKS;
+		options->params[OPT_ARG_SENTENCE_CHUNKS] = value;
+	} else if (strcasecmp(key, "mp") == 0) {
+		options->flags |= SAR_MERGE_PROMPTS;
+		options->params[OPT_ARG_MERGE_PROMPTS] = value;
 	} else {
 		ast_log(LOG_WARNING, "Unknown option: %s\n", key);
 	}
@@ -1220,6 +1411,434 @@ static APR_INLINE int synthandrecog_prompts_advance(app_session_t *app_session)
 	return app_session->prompts->nelts - app_session->cur_prompt;
 }
 
+/* Merge runs of adjacent plain text and SSML prompts, so that each run is synthesized 
+ * through a single SPEAK request. A mark ahead of every prompt of a run reports the 
+ * prompt reached. A run ends where the root element of an SSML prompt does not match.
+ */
+static void synthandrecog_prompts_merge(app_session_t *app_session, sar_options_t *sar_options)
+{
+	apr_array_header_t *prompts = app_session->prompts;
+	apr_array_header_t *merged = apr_array_make(app_session->pool, prompts->nelts, sizeof(sar_prompt_item_t));
+	const char **contents = apr_palloc(app_session->pool, prompts->nelts * sizeof(const char *));
+	const char **marks = apr_palloc(app_session->pool, prompts->nelts * sizeof(const char *));
+	const char *language = NULL;
+	sar_prompt_item_t *prompt_item;
+	sar_prompt_item_t *merged_item;
+	const char *content;
+	int count;
+	int i = 0;
+	int j;
+
+	if (sar_options->synth_hfs)
+		language = apr_hash_get(sar_options->synth_hfs, "Speech-Language", APR_HASH_KEY_STRING);
+
+	while (i < prompts->nelts) {
+		for (j = i; j < prompts->nelts; j++) {
+			prompt_item = &APR_ARRAY_IDX(prompts, j, sar_prompt_item_t);
+			if (prompt_item->is_audio_file || !determine_synth_inline(prompt_item->content))
+				break;
+			contents[j - i] = prompt_item->content;
+			marks[j - i] = apr_psprintf(app_session->pool, "prompt-%d", prompt_item->index);
+		}
+
+		merged_item = apr_array_push(merged);
+		*merged_item = APR_ARRAY_IDX(prompts, i, sar_prompt_item_t);
+		count = j - i;
+		if ((count > 1) && ((content = merge_synth_prompts(app_session->pool, contents, marks, &count, language)) != NULL)) {
+			ast_log(LOG_DEBUG, "Merged prompts %d to %d\n", merged_item->index, merged_item->index + count - 1);
+			merged_item->content = content;
+			merged_item->count = count;
+			i += count;
+		} else
+			i++;
+	}
+
+	app_session->prompts = merged;
+}
+
+/* Set the number of the prompt barged in on, as reported by the last mark reached within merged prompts. */
+static void synthandrecog_bargein_prompt_set(struct ast_channel *chan, app_session_t *app_session, sar_prompt_item_t *prompt_item)
+{
+	char mark[SPEECH_CHANNEL_MARK_SIZE];
+	char buf[16];
+	int index = prompt_item->index;
+	int reached;
+
+	if ((prompt_item->count > 1) && app_session->synth_channel && 
+		(speech_channel_mark_get(app_session->synth_channel, mark, sizeof(mark)) == 0) && 
+		(sscanf(mark, "prompt-%d", &reached) == 1) && 
+		(reached >= prompt_item->index) && (reached < prompt_item->index + prompt_item->count)) {
+		index = reached;
+	}
+
+	apr_snprintf(buf, sizeof(buf), "%d", index);
+	pbx_builtin_setvar_helper(chan, "RECOG_BARGEIN_PROMPT", buf);
+}
+
+/* Create the speech channel prompts are played out through, unless created already. */
+static int synthandrecog_synth_channel_create(app_datastore_t* datastore, app_session_t *app_session)
+{
+	if (app_session->synth_channel)
+		return 0;
+
+	const char *synth_name = apr_psprintf(app_session->pool, "TTS-%lu", (unsigned long int)app_session->schannel_number);
+
+	/* Create speech channel for synthesis. */
+	app_session->synth_channel = speech_channel_create(
+									app_session->pool,
+									synth_name,
+									SPEECH_CHANNEL_SYNTHESIZER,
+									synthandrecog,
+									app_session->nwriteformat,
+									NULL,
+									datastore->chan);
+	if (!app_session->synth_channel) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Get synthesis profile, unless the channel has been opened already. */
+static ast_mrcp_profile_t* synthandrecog_synth_profile_get(app_session_t *app_session, sar_options_t *sar_options)
+{
+	ast_mrcp_profile_t *synth_profile = app_session->synth_channel->profile;
+	const char *synth_profile_option = NULL;
+
+	if (!synth_profile) {
+		if ((sar_options->flags & SAR_SYNTH_PROFILE) == SAR_SYNTH_PROFILE) {
+			if (!ast_strlen_zero(sar_options->params[OPT_ARG_SYNTH_PROFILE])) {
+				synth_profile_option = sar_options->params[OPT_ARG_SYNTH_PROFILE];
+			}
+		}
+
+		synth_profile = get_synth_profile(synth_profile_option);
+		if (!synth_profile) {
+			ast_log(LOG_ERROR, "(%s) Can't find profile, %s\n", app_session->synth_channel->name, synth_profile_option);
+			return NULL;
+		}
+	}
+	return synth_profile;
+}
+
+/* --- PROMPT PREFETCH --- */
+
+/* Default number of upcoming prompts synthesized while the current one is played. */
+#define SAR_PREFETCH_DEFAULT_DEPTH 0
+/* Maximum size of a prefetched prompt in bytes. */
+#define SAR_PREFETCH_MAX_SIZE      (8 * 1024 * 1024)
+/* Time allowed to synthesize a prefetched prompt. */
+#define SAR_PREFETCH_TIMEOUT       apr_time_from_sec(120)
+
+/* Synthesis of the upcoming prompts while the current one is played. */
+struct sar_prefetch_t {
+	/* Memory pool of the prefetch. */
+	apr_pool_t *pool;
+	/* Worker thread synthesizing the prompts. */
+	apr_thread_t *thread;
+	/* Synchronizes the prefetch. */
+	apr_thread_mutex_t *mutex;
+	/* Signaled as the current prompt advances or the prefetch is cancelled. */
+	apr_thread_cond_t *cond;
+	/* Profile the prompts are synthesized with. */
+	ast_mrcp_profile_t *profile;
+	/* Codec of the playout. */
+	const char *codec;
+	/* Rate of the playout. */
+	apr_uint16_t rate;
+	/* Synthesizer header fields, copied as the call may end before the worker thread. */
+	apr_hash_t *synth_hfs;
+	/* Number of prompts of the session. */
+	int count;
+	/* Content of the prompts by index, copied likewise, NULL for audio files. */
+	const char **contents;
+	/* Prefetched prompts by index, NULL unless synthesized and not played yet. */
+	tts_cache_entry_t **entries;
+	/* Number of prompts synthesized ahead of the current one. */
+	int depth;
+	/* Index of the current prompt. */
+	int current;
+	/* Index of the next prompt to synthesize. */
+	int next;
+	/* Channel not attached to the call the prompts are synthesized through. */
+	speech_channel_t *schannel;
+	/* True once the prefetch is cancelled. */
+	int cancelled;
+	/* True once the worker thread no longer uses the prefetch. */
+	volatile apr_uint32_t finished;
+	/* Next cancelled prefetch waiting for its worker thread to be joined. */
+	struct sar_prefetch_t *retired_next;
+};
+
+typedef struct sar_prefetch_t sar_prefetch_t;
+
+/* Cancelled prefetches waiting for their worker threads to be joined, guarded by globals.mutex. */
+static sar_prefetch_t *retired_prefetches = NULL;
+
+/* Synthesize a prompt through the channel of the prefetch, which is opened on 
+ * demand. Return the synthesized prompt, NULL if it failed or is cached already.
+ */
+static tts_cache_entry_t* synthandrecog_prefetch_prompt(sar_prefetch_t *prefetch, const char *prompt)
+{
+	speech_channel_t *schannel = prefetch->schannel;
+	tts_cache_entry_t *cached;
+	const char *key = NULL;
+	const char *content = NULL;
+	const char *content_type = NULL;
+	int status;
+
+	/* Open a channel of the faster than realtime media engine, if any, again if the previous one failed. */
+	if (schannel && speech_channel_get_state(schannel) != SPEECH_CHANNEL_READY) {
+		apr_thread_mutex_lock(prefetch->mutex);
+		prefetch->schannel = NULL;
+		apr_thread_mutex_unlock(prefetch->mutex);
+		speech_channel_destroy(schannel);
+		schannel = NULL;
+	}
+	if (!schannel) {
+		schannel = speech_channel_batch(prefetch->profile, synthandrecog, SPEECH_CHANNEL_SYNTHESIZER, prefetch->codec, prefetch->rate);
+		if (!schannel)
+			return NULL;
+
+		apr_thread_mutex_lock(prefetch->mutex);
+		prefetch->schannel = schannel;
+		apr_thread_mutex_unlock(prefetch->mutex);
+	}
+
+	/* A cached prompt is played from the TTS cache. */
+	if ((cached = speech_channel_cache_lookup(schannel, prefetch->profile, prompt, prefetch->synth_hfs, &key)) != NULL) {
+		tts_cache_entry_release(cached);
+		return NULL;
+	}
+
+	if (determine_synth_content_type(schannel, prompt, &content, &content_type) != 0) {
+		ast_log(LOG_WARNING, "(%s) Unable to determine synthesis content type\n", schannel->name);
+		return NULL;
+	}
+
+	if (speech_channel_prefetch_capture(schannel, key, SAR_PREFETCH_MAX_SIZE) != 0)
+		return NULL;
+
+	/* The request is sent with the mutex held, so that a cancellation stops it. */
+	apr_thread_mutex_lock(prefetch->mutex);
+	status = prefetch->cancelled ? -1 : synth_channel_speak(schannel, content, content_type, prefetch->synth_hfs, 1);
+	apr_thread_mutex_unlock(prefetch->mutex);
+
+	if (status != 0) {
+		tts_cache_entry_release(speech_channel_prefetch_drain(schannel, 0));
+		return NULL;
+	}
+
+	return speech_channel_prefetch_drain(schannel, SAR_PREFETCH_TIMEOUT);
+}
+
+/* Worker thread synthesizing the upcoming prompts, up to depth prompts ahead of the current one. */
+static void * APR_THREAD_FUNC synthandrecog_prefetch_run(apr_thread_t *thread, void *data)
+{
+	sar_prefetch_t *prefetch = (sar_prefetch_t *)data;
+	tts_cache_entry_t *entry;
+	speech_channel_t *schannel;
+	int index;
+
+	apr_thread_mutex_lock(prefetch->mutex);
+	for (;;) {
+		while (!prefetch->cancelled && (prefetch->next < prefetch->count) && (prefetch->next > prefetch->current + prefetch->depth))
+			apr_thread_cond_wait(prefetch->cond, prefetch->mutex);
+
+		if (prefetch->cancelled || (prefetch->next >= prefetch->count))
+			break;
+
+		/* Audio files are played as they are, prompts already due are synthesized as usual. */
+		index = prefetch->next++;
+		if (!prefetch->contents[index] || (index <= prefetch->current))
+			continue;
+
+		apr_thread_mutex_unlock(prefetch->mutex);
+		entry = synthandrecog_prefetch_prompt(prefetch, prefetch->contents[index]);
+		apr_thread_mutex_lock(prefetch->mutex);
+
+		if (entry && !prefetch->cancelled && (index > prefetch->current)) {
+			ast_log(LOG_DEBUG, "Prefetched prompt %d of %d\n", index + 1, prefetch->count);
+			prefetch->entries[index] = entry;
+		}
+		else
+			tts_cache_entry_release(entry);
+	}
+	schannel = prefetch->schannel;
+	prefetch->schannel = NULL;
+	apr_thread_mutex_unlock(prefetch->mutex);
+
+	if (schannel)
+		speech_channel_destroy(schannel);
+
+	apr_atomic_set32(&prefetch->finished, TRUE);
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Start synthesizing the upcoming prompts, if there are any to be synthesized. */
+static int synthandrecog_prefetch_start(app_datastore_t* datastore, app_session_t *app_session, sar_options_t *sar_options)
+{
+	sar_prefetch_t *prefetch;
+	sar_prompt_item_t *prompt_item;
+	apr_hash_index_t *hi;
+	apr_pool_t *pool;
+	int depth = SAR_PREFETCH_DEFAULT_DEPTH;
+	int i;
+
+	if ((sar_options->flags & SAR_PREFETCH_PROMPTS) == SAR_PREFETCH_PROMPTS) {
+		if (!ast_strlen_zero(sar_options->params[OPT_ARG_PREFETCH_PROMPTS])) {
+			depth = atoi(sar_options->params[OPT_ARG_PREFETCH_PROMPTS]);
+		}
+	}
+	if (depth <= 0)
+		return 0;
+
+	for (i = app_session->cur_prompt + 1; i < app_session->prompts->nelts; i++) {
+		if (!APR_ARRAY_IDX(app_session->prompts, i, sar_prompt_item_t).is_audio_file)
+			break;
+	}
+	if (i >= app_session->prompts->nelts)
+		return 0;
+
+	/* The prompts are synthesized to the codec and rate of the playout. */
+	if (synthandrecog_synth_channel_create(datastore, app_session) != 0)
+		return -1;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return -1;
+
+	prefetch = apr_pcalloc(pool, sizeof(sar_prefetch_t));
+	prefetch->pool = pool;
+	prefetch->codec = apr_pstrdup(pool, app_session->synth_channel->codec);
+	prefetch->rate = app_session->synth_channel->rate;
+	if (sar_options->synth_hfs) {
+		prefetch->synth_hfs = apr_hash_make(pool);
+		for (hi = apr_hash_first(NULL, sar_options->synth_hfs); hi; hi = apr_hash_next(hi)) {
+			const void *key;
+			void *val;
+
+			apr_hash_this(hi, &key, NULL, &val);
+			apr_hash_set(prefetch->synth_hfs, apr_pstrdup(pool, key), APR_HASH_KEY_STRING, apr_pstrdup(pool, val));
+		}
+	}
+	prefetch->count = app_session->prompts->nelts;
+	prefetch->contents = apr_pcalloc(pool, prefetch->count * sizeof(const char *));
+	prefetch->entries = apr_pcalloc(pool, prefetch->count * sizeof(tts_cache_entry_t *));
+	prefetch->depth = depth;
+	prefetch->current = app_session->cur_prompt;
+	prefetch->next = app_session->cur_prompt + 1;
+	for (i = prefetch->next; i < prefetch->count; i++) {
+		prompt_item = &APR_ARRAY_IDX(app_session->prompts, i, sar_prompt_item_t);
+		if (!prompt_item->is_audio_file)
+			prefetch->contents[i] = apr_pstrdup(pool, prompt_item->content);
+	}
+
+	if ((prefetch->profile = synthandrecog_synth_profile_get(app_session, sar_options)) == NULL) {
+		apr_pool_destroy(pool);
+		return -1;
+	}
+
+	if ((apr_thread_mutex_create(&prefetch->mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS) ||
+		(apr_thread_cond_create(&prefetch->cond, pool) != APR_SUCCESS) ||
+		(apr_thread_create(&prefetch->thread, NULL, synthandrecog_prefetch_run, prefetch, pool) != APR_SUCCESS)) {
+		ast_log(LOG_WARNING, "(%s) Unable to start prompt prefetch\n", app_session->synth_channel->name);
+		apr_pool_destroy(pool);
+		return -1;
+	}
+
+	ast_log(LOG_DEBUG, "(%s) Prefetching up to %d prompts with %s\n", app_session->synth_channel->name, depth, prefetch->profile->name);
+	app_session->prefetch = prefetch;
+	return 0;
+}
+
+/* Advance the prefetch to the current prompt and take the prompt, if it has been prefetched. */
+static tts_cache_entry_t* synthandrecog_prefetch_take(app_session_t *app_session)
+{
+	sar_prefetch_t *prefetch = app_session->prefetch;
+	tts_cache_entry_t *entry;
+
+	if (!prefetch)
+		return NULL;
+
+	apr_thread_mutex_lock(prefetch->mutex);
+	prefetch->current = app_session->cur_prompt;
+	entry = prefetch->entries[prefetch->current];
+	prefetch->entries[prefetch->current] = NULL;
+	apr_thread_cond_signal(prefetch->cond);
+	apr_thread_mutex_unlock(prefetch->mutex);
+
+	return entry;
+}
+
+/* Join the worker threads of the cancelled prefetches which have finished, or 
+ * of all of them if wait is set, and destroy the prefetches.
+ */
+static void synthandrecog_prefetch_reap(int wait)
+{
+	sar_prefetch_t *reaped = NULL;
+	sar_prefetch_t **link;
+	sar_prefetch_t *prefetch;
+	apr_status_t retval;
+
+	apr_thread_mutex_lock(globals.mutex);
+	link = &retired_prefetches;
+	while ((prefetch = *link) != NULL) {
+		if (wait || apr_atomic_read32(&prefetch->finished)) {
+			*link = prefetch->retired_next;
+			prefetch->retired_next = reaped;
+			reaped = prefetch;
+		}
+		else
+			link = &prefetch->retired_next;
+	}
+	apr_thread_mutex_unlock(globals.mutex);
+
+	while ((prefetch = reaped) != NULL) {
+		reaped = prefetch->retired_next;
+		apr_thread_join(&retval, prefetch->thread);
+		apr_pool_destroy(prefetch->pool);
+	}
+}
+
+/* Cancel the prefetch and release the prompts not played. The prompt being 
+ * synthesized is stopped by the worker thread, which is joined later on, so 
+ * that neither barge-in nor the end of the call waits for it.
+ */
+static void synthandrecog_prefetch_stop(app_session_t *app_session)
+{
+	sar_prefetch_t *prefetch = app_session->prefetch;
+	int i;
+
+	if (!prefetch)
+		return;
+
+	apr_thread_mutex_lock(prefetch->mutex);
+	prefetch->cancelled = TRUE;
+	if (prefetch->schannel)
+		speech_channel_prefetch_cancel(prefetch->schannel);
+	for (i = 0; i < prefetch->count; i++) {
+		tts_cache_entry_release(prefetch->entries[i]);
+		prefetch->entries[i] = NULL;
+	}
+	apr_thread_cond_signal(prefetch->cond);
+	apr_thread_mutex_unlock(prefetch->mutex);
+
+	app_session->prefetch = NULL;
+
+	apr_thread_mutex_lock(globals.mutex);
+	prefetch->retired_next = retired_prefetches;
+	retired_prefetches = prefetch;
+	apr_thread_mutex_unlock(globals.mutex);
+
+	synthandrecog_prefetch_reap(FALSE);
+}
+
+/* Wait for the worker threads of the cancelled prefetches, as they run on the sessions torn down at unload. */
+void synthandrecog_prefetch_stop_all(void)
+{
+	synthandrecog_prefetch_reap(TRUE);
+}
+
 /* Start playing the current prompt. */
 static sar_prompt_item_t* synthandrecog_prompt_play(app_datastore_t* datastore, app_session_t *app_session, sar_options_t *sar_options)
 {
@@ -1230,6 +1849,9 @@ static sar_prompt_item_t* synthandrecog_prompt_play(app_datastore_t* datastore,
 
 	sar_prompt_item_t *prompt_item = &APR_ARRAY_IDX(app_session->prompts, app_session->cur_prompt, sar_prompt_item_t);
 
+	/* Take the prompt synthesized while the previous one was played, if any. */
+	tts_cache_entry_t *prefetched = synthandrecog_prefetch_take(app_session);
+
 	if(prompt_item->is_audio_file) {
 		app_session->filestream = astchan_stream_file(datastore->chan, prompt_item->content, &app_session->max_filelength);
 		if (!app_session->filestream) {
@@ -1242,42 +1864,42 @@ static sar_prompt_item_t* synthandrecog_prompt_play(app_datastore_t* datastore,
 		}
 	}
 	else {
-		if (!app_session->synth_channel) {
-			const char *synth_name = apr_psprintf(app_session->pool, "TTS-%lu", (unsigned long int)app_session->schannel_number);
+		if (synthandrecog_synth_channel_create(datastore, app_session) != 0) {
+			tts_cache_entry_release(prefetched);
+			return NULL;
+		}
 
-			/* Create speech channel for synthesis. */
-			app_session->synth_channel = speech_channel_create(
-											app_session->pool,
-											synth_name,
-											SPEECH_CHANNEL_SYNTHESIZER,
-											synthandrecog,
-											app_session->nwriteformat,
-											NULL,
-											datastore->chan);
-			if (!app_session->synth_channel) {
+		/* Play a prefetched prompt right after the previous one, without an MRCP request. */
+		if (prefetched) {
+			ast_log(LOG_DEBUG, "(%s) Playing prefetched prompt\n", app_session->synth_channel->name);
+			if (speech_channel_playout_cached(app_session->synth_channel, prefetched) != 0) {
+				ast_log(LOG_ERROR, "(%s) Unable to play prefetched prompt\n", app_session->synth_channel->name);
 				return NULL;
 			}
+			return prompt_item;
+		}
 
-			ast_mrcp_profile_t *synth_profile = NULL;
-			const char *synth_profile_option = NULL;
-			if ((sar_options->flags & SAR_SYNTH_PROFILE) == SAR_SYNTH_PROFILE) {
-				if (!ast_strlen_zero(sar_options->params[OPT_ARG_SYNTH_PROFILE])) {
-					synth_profile_option = sar_options->params[OPT_ARG_SYNTH_PROFILE];
-				}
-			}
+		ast_mrcp_profile_t *synth_profile = synthandrecog_synth_profile_get(app_session, sar_options);
+		if (!synth_profile) {
+			return NULL;
+		}
 
-			/* Get synthesis profile. */
-			synth_profile = get_synth_profile(synth_profile_option);
-			if (!synth_profile) {
-				ast_log(LOG_ERROR, "(%s) Can't find profile, %s\n", app_session->synth_channel->name, synth_profile_option);
+		/* Play a prompt found in the TTS cache without an MRCP session. */
+		const char *cache_key = NULL;
+		tts_cache_entry_t *cached = speech_channel_cache_lookup(app_session->synth_channel, synth_profile, prompt_item->content, sar_options->synth_hfs, &cache_key);
+		if (cached) {
+			ast_log(LOG_DEBUG, "(%s) Playing cached prompt\n", app_session->synth_channel->name);
+			if (speech_channel_playout_cached(app_session->synth_channel, cached) != 0) {
+				ast_log(LOG_ERROR, "(%s) Unable to play cached prompt\n", app_session->synth_channel->name);
 				return NULL;
 			}
+			return prompt_item;
+		}
 
-			/* Open synthesis channel. */
-			if (speech_channel_open(app_session->synth_channel, synth_profile) != 0) {
-				ast_log(LOG_ERROR, "(%s) Unable to open speech channel\n", app_session->synth_channel->name);
-				return NULL;
-			}
+		/* Open synthesis channel, or wait for the rest of the open, if the channel has been prefetched. */
+		if (speech_channel_open_ready(app_session->synth_channel, synth_profile) != 0) {
+			ast_log(LOG_ERROR, "(%s) Unable to open speech channel\n", app_session->synth_channel->name);
+			return NULL;
 		}
 
 		const char *content = NULL;
@@ -1288,8 +1910,24 @@ static sar_prompt_item_t* synthandrecog_prompt_play(app_datastore_t* datastore,
 			return NULL;
 		}
 
+		/* Split the prompt into sentences synthesized back to back, if requested. */
+		apr_size_t chunk_len = 0;
+		if ((sar_options->flags & SAR_SENTENCE_CHUNKS) == SAR_SENTENCE_CHUNKS) {
+			if (!ast_strlen_zero(sar_options->params[OPT_ARG_SENTENCE_CHUNKS])) {
+				chunk_len = (apr_size_t)atol(sar_options->params[OPT_ARG_SENTENCE_CHUNKS]);
+			}
+		}
+
+		apr_array_header_t *chunks = NULL;
+		if (determine_synth_chunks(app_session->synth_channel, content, content_type, chunk_len, &chunks) != 0) {
+			return NULL;
+		}
+
+		/* Capture the synthesized speech for the TTS cache. */
+		speech_channel_cache_capture(app_session->synth_channel, cache_key);
+
 		/* Start synthesis. */
-		if (synth_channel_speak(app_session->synth_channel, content, content_type, sar_options->synth_hfs) != 0) {
+		if (synth_channel_speak_chunks(app_session->synth_channel, chunks, content_type, sar_options->synth_hfs) != 0) {
 			ast_log(LOG_ERROR, "(%s) Unable to send SPEAK request\n", app_session->synth_channel->name);
 			return NULL;
 		}
@@ -1302,16 +1940,33 @@ static sar_prompt_item_t* synthandrecog_prompt_play(app_datastore_t* datastore,
 static int synthandrecog_exit(struct ast_channel *chan, app_session_t *app_session, speech_channel_status_t status)
 {
 	if (app_session) {
+		/* Stop synthesizing the prompts which are not going to be played. */
+		synthandrecog_prefetch_stop(app_session);
+
+		/* The synthesizer channel may be gone once the application exits. */
+		if (app_session->recog_channel)
+			recog_channel_set_bargein_channel(app_session->recog_channel, NULL);
+
+		/* Stop the playout before the write format is restored. */
+		if (app_session->synth_channel)
+			speech_channel_playout_stop(app_session->synth_channel);
+
 		if (app_session->writeformat && app_session->rawwriteformat)
 			ast_set_write_format_path(chan, app_session->writeformat, app_session->rawwriteformat);
 
 		if (app_session->readformat && app_session->rawreadformat)
 			ast_set_read_format_path(chan, app_session->rawreadformat, app_session->readformat);
 
-		if (app_session->recog_channel)
+		if (app_session->recog_channel) {
 			if (app_session->recog_channel->session_id)
 				pbx_builtin_setvar_helper(chan, "RECOG_SID", app_session->recog_channel->session_id);
 
+			speech_channel_timing_export(app_session->recog_channel, chan);
+		}
+
+		if (app_session->synth_channel)
+			speech_channel_timing_export(app_session->synth_channel, chan);
+
 		if (app_session->lifetime == APP_SESSION_LIFETIME_DYNAMIC) {
 			if (app_session->synth_channel) {
 				if (app_session->stop_barged_synth == TRUE) {
@@ -1480,6 +2135,11 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 	}
 	else {
 		recog_name = app_session->recog_channel->name;
+
+		/* Wait for the rest of the open, if the channel has been prefetched. */
+		if (speech_channel_open_wait(app_session->recog_channel) != 0) {
+			return synthandrecog_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
+		}
 	}
 
 	/* Get old read format. */
@@ -1600,6 +2260,8 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 
 		prompt_item->content = NULL;
 		prompt_item->is_audio_file = 0;
+		prompt_item->index = app_session->prompts->nelts;
+		prompt_item->count = 1;
 
 		if (determine_prompt_type(prompt_str, &prompt_item->content, &prompt_item->is_audio_file) !=0 ) {
 			ast_log(LOG_WARNING, "(%s) Unable to determine prompt type\n", recog_name);
@@ -1608,11 +2270,27 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 
 		prompt_str = apr_strtok(NULL, output_delimiters, &last);
 	}
+	pbx_builtin_setvar_helper(chan, "RECOG_BARGEIN_PROMPT", NULL);
+	pbx_builtin_setvar_helper(chan, "RECOG_BARGEIN_MS", NULL);
+
+	/* Merge adjacent synthesized prompts. */
+	if ((sar_options.flags & SAR_MERGE_PROMPTS) == SAR_MERGE_PROMPTS) {
+		if (!ast_strlen_zero(sar_options.params[OPT_ARG_MERGE_PROMPTS]) && atoi(sar_options.params[OPT_ARG_MERGE_PROMPTS]) != 0)
+			synthandrecog_prompts_merge(app_session, &sar_options);
+	}
+
+	/* Start capturing caller audio, the pre-roll is replayed once recognition is in progress. */
+	speech_channel_preroll_clear(app_session->recog_channel);
 
 	int prompt_processing = (synthandrecog_prompts_available(app_session)) ? 1 : 0;
 	sar_prompt_item_t *prompt_item = NULL;
 	int end_of_prompt;
 
+	/* Synthesize the upcoming prompts while the current one is played. */
+	if (prompt_processing && synthandrecog_prefetch_start(datastore, app_session, &sar_options) != 0) {
+		ast_log(LOG_WARNING, "(%s) Unable to prefetch prompts\n", recog_name);
+	}
+
 	/* If bargein is not allowed, play all the prompts and wait for for them to complete. */
 	if (!bargein && prompt_processing) {
 		/* Start playing first prompt. */
@@ -1652,9 +2330,14 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 					return synthandrecog_exit(chan, app_session, SPEECH_CHANNEL_STATUS_INTERRUPTED);
 				}
 
+				/* Keep the most recent audio in the pre-roll, if enabled. */
+				if (f->frametype == AST_FRAME_VOICE && f->datalen) {
+					len = f->datalen;
+					speech_channel_write(app_session->recog_channel, ast_frame_get_data(f), &len);
+				}
 				ast_frfree(f);
 
-				if (app_session->synth_channel->state != SPEECH_CHANNEL_PROCESSING) {
+				if ((app_session->synth_channel->state != SPEECH_CHANNEL_PROCESSING) && !speech_channel_playout_pending(app_session->synth_channel)) {
 					end_of_prompt = 1;
 				}
 			}
@@ -1714,6 +2397,7 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 		if (!prompt_item) {
 			return synthandrecog_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
 		}
+		recog_channel_set_bargein_channel(app_session->recog_channel, prompt_item->is_audio_file ? NULL : app_session->synth_channel);
 	}
 
 #if !AST_VERSION_AT_LEAST(11,0,0)
@@ -1763,12 +2447,13 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 				}
 			}
 			else {
-				if (app_session->synth_channel->state != SPEECH_CHANNEL_PROCESSING) {
+				if ((app_session->synth_channel->state != SPEECH_CHANNEL_PROCESSING) && !speech_channel_playout_pending(app_session->synth_channel)) {
 					end_of_prompt = 1;
 				}
 			}
 
-			if (end_of_prompt) {
+			/* The next prompt is not started once voice has started. */
+			if (end_of_prompt && !(r && r->start_of_input)) {
 				/* End of current prompt -> advance to the next one. */
 				if (synthandrecog_prompts_advance(app_session) > 0) {
 					/* Start playing current prompt. */
@@ -1776,19 +2461,29 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 					if (!prompt_item) {
 						return synthandrecog_exit(chan, app_session, SPEECH_CHANNEL_STATUS_ERROR);
 					}
+					recog_channel_set_bargein_channel(app_session->recog_channel, prompt_item->is_audio_file ? NULL : app_session->synth_channel);
 				}
 				else {
 					/* End of prompts -> start input timers. */
 					if (app_session->it_policy == IT_POLICY_AUTO) {
 						ast_log(LOG_DEBUG, "(%s) Start input timers\n", recog_name);
 						recog_channel_start_input_timers(app_session->recog_channel);
+						speech_channel_vad_reset(app_session->recog_channel);
 					}
+					recog_channel_set_bargein_channel(app_session->recog_channel, NULL);
 					prompt_processing = 0;
 				}
 			}
 
 			if (prompt_processing && r && r->start_of_input) {
-				ast_log(LOG_DEBUG, "(%s) Bargein occurred\n", recog_name);
+				int bargein_local;
+				apr_interval_time_t bargein_latency = recog_channel_bargein_latency(app_session->recog_channel, &bargein_local);
+				char bargein_ms[32];
+
+				ast_log(LOG_DEBUG, "(%s) Bargein occurred, prompt silenced after %" APR_TIME_T_FMT " ms\n", recog_name, apr_time_as_msec(bargein_latency));
+				apr_snprintf(bargein_ms, sizeof(bargein_ms), "%" APR_TIME_T_FMT, apr_time_as_msec(bargein_latency));
+				pbx_builtin_setvar_helper(chan, "RECOG_BARGEIN_MS", bargein_ms);
+				recog_channel_set_bargein_channel(app_session->recog_channel, NULL);
 				if (prompt_item->is_audio_file) {
 					ast_stopstream(chan);
 					app_session->filestream = NULL;
@@ -1796,7 +2491,16 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 				else {
 					synth_channel_bargein_occurred(app_session->synth_channel);
 				}
+				synthandrecog_bargein_prompt_set(chan, app_session, prompt_item);
+				synthandrecog_prefetch_stop(app_session);
 				prompt_processing = 0;
+
+				/* The local onset may be false, the recognizer is to time out on no input then. */
+				if (bargein_local && (app_session->it_policy == IT_POLICY_AUTO)) {
+					ast_log(LOG_DEBUG, "(%s) Start input timers\n", recog_name);
+					recog_channel_start_input_timers(app_session->recog_channel);
+					speech_channel_vad_reset(app_session->recog_channel);
+				}
 			}
 		}
 
@@ -1816,6 +2520,23 @@ static int app_synthandrecog_exec(struct ast_channel *chan, ast_app_data data)
 				ast_frfree(f);
 				break;
 			}
+
+			switch (speech_channel_vad_poll(app_session->recog_channel)) {
+				case ENERGY_VAD_START_OF_SPEECH:
+					/* Barge in ahead of the START-OF-INPUT event. */
+					if (prompt_processing && globals.vad_bargein)
+						recog_channel_set_start_of_input(app_session->recog_channel, TRUE);
+					break;
+				case ENERGY_VAD_NO_INPUT:
+					/* Release the recognizer ahead of its own no-input timeout. */
+					if (r && r->timers_started) {
+						ast_log(LOG_DEBUG, "(%s) No input detected locally\n", recog_name);
+						recog_channel_set_no_input(app_session->recog_channel);
+					}
+					break;
+				default:
+					break;
+			}
 		} else if (f->frametype == AST_FRAME_VIDEO) {
 			/* Ignore. */
 		} else if (f->frametype == AST_FRAME_DTMF) {
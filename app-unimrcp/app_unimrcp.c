@@ -76,6 +76,13 @@ ASTERISK_REGISTER_FILE()
 /* UniMRCP includes. */
 #include "ast_unimrcp_framework.h"
 #include "app_datastore.h"
+#include "app_cli.h"
+#include "speech_channel.h"
+#include "stream_dump.h"
+#include "tts_cache.h"
+#include "tts_store.h"
+#include "energy_vad.h"
+#include "content_cache.h"
 
 /* The configuration file to read. */
 #define MRCP_CONFIG "mrcp.conf"
@@ -85,14 +92,22 @@ static int apr_initialized = 0;
 /* MRCPSynth application. */ 
 int load_mrcpsynth_app();
 int unload_mrcpsynth_app();
+void mrcpsynth_warm_stop(void);
+void mrcpsynth_file_stop(void);
 
 /* MRCPRecog application. */ 
 int load_mrcprecog_app();
 int unload_mrcprecog_app();
+void mrcprecog_files_stop(void);
 
 /* SynthAndRecog application. */ 
 int load_synthandrecog_app();
 int unload_synthandrecog_app();
+void synthandrecog_prefetch_stop_all(void);
+
+/* MRCPPrefetch application. */ 
+int load_mrcpprefetch_app();
+int unload_mrcpprefetch_app();
 
 /* Connects UniMRCP logging to Asterisk. */
 static apt_bool_t unimrcp_log(const char *file, int line, const char *id, apt_log_priority_e priority, const char *format, va_list arg_ptr)
@@ -192,6 +207,7 @@ AST_COMPAT_STATIC int load_module(void)
 	load_mrcpsynth_app();
 	load_mrcprecog_app();
 	load_synthandrecog_app();
+	load_mrcpprefetch_app();
 
 	/* Start the client stack. */
 	if (!mrcp_client_start(globals.mrcp_client)) {
@@ -209,6 +225,33 @@ AST_COMPAT_STATIC int load_module(void)
 		return AST_MODULE_LOAD_DECLINE;
 	}
 
+	/* Start tearing down speech channels in the background, they are torn down synchronously otherwise. */
+	if (speech_channel_reaper_start() != 0)
+		ast_log(LOG_WARNING, "Unable to start speech channel reaper\n");
+
+	/* Start writing the stream dumps enabled from the CLI. */
+	if (stream_dump_writer_start(globals.pool) != 0)
+		ast_log(LOG_WARNING, "Unable to start stream dump writer\n");
+
+	/* Load the stored prompts, before the cache which looks them up. */
+	if (tts_store_start(globals.pool, globals.tts_store_dir, globals.tts_store_size) != 0)
+		ast_log(LOG_WARNING, "Unable to start TTS store\n");
+
+	/* Decode G.711 for the voice activity detector. */
+	energy_vad_tables_init();
+
+	/* Set up the cache of synthesized prompts, prompts are always synthesized otherwise. */
+	if (tts_cache_init(globals.pool, globals.tts_cache_size) != 0)
+		ast_log(LOG_WARNING, "Unable to set up TTS cache\n");
+
+	/* Set up the cache of grammar and SSML files, files are always read otherwise. */
+	if (content_cache_init(globals.pool, globals.content_cache_size) != 0)
+		ast_log(LOG_WARNING, "Unable to set up content cache\n");
+
+	/* Start maintaining the session pools, the module works without them. */
+	if (session_pool_start() != 0)
+		ast_log(LOG_WARNING, "Unable to start session pool processing\n");
+
 	/* Register the applications. */
 	for (hi = apr_hash_first(NULL, globals.apps); hi; hi = apr_hash_next(hi)) {
 		const void *key;
@@ -231,6 +274,9 @@ AST_COMPAT_STATIC int load_module(void)
 	/* Register the custom functions. */
 	res |= app_datastore_functions_register(ast_module_info->self);
 
+	/* Register the CLI commands. */
+	res |= app_cli_register();
+
 	return res;
 }
 
@@ -254,10 +300,28 @@ AST_COMPAT_STATIC int unload_module(void)
 	/* Unregister the custom functions. */
 	res |= app_datastore_functions_unregister();
 
+	/* Unregister the CLI commands. */
+	res |= app_cli_unregister();
+
+	/* Cancel the background jobs and wait for them, as they run on the sessions and caches torn down next. */
+	mrcpsynth_warm_stop();
+	mrcpsynth_file_stop();
+	mrcprecog_files_stop();
+	synthandrecog_prefetch_stop_all();
+
+	/* Terminate the idle sessions and complete the pending teardowns. */
+	session_pool_stop();
+	speech_channel_reaper_stop();
+	stream_dump_writer_stop();
+	tts_cache_destroy();
+	tts_store_stop();
+	content_cache_destroy();
+
 	/* Unload the applications. */
 	unload_mrcpsynth_app();
 	unload_mrcprecog_app();
 	unload_synthandrecog_app();
+	unload_mrcpprefetch_app();
 
 	/* Stop the MRCP client stack. */
 	if (globals.mrcp_client != NULL) {
@@ -40,6 +40,11 @@
 /* UniMRCP includes. */
 #include "uni_revision.h"
 #include "ast_unimrcp_framework.h"
+#include "audio_queue.h"
+#include "stream_dump.h"
+#include "tts_cache.h"
+#include "energy_vad.h"
+#include "speech_channel.h"
 
 #define DEFAULT_UNIMRCP_MAX_CONNECTION_COUNT   100
 #define DEFAULT_UNIMRCP_MAX_SHARED_USE_COUNT   100
@@ -48,6 +53,29 @@
 
 #define DEFAULT_SPEECH_CHANNEL_TIMEOUT         apr_time_from_msec(30000)
 
+#define DEFAULT_AUDIO_QUEUE_LATENCY            1000
+#define MIN_AUDIO_QUEUE_LATENCY                20
+#define DEFAULT_AUDIO_QUEUE_OVERFLOW_POLICY    AUDIO_QUEUE_OVERFLOW_DROP_NEWEST
+#define DEFAULT_AUDIO_QUEUE_TARGET_DEPTH       0
+
+#define DEFAULT_TTS_CACHE_SIZE                 0
+#define DEFAULT_TTS_STORE_SIZE                 (256 * 1024 * 1024)
+#define DEFAULT_CONTENT_CACHE_SIZE             0
+#define DEFAULT_TTS_WARM_CHANNELS              4
+#define MAX_TTS_WARM_CHANNELS                  64
+#define DEFAULT_TTS_WARM_RATE                  1
+#define DEFAULT_RECOG_FILE_CHANNELS            4
+#define MAX_RECOG_FILE_CHANNELS                64
+#define DEFAULT_VAD_LEVEL                      0
+#define DEFAULT_VAD_NO_INPUT_TIMEOUT           0
+#define DEFAULT_RECOG_PREROLL                  0
+
+#define DEFAULT_SESSION_POOL_MIN_IDLE          0
+#define DEFAULT_SESSION_POOL_MAX_IDLE          0
+#define DEFAULT_SESSION_POOL_IDLE_TTL          apr_time_from_msec(60000)
+#define SESSION_POOL_INTERVAL                  apr_time_from_sec(1)
+#define SESSION_POOL_MAX_CLASSES               16
+
 #define DEFAULT_LOCAL_IP_ADDRESS               "127.0.0.1"
 #define DEFAULT_REMOTE_IP_ADDRESS              "127.0.0.1"
 #define DEFAULT_SIP_LOCAL_PORT                 5090
@@ -80,7 +108,33 @@ static void globals_null(void)
 	globals.mutex = NULL;
 	globals.speech_channel_number = 0;
 	globals.speech_channel_timeout = 0;
+	globals.audio_queue_latency = 0;
+	globals.audio_queue_overflow_policy = 0;
+	globals.audio_queue_target_depth = 0;
+	globals.tts_cache_size = 0;
+	globals.tts_store_dir = NULL;
+	globals.tts_store_size = 0;
+	globals.content_cache_size = 0;
+	globals.tts_warm_channels = 0;
+	globals.recog_file_channels = 0;
+	globals.tts_warm_rate = 0;
+	globals.vad_level = 0;
+	globals.vad_squelch = 0;
+	globals.vad_bargein = 0;
+	globals.vad_no_input_timeout = 0;
+	globals.recog_preroll = 0;
 	globals.profiles = NULL;
+	globals.channels = NULL;
+	globals.media_lock_waits = 0;
+	globals.session_pool_thread = NULL;
+	globals.session_pool_cond = NULL;
+	globals.session_pool_running = 0;
+	globals.reaper_thread = NULL;
+	globals.reaper_cond = NULL;
+	globals.reaper_running = 0;
+	globals.pending_teardowns = 0;
+	globals.failed_teardowns = 0;
+	globals.debug_flags = 0;
 }
 
 static void globals_clear(void)
@@ -136,6 +190,21 @@ static void globals_default(void)
 	globals.unimrcp_log_level = DEFAULT_UNIMRCP_LOG_LEVEL;
 	globals.speech_channel_number = 0;
 	globals.speech_channel_timeout = DEFAULT_SPEECH_CHANNEL_TIMEOUT;
+	globals.audio_queue_latency = DEFAULT_AUDIO_QUEUE_LATENCY;
+	globals.audio_queue_overflow_policy = DEFAULT_AUDIO_QUEUE_OVERFLOW_POLICY;
+	globals.audio_queue_target_depth = DEFAULT_AUDIO_QUEUE_TARGET_DEPTH;
+	globals.tts_cache_size = DEFAULT_TTS_CACHE_SIZE;
+	globals.tts_store_dir = NULL;
+	globals.tts_store_size = DEFAULT_TTS_STORE_SIZE;
+	globals.content_cache_size = DEFAULT_CONTENT_CACHE_SIZE;
+	globals.tts_warm_channels = DEFAULT_TTS_WARM_CHANNELS;
+	globals.tts_warm_rate = DEFAULT_TTS_WARM_RATE;
+	globals.recog_file_channels = DEFAULT_RECOG_FILE_CHANNELS;
+	globals.vad_level = DEFAULT_VAD_LEVEL;
+	globals.vad_squelch = 0;
+	globals.vad_bargein = 0;
+	globals.vad_no_input_timeout = DEFAULT_VAD_NO_INPUT_TIMEOUT;
+	globals.recog_preroll = DEFAULT_RECOG_PREROLL;
 }
 
 void globals_destroy(void)
@@ -148,6 +217,11 @@ void globals_destroy(void)
 			ast_log(LOG_WARNING, "Unable to destroy global mutex\n");
 	}
 
+	/* The slab memory is released with the global pool. */
+	speech_channel_slabs_destroy();
+	audio_queue_slabs_destroy();
+	slab_list_clear();
+
 	if (globals.pool != NULL)
 		apr_pool_destroy(globals.pool);
 
@@ -195,6 +269,29 @@ int globals_init(void)
 		return -1;
 	}
 
+	/* Create a hash for the active speech channels. */
+	if ((globals.channels = apr_hash_make(globals.pool)) == NULL) {
+		ast_log(LOG_ERROR, "Unable to create channels hash\n");
+		apr_thread_mutex_destroy(globals.mutex);
+		apr_pool_destroy(globals.pool);
+		globals.pool = NULL;
+		globals.mutex = NULL;
+		return -1;
+	}
+
+	/* Create the slabs for speech channels and audio queues. */
+	if ((speech_channel_slabs_create(globals.pool) != 0) || (audio_queue_slabs_create(globals.pool) != 0)) {
+		ast_log(LOG_ERROR, "Unable to create slabs\n");
+		speech_channel_slabs_destroy();
+		audio_queue_slabs_destroy();
+		slab_list_clear();
+		apr_thread_mutex_destroy(globals.mutex);
+		apr_pool_destroy(globals.pool);
+		globals.pool = NULL;
+		globals.mutex = NULL;
+		return -1;
+	}
+
 	/* Set the default values. */
 	globals_default();
 
@@ -252,6 +349,31 @@ ast_mrcp_profile_t* get_recog_profile(const char *option_profile)
 
 /* --- PROFILE FUNCTIONS --- */
 
+/* Create the session pool of a profile. */
+static int session_pool_create(ast_mrcp_session_pool_t **session_pool, apr_pool_t *pool)
+{
+	ast_mrcp_session_pool_t *spool = (ast_mrcp_session_pool_t *)apr_palloc(pool, sizeof(ast_mrcp_session_pool_t));
+
+	*session_pool = NULL;
+	spool->mutex = NULL;
+	spool->idle = NULL;
+	spool->idle_count = 0;
+	spool->hits = 0;
+	spool->misses = 0;
+	spool->checkins = 0;
+
+	if ((spool->classes = apr_array_make(pool, 1, sizeof(ast_mrcp_session_class_t))) == NULL)
+		return -1;
+
+	if ((apr_thread_mutex_create(&spool->mutex, APR_THREAD_MUTEX_UNNESTED, pool) != APR_SUCCESS) || (spool->mutex == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create session pool mutex\n");
+		return -1;
+	}
+
+	*session_pool = spool;
+	return 0;
+}
+
 /* Create a profile. */
 int profile_create(ast_mrcp_profile_t **profile, const char *name, const char *version, apr_pool_t *pool)
 {
@@ -266,7 +388,7 @@ int profile_create(ast_mrcp_profile_t **profile, const char *name, const char *v
 	if (pool == NULL)
 		return -1;
 		
-	lprofile = (ast_mrcp_profile_t *)apr_palloc(pool, sizeof(ast_mrcp_profile_t));
+	lprofile = (ast_mrcp_profile_t *)apr_pcalloc(pool, sizeof(ast_mrcp_profile_t));
 	if ((lprofile != NULL) && (name != NULL) && (version != NULL)) {
 		if ((lprofile->cfg = apr_hash_make(pool)) != NULL) {
 			lprofile->name = apr_pstrdup(pool, name);
@@ -277,7 +399,13 @@ int profile_create(ast_mrcp_profile_t **profile, const char *name, const char *v
 			lprofile->jsgf_mime_type = "application/x-jsgf";
 			lprofile->xml_mime_type = "application/xml";
 			lprofile->ssml_mime_type = "application/ssml+xml";
-			*profile = lprofile;
+			lprofile->session_pool_min_idle = DEFAULT_SESSION_POOL_MIN_IDLE;
+			lprofile->session_pool_max_idle = DEFAULT_SESSION_POOL_MAX_IDLE;
+			lprofile->session_pool_idle_ttl = DEFAULT_SESSION_POOL_IDLE_TTL;
+			if (session_pool_create(&lprofile->session_pool, pool) != 0)
+				res = -1;
+			else
+				*profile = lprofile;
 		} else
 			res = -1;
 	} else
@@ -310,6 +438,14 @@ static int process_profile_config(ast_mrcp_profile_t *profile, const char *param
 		profile->srgs_mime_type = apr_pstrdup(pool, val);
 	else if (strcasecmp(param, "ssml-mime-type") == 0)
 		profile->ssml_mime_type = apr_pstrdup(pool, val);
+	else if (strcasecmp(param, "session-pool-min-idle") == 0)
+		profile->session_pool_min_idle = (apr_size_t)atol(val);
+	else if (strcasecmp(param, "session-pool-max-idle") == 0)
+		profile->session_pool_max_idle = (apr_size_t)atol(val);
+	else if (strcasecmp(param, "session-pool-idle-ttl") == 0)
+		profile->session_pool_idle_ttl = apr_time_from_msec(atol(val));
+	else if (strcasecmp(param, "grammar-hash-ids") == 0)
+		profile->grammar_hash_ids = (atoi(val) != 0);
 	else
 		mine = 0;
 
@@ -452,7 +588,7 @@ static int process_mrcpv2_config(mrcp_sofia_client_config_t *config, mrcp_sig_se
 }
 
 /* --- MRCP CLIENT --- */
-static int load_profiles(mrcp_client_t *client, mrcp_connection_agent_t *shared_connection_agent, mpf_engine_t *shared_media_engine, apr_pool_t *pool)
+static int load_profiles(mrcp_client_t *client, mrcp_connection_agent_t *shared_connection_agent, mpf_engine_t *shared_media_engine, mpf_engine_t *batch_media_engine, apr_pool_t *pool)
 {
 	apr_hash_index_t *hi;
 
@@ -478,7 +614,7 @@ static int load_profiles(mrcp_client_t *client, mrcp_connection_agent_t *shared_
 		mpf_rtp_config_t *rtp_config = NULL;
 		mpf_rtp_settings_t *rtp_settings = mpf_rtp_settings_alloc(pool);
 		mrcp_sig_settings_t *sig_settings = mrcp_signaling_settings_alloc(pool);
-		ast_mrcp_profile_t *mod_profile = NULL;
+		ast_mrcp_profile_t *mod_profile = v;
 		mrcp_connection_agent_t *connection_agent = NULL;
 		mpf_engine_t *media_engine = shared_media_engine;
 
@@ -603,6 +739,11 @@ static int load_profiles(mrcp_client_t *client, mrcp_connection_agent_t *shared_
 			return -1;
 		}
 
+		if (mod_profile->session_pool_min_idle > mod_profile->session_pool_max_idle) {
+			ast_log(LOG_WARNING, "Profile %s session-pool-min-idle exceeds session-pool-max-idle, using %"APR_SIZE_T_FMT"\n", name, mod_profile->session_pool_min_idle);
+			mod_profile->session_pool_max_idle = mod_profile->session_pool_min_idle;
+		}
+
 		if ((termination_factory = mpf_rtp_termination_factory_create(rtp_config, pool)) != NULL)
 			mrcp_client_rtp_factory_register(client, termination_factory, name);
 
@@ -617,6 +758,16 @@ static int load_profiles(mrcp_client_t *client, mrcp_connection_agent_t *shared_
 			if (!mrcp_client_profile_register(client, mprofile, name))
 				ast_log(LOG_WARNING, "Unable to register MRCP client profile\n");
 		}
+
+		/* Register a twin of the profile running on the batch media engine, for pre-synthesis. */
+		if ((batch_media_engine != NULL) && 
+			((mprofile = mrcp_client_profile_create(NULL, agent, connection_agent, batch_media_engine, termination_factory, rtp_settings, sig_settings, pool)) != NULL)) {
+			const char *batch_name = apr_psprintf(pool, "%s-batch", name);
+			if (mrcp_client_profile_register(client, mprofile, batch_name))
+				mod_profile->batch_name = batch_name;
+			else
+				ast_log(LOG_WARNING, "Unable to register MRCP client profile %s\n", batch_name);
+		}
 	}
 
 	return 0;
@@ -641,6 +792,7 @@ mrcp_client_t *mod_unimrcp_client_create(apr_pool_t *mod_pool)
 	apt_bool_t offer_new_connection = FALSE;
 	mrcp_connection_agent_t *shared_connection_agent = NULL;
 	mpf_engine_t *shared_media_engine = NULL;
+	mpf_engine_t *batch_media_engine = NULL;
 
 	if (!globals.profiles) {
 		ast_log(LOG_ERROR, "Profiles hash is NULL\n");
@@ -747,8 +899,19 @@ mrcp_client_t *mod_unimrcp_client_create(apr_pool_t *mod_pool)
 			ast_log(LOG_WARNING, "Unable to register MRCP client media engine\n");
 	}
 
+	/* Set up the media engine prompts are pre-synthesized with, faster than realtime. */
+	if ((globals.tts_warm_rate > 1) && ((batch_media_engine = mpf_engine_create("BatchMediaEngine", pool)) != NULL)) {
+		if (!mpf_engine_scheduler_rate_set(batch_media_engine, (unsigned long)globals.tts_warm_rate))
+			ast_log(LOG_WARNING, "Unable to set scheduler rate for MRCP client batch media engine\n");
+
+		if (!mrcp_client_media_engine_register(client, batch_media_engine)) {
+			ast_log(LOG_WARNING, "Unable to register MRCP client batch media engine\n");
+			batch_media_engine = NULL;
+		}
+	}
+
 	if (globals.profiles) {
-		if(load_profiles(client, shared_connection_agent, shared_media_engine, pool) !=0)
+		if(load_profiles(client, shared_connection_agent, shared_media_engine, batch_media_engine, pool) !=0)
 			return NULL;
 	}
 
@@ -835,6 +998,100 @@ int load_mrcp_config(const char *filename, const char *who_asked)
 			globals.speech_channel_timeout = DEFAULT_SPEECH_CHANNEL_TIMEOUT;
 		}
 	}
+	if ((value = ast_variable_retrieve(cfg, "general", "audio-queue-latency")) != NULL) {
+		ast_log(LOG_DEBUG, "general.audio-queue-latency=%s\n",  value);
+		globals.audio_queue_latency = atol(value);
+		if (globals.audio_queue_latency < MIN_AUDIO_QUEUE_LATENCY) {
+			ast_log(LOG_DEBUG, "Reset general.audio-queue-latency to default\n");
+			globals.audio_queue_latency = DEFAULT_AUDIO_QUEUE_LATENCY;
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "audio-queue-overflow-policy")) != NULL) {
+		audio_queue_overflow_policy_t policy;
+		ast_log(LOG_DEBUG, "general.audio-queue-overflow-policy=%s\n",  value);
+		if (audio_queue_overflow_policy_parse(value, &policy) == 0) {
+			globals.audio_queue_overflow_policy = policy;
+		} else {
+			ast_log(LOG_WARNING, "Unknown general.audio-queue-overflow-policy %s, using %s\n", value, audio_queue_overflow_policy_to_string(DEFAULT_AUDIO_QUEUE_OVERFLOW_POLICY));
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "audio-queue-target-depth")) != NULL) {
+		ast_log(LOG_DEBUG, "general.audio-queue-target-depth=%s\n",  value);
+		globals.audio_queue_target_depth = atol(value);
+		if (globals.audio_queue_target_depth >= globals.audio_queue_latency) {
+			ast_log(LOG_WARNING, "general.audio-queue-target-depth must be less than general.audio-queue-latency, disabling drift compensation\n");
+			globals.audio_queue_target_depth = 0;
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "tts-cache-size")) != NULL) {
+		ast_log(LOG_DEBUG, "general.tts-cache-size=%s\n",  value);
+		globals.tts_cache_size = (apr_size_t)atol(value) * 1024;
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "tts-store-dir")) != NULL) {
+		ast_log(LOG_DEBUG, "general.tts-store-dir=%s\n",  value);
+		if (!ast_strlen_zero(value))
+			globals.tts_store_dir = apr_pstrdup(globals.pool, value);
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "tts-store-size")) != NULL) {
+		ast_log(LOG_DEBUG, "general.tts-store-size=%s\n",  value);
+		globals.tts_store_size = (apr_size_t)atol(value) * 1024 * 1024;
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "content-cache-size")) != NULL) {
+		ast_log(LOG_DEBUG, "general.content-cache-size=%s\n",  value);
+		globals.content_cache_size = (apr_size_t)atol(value) * 1024;
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "tts-warm-channels")) != NULL) {
+		ast_log(LOG_DEBUG, "general.tts-warm-channels=%s\n",  value);
+		globals.tts_warm_channels = (apr_size_t)atol(value);
+		if ((globals.tts_warm_channels == 0) || (globals.tts_warm_channels > MAX_TTS_WARM_CHANNELS)) {
+			ast_log(LOG_WARNING, "general.tts-warm-channels must be between 1 and %d, using %d\n", MAX_TTS_WARM_CHANNELS, DEFAULT_TTS_WARM_CHANNELS);
+			globals.tts_warm_channels = DEFAULT_TTS_WARM_CHANNELS;
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "tts-warm-rate")) != NULL) {
+		ast_log(LOG_DEBUG, "general.tts-warm-rate=%s\n",  value);
+		globals.tts_warm_rate = (apr_size_t)atol(value);
+		if (globals.tts_warm_rate == 0) {
+			ast_log(LOG_WARNING, "general.tts-warm-rate must be at least 1, using %d\n", DEFAULT_TTS_WARM_RATE);
+			globals.tts_warm_rate = DEFAULT_TTS_WARM_RATE;
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "recog-file-channels")) != NULL) {
+		ast_log(LOG_DEBUG, "general.recog-file-channels=%s\n",  value);
+		globals.recog_file_channels = (apr_size_t)atol(value);
+		if ((globals.recog_file_channels == 0) || (globals.recog_file_channels > MAX_RECOG_FILE_CHANNELS)) {
+			ast_log(LOG_WARNING, "general.recog-file-channels must be between 1 and %d, using %d\n", MAX_RECOG_FILE_CHANNELS, DEFAULT_RECOG_FILE_CHANNELS);
+			globals.recog_file_channels = DEFAULT_RECOG_FILE_CHANNELS;
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "vad-level")) != NULL) {
+		ast_log(LOG_DEBUG, "general.vad-level=%s\n",  value);
+		globals.vad_level = atoi(value);
+		if (globals.vad_level > 0) {
+			ast_log(LOG_WARNING, "general.vad-level must be negative (dBov), disabling voice activity detection\n");
+			globals.vad_level = 0;
+		}
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "vad-squelch")) != NULL) {
+		ast_log(LOG_DEBUG, "general.vad-squelch=%s\n",  value);
+		globals.vad_squelch = (atoi(value) != 0);
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "vad-bargein")) != NULL) {
+		ast_log(LOG_DEBUG, "general.vad-bargein=%s\n",  value);
+		globals.vad_bargein = (atoi(value) != 0);
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "vad-no-input-timeout")) != NULL) {
+		ast_log(LOG_DEBUG, "general.vad-no-input-timeout=%s\n",  value);
+		globals.vad_no_input_timeout = (apr_size_t)atol(value);
+	}
+	if ((value = ast_variable_retrieve(cfg, "general", "recog-preroll")) != NULL) {
+		ast_log(LOG_DEBUG, "general.recog-preroll=%s\n",  value);
+		globals.recog_preroll = (apr_size_t)atol(value);
+		if (globals.recog_preroll >= globals.audio_queue_latency) {
+			ast_log(LOG_WARNING, "general.recog-preroll must be less than general.audio-queue-latency, disabling pre-roll\n");
+			globals.recog_preroll = DEFAULT_RECOG_PREROLL;
+		}
+	}
 
 	while ((cat = ast_category_browse(cfg, cat)) != NULL) {
 		if (strcasecmp(cat, "general") != 0) {
@@ -859,3 +1116,361 @@ int load_mrcp_config(const char *filename, const char *who_asked)
 
 	return 0;
 }
+
+
+/* --- LATENCY --- */
+
+/* Upper bounds of the latency histogram buckets (msec), the last bucket is unbounded. */
+static const apr_uint32_t latency_bounds[AST_MRCP_LATENCY_BUCKETS - 1] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000 };
+
+/* Record a latency of a speech channel of the specified type in the histograms of the profile. */
+void profile_latency_record(ast_mrcp_profile_t *profile, int type, ast_mrcp_latency_t latency, apr_interval_time_t elapsed)
+{
+	ast_mrcp_latency_histogram_t *histogram;
+	apr_uint32_t msec;
+	apr_uint32_t max;
+	int bucket = 0;
+
+	if ((profile == NULL) || (type < 0) || (type >= AST_MRCP_LATENCY_TYPES) || (latency >= AST_MRCP_LATENCY_COUNT) || (elapsed < 0))
+		return;
+
+	histogram = &profile->latency[type][latency];
+	msec = (apr_uint32_t)apr_time_as_msec(elapsed);
+
+	while ((bucket < AST_MRCP_LATENCY_BUCKETS - 1) && (msec >= latency_bounds[bucket]))
+		bucket++;
+
+	apr_atomic_inc32(&histogram->buckets[bucket]);
+	apr_atomic_inc32(&histogram->count);
+#if APR_VERSION_AT_LEAST(1,7,0)
+	apr_atomic_add64(&histogram->sum, msec);
+#else
+	__sync_fetch_and_add(&histogram->sum, (apr_uint64_t)msec);
+#endif
+
+	while ((max = apr_atomic_read32(&histogram->max)) < msec) {
+		if (apr_atomic_cas32(&histogram->max, msec, max) == max)
+			break;
+	}
+}
+
+/* Get the sum of the measurements of a latency (msec). */
+apr_uint64_t profile_latency_sum(ast_mrcp_latency_histogram_t *histogram)
+{
+#if APR_VERSION_AT_LEAST(1,7,0)
+	return apr_atomic_read64(&histogram->sum);
+#else
+	return __sync_fetch_and_add(&histogram->sum, 0);
+#endif
+}
+
+/* Convert latency to string. */
+const char *profile_latency_to_string(ast_mrcp_latency_t latency)
+{
+	switch (latency) {
+		case AST_MRCP_LATENCY_SETUP: return "setup";
+		case AST_MRCP_LATENCY_RESPONSE: return "response";
+		case AST_MRCP_LATENCY_FIRST_AUDIO: return "first-audio";
+		case AST_MRCP_LATENCY_START_OF_INPUT: return "start-of-input";
+		case AST_MRCP_LATENCY_COMPLETE: return "complete";
+		case AST_MRCP_LATENCY_FIRST_AUDIO_CHUNKED: return "first-audio-chunked";
+		default: return "UNKNOWN";
+	}
+}
+
+/* Convert latency histogram bucket to string. */
+const char *profile_latency_bucket_to_string(int bucket)
+{
+	static const char *names[AST_MRCP_LATENCY_BUCKETS] = { "<10", "<20", "<50", "<100", "<200", "<500", "<1s", "<2s", "<5s", "<10s", ">=10s" };
+
+	if ((bucket < 0) || (bucket >= AST_MRCP_LATENCY_BUCKETS))
+		return "UNKNOWN";
+	return names[bucket];
+}
+
+/* --- SESSION POOL --- */
+
+/* Check whether the session pool of the profile has room for another idle channel. */
+int session_pool_accepts(ast_mrcp_profile_t *profile)
+{
+	ast_mrcp_session_pool_t *spool = profile->session_pool;
+	int accepts;
+
+	if ((spool == NULL) || (profile->session_pool_max_idle == 0) || !globals.session_pool_running)
+		return 0;
+
+	apr_thread_mutex_lock(spool->mutex);
+	accepts = spool->idle_count < profile->session_pool_max_idle;
+	apr_thread_mutex_unlock(spool->mutex);
+
+	return accepts;
+}
+
+/* Remember a kind of channel, so the pool can be topped up with it. Call with the pool locked. */
+static void session_pool_class_add(ast_mrcp_session_pool_t *spool, ast_mrcp_application_t *app, int type, const char *codec, apr_uint16_t rate)
+{
+	ast_mrcp_session_class_t *sclass;
+	int i;
+
+	for (i = 0; i < spool->classes->nelts; i++) {
+		sclass = &APR_ARRAY_IDX(spool->classes, i, ast_mrcp_session_class_t);
+		if ((sclass->application == app) && (sclass->type == type) && (sclass->rate == rate) && (strcmp(sclass->codec, codec) == 0))
+			return;
+	}
+
+	if (spool->classes->nelts >= SESSION_POOL_MAX_CLASSES)
+		return;
+
+	sclass = (ast_mrcp_session_class_t *)apr_array_push(spool->classes);
+	sclass->application = app;
+	sclass->type = type;
+	sclass->codec = codec;
+	sclass->rate = rate;
+}
+
+/* Take an idle channel matching the requested kind out of the pool. */
+speech_channel_t *session_pool_checkout(ast_mrcp_profile_t *profile, ast_mrcp_application_t *app, int type, const char *codec, apr_uint16_t rate)
+{
+	ast_mrcp_session_pool_t *spool = profile->session_pool;
+	speech_channel_t **prev;
+	speech_channel_t *schannel;
+	apr_time_t now = apr_time_now();
+
+	if ((spool == NULL) || (profile->session_pool_max_idle == 0) || !globals.session_pool_running)
+		return NULL;
+
+	apr_thread_mutex_lock(spool->mutex);
+	session_pool_class_add(spool, app, type, codec, rate);
+
+	for (prev = &spool->idle; (schannel = *prev) != NULL; prev = &schannel->idle_next) {
+		if ((schannel->application == app) && ((int)schannel->type == type) && (schannel->rate == rate) && (strcmp(schannel->codec, codec) == 0) &&
+			(speech_channel_get_state(schannel) == SPEECH_CHANNEL_READY) && (now - schannel->idle_since < profile->session_pool_idle_ttl)) {
+			*prev = schannel->idle_next;
+			schannel->idle_next = NULL;
+			spool->idle_count--;
+			break;
+		}
+	}
+
+	if (schannel != NULL)
+		spool->hits++;
+	else
+		spool->misses++;
+	apr_thread_mutex_unlock(spool->mutex);
+
+	/* Let the pool be topped up. */
+	apr_thread_mutex_lock(globals.mutex);
+	if (globals.session_pool_cond != NULL)
+		apr_thread_cond_signal(globals.session_pool_cond);
+	apr_thread_mutex_unlock(globals.mutex);
+
+	return schannel;
+}
+
+/* Put an idle channel into the pool. */
+int session_pool_checkin(ast_mrcp_profile_t *profile, speech_channel_t *schannel)
+{
+	ast_mrcp_session_pool_t *spool = profile->session_pool;
+	int status = -1;
+
+	if ((spool == NULL) || (profile->session_pool_max_idle == 0) || !globals.session_pool_running)
+		return -1;
+
+	apr_thread_mutex_lock(spool->mutex);
+	if (spool->idle_count < profile->session_pool_max_idle) {
+		schannel->idle_since = apr_time_now();
+		schannel->idle_next = spool->idle;
+		spool->idle = schannel;
+		spool->idle_count++;
+		spool->checkins++;
+		status = 0;
+	}
+	apr_thread_mutex_unlock(spool->mutex);
+
+	return status;
+}
+
+/* Take the channels to be terminated out of the pool: those whose session is 
+ * gone, those idle for longer than the TTL and those over the maximum. All of 
+ * them on shutdown.
+ */
+static speech_channel_t *session_pool_expire(ast_mrcp_profile_t *profile, apr_time_t now, int shutdown)
+{
+	ast_mrcp_session_pool_t *spool = profile->session_pool;
+	speech_channel_t *expired = NULL;
+	speech_channel_t **prev;
+	speech_channel_t *schannel;
+	apr_size_t kept = 0;
+
+	apr_thread_mutex_lock(spool->mutex);
+	prev = &spool->idle;
+	while ((schannel = *prev) != NULL) {
+		if (shutdown || (speech_channel_get_state(schannel) != SPEECH_CHANNEL_READY) ||
+			(now - schannel->idle_since >= profile->session_pool_idle_ttl) || (kept >= profile->session_pool_max_idle)) {
+			*prev = schannel->idle_next;
+			schannel->idle_next = expired;
+			expired = schannel;
+			spool->idle_count--;
+		} else {
+			prev = &schannel->idle_next;
+			kept++;
+		}
+	}
+	apr_thread_mutex_unlock(spool->mutex);
+
+	return expired;
+}
+
+/* Count the idle channels of a kind. Call with the pool locked. */
+static apr_size_t session_pool_class_count(ast_mrcp_session_pool_t *spool, ast_mrcp_session_class_t *sclass)
+{
+	speech_channel_t *schannel;
+	apr_size_t count = 0;
+
+	for (schannel = spool->idle; schannel != NULL; schannel = schannel->idle_next) {
+		if ((schannel->application == sclass->application) && ((int)schannel->type == sclass->type) && (schannel->rate == sclass->rate) && (strcmp(schannel->codec, sclass->codec) == 0))
+			count++;
+	}
+
+	return count;
+}
+
+/* Establish sessions until there are session-pool-min-idle channels of each kind requested so far. */
+static void session_pool_top_up(ast_mrcp_profile_t *profile)
+{
+	ast_mrcp_session_pool_t *spool = profile->session_pool;
+	int i;
+
+	for (i = 0; i < spool->classes->nelts && globals.session_pool_running; i++) {
+		ast_mrcp_session_class_t sclass;
+		apr_size_t count;
+		apr_size_t total;
+
+		apr_thread_mutex_lock(spool->mutex);
+		sclass = APR_ARRAY_IDX(spool->classes, i, ast_mrcp_session_class_t);
+		apr_thread_mutex_unlock(spool->mutex);
+
+		while (globals.session_pool_running) {
+			speech_channel_t *schannel;
+
+			apr_thread_mutex_lock(spool->mutex);
+			count = session_pool_class_count(spool, &sclass);
+			total = spool->idle_count;
+			apr_thread_mutex_unlock(spool->mutex);
+
+			if ((count >= profile->session_pool_min_idle) || (total >= profile->session_pool_max_idle))
+				break;
+
+			if ((schannel = speech_channel_warm(profile, sclass.application, (speech_channel_type_t)sclass.type, sclass.codec, sclass.rate)) == NULL)
+				break;
+
+			if (session_pool_checkin(profile, schannel) != 0) {
+				speech_channel_destroy(schannel);
+				break;
+			}
+		}
+	}
+}
+
+/* Terminate expired sessions and top up the pools. */
+static void session_pool_maintain(apr_pool_t *pool, int shutdown)
+{
+	apr_hash_index_t *hi;
+	apr_time_t now = apr_time_now();
+
+	for (hi = apr_hash_first(pool, globals.profiles); hi; hi = apr_hash_next(hi)) {
+		ast_mrcp_profile_t *profile;
+		speech_channel_t *expired;
+		void *val;
+
+		apr_hash_this(hi, NULL, NULL, &val);
+		profile = (ast_mrcp_profile_t *)val;
+
+		if ((profile == NULL) || (profile->session_pool == NULL) || (profile->session_pool_max_idle == 0))
+			continue;
+
+		expired = session_pool_expire(profile, now, shutdown);
+		while (expired != NULL) {
+			speech_channel_t *next = expired->idle_next;
+
+			expired->idle_next = NULL;
+			ast_log(LOG_DEBUG, "(%s) Terminating idle session with %s\n", expired->name, profile->name);
+			speech_channel_destroy(expired);
+			expired = next;
+		}
+
+		if (!shutdown && (profile->session_pool_min_idle > 0))
+			session_pool_top_up(profile);
+	}
+
+	/* Channels whose session was taken over are kept until no media engine callback can refer to them. */
+	speech_channel_retired_reap(shutdown ? 0 : SESSION_POOL_INTERVAL);
+}
+
+/* The session pool thread. */
+static void * APR_THREAD_FUNC session_pool_run(apr_thread_t *thread, void *data)
+{
+	apr_pool_t *pool = (apr_pool_t *)data;
+
+	apr_thread_mutex_lock(globals.mutex);
+	while (globals.session_pool_running) {
+		apr_thread_cond_timedwait(globals.session_pool_cond, globals.mutex, SESSION_POOL_INTERVAL);
+		if (!globals.session_pool_running)
+			break;
+
+		apr_thread_mutex_unlock(globals.mutex);
+		session_pool_maintain(pool, 0);
+		apr_pool_clear(pool);
+		apr_thread_mutex_lock(globals.mutex);
+	}
+	apr_thread_mutex_unlock(globals.mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Start the session pool thread. */
+int session_pool_start(void)
+{
+	apr_pool_t *pool;
+
+	if ((pool = apt_subpool_create(globals.pool)) == NULL) {
+		ast_log(LOG_ERROR, "Unable to create session pool memory pool\n");
+		return -1;
+	}
+
+	if ((apr_thread_cond_create(&globals.session_pool_cond, globals.pool) != APR_SUCCESS) || (globals.session_pool_cond == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create session pool condition variable\n");
+		globals.session_pool_cond = NULL;
+		return -1;
+	}
+
+	globals.session_pool_running = 1;
+	if (apr_thread_create(&globals.session_pool_thread, NULL, session_pool_run, pool, globals.pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create session pool thread\n");
+		globals.session_pool_running = 0;
+		globals.session_pool_thread = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Stop the session pool thread and terminate the idle sessions. */
+void session_pool_stop(void)
+{
+	apr_status_t status;
+
+	if (globals.session_pool_thread == NULL)
+		return;
+
+	apr_thread_mutex_lock(globals.mutex);
+	globals.session_pool_running = 0;
+	apr_thread_cond_signal(globals.session_pool_cond);
+	apr_thread_mutex_unlock(globals.mutex);
+
+	apr_thread_join(&status, globals.session_pool_thread);
+	globals.session_pool_thread = NULL;
+
+	session_pool_maintain(NULL, 1);
+}
@@ -20,7 +20,11 @@
 
 /* UniMRCP includes. */
 #include <apr_general.h>
+#include <apr_atomic.h>
+#include <apr_version.h>
 #include <apr_hash.h>
+#include <apr_tables.h>
+#include <apr_thread_proc.h>
 #include <apr_thread_cond.h>
 #include <apr_thread_mutex.h>
 #include "apt.h"
@@ -94,6 +98,36 @@ struct ast_mrcp_globals_t {
 	char *unimrcp_log_level;
 	/* The speech channel timeout configuration. */
 	apr_interval_time_t speech_channel_timeout;
+	/* The audio queue latency configuration (msec). */
+	apr_size_t audio_queue_latency;
+	/* The audio queue overflow policy configuration (audio_queue_overflow_policy_t). */
+	int audio_queue_overflow_policy;
+	/* The target audio queue depth for drift compensation (msec), 0 if disabled. */
+	apr_size_t audio_queue_target_depth;
+	/* The memory cap of the synthesized prompt cache (bytes), 0 if disabled. */
+	apr_size_t tts_cache_size;
+	/* The directory synthesized prompts are stored to, NULL if disabled. */
+	char *tts_store_dir;
+	/* The disk cap of the synthesized prompt store (bytes). */
+	apr_size_t tts_store_size;
+	/* The memory cap of the grammar and SSML file cache (bytes), 0 if disabled. */
+	apr_size_t content_cache_size;
+	/* Number of speech channels prompts are pre-synthesized through. */
+	apr_size_t tts_warm_channels;
+	/* Rate of the media engine prompts are pre-synthesized with, relative to realtime. */
+	apr_size_t tts_warm_rate;
+	/* Number of speech channels recorded files are recognized through. */
+	apr_size_t recog_file_channels;
+	/* Level (dBov) of the local voice activity detector of recognizers, 0 if disabled. */
+	int vad_level;
+	/* True if the leading silence sent to recognizers is replaced with digital silence. */
+	int vad_squelch;
+	/* True if a prompt is barged in on once speech is detected locally. */
+	int vad_bargein;
+	/* Time (msec) without speech after which recognition ends with no input, 0 if disabled. */
+	apr_size_t vad_no_input_timeout;
+	/* Audio (msec) kept while a recognizer is not processing and replayed once it is, 0 if disabled. */
+	apr_size_t recog_preroll;
 
 	/* The MRCP client stack. */
 	mrcp_client_t *mrcp_client;
@@ -107,9 +141,106 @@ struct ast_mrcp_globals_t {
 	apr_uint32_t speech_channel_number;
 	/* The available profiles. */
 	apr_hash_t *profiles;
+	/* The active speech channels, synchronized by the globals mutex. */
+	apr_hash_t *channels;
+	/* Number of times a media path callback waited on a lock (for debugging). */
+	volatile apr_uint32_t media_lock_waits;
+
+	/* Thread maintaining the session pools. */
+	apr_thread_t *session_pool_thread;
+	/* Wakes up the session pool thread, used with the globals mutex. */
+	apr_thread_cond_t *session_pool_cond;
+	/* True while the session pool thread is running. */
+	int session_pool_running;
+
+	/* Thread tearing down speech channels. */
+	apr_thread_t *reaper_thread;
+	/* Wakes up the reaper thread, used with the globals mutex. */
+	apr_thread_cond_t *reaper_cond;
+	/* True while the reaper thread is running. */
+	int reaper_running;
+	/* Number of speech channels pending teardown. */
+	volatile apr_uint32_t pending_teardowns;
+	/* Number of speech channels whose session did not terminate. */
+	volatile apr_uint32_t failed_teardowns;
+
+	/* Debug flags applied to every new speech channel (SPEECH_CHANNEL_DEBUG_*). */
+	volatile apr_uint32_t debug_flags;
 };
 typedef struct ast_mrcp_globals_t ast_mrcp_globals_t;
 
+struct speech_channel_t;
+
+/* Kind of speech channel kept in a session pool. */
+struct ast_mrcp_session_class_t {
+	/* Application the channels run. */
+	ast_mrcp_application_t *application;
+	/* Type of the channels (speech_channel_type_t). */
+	int type;
+	/* Codec of the channels. */
+	const char *codec;
+	/* Rate of the channels. */
+	apr_uint16_t rate;
+};
+typedef struct ast_mrcp_session_class_t ast_mrcp_session_class_t;
+
+/* Idle speech channels with established MRCP sessions, ready to be taken over by a call. */
+struct ast_mrcp_session_pool_t {
+	/* Synchronizes access to the pool. */
+	apr_thread_mutex_t *mutex;
+	/* List of idle channels. */
+	struct speech_channel_t *idle;
+	/* Number of idle channels. */
+	apr_size_t idle_count;
+	/* Kinds of channels requested so far (ast_mrcp_session_class_t). */
+	apr_array_header_t *classes;
+	/* Number of channels taken from the pool. */
+	apr_uint32_t hits;
+	/* Number of channels requested while the pool had none. */
+	apr_uint32_t misses;
+	/* Number of channels returned to the pool. */
+	apr_uint32_t checkins;
+};
+typedef struct ast_mrcp_session_pool_t ast_mrcp_session_pool_t;
+
+/* Latencies measured per speech channel request. */
+enum ast_mrcp_latency_t {
+	/* Open of the channel to the channel being ready. */
+	AST_MRCP_LATENCY_SETUP,
+	/* Request sent to the IN-PROGRESS response. */
+	AST_MRCP_LATENCY_RESPONSE,
+	/* Request sent to the first audio frame. */
+	AST_MRCP_LATENCY_FIRST_AUDIO,
+	/* Request sent to the START-OF-INPUT event. */
+	AST_MRCP_LATENCY_START_OF_INPUT,
+	/* Request sent to the COMPLETE event. */
+	AST_MRCP_LATENCY_COMPLETE,
+	/* Request sent to the first audio frame, of a prompt split into chunks. */
+	AST_MRCP_LATENCY_FIRST_AUDIO_CHUNKED,
+
+	/* This MUST be the last value in this enum! */
+	AST_MRCP_LATENCY_COUNT
+};
+typedef enum ast_mrcp_latency_t ast_mrcp_latency_t;
+
+/* Number of buckets of a latency histogram. */
+#define AST_MRCP_LATENCY_BUCKETS 11
+/* Number of speech channel types latencies are measured for. */
+#define AST_MRCP_LATENCY_TYPES   2
+
+/* Histogram of a latency, updated atomically. */
+struct ast_mrcp_latency_histogram_t {
+	/* Number of measurements per bucket. */
+	volatile apr_uint32_t buckets[AST_MRCP_LATENCY_BUCKETS];
+	/* Number of measurements. */
+	volatile apr_uint32_t count;
+	/* Sum of the measurements (msec), wide enough not to wrap. */
+	volatile apr_uint64_t sum;
+	/* Maximum measurement (msec). */
+	volatile apr_uint32_t max;
+};
+typedef struct ast_mrcp_latency_histogram_t ast_mrcp_latency_histogram_t;
+
 /* Profile-specific configuration. This allows us to handle differing MRCP
  * server behavior on a per-profile basis.
  */
@@ -132,6 +263,22 @@ struct ast_mrcp_profile_t {
 	const char *ssml_mime_type;
 	/* The profile configuration. */
 	apr_hash_t *cfg;
+	/* Minimum number of idle channels per kind of channel. */
+	apr_size_t session_pool_min_idle;
+	/* Maximum number of idle channels, 0 if the session pool is disabled. */
+	apr_size_t session_pool_max_idle;
+	/* Time an idle channel is kept before its session is terminated. */
+	apr_interval_time_t session_pool_idle_ttl;
+	/* The pool of idle channels. */
+	ast_mrcp_session_pool_t *session_pool;
+	/* Latency histograms, indexed by speech channel type and latency. */
+	ast_mrcp_latency_histogram_t latency[AST_MRCP_LATENCY_TYPES][AST_MRCP_LATENCY_COUNT];
+	/* Debug flags applied to the speech channels opened with the profile (SPEECH_CHANNEL_DEBUG_*). */
+	volatile apr_uint32_t debug_flags;
+	/* Name of the MRCP client profile running on the faster than realtime media engine, NULL if none. */
+	const char *batch_name;
+	/* True, if inline grammars are defined by Content-IDs derived from their content. */
+	int grammar_hash_ids;
 };
 typedef struct ast_mrcp_profile_t ast_mrcp_profile_t;
 
@@ -153,4 +300,22 @@ mrcp_client_t *mod_unimrcp_client_create(apr_pool_t *mod_pool);
 
 int load_mrcp_config(const char *filename, const char *who_asked);
 
+int session_pool_start(void);
+
+void session_pool_stop(void);
+
+int session_pool_accepts(ast_mrcp_profile_t *profile);
+
+struct speech_channel_t *session_pool_checkout(ast_mrcp_profile_t *profile, ast_mrcp_application_t *app, int type, const char *codec, apr_uint16_t rate);
+
+int session_pool_checkin(ast_mrcp_profile_t *profile, struct speech_channel_t *schannel);
+
+void profile_latency_record(ast_mrcp_profile_t *profile, int type, ast_mrcp_latency_t latency, apr_interval_time_t elapsed);
+
+const char *profile_latency_to_string(ast_mrcp_latency_t latency);
+
+apr_uint64_t profile_latency_sum(ast_mrcp_latency_histogram_t *histogram);
+
+const char *profile_latency_bucket_to_string(int bucket);
+
 #endif /* AST_UNIMRCP_FRAMEWORK_H */
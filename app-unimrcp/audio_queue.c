@@ -45,156 +45,267 @@
  * 16000 samples/sec * 2 bytes/sample (16-bit) * 1 second = 32000 bytes
  *
  * Make provision for 16kHz sample rates with 16-bit samples, 1 second audio.
+ * The ring capacity is rounded up to the next power of two.
  */
 #define AUDIO_QUEUE_SIZE						(16000 * 2)
 
 #define AUDIO_QUEUE_READ_TIMEOUT_USEC			(30 * 1000000)
 
-/* --- AUDIO BUFFER --- */
+/* Audio queues are allocated from slabs of power of two sizes, from 4 KB 
+ * (8 kHz G.711 at 500 msec) to 1 MB. Larger queues use a dedicated pool.
+ */
+#define AUDIO_QUEUE_SLAB_MIN_SIZE				4096
+#define AUDIO_QUEUE_SLAB_CLASSES				9
+
+static slab_t *audio_queue_slabs[AUDIO_QUEUE_SLAB_CLASSES];
 
-static int audio_buffer_create(audio_buffer_t **buffer, apr_size_t max_len)
+/* --- AUDIO RING --- */
+
+/* Round the specified size up to the next power of two. */
+static apr_uint32_t audio_ring_capacity(apr_size_t size)
 {
-	apr_pool_t *pool;
-	audio_buffer_t *new_buffer;
+	apr_uint32_t capacity = 1;
+	while (capacity < size)
+		capacity <<= 1;
+	return capacity;
+}
 
-	if (buffer == NULL)
-		return -1;
-	else
-		*buffer = NULL;
+/* Copy data into the ring at the specified index, wrapping around the end. */
+static void audio_ring_copy_in(audio_queue_t *queue, apr_uint32_t index, const void *data, apr_size_t datalen)
+{
+	apr_uint32_t offset = index & queue->mask;
+	apr_size_t first = queue->size - offset;
 
-	if ((pool = apt_pool_create()) == NULL)
-		return -1;
+	if (first >= datalen) {
+		memcpy(queue->data + offset, data, datalen);
+	} else {
+		memcpy(queue->data + offset, data, first);
+		memcpy(queue->data, (const apr_byte_t *)data + first, datalen - first);
+	}
+}
 
-	if ((max_len > 0) && ((new_buffer = apr_palloc(pool, sizeof(audio_buffer_t))) != NULL) && ((new_buffer->data = apr_palloc(pool, max_len)) != NULL)) {
-		new_buffer->datalen = max_len;
-		new_buffer->pool = pool;
-		new_buffer->used = 0;
-		*buffer = new_buffer;
-		return 0;
+/* Copy data out of the ring from the specified index, wrapping around the end. */
+static void audio_ring_copy_out(audio_queue_t *queue, apr_uint32_t index, void *data, apr_size_t datalen)
+{
+	apr_uint32_t offset = index & queue->mask;
+	apr_size_t first = queue->size - offset;
+
+	if (first >= datalen) {
+		memcpy(data, queue->data + offset, datalen);
+	} else {
+		memcpy(data, queue->data + offset, first);
+		memcpy((apr_byte_t *)data + first, queue->data, datalen - first);
 	}
+}
 
-	apr_pool_destroy(pool);
-	return -1;
+/* Copy data into the ring at the specified index, dropping samples evenly to fit the output length. */
+static void audio_ring_compress_in(audio_queue_t *queue, apr_uint32_t index, const void *data, apr_size_t datalen, apr_size_t outlen)
+{
+	const apr_byte_t *in = data;
+	apr_size_t sample_size = queue->sample_size;
+	apr_size_t in_samples = datalen / sample_size;
+	apr_size_t out_samples = outlen / sample_size;
+	apr_size_t i, j;
+
+	for (i = 0; i < out_samples; i++) {
+		const apr_byte_t *sample = in + (i * in_samples / out_samples) * sample_size;
+		for (j = 0; j < sample_size; j++) {
+			queue->data[index & queue->mask] = sample[j];
+			index++;
+		}
+	}
 }
 
-static void audio_buffer_destroy(audio_buffer_t *buffer)
+/* --- AUDIO QUEUE --- */
+
+/* Lock the queue mutex, counting the attempts which had to wait for it. */
+static void audio_queue_lock(audio_queue_t *queue)
 {
-	if (buffer != NULL && buffer->pool != NULL) {
-		apr_pool_destroy(buffer->pool);
+	if (APR_STATUS_IS_EBUSY(apr_thread_mutex_trylock(queue->mutex))) {
+		apr_atomic_inc32(&queue->lock_waits);
+		apr_thread_mutex_lock(queue->mutex);
 	}
 }
 
-static apr_size_t audio_buffer_inuse(audio_buffer_t *buffer)
+/* Get the number of bytes available for reading. */
+apr_size_t audio_queue_inuse(audio_queue_t *queue)
 {
-	if (buffer != NULL)
-		return buffer->used;
-	else
+	if (queue == NULL)
 		return 0;
+
+	return (apr_size_t)(apr_atomic_read32(&queue->head) - apr_atomic_read32(&queue->tail));
 }
 
-static apr_size_t audio_buffer_read(audio_buffer_t *buffer, void *data, apr_size_t datalen)
+/* Empty the queue. */
+int audio_queue_clear(audio_queue_t *queue)
 {
-	apr_size_t reading = 0;
+	apr_uint32_t tail;
 
-	if ((buffer == NULL) || (buffer->data == NULL) || (data == NULL) || (datalen == 0))
-		return 0;
+	if (queue == NULL)
+		return -1;
 
-	if (buffer->used < 1) {
-		buffer->used = 0;
-		return 0;
-	} else if (buffer->used >= datalen)
-		reading = datalen;
-	else
-		reading = buffer->used;
+	/* Move the read index up to the write index. A concurrent read detects
+	 * the change of the read index and discards what it has copied. */
+	do {
+		tail = apr_atomic_read32(&queue->tail);
+	} while (apr_atomic_cas32(&queue->tail, apr_atomic_read32(&queue->head), tail) != tail);
 
-	memcpy(data, buffer->data, reading);
-	buffer->used = buffer->used - reading;
-	memmove(buffer->data, buffer->data + reading, buffer->used);
+	if (apr_atomic_read32(&queue->waiting) != 0 && queue->mutex != NULL && queue->cond != NULL) {
+		audio_queue_lock(queue);
+		apr_thread_cond_signal(queue->cond);
+		apr_thread_mutex_unlock(queue->mutex);
+	}
 
-	return reading;
+	return 0;
 }
 
-static apr_size_t audio_buffer_write(audio_buffer_t *buffer, const void *data, apr_size_t datalen)
+/* Discard the specified number of the oldest bytes in the queue. */
+static void audio_queue_drop(audio_queue_t *queue, apr_size_t len)
 {
-	apr_size_t freespace;
+	apr_uint32_t tail;
+	apr_size_t drop;
+
+	/* Keep the read index aligned to samples. */
+	if (queue->sample_size > 1 && len % queue->sample_size)
+		len += queue->sample_size - len % queue->sample_size;
+
+	do {
+		tail = apr_atomic_read32(&queue->tail);
+		drop = (apr_size_t)(apr_atomic_read32(&queue->head) - tail);
+		if (drop > len)
+			drop = len;
+	} while (apr_atomic_cas32(&queue->tail, tail + (apr_uint32_t)drop, tail) != tail);
+}
 
-	if ((buffer == NULL) || (buffer->data == NULL) || (data == NULL))
-		return 0;
+/* Set the overflow policy and the sample size the policy operates on. */
+void audio_queue_overflow_policy_set(audio_queue_t *queue, audio_queue_overflow_policy_t policy, apr_size_t sample_size)
+{
+	if (queue == NULL)
+		return;
 
-	if (datalen == 0)
-		return buffer->used;
+	queue->overflow_policy = policy;
+	queue->sample_size = sample_size;
+}
 
-	freespace = buffer->datalen - buffer->used;
+/* Convert an overflow policy name to its value. */
+int audio_queue_overflow_policy_parse(const char *name, audio_queue_overflow_policy_t *policy)
+{
+	if (name == NULL || policy == NULL)
+		return -1;
 
-	if (freespace < datalen)
-		return 0;
+	if (strcasecmp(name, "drop-newest") == 0)
+		*policy = AUDIO_QUEUE_OVERFLOW_DROP_NEWEST;
+	else if (strcasecmp(name, "drop-oldest") == 0)
+		*policy = AUDIO_QUEUE_OVERFLOW_DROP_OLDEST;
+	else if (strcasecmp(name, "time-compress") == 0)
+		*policy = AUDIO_QUEUE_OVERFLOW_TIME_COMPRESS;
+	else
+		return -1;
 
-	memcpy(buffer->data + buffer->used, data, datalen);
-	buffer->used = buffer->used + datalen;
+	return 0;
+}
 
-	return buffer->used;
+/* Convert an overflow policy to its name. */
+const char *audio_queue_overflow_policy_to_string(audio_queue_overflow_policy_t policy)
+{
+	switch (policy) {
+		case AUDIO_QUEUE_OVERFLOW_DROP_NEWEST: return "drop-newest";
+		case AUDIO_QUEUE_OVERFLOW_DROP_OLDEST: return "drop-oldest";
+		case AUDIO_QUEUE_OVERFLOW_TIME_COMPRESS: return "time-compress";
+		default: return "unknown";
+	}
 }
 
-static void audio_buffer_zero(audio_buffer_t *buffer)
+/* Set up the buffer, mutex and condition variable of a newly allocated queue. */
+static int audio_queue_setup(audio_queue_t *queue, apr_pool_t *pool)
 {
-	if (buffer != NULL)
-		buffer->used = 0;
+	/* The buffer follows the queue structure. */
+	queue->data = (apr_byte_t *)(queue + 1);
+	queue->mutex = NULL;
+	queue->cond = NULL;
+
+	if (apr_thread_mutex_create(&queue->mutex, APR_THREAD_MUTEX_UNNESTED, pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create audio queue mutex\n");
+		return -1;
+	}
+	if (apr_thread_cond_create(&queue->cond, pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create audio queue condition variable\n");
+		apr_thread_mutex_destroy(queue->mutex);
+		queue->mutex = NULL;
+		return -1;
+	}
+	return 0;
 }
 
-/* --- AUDIO QUEUE --- */
+/* Initialize a queue carved out of a slab. */
+static int audio_queue_slab_object_init(slab_t *slab, void *object)
+{
+	return audio_queue_setup((audio_queue_t *)object, slab->pool);
+}
 
-/* Empty the queue. */
-int audio_queue_clear(audio_queue_t *queue)
+/* Create the slabs audio queues are allocated from. */
+int audio_queue_slabs_create(apr_pool_t *pool)
 {
-	if (queue->mutex != NULL)
-		apr_thread_mutex_lock(queue->mutex);
+	int i;
+	char name[32];
 
-	if (queue->buffer != NULL)
-		audio_buffer_zero(queue->buffer);
+	for (i = 0; i < AUDIO_QUEUE_SLAB_CLASSES; i++) {
+		apr_size_t size = (apr_size_t)AUDIO_QUEUE_SLAB_MIN_SIZE << i;
 
-	if (queue->cond != NULL)
-		apr_thread_cond_signal(queue->cond);
+		apr_snprintf(name, sizeof(name), "audio-queue-%"APR_SIZE_T_FMT"k", size / 1024);
+		if ((audio_queue_slabs[i] = slab_create(name, sizeof(audio_queue_t) + size, audio_queue_slab_object_init, pool)) == NULL)
+			return -1;
+	}
+	return 0;
+}
 
-	if (queue->mutex != NULL)
-		apr_thread_mutex_unlock(queue->mutex);
+/* Forget the slabs. */
+void audio_queue_slabs_destroy(void)
+{
+	int i;
 
-	return 0;
+	for (i = 0; i < AUDIO_QUEUE_SLAB_CLASSES; i++)
+		audio_queue_slabs[i] = NULL;
+}
+
+/* Get the smallest slab holding a queue of the specified capacity. */
+static slab_t *audio_queue_slab_get(apr_uint32_t capacity)
+{
+	int i;
+
+	for (i = 0; i < AUDIO_QUEUE_SLAB_CLASSES; i++) {
+		if (capacity <= ((apr_uint32_t)AUDIO_QUEUE_SLAB_MIN_SIZE << i))
+			return audio_queue_slabs[i];
+	}
+	return NULL;
 }
 
 /* Destroy the audio queue. */
 int audio_queue_destroy(audio_queue_t *queue)
 {
 	if (queue != NULL) {
-		char *name = queue->name;
-		if ((name == NULL) || (strlen(name) == 0))
-			name = "";
-
-		if (queue->buffer != NULL) {
-			audio_buffer_zero(queue->buffer);
-			audio_buffer_destroy(queue->buffer);
-			queue->buffer = NULL;
+		ast_log(LOG_DEBUG, "(%s) Audio queue destroyed\n", queue->name);
+
+		if (queue->slab != NULL) {
+			/* Keep the buffer, mutex and condition variable for the next queue. */
+			slab_free(queue->slab, queue);
+			return 0;
 		}
 
 		if (queue->cond != NULL) {
 			if (apr_thread_cond_destroy(queue->cond) != APR_SUCCESS)
-				ast_log(LOG_WARNING, "(%s) Unable to destroy audio queue condition variable\n", name);
+				ast_log(LOG_WARNING, "(%s) Unable to destroy audio queue condition variable\n", queue->name);
 
 			queue->cond = NULL;
 		}
 
 		if (queue->mutex != NULL) {
 			if (apr_thread_mutex_destroy(queue->mutex) != APR_SUCCESS)
-				ast_log(LOG_WARNING, "(%s) Unable to destroy audio queue mutex\n", name);
+				ast_log(LOG_WARNING, "(%s) Unable to destroy audio queue mutex\n", queue->name);
 
 			queue->mutex = NULL;
 		}
 
-		queue->name = NULL;
-		queue->read_bytes = 0;
-		queue->waiting = 0;
-		queue->write_bytes = 0;
-
-		ast_log(LOG_DEBUG, "(%s) Audio queue destroyed\n", name);
 		if (queue->pool != NULL) {
 			apr_pool_destroy(queue->pool);
 		}
@@ -204,133 +315,153 @@ int audio_queue_destroy(audio_queue_t *queue)
 }
 
 /* Create the audio queue. */
-int audio_queue_create(audio_queue_t **audio_queue, const char *name)
+int audio_queue_create(audio_queue_t **audio_queue, const char *name, apr_size_t size)
 {
-	int status = 0;
 	audio_queue_t *laudio_queue = NULL;
-	char *lname = "";
-	apr_pool_t *pool;
+	apr_uint32_t capacity;
+	apr_pool_t *pool = NULL;
+	slab_t *slab;
 
 	if (audio_queue == NULL)
 		return -1;
 	else
 		*audio_queue = NULL;
 
-	if ((pool = apt_pool_create()) == NULL)
-		return -1;
+	if (name == NULL)
+		name = "";
 
-	if ((name == NULL) || (strlen(name) == 0))
-		lname = "";
-	else
-		lname = apr_pstrdup(pool, name);
-	if (lname == NULL)
-		lname = "";
+	capacity = audio_ring_capacity(size > 0 ? size : AUDIO_QUEUE_SIZE);
 
-	if ((laudio_queue = (audio_queue_t *)apr_palloc(pool, sizeof(audio_queue_t))) == NULL) {
-		ast_log(LOG_ERROR, "(%s) Unable to create audio queue\n", lname);
-		return -1;
+	if ((slab = audio_queue_slab_get(capacity)) != NULL) {
+		if ((laudio_queue = (audio_queue_t *)slab_alloc(slab)) == NULL) {
+			ast_log(LOG_ERROR, "(%s) Unable to create audio queue\n", name);
+			return -1;
+		}
 	} else {
-		laudio_queue->buffer = NULL;
-		laudio_queue->cond = NULL;
-		laudio_queue->mutex = NULL;
-		laudio_queue->name = lname;
-		laudio_queue->pool = pool;
-		laudio_queue->read_bytes = 0;
-		laudio_queue->waiting = 0;
-		laudio_queue->write_bytes = 0;
-
-		if (audio_buffer_create(&laudio_queue->buffer, AUDIO_QUEUE_SIZE) != 0) {
-			ast_log(LOG_ERROR, "(%s) Unable to create audio queue buffer\n", laudio_queue->name);
-			status = -1;
-		} else if (apr_thread_mutex_create(&laudio_queue->mutex, APR_THREAD_MUTEX_UNNESTED, pool) != APR_SUCCESS) {
-			ast_log(LOG_ERROR, "(%s) Unable to create audio queue mutex\n", laudio_queue->name);
-			status = -1;
-		} else if (apr_thread_cond_create(&laudio_queue->cond, pool) != APR_SUCCESS) {
-			ast_log(LOG_ERROR, "(%s) Unable to create audio queue condition variable\n", laudio_queue->name);
-			status = -1;
-		} else {
-			*audio_queue = laudio_queue;
-			ast_log(LOG_DEBUG, "(%s) Audio queue created\n", laudio_queue->name);
+		/* Too large for any slab, use a dedicated pool. */
+		if ((pool = apt_pool_create()) == NULL)
+			return -1;
+
+		if (((laudio_queue = (audio_queue_t *)apr_palloc(pool, sizeof(audio_queue_t) + capacity)) == NULL) || (audio_queue_setup(laudio_queue, pool) != 0)) {
+			ast_log(LOG_ERROR, "(%s) Unable to create audio queue\n", name);
+			apr_pool_destroy(pool);
+			return -1;
 		}
 	}
 
-	if (status != 0)
-		audio_queue_destroy(laudio_queue);
-
-	return status;
+	laudio_queue->pool = pool;
+	laudio_queue->slab = slab;
+	apr_cpystrn(laudio_queue->name, name, sizeof(laudio_queue->name));
+	laudio_queue->read_bytes = 0;
+	laudio_queue->write_bytes = 0;
+	laudio_queue->size = capacity;
+	laudio_queue->mask = capacity - 1;
+	apr_atomic_set32(&laudio_queue->head, 0);
+	apr_atomic_set32(&laudio_queue->tail, 0);
+	apr_atomic_set32(&laudio_queue->waiting, 0);
+	apr_atomic_set32(&laudio_queue->lock_waits, 0);
+	apr_atomic_set32(&laudio_queue->overflows, 0);
+	laudio_queue->overflow_policy = AUDIO_QUEUE_OVERFLOW_DROP_NEWEST;
+	laudio_queue->sample_size = 0;
+
+	*audio_queue = laudio_queue;
+	ast_log(LOG_DEBUG, "(%s) Audio queue created, size=%u\n", laudio_queue->name, laudio_queue->size);
+	return 0;
 }
 
 /* Read from the audio queue. */
 apr_status_t audio_queue_read(audio_queue_t *queue, void *data, apr_size_t *data_len, int block)
 {
 	apr_size_t requested;
-	int status = 0;
+	apr_size_t inuse;
+	apr_uint32_t tail;
 
 	if ((queue == NULL) || (data == NULL) || (data_len == NULL))
 		return -1;
 	else
 		requested = *data_len;
 
-	if (queue->mutex != NULL)
-		apr_thread_mutex_lock(queue->mutex);
-
-	/* Wait for data, if allowed. */
-	if (block != 0) {
-		if (audio_buffer_inuse(queue->buffer) < requested) {
-			queue->waiting = requested;
-
-			if ((queue->mutex != NULL) && (queue->cond != NULL))
-				apr_thread_cond_timedwait(queue->cond, queue->mutex, AUDIO_QUEUE_READ_TIMEOUT_USEC);
-
-		}
-
-		queue->waiting = 0;
+	/* Wait for data, if allowed. The lock is only taken on this path. */
+	if ((block != 0) && (audio_queue_inuse(queue) < requested) && (queue->mutex != NULL) && (queue->cond != NULL)) {
+		audio_queue_lock(queue);
+		apr_atomic_set32(&queue->waiting, (apr_uint32_t)requested);
+		if (audio_queue_inuse(queue) < requested)
+			apr_thread_cond_timedwait(queue->cond, queue->mutex, AUDIO_QUEUE_READ_TIMEOUT_USEC);
+		apr_atomic_set32(&queue->waiting, 0);
+		apr_thread_mutex_unlock(queue->mutex);
 	}
 
-	if (audio_buffer_inuse(queue->buffer) < requested)
-		requested = audio_buffer_inuse(queue->buffer);
+	tail = apr_atomic_read32(&queue->tail);
+	inuse = (apr_size_t)(apr_atomic_read32(&queue->head) - tail);
+	if (inuse < requested)
+		requested = inuse;
 
 	if (requested == 0) {
 		*data_len = 0;
-		status = -1;
-	} else {
-		/* Read the data. */
-		*data_len = audio_buffer_read(queue->buffer, data, requested);
-		queue->read_bytes = queue->read_bytes + *data_len;
+		return -1;
 	}
 
-	if (queue->mutex != NULL)
-		apr_thread_mutex_unlock(queue->mutex);
+	/* Read the data and release the space to the producer. */
+	audio_ring_copy_out(queue, tail, data, requested);
+	if (apr_atomic_cas32(&queue->tail, tail + (apr_uint32_t)requested, tail) != tail) {
+		/* The queue has been cleared meanwhile. */
+		*data_len = 0;
+		return -1;
+	}
 
-	return status;
+	queue->read_bytes = queue->read_bytes + requested;
+	*data_len = requested;
+	return 0;
 }
 
 /* Write to the audio queue. */
 int audio_queue_write(audio_queue_t *queue, void *data, apr_size_t *data_len)
 {
-	int status = 0;
+	apr_uint32_t head;
+	apr_size_t freespace;
+	apr_size_t written;
 
 	if ((queue == NULL) || (data == NULL) || (data_len == NULL))
 		return -1;
 
-	if (queue->mutex != NULL)
-		apr_thread_mutex_lock(queue->mutex);
+	head = apr_atomic_read32(&queue->head);
+	freespace = queue->size - (apr_size_t)(head - apr_atomic_read32(&queue->tail));
+	written = *data_len;
 
-	if (audio_buffer_write(queue->buffer, data, *data_len) > 0) {
-		queue->write_bytes = queue->write_bytes + *data_len;
+	if (freespace < written) {
+		apr_atomic_inc32(&queue->overflows);
 
-		if (queue->waiting <= audio_buffer_inuse(queue->buffer)) {
-			if (queue->cond != NULL)
-				apr_thread_cond_signal(queue->cond);
+		if (queue->overflow_policy == AUDIO_QUEUE_OVERFLOW_DROP_OLDEST && written <= queue->size) {
+			/* Make room for the new data. */
+			audio_queue_drop(queue, written - freespace);
+			freespace = queue->size - (apr_size_t)(head - apr_atomic_read32(&queue->tail));
+		} else if (queue->overflow_policy == AUDIO_QUEUE_OVERFLOW_TIME_COMPRESS && queue->sample_size > 0 && freespace >= written / 2) {
+			/* Squeeze the new data into the free space. */
+			written = freespace - freespace % queue->sample_size;
+		}
+
+		if (written == 0 || freespace < written) {
+			ast_log(LOG_WARNING, "(%s) Audio queue overflow!\n", queue->name);
+			*data_len = 0;
+			return -1;
 		}
-	} else {
-		ast_log(LOG_WARNING, "(%s) Audio queue overflow!\n", queue->name);
-		*data_len = 0;
-		status = -1;
 	}
 
-	if (queue->mutex != NULL)
+	/* Copy the data, then publish it to the consumer. */
+	if (written < *data_len)
+		audio_ring_compress_in(queue, head, data, *data_len, written);
+	else
+		audio_ring_copy_in(queue, head, data, written);
+	apr_atomic_set32(&queue->head, head + (apr_uint32_t)written);
+	queue->write_bytes = queue->write_bytes + written;
+	*data_len = written;
+
+	/* Wake up a blocked reader, if any. */
+	if (apr_atomic_read32(&queue->waiting) != 0 && apr_atomic_read32(&queue->waiting) <= audio_queue_inuse(queue)) {
+		audio_queue_lock(queue);
+		apr_thread_cond_signal(queue->cond);
 		apr_thread_mutex_unlock(queue->mutex);
+	}
 
-	return status;
+	return 0;
 }
@@ -19,52 +19,96 @@
 #define AUDIO_QUEUE_H
 
 #include <apr_general.h>
+#include <apr_atomic.h>
 #include <apr_thread_cond.h>
 #include <apr_thread_mutex.h>
+#include "slab.h"
 
-struct audio_buffer_t {
-	/* The memory pool. */
-	apr_pool_t *pool;
-	/* The actual data. */
-	apr_byte_t *data;
-	/* Number of bytes used in the buffer. */
-	apr_size_t used;
-	/* Size of the buffer. */
-	apr_size_t datalen;
+/* Maximum length of the name of a queue. */
+#define AUDIO_QUEUE_NAME_SIZE   64
+
+/* Policy applied when audio is written to a full queue. */
+enum audio_queue_overflow_policy_t {
+	/* Discard the data being written. */
+	AUDIO_QUEUE_OVERFLOW_DROP_NEWEST,
+	/* Discard the oldest queued data to make room. */
+	AUDIO_QUEUE_OVERFLOW_DROP_OLDEST,
+	/* Compress the data being written in time to fit the free space. */
+	AUDIO_QUEUE_OVERFLOW_TIME_COMPRESS
 };
-typedef struct audio_buffer_t audio_buffer_t;
+typedef enum audio_queue_overflow_policy_t audio_queue_overflow_policy_t;
 
+/* Audio queue implemented as a single-producer/single-consumer ring buffer.
+ *
+ * The producer only advances head and the consumer only advances tail, so 
+ * neither side needs a lock to move audio. Both indexes run freely and are 
+ * masked on access, hence the capacity must be a power of two. The mutex 
+ * and condition variable are used by blocking readers only.
+ */
 struct audio_queue_t {
-	/* The memory pool. */
+	/* The memory pool, if the queue is not allocated from a slab. */
 	apr_pool_t *pool;
-	/* The buffer of audio data. */
-	audio_buffer_t *buffer;
-	/* Synchronizes access to queue. */
+	/* The slab the queue is allocated from. */
+	slab_t *slab;
+	/* The ring of audio data. */
+	apr_byte_t *data;
+	/* Capacity of the ring in bytes (power of two). */
+	apr_uint32_t size;
+	/* Mask applied to the head and tail indexes. */
+	apr_uint32_t mask;
+	/* Write index, advanced by the producer only. */
+	volatile apr_uint32_t head;
+	/* Read index, advanced by the consumer only. */
+	volatile apr_uint32_t tail;
+	/* Synchronizes blocked readers. */
 	apr_thread_mutex_t *mutex;
-	/* Signaling for blocked readers/writers. */
+	/* Signaling for blocked readers. */
 	apr_thread_cond_t *cond;
 	/* Total bytes written. */
 	apr_size_t write_bytes;
 	/* Total bytes read. */
 	apr_size_t read_bytes;
 	/* Number of bytes reader is waiting for. */
-	apr_size_t waiting;
+	volatile apr_uint32_t waiting;
+	/* Number of times the queue mutex was found locked (for debugging). */
+	volatile apr_uint32_t lock_waits;
+	/* Number of writes which did not fit in the queue. */
+	volatile apr_uint32_t overflows;
+	/* Overflow policy. */
+	audio_queue_overflow_policy_t overflow_policy;
+	/* Size of a sample in bytes, 0 if samples are not byte aligned. */
+	apr_size_t sample_size;
 	/* Name of this queue (for logging). */
-	char *name;
+	char name[AUDIO_QUEUE_NAME_SIZE];
 };
 typedef struct audio_queue_t audio_queue_t;
 
 
 /* --- AUDIO QUEUE --- */
 
+/* Create the slabs audio queues are allocated from. */
+int audio_queue_slabs_create(apr_pool_t *pool);
+
+/* Forget the slabs, their memory is released with the pool they were created from. */
+void audio_queue_slabs_destroy(void);
+
 /* Empty the queue. */
 int audio_queue_clear(audio_queue_t *queue);
 
 /* Destroy the audio queue. */
 int audio_queue_destroy(audio_queue_t *queue);
 
-/* Create the audio queue. */
-int audio_queue_create(audio_queue_t **audio_queue, const char *name);
+/* Create the audio queue. The size is rounded up to a power of two, 0 selects the default size. */
+int audio_queue_create(audio_queue_t **audio_queue, const char *name, apr_size_t size);
+
+/* Set the overflow policy and the sample size the policy operates on. */
+void audio_queue_overflow_policy_set(audio_queue_t *queue, audio_queue_overflow_policy_t policy, apr_size_t sample_size);
+
+/* Convert an overflow policy name to its value. */
+int audio_queue_overflow_policy_parse(const char *name, audio_queue_overflow_policy_t *policy);
+
+/* Convert an overflow policy to its name. */
+const char *audio_queue_overflow_policy_to_string(audio_queue_overflow_policy_t policy);
 
 /* Read from the audio queue. */
 apr_status_t audio_queue_read(audio_queue_t *queue, void *data, apr_size_t *data_len, int block);
@@ -72,4 +116,7 @@ apr_status_t audio_queue_read(audio_queue_t *queue, void *data, apr_size_t *data
 /* Write to the audio queue. */
 int audio_queue_write(audio_queue_t *queue, void *data, apr_size_t *data_len);
 
+/* Get the number of bytes available for reading. */
+apr_size_t audio_queue_inuse(audio_queue_t *queue);
+
 #endif /* AUDIO_QUEUE_H */
@@ -0,0 +1,181 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include "apt_pool.h"
+#include "ast_unimrcp_framework.h"
+#include "batch_job.h"
+
+/* Worker thread processing the items one after the other. */
+static void * APR_THREAD_FUNC batch_job_run(apr_thread_t *thread, void *data)
+{
+	batch_job_t *job = (batch_job_t *)data;
+	void *worker = NULL;
+	apr_uint32_t index;
+
+	while (!batch_job_cancelled(job) && ((index = apr_atomic_inc32(&job->next)) < job->total)) {
+		switch (job->process(job, index, &worker)) {
+			case BATCH_JOB_COMPLETED: apr_atomic_inc32(&job->completed); break;
+			case BATCH_JOB_SKIPPED: apr_atomic_inc32(&job->skipped); break;
+			default: apr_atomic_inc32(&job->failed); break;
+		}
+		apr_atomic_inc32(&job->done);
+	}
+
+	if ((worker != NULL) && (job->worker_done != NULL))
+		job->worker_done(job, worker);
+
+	/* The last worker reports the outcome. */
+	if (apr_atomic_dec32(&job->running) == 0) {
+		job->finished = apr_time_now();
+		ast_log(LOG_NOTICE, "%s %s: %u completed, %u skipped, %u failed of %u in %"APR_TIME_T_FMT" msec\n",
+			job->name, batch_job_cancelled(job) ? "cancelled" : "completed",
+			apr_atomic_read32(&job->completed), apr_atomic_read32(&job->skipped), apr_atomic_read32(&job->failed),
+			job->total, apr_time_as_msec(job->finished - job->started));
+	}
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Create a job in a pool of its own, to be named and started with batch_job_start() or destroyed. */
+batch_job_t *batch_job_create(batch_job_process_f process, batch_job_worker_done_f worker_done)
+{
+	apr_pool_t *pool;
+	batch_job_t *job;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return NULL;
+
+	job = apr_pcalloc(pool, sizeof(batch_job_t));
+	job->pool = pool;
+	job->name = "Batch job";
+	job->process = process;
+	job->worker_done = worker_done;
+	job->threads = apr_array_make(pool, 8, sizeof(apr_thread_t *));
+	return job;
+}
+
+/* Wait for the worker threads of a job, if any, and destroy it. */
+void batch_job_destroy(batch_job_t *job)
+{
+	apr_status_t status;
+	int i;
+
+	if (job == NULL)
+		return;
+
+	for (i = 0; i < job->threads->nelts; i++)
+		apr_thread_join(&status, APR_ARRAY_IDX(job->threads, i, apr_thread_t *));
+	apr_pool_destroy(job->pool);
+}
+
+/* Make room for a new job in slot, which holds the last job of a kind. Return
+ * 1 if the last job is still running, otherwise destroy it and return 0.
+ */
+int batch_job_claim(batch_job_t **slot)
+{
+	batch_job_t *previous;
+
+	apr_thread_mutex_lock(globals.mutex);
+	previous = *slot;
+	if ((previous != NULL) && (apr_atomic_read32(&previous->running) > 0)) {
+		apr_thread_mutex_unlock(globals.mutex);
+		return 1;
+	}
+	*slot = NULL;
+	apr_thread_mutex_unlock(globals.mutex);
+
+	/* The threads of the previous job have exited or are about to. */
+	batch_job_destroy(previous);
+	return 0;
+}
+
+/* Start a job of total items through up to threads worker threads, and keep it
+ * in slot. The job is destroyed if it cannot be started. Return 0 on success.
+ */
+int batch_job_start(batch_job_t **slot, batch_job_t *job, apr_uint32_t total, apr_size_t threads)
+{
+	apr_size_t i;
+
+	job->total = total;
+	if (threads > (apr_size_t)total)
+		threads = (apr_size_t)total;
+
+	job->started = apr_time_now();
+	apr_atomic_set32(&job->running, (apr_uint32_t)threads);
+	for (i = 0; i < threads; i++) {
+		apr_thread_t *thread = NULL;
+
+		if (apr_thread_create(&thread, NULL, batch_job_run, job, job->pool) != APR_SUCCESS) {
+			ast_log(LOG_WARNING, "Unable to create worker thread of %s\n", job->name);
+			apr_atomic_dec32(&job->running);
+			continue;
+		}
+		APR_ARRAY_PUSH(job->threads, apr_thread_t *) = thread;
+	}
+
+	if (job->threads->nelts == 0) {
+		batch_job_destroy(job);
+		return -1;
+	}
+
+	apr_thread_mutex_lock(globals.mutex);
+	*slot = job;
+	apr_thread_mutex_unlock(globals.mutex);
+	return 0;
+}
+
+/* Get the progress of the job in slot, return -1 if none has run. */
+int batch_job_stats_get(batch_job_t **slot, batch_job_stats_t *stats)
+{
+	batch_job_t *job;
+
+	memset(stats, 0, sizeof(batch_job_stats_t));
+
+	apr_thread_mutex_lock(globals.mutex);
+	if ((job = *slot) != NULL) {
+		stats->running = (apr_atomic_read32(&job->running) > 0);
+		stats->total = job->total;
+		stats->done = apr_atomic_read32(&job->done);
+		stats->completed = apr_atomic_read32(&job->completed);
+		stats->skipped = apr_atomic_read32(&job->skipped);
+		stats->failed = apr_atomic_read32(&job->failed);
+		stats->elapsed = (stats->running ? apr_time_now() : job->finished) - job->started;
+	}
+	apr_thread_mutex_unlock(globals.mutex);
+
+	return (job != NULL) ? 0 : -1;
+}
+
+/* Cancel the job in slot, if any, wait for its worker threads and destroy it. */
+void batch_job_stop(batch_job_t **slot)
+{
+	batch_job_t *job;
+
+	apr_thread_mutex_lock(globals.mutex);
+	job = *slot;
+	*slot = NULL;
+	apr_thread_mutex_unlock(globals.mutex);
+
+	if (job != NULL) {
+		apr_atomic_set32(&job->cancelled, TRUE);
+		batch_job_destroy(job);
+	}
+}
@@ -0,0 +1,133 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef BATCH_JOB_H
+#define BATCH_JOB_H
+
+#include <apr_general.h>
+#include <apr_atomic.h>
+#include <apr_tables.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+/* Outcome of an item of a batch job. */
+enum batch_job_outcome_t {
+	/* The item was processed with a result. */
+	BATCH_JOB_COMPLETED,
+	/* The item needed no processing or gave no result. */
+	BATCH_JOB_SKIPPED,
+	/* The item could not be processed. */
+	BATCH_JOB_FAILED
+};
+typedef enum batch_job_outcome_t batch_job_outcome_t;
+
+typedef struct batch_job_t batch_job_t;
+
+/* Process the item at index of the job. The worker state, such as a speech
+ * channel, is kept by the worker thread across items, NULL at first.
+ */
+typedef batch_job_outcome_t (*batch_job_process_f)(batch_job_t *job, apr_uint32_t index, void **worker);
+
+/* Release the worker state once the worker thread is done, may be NULL. */
+typedef void (*batch_job_worker_done_f)(batch_job_t *job, void *worker);
+
+/* Items processed in the background through parallel worker threads, such
+ * as prompts to pre-synthesize or recorded files to recognize.
+ */
+struct batch_job_t {
+	/* Memory pool of the job. */
+	apr_pool_t *pool;
+	/* Description of the job (for logging). */
+	const char *name;
+	/* Number of items. */
+	apr_uint32_t total;
+	/* Function processing an item. */
+	batch_job_process_f process;
+	/* Function releasing the worker state. */
+	batch_job_worker_done_f worker_done;
+	/* Data of the kind of job. */
+	void *data;
+	/* Index of the next item to process. */
+	volatile apr_uint32_t next;
+	/* Number of items processed. */
+	volatile apr_uint32_t done;
+	/* Number of items processed with a result. */
+	volatile apr_uint32_t completed;
+	/* Number of items which needed no processing or gave no result. */
+	volatile apr_uint32_t skipped;
+	/* Number of items which could not be processed. */
+	volatile apr_uint32_t failed;
+	/* Number of worker threads still running. */
+	volatile apr_uint32_t running;
+	/* True once the job is to be stopped. */
+	volatile apr_uint32_t cancelled;
+	/* The worker threads. */
+	apr_array_header_t *threads;
+	/* Time the job started. */
+	apr_time_t started;
+	/* Time the job finished, 0 while running. */
+	apr_time_t finished;
+};
+
+/* Progress of a batch job. */
+struct batch_job_stats_t {
+	/* True while the job is running. */
+	int running;
+	/* Number of items. */
+	apr_uint32_t total;
+	/* Number of items processed. */
+	apr_uint32_t done;
+	/* Number of items processed with a result. */
+	apr_uint32_t completed;
+	/* Number of items which needed no processing or gave no result. */
+	apr_uint32_t skipped;
+	/* Number of items which could not be processed. */
+	apr_uint32_t failed;
+	/* Time the job has taken so far. */
+	apr_interval_time_t elapsed;
+};
+typedef struct batch_job_stats_t batch_job_stats_t;
+
+/* Create a job in a pool of its own, to be named and started with batch_job_start() or destroyed. */
+batch_job_t *batch_job_create(batch_job_process_f process, batch_job_worker_done_f worker_done);
+
+/* Wait for the worker threads of a job, if any, and destroy it. */
+void batch_job_destroy(batch_job_t *job);
+
+/* Make room for a new job in slot, which holds the last job of a kind. Return
+ * 1 if the last job is still running, otherwise destroy it and return 0.
+ */
+int batch_job_claim(batch_job_t **slot);
+
+/* Start a job of total items through up to threads worker threads, and keep it
+ * in slot. The job is destroyed if it cannot be started. Return 0 on success.
+ */
+int batch_job_start(batch_job_t **slot, batch_job_t *job, apr_uint32_t total, apr_size_t threads);
+
+/* Get the progress of the job in slot, return -1 if none has run. */
+int batch_job_stats_get(batch_job_t **slot, batch_job_stats_t *stats);
+
+/* Cancel the job in slot, if any, wait for its worker threads and destroy it. */
+void batch_job_stop(batch_job_t **slot);
+
+/* Whether the job is to be stopped. */
+static APR_INLINE int batch_job_cancelled(batch_job_t *job)
+{
+	return apr_atomic_read32(&job->cancelled) != 0;
+}
+
+#endif /* BATCH_JOB_H */
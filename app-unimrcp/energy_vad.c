@@ -0,0 +1,209 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+#include "energy_vad.h"
+
+/* Time (msec) chunks must be voiced in a row for speech to start. */
+#define ENERGY_VAD_ONSET       40
+
+/* Squares of the linear values of G.711 samples, indexed by the encoded byte. */
+static apr_uint32_t ulaw_squares[256];
+static apr_uint32_t alaw_squares[256];
+
+/* Decode a G.711 u-law sample. */
+static int ulaw_decode(apr_byte_t u)
+{
+	int t;
+
+	u = ~u;
+	t = ((u & 0x0f) << 3) + 0x84;
+	t <<= (u & 0x70) >> 4;
+	return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+/* Decode a G.711 A-law sample. */
+static int alaw_decode(apr_byte_t a)
+{
+	int t;
+	int seg;
+
+	a ^= 0x55;
+	t = (a & 0x0f) << 4;
+	seg = (a & 0x70) >> 4;
+	if (seg == 0)
+		t += 8;
+	else
+		t = (t + 0x108) << (seg - 1);
+	return (a & 0x80) ? t : -t;
+}
+
+/* Fill the tables the G.711 samples are decoded by, once on load. */
+void energy_vad_tables_init(void)
+{
+	int i;
+	int v;
+
+	for (i = 0; i < 256; i++) {
+		v = ulaw_decode((apr_byte_t)i);
+		ulaw_squares[i] = (apr_uint32_t)(v * v);
+		v = alaw_decode((apr_byte_t)i);
+		alaw_squares[i] = (apr_uint32_t)(v * v);
+	}
+}
+
+/* Sum the squares of 16-bit linear samples. The square of a sample fits in
+ * 31 bits, the sum of two squares in 32 unsigned bits, so pairs are summed
+ * in 32-bit lanes and widened before being accumulated.
+ */
+static apr_uint64_t energy_l16(const apr_int16_t *samples, apr_size_t count)
+{
+	apr_uint64_t sum = 0;
+	apr_size_t i = 0;
+
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+	const __m128i zero = _mm_setzero_si128();
+	apr_uint64_t lanes[2];
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+		__m128i pairs = _mm_madd_epi16(v, v);
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(pairs, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(pairs, zero));
+	}
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint64x2_t acc = vdupq_n_u64(0);
+
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t v = vld1q_s16(samples + i);
+		acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_low_s16(v), vget_low_s16(v))));
+		acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_high_s16(v), vget_high_s16(v))));
+	}
+	sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+
+	for (; i < count; i++)
+		sum += (apr_uint32_t)(samples[i] * samples[i]);
+	return sum;
+}
+
+/* Sum the squares of G.711 samples by table lookup. */
+static apr_uint64_t energy_g711(const apr_uint32_t *squares, const apr_byte_t *samples, apr_size_t count)
+{
+	apr_uint64_t sum = 0;
+	apr_size_t i;
+
+	for (i = 0; i < count; i++)
+		sum += squares[samples[i]];
+	return sum;
+}
+
+/* Create a detector of speech louder than level dBov in audio of the given
+ * codec name and rate. Return NULL if the codec is not supported.
+ */
+energy_vad_t *energy_vad_create(apr_pool_t *pool, const char *codec, apr_uint16_t rate, int level, apr_size_t no_input_timeout)
+{
+	energy_vad_t *vad;
+	double rms;
+
+	if ((vad = apr_palloc(pool, sizeof(energy_vad_t))) == NULL)
+		return NULL;
+
+	if (strcmp(codec, "LPCM") == 0) {
+		vad->codec = ENERGY_VAD_L16;
+		vad->silence = 0;
+	} else if (strcmp(codec, "PCMU") == 0) {
+		vad->codec = ENERGY_VAD_PCMU;
+		vad->silence = 0xff;
+	} else if (strcmp(codec, "PCMA") == 0) {
+		vad->codec = ENERGY_VAD_PCMA;
+		vad->silence = 0xd5;
+	} else
+		return NULL;
+
+	/* The level is relative to a full scale 16-bit sample. */
+	rms = 32768.0 * pow(10.0, level / 20.0);
+	vad->rate = rate;
+	vad->threshold = (apr_uint64_t)(rms * rms);
+	vad->onset_samples = (apr_size_t)rate * ENERGY_VAD_ONSET / 1000;
+	vad->no_input_samples = (apr_size_t)rate * no_input_timeout / 1000;
+	energy_vad_reset(vad);
+	return vad;
+}
+
+/* Start detecting anew, e.g. once the input timers are started. */
+void energy_vad_reset(energy_vad_t *vad)
+{
+	vad->voiced_samples = 0;
+	vad->elapsed_samples = 0;
+	vad->speech = FALSE;
+	vad->no_input = FALSE;
+}
+
+/* Feed a chunk of audio to the detector. Set voiced to whether the chunk is
+ * voiced and return the event detected, if any.
+ */
+energy_vad_event_t energy_vad_process(energy_vad_t *vad, const void *data, apr_size_t len, int *voiced)
+{
+	apr_uint64_t energy;
+	apr_size_t count;
+
+	switch (vad->codec) {
+		case ENERGY_VAD_L16:
+			count = len / sizeof(apr_int16_t);
+			energy = energy_l16((const apr_int16_t *)data, count);
+			break;
+		case ENERGY_VAD_PCMU:
+			count = len;
+			energy = energy_g711(ulaw_squares, (const apr_byte_t *)data, count);
+			break;
+		default:
+			count = len;
+			energy = energy_g711(alaw_squares, (const apr_byte_t *)data, count);
+	}
+
+	*voiced = (count > 0) && (energy > vad->threshold * count);
+	if (vad->speech)
+		return ENERGY_VAD_NONE;
+
+	if (*voiced) {
+		vad->voiced_samples += count;
+		if (vad->voiced_samples >= vad->onset_samples) {
+			vad->speech = TRUE;
+			return ENERGY_VAD_START_OF_SPEECH;
+		}
+	} else
+		vad->voiced_samples = 0;
+
+	vad->elapsed_samples += count;
+	if (vad->no_input_samples && !vad->no_input && (vad->elapsed_samples >= vad->no_input_samples)) {
+		vad->no_input = TRUE;
+		return ENERGY_VAD_NO_INPUT;
+	}
+	return ENERGY_VAD_NONE;
+}
@@ -0,0 +1,98 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef ENERGY_VAD_H
+#define ENERGY_VAD_H
+
+#include <apr_general.h>
+#include <apr_pools.h>
+
+/* Codec of the audio a detector is fed with. */
+enum energy_vad_codec_t {
+	/* 16-bit linear PCM in host byte order. */
+	ENERGY_VAD_L16,
+	/* 8-bit G.711 u-law. */
+	ENERGY_VAD_PCMU,
+	/* 8-bit G.711 A-law. */
+	ENERGY_VAD_PCMA
+};
+typedef enum energy_vad_codec_t energy_vad_codec_t;
+
+/* Event detected in the audio fed to a detector. */
+enum energy_vad_event_t {
+	/* Nothing new. */
+	ENERGY_VAD_NONE,
+	/* Speech started. */
+	ENERGY_VAD_START_OF_SPEECH,
+	/* No speech started within the no-input timeout. */
+	ENERGY_VAD_NO_INPUT
+};
+typedef enum energy_vad_event_t energy_vad_event_t;
+
+/* Energy-based voice activity detector.
+ *
+ * Every chunk of audio fed to the detector is voiced if its mean square
+ * level is above the threshold. Speech starts once chunks are voiced for
+ * the onset time in a row. The detector is fed from a single thread.
+ */
+struct energy_vad_t {
+	/* Codec of the audio. */
+	energy_vad_codec_t codec;
+	/* Number of samples per second. */
+	apr_uint16_t rate;
+	/* Byte of digital silence, per the codec. */
+	apr_byte_t silence;
+	/* Mean square level above which a chunk is voiced. */
+	apr_uint64_t threshold;
+	/* Number of voiced samples in a row speech starts after. */
+	apr_size_t onset_samples;
+	/* Number of samples without speech no input is reported after, 0 if disabled. */
+	apr_size_t no_input_samples;
+	/* Number of voiced samples in a row so far. */
+	apr_size_t voiced_samples;
+	/* Number of samples fed since the last reset, while no speech started. */
+	apr_size_t elapsed_samples;
+	/* True once speech started. */
+	int speech;
+	/* True once no input is reported. */
+	int no_input;
+};
+typedef struct energy_vad_t energy_vad_t;
+
+/* Fill the tables the G.711 samples are decoded by, once on load. */
+void energy_vad_tables_init(void);
+
+/* Create a detector of speech louder than level dBov in audio of the given
+ * codec name and rate. Return NULL if the codec is not supported.
+ */
+energy_vad_t *energy_vad_create(apr_pool_t *pool, const char *codec, apr_uint16_t rate, int level, apr_size_t no_input_timeout);
+
+/* Start detecting anew, e.g. once the input timers are started. */
+void energy_vad_reset(energy_vad_t *vad);
+
+/* Feed a chunk of audio to the detector. Set voiced to whether the chunk is
+ * voiced and return the event detected, if any.
+ */
+energy_vad_event_t energy_vad_process(energy_vad_t *vad, const void *data, apr_size_t len, int *voiced);
+
+/* Whether speech started since the last reset. */
+static APR_INLINE int energy_vad_in_speech(const energy_vad_t *vad)
+{
+	return vad->speech;
+}
+
+#endif /* ENERGY_VAD_H */
@@ -0,0 +1,125 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include "apt_pool.h"
+#include "slab.h"
+
+/* Free objects are chained through their first bytes. */
+struct slab_object_t {
+	struct slab_object_t *next;
+};
+typedef struct slab_object_t slab_object_t;
+
+/* List of the created slabs. Slabs are created and cleared on module load/unload only. */
+static slab_t *slabs = NULL;
+
+/* Create a slab of objects of the specified size. */
+slab_t *slab_create(const char *name, apr_size_t object_size, slab_object_init_f init, apr_pool_t *pool)
+{
+	slab_t *slab;
+	apr_pool_t *slab_pool;
+
+	if ((slab_pool = apt_subpool_create(pool)) == NULL) {
+		ast_log(LOG_ERROR, "Unable to create memory pool for slab %s\n", name);
+		return NULL;
+	}
+
+	slab = apr_palloc(slab_pool, sizeof(slab_t));
+	slab->name = apr_pstrdup(slab_pool, name);
+	slab->object_size = object_size < sizeof(slab_object_t) ? sizeof(slab_object_t) : object_size;
+	slab->pool = slab_pool;
+	slab->mutex = NULL;
+	slab->init = init;
+	slab->free_list = NULL;
+	slab->allocated = 0;
+	slab->free = 0;
+	slab->failures = 0;
+
+	if (apr_thread_mutex_create(&slab->mutex, APR_THREAD_MUTEX_UNNESTED, slab_pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create mutex for slab %s\n", name);
+		apr_pool_destroy(slab_pool);
+		return NULL;
+	}
+
+	slab->next = slabs;
+	slabs = slab;
+
+	ast_log(LOG_DEBUG, "Slab %s created, object size=%"APR_SIZE_T_FMT"\n", slab->name, slab->object_size);
+	return slab;
+}
+
+/* Take an object from the slab. */
+void *slab_alloc(slab_t *slab)
+{
+	slab_object_t *object;
+
+	if (slab == NULL)
+		return NULL;
+
+	apr_thread_mutex_lock(slab->mutex);
+
+	if (slab->free_list != NULL) {
+		/* Reuse a free object. */
+		object = slab->free_list;
+		slab->free_list = object->next;
+		slab->free--;
+	} else {
+		/* Carve a new object, the pool is not thread-safe so keep holding the lock. */
+		object = apr_palloc(slab->pool, slab->object_size);
+		if (object != NULL && slab->init != NULL && slab->init(slab, object) != 0)
+			object = NULL;
+
+		if (object != NULL)
+			slab->allocated++;
+		else
+			slab->failures++;
+	}
+
+	apr_thread_mutex_unlock(slab->mutex);
+
+	return object;
+}
+
+/* Return an object to the slab. */
+void slab_free(slab_t *slab, void *object)
+{
+	slab_object_t *slab_object = object;
+
+	if (slab == NULL || object == NULL)
+		return;
+
+	apr_thread_mutex_lock(slab->mutex);
+	slab_object->next = slab->free_list;
+	slab->free_list = slab_object;
+	slab->free++;
+	apr_thread_mutex_unlock(slab->mutex);
+}
+
+/* Get the first of the created slabs. */
+slab_t *slab_first(void)
+{
+	return slabs;
+}
+
+/* Forget all the created slabs. */
+void slab_list_clear(void)
+{
+	slabs = NULL;
+}
@@ -0,0 +1,74 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <apr_general.h>
+#include <apr_thread_mutex.h>
+
+typedef struct slab_t slab_t;
+
+/* Called once when a new object is carved out of the slab memory. */
+typedef int (*slab_object_init_f)(slab_t *slab, void *object);
+
+/* A process-wide free list of fixed size objects. Objects returned to the 
+ * slab keep whatever was set up by the init function (mutexes, condition 
+ * variables, buffers), so reusing them needs no further allocation.
+ *
+ * A free object is chained through its first pointer-sized bytes, hence 
+ * the state preserved across reuse must not be placed there.
+ */
+struct slab_t {
+	/* Name of the slab (for reporting). */
+	const char *name;
+	/* Size of an object in bytes. */
+	apr_size_t object_size;
+	/* Memory pool objects are carved from. */
+	apr_pool_t *pool;
+	/* Synchronizes access to the free list and the pool. */
+	apr_thread_mutex_t *mutex;
+	/* Function to initialize a newly carved object. */
+	slab_object_init_f init;
+	/* List of free objects. */
+	void *free_list;
+	/* Number of objects carved out of the pool. */
+	apr_uint32_t allocated;
+	/* Number of objects in the free list. */
+	apr_uint32_t free;
+	/* Number of objects which could not be carved out of the pool. */
+	apr_uint32_t failures;
+	/* Next slab in the list of slabs. */
+	slab_t *next;
+};
+
+/* Create a slab of objects of the specified size. */
+slab_t *slab_create(const char *name, apr_size_t object_size, slab_object_init_f init, apr_pool_t *pool);
+
+/* Take an object from the slab. */
+void *slab_alloc(slab_t *slab);
+
+/* Return an object to the slab. */
+void slab_free(slab_t *slab, void *object);
+
+/* Get the first of the created slabs, follow slab_t.next for the rest. */
+slab_t *slab_first(void);
+
+/* Forget all the created slabs. Their memory is released with the pool they were created from. */
+void slab_list_clear(void);
+
+#endif /* SLAB_H */
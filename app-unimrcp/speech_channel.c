@@ -34,13 +34,22 @@
 
 /* Asterisk includes. */
 #include "ast_compat_defs.h"
+#include "asterisk/channel.h"
 #include "asterisk/file.h"
+#include "asterisk/pbx.h"
+
+#include <time.h>
+#include <apr_md5.h>
 
 /* UniMRCP includes. */
 #include "ast_unimrcp_framework.h"
 
 #include "audio_queue.h"
+#include "stream_dump.h"
+#include "tts_cache.h"
+#include "energy_vad.h"
 #include "speech_channel.h"
+#include "content_cache.h"
 
 #define MIME_TYPE_PLAIN_TEXT   "text/plain"
 #define MIME_TYPE_URI_LIST     "text/uri-list"
@@ -61,8 +70,58 @@
 
 #define AUDIO_FILE_ID          "audio:"
 
+/* Number of reads (10 msec each) the drift is estimated over. */
+#define SPEECH_CHANNEL_DRIFT_WINDOW       100
+/* Allowed deviation from the target queue depth (msec). */
+#define SPEECH_CHANNEL_DRIFT_TOLERANCE    20
+
+/* Number of session terminate requests sent before a channel is given up. */
+#define SPEECH_CHANNEL_TEARDOWN_ATTEMPTS  3
+/* Interval the reaper checks the channels pending teardown at. */
+#define SPEECH_CHANNEL_REAPER_INTERVAL    apr_time_from_msec(100)
+
+/* Initial and minimum depth of synthesized speech buffered before playout (msec). */
+#define SPEECH_CHANNEL_PLAYOUT_MIN_DEPTH  40
+/* Maximum depth the playout buffer grows to on underruns (msec). */
+#define SPEECH_CHANNEL_PLAYOUT_MAX_DEPTH  200
+/* Step the depth of the playout buffer is adjusted by (msec). */
+#define SPEECH_CHANNEL_PLAYOUT_STEP       20
+/* Number of frames played out without an underrun before the depth is reduced. */
+#define SPEECH_CHANNEL_PLAYOUT_STABLE     250
+/* Packetization time used if the one of the channel is unknown, and its bounds (msec). */
+#define SPEECH_CHANNEL_PLAYOUT_PTIME      20
+#define SPEECH_CHANNEL_PLAYOUT_MIN_PTIME  10
+#define SPEECH_CHANNEL_PLAYOUT_MAX_PTIME  60
+/* Maximum size of a frame played out. */
+#define SPEECH_CHANNEL_PLAYOUT_FRAME_SIZE 4096
+/* Time without a generator call after which the playout is considered stalled. */
+#define SPEECH_CHANNEL_PLAYOUT_STALL      apr_time_from_msec(500)
+
+/* Size of the chunks the pre-roll ring is replayed by. */
+#define SPEECH_CHANNEL_PREROLL_CHUNK_SIZE 640
+
+/* Time between checks for room in the audio queue while feeding audio from a file. */
+#define SPEECH_CHANNEL_FEED_INTERVAL      apr_time_from_msec(5)
+
+/* Time between reads of an empty audio queue while draining synthesized speech. */
+#define SPEECH_CHANNEL_DRAIN_INTERVAL     apr_time_from_msec(5)
+
 /* --- MRCP SPEECH CHANNEL --- */
 
+/* Slab speech channels are allocated from. */
+static slab_t *speech_channel_slab = NULL;
+
+/* Channels whose session was taken over, synchronized by the globals mutex. */
+static speech_channel_t *retired_channels = NULL;
+
+/* Channels queued for teardown, synchronized by the globals mutex. */
+static speech_channel_t *teardown_channels = NULL;
+
+static void speech_channel_reaper_add(speech_channel_t *schannel);
+static void speech_channel_speak_reset(speech_channel_t *schannel);
+static int text_starts_with(const char *text, const char *match);
+static apr_hash_t *grammar_defined_copy(apr_hash_t *defined_grammars, apr_pool_t *pool);
+
 /* Convert channel state to string. */
 static const char *speech_channel_state_to_string(speech_channel_state_t state)
 {
@@ -96,34 +155,1197 @@ const char *speech_channel_status_to_string(speech_channel_status_t status)
 	}
 }
 
+/* Get the number of bytes per second and the size of a sample for the channel codec. */
+static apr_size_t speech_channel_byte_rate(speech_channel_t *schannel, apr_size_t *sample_size)
+{
+	if (strcmp(schannel->codec, "LPCM") == 0) {
+		*sample_size = 2;
+		return schannel->rate * 2;
+	}
+	if (strcmp(schannel->codec, "G722") == 0) {
+		/* 64 kbit/s, samples are not byte aligned. */
+		*sample_size = 0;
+		return 8000;
+	}
+	/* 8-bit PCMU, PCMA. */
+	*sample_size = 1;
+	return schannel->rate;
+}
+
+/* Set or clear debug flags of the channel. The dump is created once dumping is 
+ * first enabled and kept until the channel is released, as the media engine 
+ * uses it without a lock.
+ */
+int speech_channel_debug_set(speech_channel_t *schannel, apr_uint32_t flags, int enable)
+{
+	apr_uint32_t debug;
+	apr_uint32_t prev;
+	stream_dump_t *dump;
+
+	if (schannel == NULL)
+		return -1;
+
+	do {
+		prev = apr_atomic_read32(&schannel->debug);
+		debug = enable ? (prev | flags) : (prev & ~flags);
+	} while (apr_atomic_cas32(&schannel->debug, debug, prev) != prev);
+
+	if (!(flags & SPEECH_CHANNEL_DEBUG_DUMP))
+		return 0;
+
+	if (((dump = schannel->dump) == NULL) && enable) {
+		apr_size_t sample_size;
+		char path[256];
+
+		apr_snprintf(path, sizeof(path), "%s/%s-%s", SPEECH_CHANNEL_DUMP_DIR, schannel->name, schannel->codec);
+		if ((dump = stream_dump_create(path, speech_channel_byte_rate(schannel, &sample_size))) == NULL) {
+			ast_log(LOG_WARNING, "(%s) Unable to create stream dump\n", schannel->name);
+			return -1;
+		}
+
+		/* Another thread may have enabled dumping meanwhile. */
+		if (apr_atomic_casptr((volatile void **)&schannel->dump, dump, NULL) != NULL) {
+			stream_dump_destroy(dump);
+			dump = schannel->dump;
+		}
+	}
+
+	stream_dump_enable(dump, enable);
+	return 0;
+}
+
+/* Destroy the dump of a channel no longer used by the media engine. */
+static void speech_channel_dump_destroy(speech_channel_t *schannel)
+{
+	stream_dump_t *dump = schannel->dump;
+
+	schannel->dump = NULL;
+	apr_atomic_set32(&schannel->debug, 0);
+	stream_dump_destroy(dump);
+}
+
+/* Add the speech channel to the active channels. */
+static void speech_channel_register(speech_channel_t *schannel)
+{
+	if (globals.channels == NULL)
+		return;
+
+	apr_thread_mutex_lock(globals.mutex);
+	apr_hash_set(globals.channels, schannel->name, APR_HASH_KEY_STRING, schannel);
+	apr_thread_mutex_unlock(globals.mutex);
+}
+
+/* Remove the speech channel from the active channels. */
+static void speech_channel_unregister(speech_channel_t *schannel)
+{
+	if (globals.channels == NULL || schannel->name == NULL)
+		return;
+
+	apr_thread_mutex_lock(globals.mutex);
+	if (apr_hash_get(globals.channels, schannel->name, APR_HASH_KEY_STRING) == schannel)
+		apr_hash_set(globals.channels, schannel->name, APR_HASH_KEY_STRING, NULL);
+	apr_thread_mutex_unlock(globals.mutex);
+}
+
+/* Initialize a speech channel carved out of the slab. The mutex and condition 
+ * variable are kept when the channel is returned to the slab.
+ */
+static int speech_channel_slab_object_init(slab_t *slab, void *object)
+{
+	speech_channel_t *schannel = object;
+
+	schannel->mutex = NULL;
+	schannel->cond = NULL;
+
+	if ((apr_thread_mutex_create(&schannel->mutex, APR_THREAD_MUTEX_UNNESTED, slab->pool) != APR_SUCCESS) || (schannel->mutex == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create channel mutex\n");
+		return -1;
+	}
+	if ((apr_thread_cond_create(&schannel->cond, slab->pool) != APR_SUCCESS) || (schannel->cond == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create channel condition variable\n");
+		apr_thread_mutex_destroy(schannel->mutex);
+		return -1;
+	}
+	return 0;
+}
+
+/* Keep a channel which may still be referenced by the media engine until the 
+ * retired channels are reaped.
+ */
+static void speech_channel_retire(speech_channel_t *schannel)
+{
+	schannel->idle_since = apr_time_now();
+
+	apr_thread_mutex_lock(globals.mutex);
+	schannel->idle_next = retired_channels;
+	retired_channels = schannel;
+	apr_thread_mutex_unlock(globals.mutex);
+}
+
+/* Return the channels retired for longer than the grace period to the slab. */
+void speech_channel_retired_reap(apr_interval_time_t grace)
+{
+	speech_channel_t **prev;
+	speech_channel_t *schannel;
+	apr_time_t now = apr_time_now();
+
+	apr_thread_mutex_lock(globals.mutex);
+	prev = &retired_channels;
+	while ((schannel = *prev) != NULL) {
+		if (now - schannel->idle_since >= grace) {
+			*prev = schannel->idle_next;
+			if (schannel->audio_queue != NULL)
+				audio_queue_destroy(schannel->audio_queue);
+			if (schannel->preroll != NULL)
+				audio_queue_destroy(schannel->preroll);
+			if (schannel->warm_pool != NULL)
+				apr_pool_destroy(schannel->warm_pool);
+			schannel->audio_queue = NULL;
+			schannel->preroll = NULL;
+			schannel->warm_pool = NULL;
+			schannel->idle_next = NULL;
+			speech_channel_dump_destroy(schannel);
+			slab_free(speech_channel_slab, schannel);
+		} else
+			prev = &schannel->idle_next;
+	}
+	apr_thread_mutex_unlock(globals.mutex);
+}
+
+/* Create the slab speech channels are allocated from. */
+int speech_channel_slabs_create(apr_pool_t *pool)
+{
+	if ((speech_channel_slab = slab_create("speech-channel", sizeof(speech_channel_t), speech_channel_slab_object_init, pool)) == NULL)
+		return -1;
+	return 0;
+}
+
+/* Forget the slab. */
+void speech_channel_slabs_destroy(void)
+{
+	speech_channel_slab = NULL;
+}
+
+/* --- CLOCK DRIFT --- */
+
+/* Initialize the clock drift estimator. */
+static void speech_channel_drift_init(speech_channel_t *schannel, apr_size_t byte_rate, apr_size_t sample_size)
+{
+	speech_channel_drift_t *drift = &schannel->drift;
+
+	memset(drift, 0, sizeof(speech_channel_drift_t));
+	drift->byte_rate = byte_rate;
+	drift->sample_size = sample_size;
+
+	/* Samples can only be dropped or inserted if they are byte aligned. */
+	if (sample_size > 0 && globals.audio_queue_target_depth > 0) {
+		drift->target_depth = byte_rate * globals.audio_queue_target_depth / 1000;
+		drift->tolerance = byte_rate * SPEECH_CHANNEL_DRIFT_TOLERANCE / 1000;
+		/* Large enough for a 20 msec frame and an extra sample. */
+		drift->scratch_size = byte_rate * 20 / 1000 + sample_size;
+		drift->scratch = apr_palloc(schannel->pool, drift->scratch_size);
+	}
+}
+
+/* Update the drift estimation with the queue depth sampled before a read. */
+static void speech_channel_drift_update(speech_channel_t *schannel, apr_size_t depth, apr_size_t read_len)
+{
+	speech_channel_drift_t *drift = &schannel->drift;
+	apr_size_t average;
+
+	drift->depth_sum += depth;
+	drift->window_bytes += read_len;
+	if (++drift->window_reads < SPEECH_CHANNEL_DRIFT_WINDOW)
+		return;
+
+	average = drift->depth_sum / drift->window_reads;
+	if (drift->primed && drift->window_bytes > 0) {
+		/* The change of the depth over the window, not counting the samples dropped 
+		 * or inserted, is the difference between the writer and reader clocks. */
+		apr_int64_t delta = (apr_int64_t)average - (apr_int64_t)drift->average_depth + drift->window_adjusted;
+		apr_int32_t ppm = (apr_int32_t)(delta * 1000000 / (apr_int64_t)drift->window_bytes);
+		apr_int32_t prev_ppm = (apr_int32_t)apr_atomic_read32(&drift->drift_ppm);
+
+		/* Smooth the estimation. */
+		apr_atomic_set32(&drift->drift_ppm, (apr_uint32_t)((prev_ppm * 3 + ppm) / 4));
+	}
+
+	drift->average_depth = average;
+	drift->primed = 1;
+	if (drift->byte_rate > 0)
+		apr_atomic_set32(&drift->depth_ms, (apr_uint32_t)(average * 1000 / drift->byte_rate));
+
+	drift->depth_sum = 0;
+	drift->window_bytes = 0;
+	drift->window_reads = 0;
+	drift->window_adjusted = 0;
+}
+
+/* Read from the audio queue, dropping or inserting a sample to keep the queue near the target depth. */
+static int speech_channel_drift_read(speech_channel_t *schannel, void *data, apr_size_t *len, int block)
+{
+	speech_channel_drift_t *drift = &schannel->drift;
+	apr_size_t requested = *len;
+	apr_size_t sample_size = drift->sample_size;
+	apr_size_t scratch_len;
+	apr_size_t half;
+	int status;
+
+	if (!drift->target_depth || !drift->primed || requested + sample_size > drift->scratch_size || requested < 2 * sample_size)
+		return audio_queue_read(schannel->audio_queue, data, len, block);
+
+	if (drift->average_depth > drift->target_depth + drift->tolerance) {
+		/* The writer is ahead, drop a sample in the middle of the frame. */
+		scratch_len = requested + sample_size;
+		status = audio_queue_read(schannel->audio_queue, drift->scratch, &scratch_len, block);
+		if (status != 0 || scratch_len < requested + sample_size) {
+			memcpy(data, drift->scratch, scratch_len);
+			*len = scratch_len;
+			return status;
+		}
+
+		half = requested / sample_size / 2 * sample_size;
+		memcpy(data, drift->scratch, half);
+		memcpy((apr_byte_t *)data + half, drift->scratch + half + sample_size, requested - half);
+		drift->window_adjusted += sample_size;
+		apr_atomic_inc32(&drift->dropped);
+		return 0;
+	}
+
+	if (drift->average_depth + drift->tolerance < drift->target_depth) {
+		/* The writer is behind, repeat a sample in the middle of the frame. */
+		scratch_len = requested - sample_size;
+		status = audio_queue_read(schannel->audio_queue, drift->scratch, &scratch_len, block);
+		if (status != 0 || scratch_len < requested - sample_size) {
+			memcpy(data, drift->scratch, scratch_len);
+			*len = scratch_len;
+			return status;
+		}
+
+		half = scratch_len / sample_size / 2 * sample_size;
+		memcpy(data, drift->scratch, half + sample_size);
+		memcpy((apr_byte_t *)data + half + sample_size, drift->scratch + half, scratch_len - half);
+		drift->window_adjusted -= sample_size;
+		apr_atomic_inc32(&drift->inserted);
+		return 0;
+	}
+
+	return audio_queue_read(schannel->audio_queue, data, len, block);
+}
+
+/* --- PLAYOUT --- */
+
+/* Fill the frame with data, preceded by AST_FRIENDLY_OFFSET bytes of headroom. */
+static APR_INLINE void ast_frame_fill(speech_channel_t *schannel, struct ast_frame *fr, void *data, apr_size_t size)
+{
+	memset(fr, 0, sizeof(*fr));
+	fr->frametype = AST_FRAME_VOICE;
+	ast_frame_set_format(fr, schannel->format);
+	fr->datalen = size;
+	fr->samples = 8 * size / schannel->bits_per_sample;
+	ast_frame_set_data(fr, data);
+	fr->mallocd = 0;
+	fr->offset = AST_FRIENDLY_OFFSET;
+	fr->src = __PRETTY_FUNCTION__;
+	fr->delivery.tv_sec = 0;
+	fr->delivery.tv_usec = 0;
+}
+
+/* Initialize the playout of synthesized speech. */
+static void speech_channel_playout_init(speech_channel_t *schannel, apr_size_t byte_rate)
+{
+	speech_channel_playout_t *playout = &schannel->playout;
+
+	playout->byte_rate = byte_rate;
+	playout->target_depth = byte_rate * SPEECH_CHANNEL_PLAYOUT_MIN_DEPTH / 1000;
+	apr_atomic_set32(&playout->active, FALSE);
+	apr_atomic_set32(&playout->draining, FALSE);
+	apr_atomic_set32(&playout->muted, FALSE);
+	playout->buffering = TRUE;
+	playout->stable_frames = 0;
+	playout->last_generate = 0;
+	playout->frame_len = 0;
+	playout->frame_samples = 0;
+	playout->credit = 0;
+	playout->cached = NULL;
+	playout->cached_offset = 0;
+}
+
+/* Size the frames played out to the packetization time negotiated for the channel. */
+static void speech_channel_playout_framing(speech_channel_t *schannel, struct ast_channel *chan)
+{
+	speech_channel_playout_t *playout = &schannel->playout;
+	unsigned int ptime = ast_channel_get_write_framing(chan);
+
+	if ((ptime < SPEECH_CHANNEL_PLAYOUT_MIN_PTIME) || (ptime > SPEECH_CHANNEL_PLAYOUT_MAX_PTIME))
+		ptime = SPEECH_CHANNEL_PLAYOUT_PTIME;
+	while ((ptime > SPEECH_CHANNEL_PLAYOUT_MIN_PTIME) && (playout->byte_rate * ptime / 1000 > SPEECH_CHANNEL_PLAYOUT_FRAME_SIZE))
+		ptime -= SPEECH_CHANNEL_PLAYOUT_MIN_PTIME;
+
+	playout->frame_samples = schannel->rate * ptime / 1000;
+	playout->frame_len = playout->frame_samples * schannel->bits_per_sample / 8;
+	playout->credit = 0;
+}
+
+/* Grow or shrink the playout buffer by a step, within the bounds and the capacity of the audio queue. */
+static void speech_channel_playout_adjust(speech_channel_t *schannel, int grow)
+{
+	speech_channel_playout_t *playout = &schannel->playout;
+	apr_size_t step = playout->byte_rate * SPEECH_CHANNEL_PLAYOUT_STEP / 1000;
+	apr_size_t min_depth = playout->byte_rate * SPEECH_CHANNEL_PLAYOUT_MIN_DEPTH / 1000;
+	apr_size_t max_depth = playout->byte_rate * SPEECH_CHANNEL_PLAYOUT_MAX_DEPTH / 1000;
+
+	if (max_depth > schannel->audio_queue->size / 2)
+		max_depth = schannel->audio_queue->size / 2;
+
+	if (grow)
+		playout->target_depth = (playout->target_depth + step < max_depth) ? playout->target_depth + step : max_depth;
+	else
+		playout->target_depth = (playout->target_depth > min_depth + step) ? playout->target_depth - step : min_depth;
+
+	playout->stable_frames = 0;
+}
+
+static void *speech_channel_playout_alloc(struct ast_channel *chan, void *params)
+{
+	speech_channel_t *schannel = (speech_channel_t *)params;
+
+	schannel->playout.buffering = TRUE;
+	schannel->playout.stable_frames = 0;
+	schannel->playout.last_generate = apr_time_now();
+	apr_atomic_set32(&schannel->playout.active, TRUE);
+	return schannel;
+}
+
+static void speech_channel_playout_release(struct ast_channel *chan, void *data)
+{
+	speech_channel_t *schannel = (speech_channel_t *)data;
+
+	apr_atomic_set32(&schannel->playout.active, FALSE);
+}
+
+/* Read the next frame to play out, from the cached prompt or the audio queue. */
+static apr_status_t speech_channel_playout_read(speech_channel_t *schannel, void *data, apr_size_t *len)
+{
+	speech_channel_playout_t *playout = &schannel->playout;
+
+	if (playout->cached == NULL)
+		return audio_queue_read(schannel->audio_queue, data, len, 0);
+
+	if (*len > playout->cached->len - playout->cached_offset)
+		*len = playout->cached->len - playout->cached_offset;
+	if (*len == 0)
+		return -1;
+
+	memcpy(data, playout->cached->data + playout->cached_offset, *len);
+	playout->cached_offset += *len;
+	return 0;
+}
+
+/* Write queued synthesized speech to the channel. Called from the thread of the 
+ * Asterisk channel, which is the only reader of the audio queue of a synthesizer.
+ */
+static int speech_channel_playout_generate(struct ast_channel *chan, void *data, int len, int samples)
+{
+	speech_channel_t *schannel = (speech_channel_t *)data;
+	speech_channel_playout_t *playout = &schannel->playout;
+	audio_queue_t *queue = schannel->audio_queue;
+	apr_byte_t buffer[AST_FRIENDLY_OFFSET + SPEECH_CHANNEL_PLAYOUT_FRAME_SIZE];
+	int completed;
+	apr_size_t depth;
+	apr_size_t frame_len;
+	struct ast_frame fr;
+
+	/* All the audio of a cached prompt is available. */
+	if (playout->cached != NULL) {
+		completed = TRUE;
+		depth = playout->cached->len - playout->cached_offset;
+	} else {
+		completed = (speech_channel_get_state(schannel) != SPEECH_CHANNEL_PROCESSING);
+		depth = audio_queue_inuse(queue);
+	}
+
+	playout->last_generate = apr_time_now();
+
+	/* Nothing is played out once muted on barge-in. */
+	if (apr_atomic_read32(&playout->muted)) {
+		playout->credit = 0;
+		return 0;
+	}
+
+	/* Hold the audio back until the buffer is filled, unless no more audio is coming. */
+	if (playout->buffering) {
+		if ((depth < playout->target_depth) && !completed) {
+			playout->credit = 0;
+			return 0;
+		}
+		playout->buffering = FALSE;
+	}
+
+	/* Emit whole frames of the packetization time of the channel, as many as the 
+	 * elapsed samples allow. The frame is read right after the headroom Asterisk 
+	 * may use to prepend headers without copying the frame.
+	 */
+	playout->credit += samples;
+	while (playout->credit >= playout->frame_samples) {
+		if (playout->cached == NULL)
+			depth = audio_queue_inuse(queue);
+		if ((depth < playout->frame_len) && !completed) {
+			/* The synthesizer fell behind, buffer more before resuming. */
+			apr_atomic_inc32(&schannel->underruns);
+			speech_channel_playout_adjust(schannel, TRUE);
+			playout->buffering = TRUE;
+			playout->credit = 0;
+			return 0;
+		}
+
+		frame_len = playout->frame_len;
+		if ((depth == 0) || (speech_channel_playout_read(schannel, buffer + AST_FRIENDLY_OFFSET, &frame_len) != 0)) {
+			playout->credit = 0;
+			return 0;
+		}
+		playout->credit -= playout->frame_samples;
+		depth -= frame_len;
+
+		if (schannel->rec_file)
+			fwrite(buffer + AST_FRIENDLY_OFFSET, 1, frame_len, schannel->rec_file);
+		if (playout->cached == NULL) {
+			tts_cache_capture_write(schannel->capture, buffer + AST_FRIENDLY_OFFSET, frame_len);
+			schannel->capture_len += frame_len;
+		}
+
+		ast_frame_fill(schannel, &fr, buffer + AST_FRIENDLY_OFFSET, frame_len);
+		if (ast_write(chan, &fr) < 0) {
+			ast_log(LOG_WARNING, "(%s) Unable to write frame to channel: %s\n", schannel->name, strerror(errno));
+			return -1;
+		}
+
+		if (++playout->stable_frames >= SPEECH_CHANNEL_PLAYOUT_STABLE)
+			speech_channel_playout_adjust(schannel, FALSE);
+	}
+
+	return 0;
+}
+
+static struct ast_generator speech_channel_playout_generator = {
+	.alloc = speech_channel_playout_alloc,
+	.release = speech_channel_playout_release,
+	.generate = speech_channel_playout_generate,
+};
+
+/* Release the cached prompt played out. */
+static void speech_channel_playout_uncache(speech_channel_t *schannel)
+{
+	tts_cache_entry_t *entry = schannel->playout.cached;
+
+	schannel->playout.cached = NULL;
+	schannel->playout.cached_offset = 0;
+	tts_cache_entry_release(entry);
+}
+
+/* Activate the playout generator on the Asterisk channel. */
+static int speech_channel_playout_activate(speech_channel_t *schannel, struct ast_channel *chan)
+{
+	speech_channel_playout_framing(schannel, chan);
+	apr_atomic_set32(&schannel->playout.muted, FALSE);
+	if (ast_activate_generator(chan, &speech_channel_playout_generator, schannel) != 0) {
+		ast_log(LOG_ERROR, "(%s) Unable to start playout on %s\n", schannel->name, ast_channel_name(chan));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Start playing out synthesized speech to the Asterisk channel. */
+int speech_channel_playout_start(speech_channel_t *schannel)
+{
+	struct ast_channel *chan = schannel->chan;
+
+	/* The speech synthesized without a call is drained by speech_channel_cache_drain(). */
+	if (chan == NULL) {
+		apr_atomic_set32(&schannel->playout.draining, TRUE);
+		return 0;
+	}
+
+	/* Deactivate a generator playing out a cached prompt before the prompt is released. */
+	if (schannel->playout.cached != NULL) {
+		if (apr_atomic_read32(&schannel->playout.active))
+			ast_deactivate_generator(chan);
+		speech_channel_playout_uncache(schannel);
+	}
+
+	return speech_channel_playout_activate(schannel, chan);
+}
+
+/* Play out a prompt from the TTS cache, taking over the reference to the entry. */
+int speech_channel_playout_cached(speech_channel_t *schannel, tts_cache_entry_t *entry)
+{
+	struct ast_channel *chan = schannel->chan;
+
+	if (chan == NULL) {
+		tts_cache_entry_release(entry);
+		return -1;
+	}
+
+	if (apr_atomic_read32(&schannel->playout.active))
+		ast_deactivate_generator(chan);
+	speech_channel_playout_uncache(schannel);
+
+	schannel->playout.cached = entry;
+	schannel->playout.cached_offset = 0;
+	return speech_channel_playout_activate(schannel, chan);
+}
+
+/* Start a capture of the synthesized speech written to the audio queue from now on. */
+static void speech_channel_capture_start(speech_channel_t *schannel, tts_cache_capture_t *capture)
+{
+	apr_thread_mutex_lock(schannel->mutex);
+	schannel->capture = capture;
+	schannel->capture_overflows = apr_atomic_read32(&schannel->audio_queue->overflows);
+	schannel->capture_tail = apr_atomic_read32(&schannel->audio_queue->tail);
+	schannel->capture_len = 0;
+	apr_atomic_set32(&schannel->drain_cancelled, FALSE);
+	apr_thread_mutex_unlock(schannel->mutex);
+}
+
+/* Whether everything the media engine wrote to the audio queue since the 
+ * capture started was read into the capture, rather than discarded by a 
+ * clear or an overflow.
+ */
+static int speech_channel_capture_consumed(speech_channel_t *schannel)
+{
+	audio_queue_t *queue = schannel->audio_queue;
+
+	return (apr_atomic_read32(&queue->overflows) == schannel->capture_overflows) && 
+		(schannel->capture_len == (apr_size_t)(apr_uint32_t)(apr_atomic_read32(&queue->head) - schannel->capture_tail));
+}
+
+/* Add the captured synthesized speech to the TTS cache, if the whole prompt 
+ * has been played out. Return 0 if the prompt was added.
+ */
+static int speech_channel_cache_finish(speech_channel_t *schannel)
+{
+	tts_cache_capture_t *capture;
+	int complete;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	capture = schannel->capture;
+	schannel->capture = NULL;
+	complete = !apr_atomic_read32(&schannel->playout.muted) && speech_channel_capture_consumed(schannel);
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	if (capture == NULL)
+		return -1;
+
+	return tts_cache_capture_finish(capture, complete);
+}
+
+/* Stop playing out synthesized speech and discard the queued audio. */
+void speech_channel_playout_stop(speech_channel_t *schannel)
+{
+	struct ast_channel *chan = schannel->chan;
+
+	/* The capture is concluded once the generator no longer reads into it, and 
+	 * before the queue is cleared, for the audio left unplayed to be accounted for. */
+	if ((chan != NULL) && apr_atomic_read32(&schannel->playout.active)) {
+		ast_deactivate_generator(chan);
+		speech_channel_cache_finish(schannel);
+		audio_queue_clear(schannel->audio_queue);
+	} else
+		speech_channel_cache_finish(schannel);
+
+	speech_channel_playout_uncache(schannel);
+}
+
+/* Whether queued synthesized speech is still being played out. A generator 
+ * which is no longer called, e.g. as the channel has no timing source, is 
+ * not waited for.
+ */
+int speech_channel_playout_pending(speech_channel_t *schannel)
+{
+	speech_channel_playout_t *playout = &schannel->playout;
+
+	if (!apr_atomic_read32(&playout->active) || apr_atomic_read32(&playout->muted))
+		return FALSE;
+
+	if (playout->cached != NULL) {
+		if (playout->cached_offset >= playout->cached->len)
+			return FALSE;
+	} else if (audio_queue_inuse(schannel->audio_queue) == 0)
+		return FALSE;
+
+	return (apr_time_now() - playout->last_generate) < SPEECH_CHANNEL_PLAYOUT_STALL;
+}
+
+/* Silence the playout at once and discard the queued audio. This may be called 
+ * from any thread, e.g. on START-OF-INPUT, ahead of the generator being 
+ * deactivated by speech_channel_playout_stop() from the thread of the channel.
+ */
+void speech_channel_playout_mute(speech_channel_t *schannel)
+{
+	if (apr_atomic_xchg32(&schannel->playout.muted, TRUE))
+		return;
+
+	audio_queue_clear(schannel->audio_queue);
+	ast_log(LOG_DEBUG, "(%s) Playout muted\n", schannel->name);
+}
+
+/* --- TTS CACHE --- */
+
+/* Look up a prompt in the TTS cache. Prompts stored in files or referenced by 
+ * URI are not cached, as their content may change. Return the key of a 
+ * cacheable prompt in key.
+ */
+tts_cache_entry_t *speech_channel_cache_lookup(speech_channel_t *schannel, ast_mrcp_profile_t *profile, const char *text, apr_hash_t *header_fields, const char **key)
+{
+	const char *content_type;
+
+	*key = NULL;
+	if (!tts_cache_enabled() || (text == NULL))
+		return NULL;
+
+	if (schannel->profile != NULL)
+		profile = schannel->profile;
+	if (profile == NULL)
+		return NULL;
+
+	if (text_starts_with(text, "/") || text_starts_with(text, HTTP_ID) || text_starts_with(text, HTTPS_ID) || text_starts_with(text, FILE_ID))
+		return NULL;
+
+	if (text_starts_with(text, XML_ID) || text_starts_with(text, SSML_ID))
+		content_type = profile->ssml_mime_type;
+	else
+		content_type = MIME_TYPE_PLAIN_TEXT;
+
+	*key = tts_cache_key(schannel->pool, profile->name, schannel->codec, schannel->rate, content_type, header_fields, text);
+	return tts_cache_lookup(*key);
+}
+
+/* Capture the synthesized speech of the next SPEAK request for the TTS cache. */
+void speech_channel_cache_capture(speech_channel_t *schannel, const char *key)
+{
+	tts_cache_capture_t *capture;
+
+	/* Conclude the capture of the previous prompt, which has been played out. */
+	speech_channel_cache_finish(schannel);
+
+	if ((key == NULL) || ((capture = tts_cache_capture_create(key)) == NULL))
+		return;
+
+	speech_channel_capture_start(schannel, capture);
+}
+
+/* Mark the captured SPEAK request as successfully completed. */
+void speech_channel_cache_complete(speech_channel_t *schannel)
+{
+	apr_thread_mutex_lock(schannel->mutex);
+	tts_cache_capture_complete(schannel->capture);
+	apr_thread_mutex_unlock(schannel->mutex);
+}
+
+/* Drain the synthesized speech of the SPEAK request sent on a channel not 
+ * attached to a call into its capture and the file, if any. The calling thread 
+ * takes the place of the playout generator as the only reader of the audio 
+ * queue, and polls it as fast as the media engine writes. Return 0 once the 
+ * request is no longer in progress.
+ */
+int speech_channel_drain(speech_channel_t *schannel, apr_interval_time_t timeout, FILE *file)
+{
+	apr_byte_t buffer[SPEECH_CHANNEL_PLAYOUT_FRAME_SIZE];
+	apr_time_t deadline = apr_time_now() + timeout;
+	apr_uint32_t tail = apr_atomic_read32(&schannel->audio_queue->tail);
+	apr_uint32_t overflows = apr_atomic_read32(&schannel->audio_queue->overflows);
+	apr_size_t drained = 0;
+	apr_size_t len;
+	int processing;
+	int status = 0;
+
+	/* Also drained when the request failed before any audio, to drop its capture. */
+	if (schannel->chan != NULL)
+		return -1;
+
+	for (;;) {
+		/* Cancelled by another thread, which leaves the request to be stopped here. */
+		if (apr_atomic_read32(&schannel->drain_cancelled)) {
+			ast_log(LOG_DEBUG, "(%s) Drain of synthesized speech cancelled\n", schannel->name);
+			speech_channel_stop(schannel);
+			status = -1;
+			break;
+		}
+
+		/* Sampled ahead of the read, as the last audio may be written just before the request completes. */
+		processing = (speech_channel_get_state(schannel) == SPEECH_CHANNEL_PROCESSING);
+		len = sizeof(buffer);
+		if (audio_queue_read(schannel->audio_queue, buffer, &len, 0) == 0) {
+			tts_cache_capture_write(schannel->capture, buffer, len);
+			schannel->capture_len += len;
+			drained += len;
+			if ((file != NULL) && (fwrite(buffer, 1, len, file) != len)) {
+				ast_log(LOG_WARNING, "(%s) Unable to write synthesized speech to file\n", schannel->name);
+				file = NULL;
+				status = -1;
+			}
+			continue;
+		}
+
+		/* The queue is empty, done once no more audio is coming. */
+		if (!processing)
+			break;
+
+		if (apr_time_now() > deadline) {
+			ast_log(LOG_WARNING, "(%s) Timed out waiting for synthesis to complete\n", schannel->name);
+			speech_channel_stop(schannel);
+			status = -1;
+			break;
+		}
+
+		/* Not blocked in the read, for the cancel and the deadline to be checked meanwhile. */
+		apr_sleep(SPEECH_CHANNEL_DRAIN_INTERVAL);
+	}
+
+	/* Audio discarded by a clear of the queue was not drained. */
+	if ((status == 0) && (drained != (apr_size_t)(apr_uint32_t)(apr_atomic_read32(&schannel->audio_queue->head) - tail))) {
+		ast_log(LOG_WARNING, "(%s) Synthesized speech discarded before it was drained\n", schannel->name);
+		status = -1;
+	}
+
+	/* Audio the drain did not keep up with was lost, or compressed in time. */
+	if ((status == 0) && (apr_atomic_read32(&schannel->audio_queue->overflows) != overflows)) {
+		ast_log(LOG_WARNING, "(%s) Audio queue overflowed while draining synthesized speech\n", schannel->name);
+		status = -1;
+	}
+
+	apr_atomic_set32(&schannel->playout.draining, FALSE);
+	audio_queue_clear(schannel->audio_queue);
+	return status;
+}
+
+/* Drain the synthesized speech of the SPEAK request sent on a channel not 
+ * attached to a call into its capture. Return 0 if the prompt was added to the 
+ * TTS cache.
+ */
+int speech_channel_cache_drain(speech_channel_t *schannel, apr_interval_time_t timeout)
+{
+	if (schannel->chan != NULL)
+		return -1;
+
+	speech_channel_drain(schannel, timeout, NULL);
+	return speech_channel_cache_finish(schannel);
+}
+
+/* Capture the synthesized speech of the next SPEAK request sent on a channel 
+ * not attached to a call, for the prompt to be played out later on another 
+ * channel. The prompt is added to the TTS cache as well if the key is not NULL.
+ */
+int speech_channel_prefetch_capture(speech_channel_t *schannel, const char *key, apr_size_t max_len)
+{
+	tts_cache_capture_t *capture;
+
+	if (schannel->chan != NULL)
+		return -1;
+
+	speech_channel_cache_finish(schannel);
+
+	if ((capture = tts_cache_prefetch_create(key, max_len)) == NULL)
+		return -1;
+
+	speech_channel_capture_start(schannel, capture);
+	return 0;
+}
+
+/* Drain the synthesized speech of the SPEAK request captured by 
+ * speech_channel_prefetch_capture(). Return the prompt, to be played out with 
+ * speech_channel_playout_cached(), or NULL if the request did not complete.
+ */
+tts_cache_entry_t *speech_channel_prefetch_drain(speech_channel_t *schannel, apr_interval_time_t timeout)
+{
+	tts_cache_capture_t *capture;
+	int complete;
+
+	if (schannel->chan != NULL)
+		return NULL;
+
+	complete = (speech_channel_drain(schannel, timeout, NULL) == 0);
+
+	apr_thread_mutex_lock(schannel->mutex);
+	capture = schannel->capture;
+	schannel->capture = NULL;
+	complete = complete && speech_channel_capture_consumed(schannel);
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	return tts_cache_prefetch_finish(capture, complete);
+}
+
+/* Cancel the drain of the SPEAK request captured by 
+ * speech_channel_prefetch_capture() from another thread, without waiting for 
+ * the request to be stopped, which is left to the draining thread.
+ */
+void speech_channel_prefetch_cancel(speech_channel_t *schannel)
+{
+	apr_atomic_set32(&schannel->drain_cancelled, TRUE);
+}
+
+/* Feed up to size bytes of recorded audio from a file, -1 for the rest of the 
+ * file, to the RECOGNIZE request sent on a channel not attached to a call, as 
+ * fast as the media engine reads it, followed by up to tail msec of silence 
+ * for the end of speech to be detected. The request is stopped if it is still 
+ * in progress after that. Return 0 once the request completed by itself.
+ */
+int speech_channel_feed(speech_channel_t *schannel, FILE *file, apr_off_t size, apr_size_t tail, apr_interval_time_t timeout)
+{
+	apr_byte_t buffer[SPEECH_CHANNEL_PLAYOUT_FRAME_SIZE];
+	audio_queue_t *queue = schannel->audio_queue;
+	apr_time_t deadline = apr_time_now() + timeout;
+	apr_size_t byte_rate;
+	apr_size_t sample_size;
+	apr_size_t frame_size;
+	apr_size_t want;
+	apr_size_t len;
+
+	if (schannel->chan != NULL)
+		return -1;
+
+	byte_rate = speech_channel_byte_rate(schannel, &sample_size);
+	frame_size = byte_rate * SPEECH_CHANNEL_PLAYOUT_PTIME / 1000;
+	if (frame_size > sizeof(buffer))
+		frame_size = sizeof(buffer);
+	tail = byte_rate * tail / 1000;
+
+	while (speech_channel_get_state(schannel) == SPEECH_CHANNEL_PROCESSING) {
+		if (apr_time_now() > deadline) {
+			ast_log(LOG_WARNING, "(%s) Timed out waiting for recognition to complete\n", schannel->name);
+			speech_channel_stop(schannel);
+			return -1;
+		}
+
+		/* Wait for the media engine to make room for the next frame. */
+		if (queue->size - audio_queue_inuse(queue) < frame_size) {
+			apr_sleep(SPEECH_CHANNEL_FEED_INTERVAL);
+			continue;
+		}
+
+		len = 0;
+		if (file != NULL) {
+			/* Data following the audio, such as trailing chunks of a WAV file, is not fed. */
+			want = ((size >= 0) && (size < (apr_off_t)frame_size)) ? (apr_size_t)size : frame_size;
+			len = (want > 0) ? fread(buffer, 1, want, file) : 0;
+			if (size >= 0)
+				size -= len;
+			if ((len < want) || (size == 0)) {
+				if (ferror(file))
+					ast_log(LOG_WARNING, "(%s) Unable to read audio from file\n", schannel->name);
+				file = NULL;
+			}
+		}
+
+		if (len == 0) {
+			if (tail == 0) {
+				ast_log(LOG_DEBUG, "(%s) Recognition still in progress at the end of the audio\n", schannel->name);
+				speech_channel_stop(schannel);
+				return -1;
+			}
+			len = (tail < frame_size) ? tail : frame_size;
+			memset(buffer, schannel->silence, len);
+			tail -= len;
+		}
+
+		speech_channel_write(schannel, buffer, &len);
+	}
+
+	return 0;
+}
+
+/* --- FILES --- */
+
+/* Raw audio file format, named by its extension as known to Asterisk. */
+struct speech_channel_file_format_t {
+	/* File extension. */
+	const char  *extension;
+	/* Codec. */
+	const char  *codec;
+	/* Rate. */
+	apr_uint16_t rate;
+};
+typedef struct speech_channel_file_format_t speech_channel_file_format_t;
+
+/* The raw formats Asterisk plays without transcoding the file. */
+static const speech_channel_file_format_t speech_channel_file_formats[] = {
+	{ "ulaw",  "PCMU", 8000 },
+	{ "ul",    "PCMU", 8000 },
+	{ "pcm",   "PCMU", 8000 },
+	{ "alaw",  "PCMA", 8000 },
+	{ "al",    "PCMA", 8000 },
+	{ "sln",   "LPCM", 8000 },
+	{ "raw",   "LPCM", 8000 },
+	{ "sln16", "LPCM", 16000 },
+	{ "g722",  "G722", 16000 }
+};
+
+/* Get the codec and rate of a raw audio file by its extension. */
+int speech_channel_file_format(const char *path, const char **codec, apr_uint16_t *rate)
+{
+	const char *extension = strrchr(path, '.');
+	apr_size_t i;
+
+	if ((extension == NULL) || (strchr(extension, '/') != NULL))
+		return -1;
+
+	for (i = 0; i < ARRAY_LEN(speech_channel_file_formats); i++) {
+		if (strcasecmp(extension + 1, speech_channel_file_formats[i].extension) == 0) {
+			*codec = speech_channel_file_formats[i].codec;
+			*rate = speech_channel_file_formats[i].rate;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* --- LATENCY --- */
+
+/* Get the time from a monotonic clock, for latency measurements. */
+apr_time_t speech_channel_clock(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return apr_time_from_sec(ts.tv_sec) + ts.tv_nsec / 1000;
+#endif
+	return apr_time_now();
+}
+
+/* Get the latency between two points in time, -1 if either has not been reached. */
+static APR_INLINE apr_interval_time_t speech_channel_elapsed(apr_time_t from, apr_time_t to)
+{
+	if ((from == 0) || (to == 0) || (to < from))
+		return -1;
+	return to - from;
+}
+
+/* Get the latencies of the last request, -1 where not measured. */
+static void speech_channel_latencies(speech_channel_t *schannel, apr_interval_time_t latencies[AST_MRCP_LATENCY_COUNT])
+{
+	speech_channel_timing_t *timing = &schannel->timing;
+
+	latencies[AST_MRCP_LATENCY_SETUP] = speech_channel_elapsed(timing->open_start, timing->ready);
+	latencies[AST_MRCP_LATENCY_RESPONSE] = speech_channel_elapsed(timing->request_sent, timing->in_progress);
+	latencies[AST_MRCP_LATENCY_FIRST_AUDIO] = speech_channel_elapsed(timing->request_sent, timing->first_audio);
+	latencies[AST_MRCP_LATENCY_START_OF_INPUT] = speech_channel_elapsed(timing->request_sent, timing->start_of_input);
+	latencies[AST_MRCP_LATENCY_COMPLETE] = speech_channel_elapsed(timing->request_sent, timing->complete);
+	latencies[AST_MRCP_LATENCY_FIRST_AUDIO_CHUNKED] = -1;
+
+	/* The time to first audio of prompts split into chunks is measured apart, to compare both. */
+	if (schannel->speak_chunks > 1) {
+		latencies[AST_MRCP_LATENCY_FIRST_AUDIO_CHUNKED] = latencies[AST_MRCP_LATENCY_FIRST_AUDIO];
+		latencies[AST_MRCP_LATENCY_FIRST_AUDIO] = -1;
+	}
+}
+
+/* Timestamp a change of the channel state. Record the latencies of the open 
+ * and of the request in the histograms of the profile, once they are known.
+ */
+static void speech_channel_timing_update(speech_channel_t *schannel, speech_channel_state_t state)
+{
+	speech_channel_timing_t *timing = &schannel->timing;
+	speech_channel_state_t prev = speech_channel_get_state(schannel);
+	apr_interval_time_t latencies[AST_MRCP_LATENCY_COUNT];
+	int i;
+
+	if (schannel->opening && (state == SPEECH_CHANNEL_READY)) {
+		timing->ready = speech_channel_clock();
+		profile_latency_record(schannel->profile, schannel->type, AST_MRCP_LATENCY_SETUP, speech_channel_elapsed(timing->open_start, timing->ready));
+	} else if ((prev != SPEECH_CHANNEL_PROCESSING) && (state == SPEECH_CHANNEL_PROCESSING)) {
+		if (timing->request_sent && !timing->in_progress)
+			timing->in_progress = speech_channel_clock();
+	} else if ((prev == SPEECH_CHANNEL_PROCESSING) && (state != SPEECH_CHANNEL_PROCESSING)) {
+		/* Other requests such as DEFINE-GRAMMAR are not measured. */
+		if (timing->request_sent && !timing->complete) {
+			timing->complete = speech_channel_clock();
+
+			speech_channel_latencies(schannel, latencies);
+			for (i = AST_MRCP_LATENCY_RESPONSE; i < AST_MRCP_LATENCY_COUNT; i++) {
+				if (latencies[i] >= 0)
+					profile_latency_record(schannel->profile, schannel->type, i, latencies[i]);
+			}
+		}
+	}
+}
+
+/* Start measuring the latencies of a SPEAK or RECOGNIZE request about to be sent. */
+void speech_channel_timing_request(speech_channel_t *schannel)
+{
+	speech_channel_timing_t *timing = &schannel->timing;
+
+	timing->in_progress = 0;
+	timing->first_audio = 0;
+	timing->start_of_input = 0;
+	timing->complete = 0;
+	timing->request_sent = speech_channel_clock();
+}
+
+/* Set the latencies of the last request as variables of the Asterisk channel. */
+void speech_channel_timing_export(speech_channel_t *schannel, struct ast_channel *chan)
+{
+	static const char *synth_vars[AST_MRCP_LATENCY_COUNT] = { "SYNTH_SETUP_MS", "SYNTH_RESPONSE_MS", "SYNTH_TTFA_MS", NULL, "SYNTH_COMPLETE_MS", "SYNTH_TTFA_MS" };
+	static const char *recog_vars[AST_MRCP_LATENCY_COUNT] = { "RECOG_SETUP_MS", "RECOG_RESPONSE_MS", "RECOG_FIRST_AUDIO_MS", "RECOG_SOI_MS", "RECOG_COMPLETE_MS", NULL };
+	const char **vars = (schannel->type == SPEECH_CHANNEL_SYNTHESIZER) ? synth_vars : recog_vars;
+	apr_interval_time_t latencies[AST_MRCP_LATENCY_COUNT];
+	char buf[32];
+	int i;
+
+	speech_channel_latencies(schannel, latencies);
+	for (i = 0; i < AST_MRCP_LATENCY_COUNT; i++) {
+		if ((vars[i] != NULL) && (latencies[i] >= 0)) {
+			apr_snprintf(buf, sizeof(buf), "%" APR_TIME_T_FMT, apr_time_as_msec(latencies[i]));
+			pbx_builtin_setvar_helper(chan, vars[i], buf);
+		}
+	}
+}
+
 /* Use this function to set the current channel state without locking the 
  * speech channel.  Do this if you already have the speech channel locked.
  */
 void speech_channel_set_state_unlocked(speech_channel_t *schannel, speech_channel_state_t state)
 {
 	if (schannel != NULL) {
-		/* Wake anyone waiting for audio data. */
-		if ((schannel->state == SPEECH_CHANNEL_PROCESSING) && (state != SPEECH_CHANNEL_PROCESSING))
+		/* Wake anyone waiting for audio data. The synthesized speech of a completed 
+		 * request is left for the playout to drain, it is only discarded on STOP, 
+		 * barge-in or an error. */
+		if ((schannel->state == SPEECH_CHANNEL_PROCESSING) && (state != SPEECH_CHANNEL_PROCESSING) && 
+			((schannel->type != SPEECH_CHANNEL_SYNTHESIZER) || (state == SPEECH_CHANNEL_ERROR)))
 			audio_queue_clear(schannel->audio_queue);
 
+		/* The outstanding chunks are dropped along with the request in progress on an error. */
+		if (state == SPEECH_CHANNEL_ERROR)
+			speech_channel_speak_reset(schannel);
+
+		speech_channel_timing_update(schannel, state);
+
 		ast_log(LOG_DEBUG, "(%s) %s ==> %s\n", schannel->name, speech_channel_state_to_string(schannel->state), speech_channel_state_to_string(state));
-		schannel->state = state;
+		apr_atomic_set32(&schannel->state, state);
+		schannel->opening = FALSE;
 
 		if (schannel->cond != NULL)
 			apr_thread_cond_signal(schannel->cond);
 	}
 }
 
-/* Set the current channel state. */
-void speech_channel_set_state(speech_channel_t *schannel, speech_channel_state_t state)
+/* Set the current channel state. */
+void speech_channel_set_state(speech_channel_t *schannel, speech_channel_state_t state)
+{
+	if (schannel) {
+		apr_thread_mutex_lock(schannel->mutex);
+
+		speech_channel_set_state_unlocked(schannel, state);
+
+		apr_thread_mutex_unlock(schannel->mutex);
+	}
+}
+
+/* Start accounting for the SPEAK requests of a prompt split into chunks, 
+ * before the first one is sent, with the channel locked. All of them are 
+ * counted up front, as a chunk may complete before the next one is sent.
+ */
+void speech_channel_speak_start(speech_channel_t *schannel, apr_uint32_t chunks)
+{
+	speech_channel_speak_reset(schannel);
+	schannel->speak_chunks = chunks;
+	schannel->speak_cause = -1;
+	schannel->mark[0] = '\0';
+}
+
+/* Drop the outstanding SPEAK requests of the prompt, on STOP, barge-in or an 
+ * error, with the channel locked. Events of these requests are ignored.
+ */
+static void speech_channel_speak_reset(speech_channel_t *schannel)
+{
+	schannel->speak_done = 0;
+	if (schannel->speak_requests != NULL)
+		apr_array_clear(schannel->speak_requests);
+}
+
+/* Account for a SPEAK request accepted by the MRCP server, either IN-PROGRESS 
+ * or PENDING behind the previous chunks of the prompt.
+ */
+void speech_channel_speak_accepted(speech_channel_t *schannel, mrcp_request_id request_id)
+{
+	apr_thread_mutex_lock(schannel->mutex);
+	if (schannel->speak_requests != NULL)
+		APR_ARRAY_PUSH(schannel->speak_requests, mrcp_request_id) = request_id;
+	apr_thread_mutex_unlock(schannel->mutex);
+}
+
+/* Account for a SPEAK-COMPLETE event. Return FALSE while requests for more 
+ * chunks of the prompt are outstanding, -1 if the request is not one of them, 
+ * such as a request stopped already, otherwise TRUE with the completion cause 
+ * of the whole prompt in cause, which is the cause of the first chunk which 
+ * did not complete normally, if any.
+ */
+int speech_channel_speak_completed(speech_channel_t *schannel, mrcp_request_id request_id, int *cause)
+{
+	apr_array_header_t *requests = schannel->speak_requests;
+	int last;
+	int i;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	for (i = 0; (requests != NULL) && (i < requests->nelts); i++) {
+		if (APR_ARRAY_IDX(requests, i, mrcp_request_id) == request_id)
+			break;
+	}
+	if ((requests == NULL) || (i >= requests->nelts)) {
+		apr_thread_mutex_unlock(schannel->mutex);
+		return -1;
+	}
+	APR_ARRAY_IDX(requests, i, mrcp_request_id) = APR_ARRAY_IDX(requests, requests->nelts - 1, mrcp_request_id);
+	requests->nelts--;
+
+	if ((*cause != SYNTHESIZER_COMPLETION_CAUSE_NORMAL) && (schannel->speak_cause < 0))
+		schannel->speak_cause = *cause;
+
+	if (++schannel->speak_done < schannel->speak_chunks) {
+		last = FALSE;
+	} else {
+		if (schannel->speak_cause >= 0)
+			*cause = schannel->speak_cause;
+		last = TRUE;
+	}
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	return last;
+}
+
+/* Record the mark reached, as reported by the Speech-Marker header of a 
+ * SPEECH-MARKER event or a response, in the form "timestamp;name".
+ */
+void speech_channel_mark_reached(speech_channel_t *schannel, const apt_str_t *speech_marker)
+{
+	const char *name;
+	apr_size_t len;
+
+	if ((speech_marker->buf == NULL) || ((name = memchr(speech_marker->buf, ';', speech_marker->length)) == NULL))
+		return;
+	for (name++; (name < speech_marker->buf + speech_marker->length) && isspace((unsigned char)*name); name++);
+	len = speech_marker->buf + speech_marker->length - name;
+	if (len >= sizeof(schannel->mark))
+		len = sizeof(schannel->mark) - 1;
+
+	apr_thread_mutex_lock(schannel->mutex);
+	memcpy(schannel->mark, name, len);
+	schannel->mark[len] = '\0';
+	apr_thread_mutex_unlock(schannel->mutex);
+}
+
+/* Get the name of the last mark reached. Return -1 if none was reached since the last request. */
+int speech_channel_mark_get(speech_channel_t *schannel, char *name, apr_size_t size)
 {
-	if (schannel) {
-		apr_thread_mutex_lock(schannel->mutex);
+	int status;
 
-		speech_channel_set_state_unlocked(schannel, state);
+	apr_thread_mutex_lock(schannel->mutex);
+	ast_copy_string(name, schannel->mark, size);
+	status = ast_strlen_zero(schannel->mark) ? -1 : 0;
+	apr_thread_mutex_unlock(schannel->mutex);
 
-		apr_thread_mutex_unlock(schannel->mutex);
-	}
+	return status;
 }
 
 /* Send BARGE-IN-OCCURRED. */
@@ -162,33 +1384,42 @@ int speech_channel_bargeinoccurred(speech_channel_t *schannel)
 
 			if (schannel->state == SPEECH_CHANNEL_PROCESSING) {
 				ast_log(LOG_ERROR, "(%s) Timed out waiting for session to close.  Continuing\n", schannel->name);
-				schannel->state = SPEECH_CHANNEL_ERROR;
+				apr_atomic_set32(&schannel->state, SPEECH_CHANNEL_ERROR);
 				status = -1;
 			} else if (schannel->state == SPEECH_CHANNEL_ERROR) {
 				ast_log(LOG_ERROR, "(%s) Channel error\n", schannel->name);
-				schannel->state = SPEECH_CHANNEL_ERROR;
+				apr_atomic_set32(&schannel->state, SPEECH_CHANNEL_ERROR);
 				status = -1;
 			} else {
 				ast_log(LOG_DEBUG, "(%s) %s barge-in sent\n", schannel->name, speech_channel_type_to_string(schannel->type));
 			}
 		}
+
+		/* Discard the synthesized speech and the outstanding chunks of the interrupted request. */
+		audio_queue_clear(schannel->audio_queue);
+		speech_channel_speak_reset(schannel);
 	}
 
 	apr_thread_mutex_unlock(schannel->mutex);
 	return status;
 }
 
-speech_channel_t *speech_channel_create(
+/* Allocate and initialize a speech channel. */
+static speech_channel_t *speech_channel_alloc(
 						apr_pool_t *pool,
 						const char *name,
 						speech_channel_type_t type,
 						ast_mrcp_application_t *app,
-						ast_format_compat *format,
-						const char *rec_file_path,
+						const char *codec,
+						apr_uint16_t rate,
+						apr_uint16_t bits_per_sample,
 						struct ast_channel *chan)
 {
 	speech_channel_t *schan = NULL;
 	int status = 0;
+	apr_size_t byte_rate;
+	apr_size_t queue_size;
+	apr_size_t sample_size;
 
 	if (app == NULL) {
 		ast_log(LOG_ERROR, "MRCP application is NULL\n");
@@ -196,7 +1427,7 @@ speech_channel_t *speech_channel_create(
 	} else if (pool == NULL) {
 		ast_log(LOG_ERROR, "Memory pool is NULL\n");
 		status = -1;
-	} else if ((schan = (speech_channel_t *)apr_palloc(pool, sizeof(speech_channel_t))) == NULL) {
+	} else if ((schan = (speech_channel_t *)slab_alloc(speech_channel_slab)) == NULL) {
 		ast_log(LOG_ERROR, "Unable to allocate speech channel structure\n");
 		status = -1;
 	} else {
@@ -210,27 +1441,52 @@ speech_channel_t *speech_channel_create(
 			schan->name = "TTS";
 		}
 
-		schan->format = format;
-		schan->codec = ast_format_get_unicodec(format);
-		schan->rate = ast_format_get_sample_rate(format);
-		schan->bits_per_sample = ast_format_get_bits_per_sample(format);
+		schan->format = NULL;
+		schan->codec = codec;
+		schan->rate = rate;
+		schan->bits_per_sample = bits_per_sample;
 
 		schan->profile = NULL;
 		schan->type = type;
 		schan->application = app;
 		schan->unimrcp_session = NULL;
+		schan->handle = NULL;
 		schan->unimrcp_channel = NULL;
 		schan->stream = NULL;
 		schan->dtmf_generator = NULL;
 		schan->session_id = NULL;
 		schan->pool = pool;
-		schan->mutex = NULL;
-		schan->cond = NULL;
-		schan->state = SPEECH_CHANNEL_CLOSED;
+		schan->warm_pool = NULL;
+		schan->defined_grammars = NULL;
+		schan->contents = NULL;
+		schan->idle_next = NULL;
+		schan->idle_since = 0;
+		schan->teardown_attempts = 0;
+		schan->opening = FALSE;
+		memset(&schan->timing, 0, sizeof(schan->timing));
+		apr_atomic_set32(&schan->state, SPEECH_CHANNEL_CLOSED);
 		schan->audio_queue = NULL;
+		apr_atomic_set32(&schan->underruns, 0);
 		schan->data = NULL;
 		schan->chan = chan;
 		schan->rec_file = NULL;
+		apr_atomic_set32(&schan->debug, 0);
+		schan->dump = NULL;
+		schan->capture = NULL;
+		schan->capture_overflows = 0;
+		schan->capture_tail = 0;
+		schan->capture_len = 0;
+		schan->batch = FALSE;
+		schan->completion_cause = -1;
+		schan->speak_chunks = 1;
+		schan->speak_done = 0;
+		schan->speak_requests = (type == SPEECH_CHANNEL_SYNTHESIZER) ? apr_array_make(pool, 4, sizeof(mrcp_request_id)) : NULL;
+		schan->speak_cause = -1;
+		schan->mark[0] = '\0';
+		schan->vad = NULL;
+		schan->vad_event = ENERGY_VAD_NONE;
+		schan->preroll = NULL;
+		schan->preroll_len = 0;
 
 		if (strstr("LPCM", schan->codec)) {
 			schan->silence = 0;
@@ -239,67 +1495,84 @@ speech_channel_t *speech_channel_create(
 			schan->silence = 128;
 		}
 
-		if ((apr_thread_mutex_create(&schan->mutex, APR_THREAD_MUTEX_UNNESTED, pool) != APR_SUCCESS) || (schan->mutex == NULL)) {
-			ast_log(LOG_ERROR, "(%s) Unable to create channel mutex\n", schan->name);
-			status = -1;
-		} else if ((apr_thread_cond_create(&schan->cond, pool) != APR_SUCCESS) || (schan->cond == NULL)) {
-			ast_log(LOG_ERROR, "(%s) Unable to create channel condition variable\n",schan->name);
-			status = -1;
-		} else if ((audio_queue_create(&schan->audio_queue, name) != 0) || (schan->audio_queue == NULL)) {
+		/* Detect voice activity on the input of recognizers attached to a call. */
+		if ((type == SPEECH_CHANNEL_RECOGNIZER) && (chan != NULL) && (globals.vad_level != 0)) {
+			if ((schan->vad = energy_vad_create(pool, codec, rate, globals.vad_level, globals.vad_no_input_timeout)) == NULL)
+				ast_log(LOG_DEBUG, "(%s) No voice activity detection for codec %s\n", schan->name, codec);
+		}
+
+		/* Size the audio queue to hold the configured latency. */
+		byte_rate = speech_channel_byte_rate(schan, &sample_size);
+		queue_size = byte_rate * globals.audio_queue_latency / 1000;
+		speech_channel_drift_init(schan, byte_rate, sample_size);
+		speech_channel_playout_init(schan, byte_rate);
+
+		if ((audio_queue_create(&schan->audio_queue, schan->name, queue_size) != 0) || (schan->audio_queue == NULL)) {
 			ast_log(LOG_ERROR, "(%s) Unable to create audio queue for channel\n",schan->name);
 			status = -1;
 		} else {
-			ast_log(LOG_DEBUG, "Created speech channel: Name=%s, Type=%s, Codec=%s, Rate=%u on %s\n", schan->name, speech_channel_type_to_string(schan->type), schan->codec, schan->rate,
-				ast_channel_name(chan));
+			audio_queue_overflow_policy_set(schan->audio_queue, globals.audio_queue_overflow_policy, sample_size);
 		}
-		
-		if (!ast_strlen_zero(rec_file_path)) {
-			schan->rec_file = fopen(rec_file_path, "wb");
-			if(!schan->rec_file) {
-				ast_log(LOG_WARNING, "(%s) Unable to open recording file for writing: %s\n", schan->name, rec_file_path);
-			}
+
+		/* Keep the most recent audio written to a recognizer attached to a call until it is processing. */
+		if ((status == 0) && (type == SPEECH_CHANNEL_RECOGNIZER) && (chan != NULL) && (globals.recog_preroll > 0)) {
+			schan->preroll_len = byte_rate * globals.recog_preroll / 1000;
+			if (sample_size > 1)
+				schan->preroll_len -= schan->preroll_len % sample_size;
+			if (audio_queue_create(&schan->preroll, schan->name, schan->preroll_len) != 0) {
+				ast_log(LOG_WARNING, "(%s) Unable to create pre-roll ring for channel\n", schan->name);
+				schan->preroll = NULL;
+			} else
+				audio_queue_overflow_policy_set(schan->preroll, AUDIO_QUEUE_OVERFLOW_DROP_OLDEST, sample_size);
 		}
 	}
 
 	if (status != 0) {
 		if (schan != NULL) {
-			if (schan->audio_queue != NULL) {
-				if (audio_queue_destroy(schan->audio_queue) != 0)
-					ast_log(LOG_WARNING, "(%s) Unable to destroy channel audio queue\n", schan->name);
-			}
-
-			if (schan->cond != NULL) {
-				if (apr_thread_cond_destroy(schan->cond) != APR_SUCCESS)
-					ast_log(LOG_WARNING, "(%s) Unable to destroy channel condition variable\n", schan->name);
-
-				schan->cond = NULL;
-			}
-
-			if (schan->mutex != NULL) {
-				if (apr_thread_mutex_destroy(schan->mutex) != APR_SUCCESS)
-					ast_log(LOG_WARNING, "(%s) Unable to destroy channel mutex variable\n", schan->name);
-			}
-
+			slab_free(speech_channel_slab, schan);
 			schan = NULL;
 		}
 	}
 
-#if SPEECH_CHANNEL_DUMP
-	if(schan) {
-		const char *stream_in_filename = apr_psprintf(pool,"%s/%s-%s-in.raw", SPEECH_CHANNEL_DUMP_DIR, schan->name, schan->codec);
-		const char *stream_out_filename = apr_psprintf(pool,"%s/%s-%s-out.raw", SPEECH_CHANNEL_DUMP_DIR, schan->name, schan->codec);
+	return schan;
+}
+
+speech_channel_t *speech_channel_create(
+						apr_pool_t *pool,
+						const char *name,
+						speech_channel_type_t type,
+						ast_mrcp_application_t *app,
+						ast_format_compat *format,
+						const char *rec_file_path,
+						struct ast_channel *chan)
+{
+	speech_channel_t *schan = speech_channel_alloc(
+						pool,
+						name,
+						type,
+						app,
+						ast_format_get_unicodec(format),
+						ast_format_get_sample_rate(format),
+						ast_format_get_bits_per_sample(format),
+						chan);
+
+	if (schan == NULL)
+		return NULL;
 
-		schan->stream_in = fopen(stream_in_filename,"wb");
-		if(!schan->stream_in) {
-			ast_log(LOG_WARNING, "(%s) Unable to open input stream file for writing\n", schan->name);
-		}
+	schan->format = format;
+	speech_channel_register(schan);
+	ast_log(LOG_DEBUG, "Created speech channel: Name=%s, Type=%s, Codec=%s, Rate=%u on %s\n", schan->name, speech_channel_type_to_string(schan->type), schan->codec, schan->rate,
+		ast_channel_name(chan));
 
-		schan->stream_out = fopen(stream_out_filename,"wb");
-		if(!schan->stream_out) {
-			ast_log(LOG_WARNING, "(%s) Unable to open output stream file for writing\n", schan->name);
+	if (!ast_strlen_zero(rec_file_path)) {
+		schan->rec_file = fopen(rec_file_path, "wb");
+		if(!schan->rec_file) {
+			ast_log(LOG_WARNING, "(%s) Unable to open recording file for writing: %s\n", schan->name, rec_file_path);
 		}
 	}
-#endif
+
+	if (apr_atomic_read32(&globals.debug_flags) != 0)
+		speech_channel_debug_set(schan, apr_atomic_read32(&globals.debug_flags), TRUE);
 
 	return schan;
 }
@@ -329,51 +1602,231 @@ static mpf_termination_t *speech_channel_create_mpf_termination(speech_channel_t
 					schannel);                                        /* Object to associate. */
 }
 
-/* Destroy the speech channel. */
-int speech_channel_destroy(speech_channel_t *schannel)
+/* Detach the channel from its call. Whatever was allocated from the memory pool 
+ * of the call is replaced, as the call may be gone before the channel is.
+ */
+static int speech_channel_detach(speech_channel_t *schannel)
 {
-	if (!schannel) {
-		ast_log(LOG_ERROR, "Speech channel structure pointer is NULL\n");
+	apr_pool_t *pool;
+	apr_hash_t *defined_grammars = NULL;
+	speech_channel_drift_t *drift = &schannel->drift;
+
+	/* Already owns its memory pool. */
+	if ((schannel->warm_pool != NULL) && (schannel->pool == schannel->warm_pool))
+		return 0;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return -1;
+
+	/* The grammars defined in the session outlive the call. */
+	if ((schannel->defined_grammars != NULL) && ((defined_grammars = grammar_defined_copy(schannel->defined_grammars, pool)) == NULL)) {
+		apr_pool_destroy(pool);
 		return -1;
 	}
-	
-	ast_log(LOG_DEBUG, "Destroy speech channel: Name=%s, Type=%s, Codec=%s, Rate=%u\n", schannel->name, speech_channel_type_to_string(schannel->type), schannel->codec, schannel->rate);
 
-	if (schannel->mutex)
-		apr_thread_mutex_lock(schannel->mutex);
+	/* The prompt being captured or played out belongs to the call. */
+	speech_channel_cache_finish(schannel);
+	speech_channel_playout_uncache(schannel);
+
+	apr_thread_mutex_lock(schannel->mutex);
+
+	/* Stop the media engine from writing to the Asterisk channel first. */
+	schannel->chan = NULL;
+	schannel->name = apr_pstrdup(pool, schannel->name);
+	schannel->pool = pool;
+	schannel->warm_pool = pool;
+	schannel->format = NULL;
+	schannel->data = NULL;
+	schannel->defined_grammars = defined_grammars;
+	schannel->contents = NULL;
 
-#if SPEECH_CHANNEL_DUMP
-	if(schannel->stream_out) {
-		fclose(schannel->stream_out);
-		schannel->stream_out = NULL;
+	/* The drift compensation buffer belongs to the call. */
+	drift->target_depth = 0;
+	drift->scratch = NULL;
+	drift->scratch_size = 0;
+
+	if (schannel->rec_file) {
+		fclose(schannel->rec_file);
+		schannel->rec_file = NULL;
+	}
+
+	/* Stop dumping, the files are closed by the writer thread. */
+	speech_channel_debug_set(schannel, SPEECH_CHANNEL_DEBUG_DUMP | SPEECH_CHANNEL_DEBUG_TRACE, FALSE);
+
+	apr_thread_mutex_unlock(schannel->mutex);
+	return 0;
+}
+
+/* Return a ready channel attached to a call to the session pool of its profile. */
+static int speech_channel_checkin(speech_channel_t *schannel)
+{
+	if ((schannel->chan == NULL) || (schannel->profile == NULL) || !session_pool_accepts(schannel->profile))
+		return -1;
+
+	if (speech_channel_get_state(schannel) != SPEECH_CHANNEL_READY)
+		return -1;
+
+	if (speech_channel_detach(schannel) != 0)
+		return -1;
+
+	audio_queue_clear(schannel->audio_queue);
+
+	if (session_pool_checkin(schannel->profile, schannel) != 0)
+		return -1;
+
+	ast_log(LOG_DEBUG, "(%s) Speech channel returned to the session pool of %s\n", schannel->name, schannel->profile->name);
+	return 0;
+}
+
+/* Take over the established session of an idle channel. The idle channel may 
+ * still be referenced by a media engine callback in progress, hence it is 
+ * retired along with its memory pool rather than freed.
+ */
+static void speech_channel_adopt(speech_channel_t *schannel, speech_channel_t *idle)
+{
+	apr_thread_mutex_lock(idle->mutex);
+
+	schannel->unimrcp_session = idle->unimrcp_session;
+	schannel->handle = idle->handle;
+	schannel->unimrcp_channel = idle->unimrcp_channel;
+	schannel->stream = idle->stream;
+	schannel->dtmf_generator = idle->dtmf_generator;
+	schannel->session_id = idle->session_id;
+	schannel->rate = idle->rate;
+	if (idle->defined_grammars != NULL)
+		schannel->defined_grammars = grammar_defined_copy(idle->defined_grammars, schannel->pool);
+
+	/* Route the MRCP messages and the audio of the session to the new channel. */
+	mrcp_application_session_name_set(schannel->unimrcp_session, schannel->name);
+	if (schannel->handle != NULL)
+		schannel->handle->schannel = schannel;
+	if (schannel->stream != NULL)
+		schannel->stream->obj = schannel;
+
+	apr_atomic_set32(&schannel->state, speech_channel_get_state(idle));
+
+	idle->unimrcp_session = NULL;
+	idle->handle = NULL;
+	idle->unimrcp_channel = NULL;
+	idle->stream = NULL;
+	idle->dtmf_generator = NULL;
+	idle->session_id = NULL;
+	idle->defined_grammars = NULL;
+	idle->profile = NULL;
+	idle->name = "retired";
+	apr_atomic_set32(&idle->state, SPEECH_CHANNEL_CLOSED);
+
+	apr_thread_mutex_unlock(idle->mutex);
+
+	ast_log(LOG_DEBUG, "(%s) Took over MRCP session from the session pool of %s\n", schannel->name, schannel->profile->name);
+	speech_channel_retire(idle);
+}
+
+/* Create a channel not attached to a call, which owns its memory pool, and open it. */
+static speech_channel_t *speech_channel_create_detached(
+						ast_mrcp_profile_t *profile,
+						ast_mrcp_application_t *app,
+						speech_channel_type_t type,
+						const char *codec,
+						apr_uint16_t rate,
+						int batch)
+{
+	speech_channel_t *schan;
+	apr_pool_t *pool;
+	const char *name;
+	const char *prefix;
+	apr_uint16_t bits_per_sample;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return NULL;
+
+	/* Same as ast_format_get_bits_per_sample(). */
+	if (strcmp(codec, "LPCM") == 0)
+		bits_per_sample = 16 * rate / 8000;
+	else if (strcmp(codec, "G722") == 0)
+		bits_per_sample = 4;
+	else
+		bits_per_sample = 8;
+
+	if (batch)
+		prefix = (type == SPEECH_CHANNEL_SYNTHESIZER) ? "BATCH-TTS" : "BATCH-ASR";
+	else
+		prefix = (type == SPEECH_CHANNEL_SYNTHESIZER) ? "WARM-TTS" : "WARM-ASR";
+
+	name = apr_psprintf(pool, "%s-%lu", prefix, (unsigned long int)get_next_speech_channel_number());
+	if ((schan = speech_channel_alloc(pool, name, type, app, codec, rate, bits_per_sample, NULL)) == NULL) {
+		apr_pool_destroy(pool);
+		return NULL;
 	}
-	if(schannel->stream_in) {
-		fclose(schannel->stream_in);
-		schannel->stream_in = NULL;
+	schan->warm_pool = pool;
+	schan->batch = batch;
+
+	/* Audio is fed or drained as fast as the media engine goes, there is no clock drift to compensate. */
+	if (batch)
+		schan->drift.target_depth = 0;
+
+	if (speech_channel_open(schan, profile) != 0) {
+		ast_log(LOG_WARNING, "(%s) Unable to establish session with %s\n", schan->name, profile->name);
+		speech_channel_destroy(schan);
+		return NULL;
 	}
-#endif
 
-	/* Destroy the channel and session if not already done. */
-	if (schannel->state != SPEECH_CHANNEL_CLOSED) {
-		int warned = 0;
+	ast_log(LOG_DEBUG, "(%s) Established session with %s\n", schan->name, profile->name);
+	return schan;
+}
 
-		if ((schannel->unimrcp_session != NULL) && (schannel->unimrcp_channel != NULL)) {
-			if (!mrcp_application_session_terminate(schannel->unimrcp_session))
-				ast_log(LOG_WARNING, "(%s) Unable to terminate application session\n", schannel->name);
-		}
+/* Create an idle channel with an established session for the session pool of the profile. */
+speech_channel_t *speech_channel_warm(
+						ast_mrcp_profile_t *profile,
+						ast_mrcp_application_t *app,
+						speech_channel_type_t type,
+						const char *codec,
+						apr_uint16_t rate)
+{
+	return speech_channel_create_detached(profile, app, type, codec, rate, FALSE);
+}
 
-		ast_log(LOG_DEBUG, "(%s) Waiting for MRCP session to terminate\n", schannel->name);
-		while (schannel->state != SPEECH_CHANNEL_CLOSED) {
-			if (schannel->cond != NULL) {
-				if ((apr_thread_cond_timedwait(schannel->cond, schannel->mutex, globals.speech_channel_timeout) == APR_TIMEUP) && (!warned)) {
-					warned = 1;
-					ast_log(LOG_WARNING, "(%s) MRCP session has not terminated after %" APR_TIME_T_FMT " ms\n", schannel->name, apr_time_as_msec(globals.speech_channel_timeout));
-				}
-			}
-		}
+/* Create a channel not attached to a call with a session established with the 
+ * faster than realtime media engine of the profile, for batch jobs. The 
+ * realtime media engine is used if the profile has no faster one.
+ */
+speech_channel_t *speech_channel_batch(
+						ast_mrcp_profile_t *profile,
+						ast_mrcp_application_t *app,
+						speech_channel_type_t type,
+						const char *codec,
+						apr_uint16_t rate)
+{
+	return speech_channel_create_detached(profile, app, type, codec, rate, TRUE);
+}
+
+/* Request the termination of the MRCP session. */
+static void speech_channel_terminate(speech_channel_t *schannel)
+{
+	if ((schannel->unimrcp_session != NULL) && (schannel->unimrcp_channel != NULL)) {
+		ast_log(LOG_DEBUG, "(%s) Terminating MRCP session\n", schannel->name);
+		if (!mrcp_application_session_terminate(schannel->unimrcp_session))
+			ast_log(LOG_WARNING, "(%s) Unable to terminate application session\n", schannel->name);
 	}
-	
-	if (schannel->state != SPEECH_CHANNEL_CLOSED) {
+}
+
+/* Whether the session of the channel is closed and not being established. */
+static APR_INLINE int speech_channel_closed(speech_channel_t *schannel)
+{
+	return (speech_channel_get_state(schannel) == SPEECH_CHANNEL_CLOSED) && !schannel->opening;
+}
+
+/* Release a channel once its session is closed. A channel whose session did not 
+ * close may still be referenced by the MRCP client stack, so it is leaked.
+ */
+static void speech_channel_release(speech_channel_t *schannel)
+{
+	speech_channel_cache_finish(schannel);
+	speech_channel_playout_uncache(schannel);
+
+	apr_thread_mutex_lock(schannel->mutex);
+
+	if (!speech_channel_closed(schannel)) {
 		ast_log(LOG_ERROR, "(%s) Failed to destroy channel.  Continuing\n", schannel->name);
 	}
 
@@ -381,55 +1834,300 @@ int speech_channel_destroy(speech_channel_t *schannel)
 		fclose(schannel->rec_file);
 	}
 
-	if (schannel->dtmf_generator != NULL) {
+	/* The DTMF generator is allocated from the session pool, hence it is gone along with a closed session. */
+	if ((schannel->dtmf_generator != NULL) && (schannel->state != SPEECH_CHANNEL_CLOSED)) {
 		mpf_dtmf_generator_destroy(schannel->dtmf_generator);
 		ast_log(LOG_DEBUG, "(%s) DTMF generator destroyed\n", schannel->name);
 	}
 
 	if (schannel->audio_queue != NULL) {
+		apr_uint32_t lock_waits = apr_atomic_read32(&schannel->audio_queue->lock_waits);
+		ast_log(LOG_DEBUG, "(%s) Audio queue underruns=%u overflows=%u drift=%dppm dropped=%u inserted=%u\n", schannel->name,
+			apr_atomic_read32(&schannel->underruns), apr_atomic_read32(&schannel->audio_queue->overflows),
+			(apr_int32_t)apr_atomic_read32(&schannel->drift.drift_ppm),
+			apr_atomic_read32(&schannel->drift.dropped), apr_atomic_read32(&schannel->drift.inserted));
+		if (lock_waits) {
+			ast_log(LOG_DEBUG, "(%s) Audio path waited on a lock %u times\n", schannel->name, lock_waits);
+			apr_atomic_add32(&globals.media_lock_waits, lock_waits);
+		}
+
 		if (audio_queue_destroy(schannel->audio_queue) != 0)
 			ast_log(LOG_WARNING, "(%s) Unable to destroy channel audio queue\n",schannel->name);
+		if ((schannel->preroll != NULL) && (audio_queue_destroy(schannel->preroll) != 0))
+			ast_log(LOG_WARNING, "(%s) Unable to destroy channel pre-roll ring\n",schannel->name);
 	}
 
-	if (schannel->mutex != NULL)
-		apr_thread_mutex_unlock(schannel->mutex);
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	schannel->name = NULL;
+	schannel->profile = NULL;
+	schannel->application = NULL;
+	schannel->unimrcp_session = NULL;
+	schannel->handle = NULL;
+	schannel->unimrcp_channel = NULL;
+	schannel->stream = NULL;
+	schannel->dtmf_generator = NULL;
+	schannel->session_id = NULL;
+	schannel->defined_grammars = NULL;
+	schannel->contents = NULL;
+	schannel->pool = NULL;
+	schannel->audio_queue = NULL;
+	schannel->codec = NULL;
+	schannel->data = NULL;
+	schannel->chan = NULL;
+	schannel->rec_file = NULL;
+
+	/* The media engine may still write to the dump of a channel whose session did not close. */
+	if (speech_channel_closed(schannel))
+		speech_channel_dump_destroy(schannel);
+
+	/* The pool inherited from a warm channel holds the name, release it last. */
+	if ((schannel->warm_pool != NULL) && speech_channel_closed(schannel)) {
+		apr_pool_destroy(schannel->warm_pool);
+		schannel->warm_pool = NULL;
+	}
+
+	/* The mutex and condition variable are kept for the next channel. */
+	if (speech_channel_closed(schannel))
+		slab_free(speech_channel_slab, schannel);
+	else
+		ast_log(LOG_WARNING, "Speech channel not returned to the slab, session has not terminated\n");
+}
+
+/* Terminate the session, wait for it to close and release the channel. */
+static void speech_channel_teardown(speech_channel_t *schannel)
+{
+	int attempts = 0;
+
+	apr_thread_mutex_lock(schannel->mutex);
+
+	/* Destroy the channel and session if not already done. */
+	while (!speech_channel_closed(schannel) && (attempts++ < SPEECH_CHANNEL_TEARDOWN_ATTEMPTS)) {
+		apr_time_t deadline = apr_time_now() + globals.speech_channel_timeout;
+
+		speech_channel_terminate(schannel);
+
+		ast_log(LOG_DEBUG, "(%s) Waiting for MRCP session to terminate\n", schannel->name);
+		while (!speech_channel_closed(schannel) && (apr_time_now() < deadline))
+			apr_thread_cond_timedwait(schannel->cond, schannel->mutex, deadline - apr_time_now());
+
+		if (!speech_channel_closed(schannel))
+			ast_log(LOG_WARNING, "(%s) MRCP session has not terminated after %" APR_TIME_T_FMT " ms\n", schannel->name, apr_time_as_msec(globals.speech_channel_timeout));
+	}
+
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	speech_channel_release(schannel);
+}
+
+/* Destroy the speech channel. */
+int speech_channel_destroy(speech_channel_t *schannel)
+{
+	if (!schannel) {
+		ast_log(LOG_ERROR, "Speech channel structure pointer is NULL\n");
+		return -1;
+	}
+	
+	ast_log(LOG_DEBUG, "Destroy speech channel: Name=%s, Type=%s, Codec=%s, Rate=%u\n", schannel->name, speech_channel_type_to_string(schannel->type), schannel->codec, schannel->rate);
+
+	speech_channel_unregister(schannel);
+
+	/* Keep the established session for the next call, if the profile has a session pool. */
+	if (speech_channel_checkin(schannel) == 0)
+		return 0;
 
-	if (schannel->cond != NULL) {
-		if (apr_thread_cond_destroy(schannel->cond) != APR_SUCCESS)
-			ast_log(LOG_WARNING, "(%s) Unable to destroy channel condition variable\n", schannel->name);
+	/* Leave the teardown to the reaper, so the caller does not wait for the session to terminate. */
+	if (globals.reaper_running && (speech_channel_detach(schannel) == 0)) {
+		speech_channel_reaper_add(schannel);
+		return 0;
 	}
 
-	if (schannel->mutex != NULL) {
-		if (apr_thread_mutex_destroy(schannel->mutex) != APR_SUCCESS)
-			ast_log(LOG_WARNING, "(%s) Unable to destroy channel condition variable\n", schannel->name);
+	speech_channel_teardown(schannel);
+	return 0;
+}
+
+/* --- TEARDOWN --- */
+
+/* Queue a detached channel for teardown by the reaper. */
+static void speech_channel_reaper_add(speech_channel_t *schannel)
+{
+	schannel->teardown_attempts = 0;
+	schannel->idle_since = apr_time_now();
+	apr_atomic_inc32(&globals.pending_teardowns);
+
+	apr_thread_mutex_lock(globals.mutex);
+	schannel->idle_next = teardown_channels;
+	teardown_channels = schannel;
+	apr_thread_cond_signal(globals.reaper_cond);
+	apr_thread_mutex_unlock(globals.mutex);
+}
+
+/* Advance the teardown of a channel. Return TRUE once the channel is done with. */
+static int speech_channel_teardown_step(speech_channel_t *schannel, apr_time_t now)
+{
+	if (speech_channel_closed(schannel)) {
+		speech_channel_release(schannel);
+		return TRUE;
+	}
+
+	/* Wait for the response to the last request. */
+	if ((schannel->teardown_attempts > 0) && (now - schannel->idle_since < globals.speech_channel_timeout))
+		return FALSE;
+
+	if (schannel->teardown_attempts >= SPEECH_CHANNEL_TEARDOWN_ATTEMPTS) {
+		ast_log(LOG_ERROR, "(%s) MRCP session has not terminated after %u attempts\n", schannel->name, schannel->teardown_attempts);
+		apr_atomic_inc32(&globals.failed_teardowns);
+		speech_channel_release(schannel);
+		return TRUE;
+	}
+
+	if (schannel->teardown_attempts > 0)
+		ast_log(LOG_WARNING, "(%s) MRCP session has not terminated after %" APR_TIME_T_FMT " ms, retrying\n", schannel->name, apr_time_as_msec(globals.speech_channel_timeout));
+
+	apr_thread_mutex_lock(schannel->mutex);
+	speech_channel_terminate(schannel);
+	apr_thread_mutex_unlock(schannel->mutex);
+
+	schannel->teardown_attempts++;
+	schannel->idle_since = now;
+	return FALSE;
+}
+
+/* Advance the teardown of all the queued channels. */
+static void speech_channel_reap(void)
+{
+	speech_channel_t *pending;
+	speech_channel_t *schannel;
+	speech_channel_t *keep = NULL;
+	speech_channel_t *last = NULL;
+	apr_time_t now = apr_time_now();
+
+	apr_thread_mutex_lock(globals.mutex);
+	pending = teardown_channels;
+	teardown_channels = NULL;
+	apr_thread_mutex_unlock(globals.mutex);
+
+	while ((schannel = pending) != NULL) {
+		pending = schannel->idle_next;
+		schannel->idle_next = NULL;
+
+		if (speech_channel_teardown_step(schannel, now)) {
+			apr_atomic_dec32(&globals.pending_teardowns);
+		} else {
+			if (last == NULL)
+				last = schannel;
+			schannel->idle_next = keep;
+			keep = schannel;
+		}
+	}
+
+	if (keep != NULL) {
+		apr_thread_mutex_lock(globals.mutex);
+		last->idle_next = teardown_channels;
+		teardown_channels = keep;
+		apr_thread_mutex_unlock(globals.mutex);
+	}
+}
+
+/* The reaper thread. */
+static void * APR_THREAD_FUNC speech_channel_reaper_run(apr_thread_t *thread, void *data)
+{
+	apr_thread_mutex_lock(globals.mutex);
+	while (globals.reaper_running) {
+		apr_thread_cond_timedwait(globals.reaper_cond, globals.mutex, SPEECH_CHANNEL_REAPER_INTERVAL);
+
+		apr_thread_mutex_unlock(globals.mutex);
+		speech_channel_reap();
+		apr_thread_mutex_lock(globals.mutex);
+	}
+	apr_thread_mutex_unlock(globals.mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Start the thread tearing down speech channels. */
+int speech_channel_reaper_start(void)
+{
+	if ((apr_thread_cond_create(&globals.reaper_cond, globals.pool) != APR_SUCCESS) || (globals.reaper_cond == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create reaper condition variable\n");
+		globals.reaper_cond = NULL;
+		return -1;
+	}
+
+	globals.reaper_running = 1;
+	if (apr_thread_create(&globals.reaper_thread, NULL, speech_channel_reaper_run, NULL, globals.pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create reaper thread\n");
+		globals.reaper_running = 0;
+		globals.reaper_thread = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Stop the reaper thread and complete the pending teardowns. */
+void speech_channel_reaper_stop(void)
+{
+	apr_status_t status;
+
+	if (globals.reaper_thread == NULL)
+		return;
+
+	apr_thread_mutex_lock(globals.mutex);
+	globals.reaper_running = 0;
+	apr_thread_cond_signal(globals.reaper_cond);
+	apr_thread_mutex_unlock(globals.mutex);
+
+	apr_thread_join(&status, globals.reaper_thread);
+	globals.reaper_thread = NULL;
+
+	while (apr_atomic_read32(&globals.pending_teardowns) > 0) {
+		speech_channel_reap();
+		if (apr_atomic_read32(&globals.pending_teardowns) > 0)
+			apr_sleep(SPEECH_CHANNEL_REAPER_INTERVAL);
+	}
+}
+
+/* Create the data specific to the type of the channel. */
+static int speech_channel_data_create(speech_channel_t *schannel)
+{
+	int status = 0;
+
+	if (schannel->type == SPEECH_CHANNEL_RECOGNIZER) {
+		recognizer_data_t *r = (recognizer_data_t *)apr_palloc(schannel->pool, sizeof(recognizer_data_t));
+
+		if (r != NULL) {
+			schannel->data = r;
+			memset(r, 0, sizeof(recognizer_data_t));
+
+			if ((r->grammars = apr_hash_make(schannel->pool)) == NULL) {
+				ast_log(LOG_ERROR, "Unable to allocate hash for grammars\n");
+				status = -1;
+			}
+		} else {
+			ast_log(LOG_ERROR, "Unable to allocate recognizer data structure\n");
+			status = -1;
+		}
 	}
 
-	schannel->name = NULL;
-	schannel->profile = NULL;
-	schannel->application = NULL;
-	schannel->unimrcp_session = NULL;
-	schannel->unimrcp_channel = NULL;
-	schannel->stream = NULL;
-	schannel->dtmf_generator = NULL;
-	schannel->session_id = NULL;
-	schannel->pool = NULL;
-	schannel->mutex = NULL;
-	schannel->cond = NULL;
-	schannel->audio_queue = NULL;
-	schannel->codec = NULL;
-	schannel->data = NULL;
-	schannel->chan = NULL;
-	schannel->rec_file = NULL;
+	return status;
+}
 
-	return 0;
+/* Free the object of a session, along with the session. */
+static apr_status_t speech_channel_handle_free(void *data)
+{
+	ast_free(data);
+	return APR_SUCCESS;
 }
 
-/* Open the speech channel. */
-int speech_channel_open(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
+/* Start opening the speech channel, taking over a session from the session pool if available. */
+int speech_channel_open_start(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
 {
 	int status = 0;
 	mpf_termination_t *termination = NULL;
 	mrcp_resource_type_e resource_type;
+	speech_channel_t *idle;
 
 	if (!schannel || !profile)
 		return -1;
@@ -437,21 +2135,46 @@ int speech_channel_open(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
 	apr_thread_mutex_lock(schannel->mutex);
 
 	/* Make sure we can open channel. */
-	if (schannel->state != SPEECH_CHANNEL_CLOSED) {
+	if ((schannel->state != SPEECH_CHANNEL_CLOSED) || schannel->opening) {
 		apr_thread_mutex_unlock(schannel->mutex);
 		return -1;
 	}
 
 	schannel->profile = profile;
+	if (apr_atomic_read32(&profile->debug_flags) != 0)
+		speech_channel_debug_set(schannel, apr_atomic_read32(&profile->debug_flags), TRUE);
+	schannel->timing.open_start = speech_channel_clock();
+	schannel->timing.ready = 0;
+
+	/* Take over an established session from the session pool, if there is one. */
+	if ((schannel->chan != NULL) && ((idle = session_pool_checkout(profile, schannel->application, schannel->type, schannel->codec, schannel->rate)) != NULL)) {
+		speech_channel_adopt(schannel, idle);
+		schannel->timing.ready = speech_channel_clock();
+		profile_latency_record(profile, schannel->type, AST_MRCP_LATENCY_SETUP, schannel->timing.ready - schannel->timing.open_start);
+		status = speech_channel_data_create(schannel);
+		apr_thread_mutex_unlock(schannel->mutex);
+		return status;
+	}
+
+	/* The object of the session outlives the channel if the session is pooled, and is freed along with the session. */
+	if ((schannel->handle = (speech_channel_handle_t *)ast_calloc(1, sizeof(speech_channel_handle_t))) == NULL) {
+		apr_thread_mutex_unlock(schannel->mutex);
+		return -1;
+	}
+	schannel->handle->schannel = schannel;
 
-	/* Create MRCP session. */
-	if ((schannel->unimrcp_session = mrcp_application_session_create(schannel->application->app, profile->name, schannel)) == NULL) {
+	/* Create MRCP session, with the faster than realtime twin of the profile for batch jobs. */
+	if ((schannel->unimrcp_session = mrcp_application_session_create(schannel->application->app,
+			(schannel->batch && (profile->batch_name != NULL)) ? profile->batch_name : profile->name, schannel->handle)) == NULL) {
 		/* Profile doesn't exist? */
 		ast_log(LOG_ERROR, "(%s) Unable to create session with %s\n", schannel->name, profile->name);
 
+		ast_free(schannel->handle);
+		schannel->handle = NULL;
 		apr_thread_mutex_unlock(schannel->mutex);
 		return 2;
 	}
+	apr_pool_cleanup_register(mrcp_application_session_pool_get(schannel->unimrcp_session), schannel->handle, speech_channel_handle_free, apr_pool_cleanup_null);
 	
 	/* Set session name for logging purposes. */
 	mrcp_application_session_name_set(schannel->unimrcp_session, schannel->name);
@@ -493,8 +2216,30 @@ int speech_channel_open(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
 		return -1;
 	}
 
+	/* Cleared by the first state change, once the MRCP client has processed the request. */
+	schannel->opening = TRUE;
+
+	apr_thread_mutex_unlock(schannel->mutex);
+	return status;
+}
+
+/* Wait for the speech channel being opened to be ready. Return immediately, if the channel is not being opened. */
+int speech_channel_open_wait(speech_channel_t *schannel)
+{
+	int status = 0;
+
+	if (!schannel)
+		return -1;
+
+	apr_thread_mutex_lock(schannel->mutex);
+
+	if (!schannel->opening) {
+		apr_thread_mutex_unlock(schannel->mutex);
+		return 0;
+	}
+
 	/* Wait for channel to be ready. */
-	while (schannel->state == SPEECH_CHANNEL_CLOSED)
+	while (schannel->opening)
 		apr_thread_cond_timedwait(schannel->cond, schannel->mutex, globals.speech_channel_timeout);
 
 	if (schannel->state == SPEECH_CHANNEL_READY) {
@@ -520,27 +2265,38 @@ int speech_channel_open(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
 		}
 	}
 
-	if (schannel->type == SPEECH_CHANNEL_RECOGNIZER) {
-		recognizer_data_t *r = (recognizer_data_t *)apr_palloc(schannel->pool, sizeof(recognizer_data_t));
-
-		if (r != NULL) {
-			schannel->data = r;
-			memset(r, 0, sizeof(recognizer_data_t));
-
-			if ((r->grammars = apr_hash_make(schannel->pool)) == NULL) {
-				ast_log(LOG_ERROR, "Unable to allocate hash for grammars\n");
-				status = -1;
-			}
-		} else {
-			ast_log(LOG_ERROR, "Unable to allocate recognizer data structure\n");
-			status = -1;
-		}
-	}
+	if (speech_channel_data_create(schannel) != 0)
+		status = -1;
 
 	apr_thread_mutex_unlock(schannel->mutex);
 	return status;
 }
 
+/* Open the speech channel, taking over a session from the session pool if available. */
+int speech_channel_open(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
+{
+	int status;
+
+	if ((status = speech_channel_open_start(schannel, profile)) != 0)
+		return status;
+
+	return speech_channel_open_wait(schannel);
+}
+
+/* Open the speech channel unless it is open or being opened, e.g. as a prompt 
+ * has been played out from the TTS cache so far, and wait for it to be ready.
+ */
+int speech_channel_open_ready(speech_channel_t *schannel, ast_mrcp_profile_t *profile)
+{
+	if (!schannel)
+		return -1;
+
+	if (speech_channel_closed(schannel))
+		return speech_channel_open(schannel, profile);
+
+	return speech_channel_open_wait(schannel);
+}
+
 /* Stop SPEAK/RECOGNIZE request on speech channel. */
 int speech_channel_stop(speech_channel_t *schannel)
 {
@@ -581,22 +2337,53 @@ int speech_channel_stop(speech_channel_t *schannel)
 
 			if (schannel->state == SPEECH_CHANNEL_PROCESSING) {
 				ast_log(LOG_ERROR, "(%s) Timed out waiting for session to close.  Continuing\n", schannel->name);
-				schannel->state = SPEECH_CHANNEL_ERROR;
+				apr_atomic_set32(&schannel->state, SPEECH_CHANNEL_ERROR);
 				status = -1;
 			} else if (schannel->state == SPEECH_CHANNEL_ERROR) {
 				ast_log(LOG_ERROR, "(%s) Channel error\n", schannel->name);
-				schannel->state = SPEECH_CHANNEL_ERROR;
+				apr_atomic_set32(&schannel->state, SPEECH_CHANNEL_ERROR);
 				status = -1;
 			} else {
 				ast_log(LOG_DEBUG, "(%s) %s stopped\n", schannel->name, speech_channel_type_to_string(schannel->type));
 			}
 		}
+
+		/* Discard the synthesized speech and the outstanding chunks of the stopped request. */
+		if (schannel->type == SPEECH_CHANNEL_SYNTHESIZER) {
+			audio_queue_clear(schannel->audio_queue);
+			speech_channel_speak_reset(schannel);
+		}
 	}
 
 	apr_thread_mutex_unlock(schannel->mutex);
 	return status;
 }
 
+/* Set the body of an MRCP message. The content of a file loaded by the channel 
+ * is not copied, but referenced until the message is destroyed, as the message 
+ * may be sent after the request has timed out.
+ */
+void speech_channel_body_set(speech_channel_t *schannel, mrcp_message_t *msg, const char *content)
+{
+	content_cache_entry_t *entry;
+	int i;
+
+	if (schannel->contents != NULL) {
+		for (i = 0; i < schannel->contents->nelts; i++) {
+			entry = APR_ARRAY_IDX(schannel->contents, i, content_cache_entry_t *);
+			if (entry->data == content) {
+				content_cache_entry_ref(entry);
+				content_cache_entry_attach(entry, msg->pool);
+				apt_string_set(&msg->body, entry->data);
+				msg->body.length = entry->len;
+				return;
+			}
+		}
+	}
+
+	apt_string_assign(&msg->body, content, msg->pool);
+}
+
 /* Set parameters in an MRCP header. */
 int speech_channel_set_params(speech_channel_t *schannel, mrcp_message_t *msg, apr_hash_t *header_fields)
 {
@@ -630,36 +2417,36 @@ int speech_channel_set_params(speech_channel_t *schannel, mrcp_message_t *msg, a
 	return 0;
 }
 
-/* Read synthesized speech / speech to be recognized. */
+/* Read synthesized speech / speech to be recognized. 
+ * This is called from the UniMRCP media engine, hence no lock may be taken here.
+ */
 int speech_channel_read(speech_channel_t *schannel, void *data, apr_size_t *len, int block)
 {
 	int status = 0;
 
 	if (schannel) {
-#if SPEECH_CHANNEL_TRACE
-		apr_size_t req_len = *len;
-#endif
 		audio_queue_t *queue = schannel->audio_queue;
-
-		apr_thread_mutex_lock(schannel->mutex);
-
-		if (schannel->state == SPEECH_CHANNEL_PROCESSING)
-			status = audio_queue_read(queue, data, len, block);
-		else
+		apr_size_t requested = *len;
+
+		if (speech_channel_get_state(schannel) == SPEECH_CHANNEL_PROCESSING) {
+			apr_size_t depth = audio_queue_inuse(queue);
+			status = speech_channel_drift_read(schannel, data, len, block);
+			speech_channel_drift_update(schannel, depth, *len);
+			if ((*len > 0) && !schannel->timing.first_audio)
+				schannel->timing.first_audio = speech_channel_clock();
+			/* The caller pads the missing data with silence. */
+			if (*len < requested)
+				apr_atomic_inc32(&schannel->underruns);
+		} else
 			status = 1;
 
-		apr_thread_mutex_unlock(schannel->mutex);
+		if (status == 0)
+			stream_dump_write(schannel->dump, STREAM_DUMP_OUT, data, *len);
 
-#if SPEECH_CHANNEL_DUMP
-		if(status == 0 && schannel->stream_out) {
-			fwrite(data, 1, *len, schannel->stream_out);
+		if (apr_atomic_read32(&schannel->debug) & SPEECH_CHANNEL_DEBUG_TRACE) {
+			ast_log(LOG_DEBUG, "(%s) channel_read() status=%d req=%"APR_SIZE_T_FMT" read=%"APR_SIZE_T_FMT"\n", 
+					schannel->name, status, requested, *len);
 		}
-#endif
-
-#if SPEECH_CHANNEL_TRACE
-		ast_log(LOG_DEBUG, "(%s) channel_read() status=%d req=%"APR_SIZE_T_FMT" read=%"APR_SIZE_T_FMT"\n", 
-				schannel->name, status, req_len, *len);
-#endif
 
 	} else {
 		ast_log(LOG_ERROR, "Speech channel structure pointer is NULL\n");
@@ -669,36 +2456,114 @@ int speech_channel_read(speech_channel_t *schannel, void *data, apr_size_t *len,
 	return status;
 }
 
+/* Run the voice activity detector on audio written to a recognizer. Until 
+ * speech starts, unvoiced audio is replaced with digital silence if configured, 
+ * so the recognizer is not busy with background noise.
+ */
+static void speech_channel_vad_process(speech_channel_t *schannel, void *data, apr_size_t len)
+{
+	energy_vad_event_t event;
+	int voiced;
+
+	event = energy_vad_process(schannel->vad, data, len, &voiced);
+	if (event != ENERGY_VAD_NONE) {
+		ast_log(LOG_DEBUG, "(%s) Local %s\n", schannel->name, (event == ENERGY_VAD_START_OF_SPEECH) ? "start of speech" : "no input");
+		schannel->vad_event = event;
+	}
+
+	if (globals.vad_squelch && !voiced && !energy_vad_in_speech(schannel->vad))
+		memset(data, schannel->vad->silence, len);
+}
+
+/* Get and clear the last event of the voice activity detector, from the writer thread. */
+energy_vad_event_t speech_channel_vad_poll(speech_channel_t *schannel)
+{
+	energy_vad_event_t event = schannel->vad_event;
+
+	schannel->vad_event = ENERGY_VAD_NONE;
+	return event;
+}
+
+/* Start detecting voice activity anew, from the writer thread. */
+void speech_channel_vad_reset(speech_channel_t *schannel)
+{
+	if (schannel->vad != NULL)
+		energy_vad_reset(schannel->vad);
+	schannel->vad_event = ENERGY_VAD_NONE;
+}
+
+/* Replay the audio kept in the pre-roll ring into the audio queue, once the 
+ * recognizer is processing. Only the most recent audio of the pre-roll time 
+ * is replayed, as the ring may hold more.
+ */
+static void speech_channel_preroll_replay(speech_channel_t *schannel)
+{
+	apr_byte_t chunk[SPEECH_CHANNEL_PREROLL_CHUNK_SIZE];
+	apr_size_t inuse = audio_queue_inuse(schannel->preroll);
+	apr_size_t replayed = 0;
+	apr_size_t len;
+
+	if (inuse == 0)
+		return;
+
+	while (inuse > schannel->preroll_len) {
+		len = inuse - schannel->preroll_len;
+		if (len > sizeof(chunk))
+			len = sizeof(chunk);
+		if (audio_queue_read(schannel->preroll, chunk, &len, 0) != 0)
+			return;
+		inuse -= len;
+	}
+
+	while (audio_queue_inuse(schannel->preroll) > 0) {
+		len = sizeof(chunk);
+		if (audio_queue_read(schannel->preroll, chunk, &len, 0) != 0)
+			break;
+		if (schannel->vad != NULL)
+			speech_channel_vad_process(schannel, chunk, len);
+		if (audio_queue_write(schannel->audio_queue, chunk, &len) != 0)
+			break;
+		replayed += len;
+	}
+
+	ast_log(LOG_DEBUG, "(%s) Replayed %" APR_SIZE_T_FMT " bytes of pre-roll\n", schannel->name, replayed);
+}
+
+/* Discard the audio kept in the pre-roll ring, from the writer thread. */
+void speech_channel_preroll_clear(speech_channel_t *schannel)
+{
+	if (schannel->preroll != NULL)
+		audio_queue_clear(schannel->preroll);
+}
+
 /* Write synthesized speech / speech to be recognized. */
 int speech_channel_write(speech_channel_t *schannel, void *data, apr_size_t *len)
 {
 	int status = 0;
 
 	if ((schannel != NULL) && (*len > 0)) {
-#if SPEECH_CHANNEL_TRACE
 		apr_size_t req_len = *len;
-#endif
-
-#if SPEECH_CHANNEL_DUMP
-		if(schannel->stream_in) {
-			fwrite(data, 1, *len, schannel->stream_in);
-		}
-#endif
-		apr_thread_mutex_lock(schannel->mutex);
-
 		audio_queue_t *queue = schannel->audio_queue;
 
-		if (schannel->state == SPEECH_CHANNEL_PROCESSING)
+		stream_dump_write(schannel->dump, STREAM_DUMP_IN, data, *len);
+
+		/* The audio queue is single-producer/single-consumer, no need to lock the channel. */
+		if (speech_channel_get_state(schannel) == SPEECH_CHANNEL_PROCESSING) {
+			if (schannel->preroll != NULL)
+				speech_channel_preroll_replay(schannel);
+			if (schannel->vad != NULL)
+				speech_channel_vad_process(schannel, data, *len);
 			status = audio_queue_write(queue, data, len);
-		else
+		} else if ((schannel->preroll != NULL) && (speech_channel_get_state(schannel) != SPEECH_CHANNEL_ERROR)) {
+			/* Keep the audio until recognition is in progress, the oldest audio is dropped. */
+			status = audio_queue_write(schannel->preroll, data, len);
+		} else
 			status = -1;
 
-		apr_thread_mutex_unlock(schannel->mutex);
-
-#if SPEECH_CHANNEL_TRACE
-		ast_log(LOG_DEBUG, "(%s) channel_write() status=%d req=%"APR_SIZE_T_FMT" written=%"APR_SIZE_T_FMT"\n", 
-				schannel->name, status, req_len, *len);
-#endif
+		if (apr_atomic_read32(&schannel->debug) & SPEECH_CHANNEL_DEBUG_TRACE) {
+			ast_log(LOG_DEBUG, "(%s) channel_write() status=%d req=%"APR_SIZE_T_FMT" written=%"APR_SIZE_T_FMT"\n", 
+					schannel->name, status, req_len, *len);
+		}
 
 	} else {
 		ast_log(LOG_ERROR, "Speech channel structure pointer is NULL\n");
@@ -708,36 +2573,23 @@ int speech_channel_write(speech_channel_t *schannel, void *data, apr_size_t *len
 	return status;
 }
 
-/* Fill the frame with data. */
-static APR_INLINE void ast_frame_fill(speech_channel_t *schannel, struct ast_frame *fr, void *data, apr_size_t size)
-{
-	memset(fr, 0, sizeof(*fr));
-	fr->frametype = AST_FRAME_VOICE;
-	ast_frame_set_format(fr, schannel->format);
-	fr->datalen = size;
-	fr->samples = 8 * size / schannel->bits_per_sample;
-	ast_frame_set_data(fr, data);
-	fr->mallocd = 0;
-	fr->offset = AST_FRIENDLY_OFFSET;
-	fr->src = __PRETTY_FUNCTION__;
-	fr->delivery.tv_sec = 0;
-	fr->delivery.tv_usec = 0;
-}
-
+/* Queue synthesized speech for playout to Asterisk. This is called from the 
+ * UniMRCP media engine, hence the audio is only copied to the audio queue.
+ */
 int speech_channel_ast_write(speech_channel_t *schannel, void *data, apr_size_t len)
 {
-	struct ast_frame fr;
-	ast_frame_fill(schannel, &fr, data, len);
+	/* Idle channels kept in a session pool are not attached to a call and not drained either. */
+	if (((schannel->chan == NULL) || !apr_atomic_read32(&schannel->playout.active)) && !apr_atomic_read32(&schannel->playout.draining))
+		return 0;
 
-	if (schannel->rec_file)
-		fwrite(data, 1, len, schannel->rec_file);
-	
-	if (ast_write(schannel->chan, &fr) < 0) {
-		ast_log(LOG_WARNING, "(%s) Unable to write frame to channel: %s\n", schannel->name, strerror(errno));
-		return -1;
-	}
-	
-	return 0;
+	/* The rest of a prompt barged in on is dropped. */
+	if (apr_atomic_read32(&schannel->playout.muted))
+		return 0;
+
+	if (!schannel->timing.first_audio)
+		schannel->timing.first_audio = speech_channel_clock();
+
+	return audio_queue_write(schannel->audio_queue, data, &len);
 }
 
 /* Playback the specified sound file. */
@@ -829,35 +2681,31 @@ static int text_starts_with(const char *text, const char *match)
 	return result;
 }
 
-/* Load content from file. */
+/* Load content from file, through the content cache. The content is 
+ * referenced until the memory pool of the channel is destroyed.
+ */
 static const char *speech_channel_load_content(speech_channel_t *schannel, const char *path)
 {
-	char *content;
-	apr_file_t *file;
-	apr_finfo_t finfo;
+	content_cache_entry_t *entry;
+	int i;
 
-	if (apr_file_open(&file, path, APR_FOPEN_READ, 0, schannel->pool) != APR_SUCCESS) {
-		ast_log(LOG_WARNING, "Could not open file to read: %s\n", path);
+	if ((entry = content_cache_load(schannel->pool, path)) == NULL)
 		return NULL;
-	}
 
-	if (apr_file_info_get(&finfo, APR_FINFO_SIZE, file) == APR_SUCCESS) {
-		content = apr_palloc(schannel->pool, finfo.size+1);
-		apr_size_t length = (apr_size_t)finfo.size;
-		if (apr_file_read(file, content, &length) == APR_SUCCESS) {
-			content[length] = '\0';
-		}
-		else {
-			ast_log(LOG_WARNING, "Failed to read content from file: %s, size: %"APR_OFF_T_FMT"\n", path, finfo.size);
-			content = NULL;
+	if (schannel->contents == NULL)
+		schannel->contents = apr_array_make(schannel->pool, 1, sizeof(content_cache_entry_t *));
+
+	/* The same content is referenced once, e.g. by persistent sessions. */
+	for (i = 0; i < schannel->contents->nelts; i++) {
+		if (APR_ARRAY_IDX(schannel->contents, i, content_cache_entry_t *) == entry) {
+			content_cache_entry_release(entry);
+			return entry->data;
 		}
 	}
-	else {
-		ast_log(LOG_WARNING, "Failed to get file info: %s\n", path);
-		content = NULL;
-	}
-	apr_file_close(file);
-	return content;
+
+	APR_ARRAY_PUSH(schannel->contents, content_cache_entry_t *) = entry;
+	content_cache_entry_attach(entry, schannel->pool);
+	return entry->data;
 }
 
 /* Determine synthesis content type by specified text. */
@@ -890,6 +2738,241 @@ int determine_synth_content_type(speech_channel_t *schannel, const char *text, c
 	return 0;
 }
 
+/* Whether the text ends a sentence at pos: punctuation followed by white space or the end. */
+static APR_INLINE int text_ends_sentence(const char *text, apr_size_t pos, apr_size_t len)
+{
+	if ((text[pos] != '.') && (text[pos] != '!') && (text[pos] != '?'))
+		return FALSE;
+	return (pos + 1 == len) || isspace((unsigned char)text[pos + 1]);
+}
+
+/* Locate the <speak> root element of an SSML prompt: its start tag in root, 
+ * its content in body, and its end tag in root_end. Return -1 if the root 
+ * element is missing or empty.
+ */
+static int synth_ssml_body(const char *text, const char **root, const char **body, const char **root_end)
+{
+	const char *start;
+	const char *content;
+	const char *end;
+
+	if (((start = strstr(text, SSML_ID)) == NULL) || ((content = strchr(start, '>')) == NULL) || (content[-1] == '/'))
+		return -1;
+	content++;
+	if ((end = strstr(content, "</speak>")) == NULL)
+		return -1;
+
+	if (root)
+		*root = start;
+	*body = content;
+	*root_end = end;
+	return 0;
+}
+
+/* Split the body of a prompt at sentence boundaries into chunks of at least 
+ * min_len characters, each wrapped into prefix and suffix. In markup, only 
+ * text at the top level is split, and after top level <s> and <p> elements.
+ */
+static void synth_chunks_split(apr_pool_t *pool, const char *body, apr_size_t len, int markup, apr_size_t min_len, const char *prefix, const char *suffix, apr_array_header_t *chunks)
+{
+	apr_size_t start = 0;
+	apr_size_t end;
+	apr_size_t pos = 0;
+	const char *tag_end;
+	int depth = 0;
+
+	while (pos < len) {
+		end = 0;
+		if (markup && (body[pos] == '<')) {
+			if ((tag_end = memchr(body + pos, '>', len - pos)) == NULL)
+				break;
+			if ((pos + 1 < len) && (body[pos + 1] == '/')) {
+				if ((--depth == 0) && ((strncasecmp(body + pos, "</s>", 4) == 0) || (strncasecmp(body + pos, "</p>", 4) == 0)))
+					end = tag_end - body + 1;
+			} else if ((body[pos + 1] != '!') && (body[pos + 1] != '?') && (tag_end[-1] != '/')) {
+				depth++;
+			}
+			pos = tag_end - body + 1;
+		} else {
+			if ((depth == 0) && text_ends_sentence(body, pos, len))
+				end = pos + 1;
+			pos++;
+		}
+
+		if (end && (end - start >= min_len)) {
+			APR_ARRAY_PUSH(chunks, const char *) = apr_pstrcat(pool, prefix, apr_pstrndup(pool, body + start, end - start), suffix, NULL);
+			/* The white space between sentences is not synthesized. */
+			while ((end < len) && isspace((unsigned char)body[end]))
+				end++;
+			start = pos = end;
+		}
+	}
+
+	if (start < len)
+		APR_ARRAY_PUSH(chunks, const char *) = apr_pstrcat(pool, prefix, apr_pstrndup(pool, body + start, len - start), suffix, NULL);
+}
+
+/* Split a plain text or SSML prompt into chunks at sentence boundaries, to be 
+ * synthesized by SPEAK requests queued back to back, so that the synthesis of 
+ * the first sentence does not wait for the whole prompt. Each chunk of an SSML 
+ * prompt is a document of its own, with the prolog and the root element of 
+ * the prompt. Prompts of other types, and prompts which do not split, make up 
+ * a single chunk.
+ */
+int determine_synth_chunks(speech_channel_t *schannel, const char *content, const char *content_type, apr_size_t min_len, apr_array_header_t **chunks)
+{
+	const char *body;
+	const char *root_end;
+
+	if ((*chunks = apr_array_make(schannel->pool, 1, sizeof(const char *))) == NULL)
+		return -1;
+
+	if ((min_len > 0) && (strcmp(content_type, MIME_TYPE_PLAIN_TEXT) == 0)) {
+		synth_chunks_split(schannel->pool, content, strlen(content), FALSE, min_len, "", "", *chunks);
+	} else if ((min_len > 0) && schannel->profile && (strcmp(content_type, schannel->profile->ssml_mime_type) == 0)) {
+		if (synth_ssml_body(content, NULL, &body, &root_end) == 0) {
+			synth_chunks_split(schannel->pool, body, root_end - body, TRUE, min_len, apr_pstrndup(schannel->pool, content, body - content), root_end, *chunks);
+		}
+	}
+
+	if ((*chunks)->nelts <= 1) {
+		apr_array_clear(*chunks);
+		APR_ARRAY_PUSH(*chunks, const char *) = content;
+	}
+	return 0;
+}
+
+/* Whether a prompt is inline plain text or SSML, rather than referenced by a file or URI. */
+int determine_synth_inline(const char *text)
+{
+	const char *body;
+	const char *root_end;
+
+	if (text_starts_with(text, "/") || text_starts_with(text, HTTP_ID) || text_starts_with(text, HTTPS_ID) || text_starts_with(text, FILE_ID))
+		return FALSE;
+
+	if (text_starts_with(text, XML_ID) || text_starts_with(text, SSML_ID))
+		return (synth_ssml_body(text, NULL, &body, &root_end) == 0);
+	return TRUE;
+}
+
+/* Escape plain text to be embedded in SSML. */
+static char *synth_text_escape(apr_pool_t *pool, const char *text)
+{
+	apr_size_t len = 0;
+	const char *p;
+	char *escaped;
+	char *q;
+
+	for (p = text; *p; p++)
+		len += (*p == '&' || *p == '"' || *p == '\'') ? 6 : (*p == '<' || *p == '>') ? 4 : 1;
+
+	q = escaped = apr_palloc(pool, len + 1);
+	for (p = text; *p; p++) {
+		switch (*p) {
+			case '&': memcpy(q, "&amp;", 5); q += 5; break;
+			case '<': memcpy(q, "&lt;", 4); q += 4; break;
+			case '>': memcpy(q, "&gt;", 4); q += 4; break;
+			case '"': memcpy(q, "&quot;", 6); q += 6; break;
+			case '\'': memcpy(q, "&apos;", 6); q += 6; break;
+			default: *q++ = *p;
+		}
+	}
+	*q = '\0';
+	return escaped;
+}
+
+/* Whether the start tag of the root element of an SSML prompt sets the 
+ * xml:lang attribute to the given language.
+ */
+static int synth_ssml_root_lang_is(const char *root, const char *language)
+{
+	const char *lang;
+	const char *end;
+	char quote;
+
+	if (ast_strlen_zero(language) || ((lang = strstr(root, "xml:lang")) == NULL))
+		return FALSE;
+
+	lang += strlen("xml:lang");
+	while (isspace((unsigned char)*lang))
+		lang++;
+	if (*lang++ != '=')
+		return FALSE;
+	while (isspace((unsigned char)*lang))
+		lang++;
+	if (((quote = *lang++) != '"') && (quote != '\''))
+		return FALSE;
+	if ((end = strchr(lang, quote)) == NULL)
+		return FALSE;
+
+	return ((apr_size_t)(end - lang) == strlen(language)) && (strncasecmp(lang, language, end - lang) == 0);
+}
+
+/* Merge inline plain text and SSML prompts into a single SSML document, each 
+ * prompt preceded by a mark with the given name, so that the synthesizer 
+ * reports which prompt it reached. The root element is the one of the SSML 
+ * prompts, or a default one in the given language.
+ *
+ * The prolog and the root element carry the encoding, language, voice and 
+ * base URI of the whole document, so only SSML prompts with the same prolog 
+ * and root start tag are merged, and plain text only if that root is in the 
+ * given language. The leading prompts which merge are merged, their number is 
+ * returned in count. Return NULL if fewer than two prompts merge or a prompt 
+ * is not inline.
+ */
+const char *merge_synth_prompts(apr_pool_t *pool, const char * const *prompts, const char * const *marks, int *count, const char *language)
+{
+	apr_array_header_t *parts;
+	const char *root = NULL;
+	const char *prompt_root;
+	const char *body;
+	const char *root_end;
+	int text = FALSE;
+	int i;
+
+	/* The prolog and the root start tag, once known, come first. */
+	parts = apr_array_make(pool, 2 * (*count) + 2, sizeof(const char *));
+	APR_ARRAY_PUSH(parts, const char *) = NULL;
+
+	for (i = 0; i < *count; i++) {
+		if (!determine_synth_inline(prompts[i]))
+			return NULL;
+
+		if (text_starts_with(prompts[i], XML_ID) || text_starts_with(prompts[i], SSML_ID)) {
+			if (synth_ssml_body(prompts[i], NULL, &body, &root_end) != 0)
+				return NULL;
+			for (prompt_root = prompts[i]; isspace((unsigned char)*prompt_root); prompt_root++);
+			prompt_root = apr_pstrndup(pool, prompt_root, body - prompt_root);
+			if (root ? (strcmp(prompt_root, root) != 0) : (text && !synth_ssml_root_lang_is(prompt_root, language)))
+				break;
+			root = prompt_root;
+			APR_ARRAY_PUSH(parts, const char *) = apr_psprintf(pool, "<mark name=\"%s\"/>", marks[i]);
+			APR_ARRAY_PUSH(parts, const char *) = apr_pstrndup(pool, body, root_end - body);
+		} else {
+			if (root && !synth_ssml_root_lang_is(root, language))
+				break;
+			text = TRUE;
+			APR_ARRAY_PUSH(parts, const char *) = apr_psprintf(pool, "<mark name=\"%s\"/>", marks[i]);
+			APR_ARRAY_PUSH(parts, const char *) = synth_text_escape(pool, prompts[i]);
+		}
+	}
+
+	if (i < 2)
+		return NULL;
+	*count = i;
+
+	/* Plain text prompts alone get a default prolog and root. */
+	if (root == NULL) {
+		root = apr_psprintf(pool, "<?xml version=\"1.0\"?>\n<speak version=\"1.0\" xmlns=\"http://www.w3.org/2001/10/synthesis\" xml:lang=\"%s\">",
+			ast_strlen_zero(language) ? "en-US" : language);
+	}
+	APR_ARRAY_IDX(parts, 0, const char *) = root;
+	APR_ARRAY_PUSH(parts, const char *) = "</speak>";
+
+	return apr_array_pstrcat(pool, parts, '\0');
+}
+
 /* Determine grammar type by specified grammar data. */
 int determine_grammar_type(speech_channel_t *schannel, const char *grammar_data, const char **grammar_content, grammar_type_t *grammar_type)
 {
@@ -972,6 +3055,101 @@ int grammar_create(grammar_t **grammar, const char *name, grammar_type_t type, c
 	return status;
 }
 
+/* Copy the Content-IDs of the grammars defined in a session to a pool. */
+static apr_hash_t *grammar_defined_copy(apr_hash_t *defined_grammars, apr_pool_t *pool)
+{
+	apr_hash_t *copy;
+	apr_hash_index_t *hi;
+	const void *key;
+	void *val;
+
+	if ((copy = apr_hash_make(pool)) == NULL)
+		return NULL;
+
+	for (hi = apr_hash_first(NULL, defined_grammars); hi; hi = apr_hash_next(hi)) {
+		apr_hash_this(hi, &key, NULL, &val);
+		apr_hash_set(copy, apr_pstrdup(pool, key), APR_HASH_KEY_STRING, apr_pstrdup(pool, val));
+	}
+	return copy;
+}
+
+/* Get the Content-ID to define an inline grammar by in the MRCP session of a 
+ * recognizer, given the name of the grammar. Set defined to TRUE if the same 
+ * grammar is already defined by this Content-ID, and digest to the digest of 
+ * the grammar, formatted into buf of GRAMMAR_DIGEST_BUFFER_SIZE bytes. Nothing 
+ * is allocated, as the channel may serve many calls from a session pool.
+ */
+const char *grammar_defined_get(speech_channel_t *schannel, const char *name, const char *mime_type, const char *data, int *defined, char *buf, const char **digest)
+{
+	unsigned char raw[APR_MD5_DIGESTSIZE];
+	apr_md5_ctx_t md5;
+	const char *id;
+	char *hex;
+	int i;
+
+	*defined = FALSE;
+
+	/* The MIME type is part of the digest, as the same body may be of another type. */
+	apr_md5_init(&md5);
+	apr_md5_update(&md5, mime_type, strlen(mime_type) + 1);
+	apr_md5_update(&md5, data, strlen(data));
+	apr_md5_final(raw, &md5);
+
+	/* The digest follows the prefix of the Content-ID derived from it. */
+	strcpy(buf, "grammar-");
+	hex = buf + strlen(buf);
+	for (i = 0; i < APR_MD5_DIGESTSIZE; i++)
+		apr_snprintf(hex + i * 2, 3, "%02x", raw[i]);
+	*digest = hex;
+
+	id = (schannel->defined_grammars != NULL) ? apr_hash_get(schannel->defined_grammars, hex, APR_HASH_KEY_STRING) : NULL;
+	if ((schannel->profile != NULL) && schannel->profile->grammar_hash_ids) {
+		/* The same grammar is defined by the same Content-ID in every session. */
+		*defined = (id != NULL);
+		return buf;
+	}
+
+	/* Other grammars of this request may be defined by any other name, hence the 
+	 * grammar is only reused if it is still defined by its own name. 
+	 */
+	*defined = (id != NULL) && (strcmp(id, name) == 0);
+	return name;
+}
+
+/* Account for an inline grammar defined in the MRCP session by DEFINE-GRAMMAR. 
+ * The strings of the hash are reused, they are only allocated for a grammar 
+ * or a Content-ID not defined before.
+ */
+void grammar_defined_set(speech_channel_t *schannel, const char *id, const char *digest)
+{
+	apr_hash_index_t *hi;
+	const void *key;
+	void *val;
+	const char *defined_digest = NULL;
+	const char *defined_id = NULL;
+
+	if (schannel->defined_grammars == NULL) {
+		if ((schannel->defined_grammars = apr_hash_make(schannel->pool)) == NULL)
+			return;
+	}
+
+	/* A grammar previously defined by the same Content-ID is replaced on the server. */
+	for (hi = apr_hash_first(NULL, schannel->defined_grammars); hi; hi = apr_hash_next(hi)) {
+		apr_hash_this(hi, &key, NULL, &val);
+		if (strcmp((const char *)key, digest) == 0)
+			defined_digest = key;
+		if (strcmp((const char *)val, id) == 0) {
+			defined_id = val;
+			if (strcmp((const char *)key, digest) != 0)
+				apr_hash_set(schannel->defined_grammars, key, APR_HASH_KEY_STRING, NULL);
+		}
+	}
+
+	apr_hash_set(schannel->defined_grammars, 
+		defined_digest ? defined_digest : apr_pstrdup(schannel->pool, digest), APR_HASH_KEY_STRING, 
+		defined_id ? defined_id : apr_pstrdup(schannel->pool, id));
+}
+
 /* Get the MIME type for this grammar type. */
 const char *grammar_type_to_mime(grammar_type_t type, const ast_mrcp_profile_t *profile)
 {
@@ -18,23 +18,23 @@
 #ifndef SPEECH_CHANNEL_H
 #define SPEECH_CHANNEL_H
 
-/*
- * Set SPEECH_CHANNEL_DUMP to 1 to store input and output streams 
- * in raw header-less files for further debugging.
- */
-#define SPEECH_CHANNEL_DUMP   0
-
 /*
  * Specifies the output directory to store streams in, used if 
- * SPEECH_CHANNEL_DUMP is enabled.
+ * SPEECH_CHANNEL_DEBUG_DUMP is enabled.
  */
 #define SPEECH_CHANNEL_DUMP_DIR   UNIMRCP_DIR_LOCATION"/var"
 
 /*
- * Set SPEECH_CHANNEL_TRACE to 1 to trace a statement per 
+ * Debug flags, toggled at runtime by the "mrcp set dump|trace" CLI command.
+ * SPEECH_CHANNEL_DEBUG_DUMP stores input and output streams in raw 
+ * header-less files, SPEECH_CHANNEL_DEBUG_TRACE traces a statement per 
  * channel read or write attempt.
  */
-#define SPEECH_CHANNEL_TRACE   0
+#define SPEECH_CHANNEL_DEBUG_DUMP    0x01
+#define SPEECH_CHANNEL_DEBUG_TRACE   0x02
+
+/* Maximum length of the name of a mark reported by the synthesizer. */
+#define SPEECH_CHANNEL_MARK_SIZE     64
 
 /* Type of MRCP channel. */
 enum speech_channel_type_t {
@@ -67,6 +67,110 @@ enum speech_channel_status_t {
 };
 typedef enum speech_channel_status_t speech_channel_status_t;
 
+/* Clock drift estimation and compensation between the Asterisk channel 
+ * writing audio and the media engine reading it. Updated from the media 
+ * engine only.
+ */
+struct speech_channel_drift_t {
+	/* Number of bytes per second. */
+	apr_size_t byte_rate;
+	/* Size of a sample in bytes, 0 if samples are not byte aligned. */
+	apr_size_t sample_size;
+	/* Target depth of the audio queue in bytes, 0 to disable compensation. */
+	apr_size_t target_depth;
+	/* Allowed deviation from the target depth in bytes. */
+	apr_size_t tolerance;
+	/* Sum of the queue depths sampled in the current window. */
+	apr_size_t depth_sum;
+	/* Number of bytes read in the current window. */
+	apr_size_t window_bytes;
+	/* Number of reads in the current window. */
+	apr_uint32_t window_reads;
+	/* Net number of bytes dropped (positive) or inserted (negative) in the current window. */
+	apr_ssize_t window_adjusted;
+	/* Average queue depth of the previous window in bytes. */
+	apr_size_t average_depth;
+	/* True, if the previous window has completed. */
+	int primed;
+	/* Scratch buffer used to drop or insert samples. */
+	apr_byte_t *scratch;
+	/* Size of the scratch buffer. */
+	apr_size_t scratch_size;
+	/* Estimated drift in ppm (apr_int32_t), positive if the writer is faster. */
+	volatile apr_uint32_t drift_ppm;
+	/* Average queue depth in msec. */
+	volatile apr_uint32_t depth_ms;
+	/* Number of samples dropped. */
+	volatile apr_uint32_t dropped;
+	/* Number of samples inserted. */
+	volatile apr_uint32_t inserted;
+};
+typedef struct speech_channel_drift_t speech_channel_drift_t;
+
+/* Playout of synthesized speech to Asterisk. The media engine only queues the 
+ * audio, a generator activated on the Asterisk channel writes it from the 
+ * thread of the channel, once enough audio is buffered to absorb jitter.
+ */
+struct speech_channel_playout_t {
+	/* Byte rate of the played out audio. */
+	apr_size_t byte_rate;
+	/* Number of bytes buffered before the playout starts or resumes. */
+	apr_size_t target_depth;
+	/* True while the generator is active on the Asterisk channel. */
+	volatile apr_uint32_t active;
+	/* True while the audio of a channel not attached to a call is drained into the TTS cache. */
+	volatile apr_uint32_t draining;
+	/* True once muted on barge-in, until the next prompt is played out. */
+	volatile apr_uint32_t muted;
+	/* True while audio is buffered up to the target depth. */
+	int buffering;
+	/* Number of frames played out since the last underrun or adjustment. */
+	apr_uint32_t stable_frames;
+	/* Size of a played out frame in bytes, per the packetization time of the channel. */
+	apr_size_t frame_len;
+	/* Number of samples in a played out frame. */
+	apr_size_t frame_samples;
+	/* Number of samples elapsed and not played out yet. */
+	apr_size_t credit;
+	/* Last time the generator was called. */
+	apr_time_t last_generate;
+	/* Prompt played out from the TTS cache instead of the audio queue. */
+	tts_cache_entry_t *cached;
+	/* Number of bytes of the cached prompt played out. */
+	apr_size_t cached_offset;
+};
+typedef struct speech_channel_playout_t speech_channel_playout_t;
+
+/* Points in time of the last request on a speech channel, from a monotonic 
+ * clock, 0 if not reached.
+ */
+struct speech_channel_timing_t {
+	/* Open of the channel started. */
+	apr_time_t open_start;
+	/* Channel became ready. */
+	apr_time_t ready;
+	/* SPEAK or RECOGNIZE request sent. */
+	apr_time_t request_sent;
+	/* IN-PROGRESS response received. */
+	apr_time_t in_progress;
+	/* First audio frame seen by the media engine callback. */
+	apr_time_t first_audio;
+	/* START-OF-INPUT event received. */
+	apr_time_t start_of_input;
+	/* COMPLETE event received. */
+	apr_time_t complete;
+};
+typedef struct speech_channel_timing_t speech_channel_timing_t;
+
+/* Object of an MRCP session, allocated along with the session and re-targeted 
+ * to the channel taking the session over from the session pool.
+ */
+struct speech_channel_handle_t {
+	/* The channel the session belongs to. */
+	struct speech_channel_t *schannel;
+};
+typedef struct speech_channel_handle_t speech_channel_handle_t;
+
 /* An MRCP speech channel. */
 struct speech_channel_t {
 	/* The name of this channel (for logging). */
@@ -79,6 +183,8 @@ struct speech_channel_t {
 	ast_mrcp_application_t *application;
 	/* UniMRCP session. */
 	mrcp_session_t *unimrcp_session;
+	/* Object of the UniMRCP session, NULL if none. */
+	speech_channel_handle_t *handle;
 	/* UniMRCP channel. */
 	mrcp_channel_t *unimrcp_channel;
 	/* UniMRCP stream object. */
@@ -89,14 +195,36 @@ struct speech_channel_t {
 	char *session_id;
 	/* Memory pool. */
 	apr_pool_t *pool;
+	/* Memory pool owned by the channel while it is kept in a session pool. */
+	apr_pool_t *warm_pool;
+	/* Next idle or retired channel. */
+	struct speech_channel_t *idle_next;
+	/* Time the channel became idle or retired, or the last teardown attempt. */
+	apr_time_t idle_since;
+	/* Content-IDs of the inline grammars defined in the MRCP session, keyed by content digest, NULL if none. */
+	apr_hash_t *defined_grammars;
+	/* Contents of the files loaded by the channel, referenced until its memory pool is destroyed, NULL if none. */
+	apr_array_header_t *contents;
+	/* Number of session terminate requests sent by the reaper. */
+	apr_uint32_t teardown_attempts;
 	/* Synchronizes channel state/ */
 	apr_thread_mutex_t *mutex;
 	/* Wait on channel states. */
 	apr_thread_cond_t *cond;
-	/* Channel state. */
-	speech_channel_state_t state;
+	/* True while the session is being established. */
+	int opening;
+	/* Channel state (speech_channel_state_t), read atomically from the media path. */
+	volatile apr_uint32_t state;
 	/* UniMRCP <--> Asterisk audio buffer. */
 	audio_queue_t *audio_queue;
+	/* Number of reads the audio queue could not fully satisfy. */
+	volatile apr_uint32_t underruns;
+	/* Clock drift estimator. */
+	speech_channel_drift_t drift;
+	/* Playout of synthesized speech. */
+	speech_channel_playout_t playout;
+	/* Latency measurements. */
+	speech_channel_timing_t timing;
 	/* Speech format. */
 	ast_format_compat *format;
 	/* Codec. */
@@ -113,14 +241,53 @@ struct speech_channel_t {
 	struct ast_channel *chan;
 	/* File to store data streamed to Asterisk. */
 	FILE *rec_file;
-
-#if SPEECH_CHANNEL_DUMP
-	FILE *stream_in;
-	FILE *stream_out;
-#endif
+	/* Debug flags (SPEECH_CHANNEL_DEBUG_*). */
+	volatile apr_uint32_t debug;
+	/* Dump of the streams, created once dumping is first enabled. */
+	stream_dump_t *volatile dump;
+	/* Capture of the synthesized speech for the TTS cache. */
+	tts_cache_capture_t *capture;
+	/* Number of audio queue overflows when the capture started. */
+	apr_uint32_t capture_overflows;
+	/* Read index of the audio queue when the capture started. */
+	apr_uint32_t capture_tail;
+	/* Number of bytes read from the audio queue into the capture. */
+	apr_size_t capture_len;
+	/* True once the drain of the captured SPEAK request is cancelled by another thread. */
+	volatile apr_uint32_t drain_cancelled;
+	/* True if the session is established with the faster than realtime media engine. */
+	int batch;
+	/* Completion cause of the last SPEAK request, -1 until it completes. */
+	int completion_cause;
+	/* Number of chunks the prompt of the last SPEAK request was split into, one SPEAK request each. */
+	apr_uint32_t speak_chunks;
+	/* Number of SPEAK requests for the chunks of the prompt completed. */
+	apr_uint32_t speak_done;
+	/* Request-ids of the SPEAK requests for the chunks of the prompt not completed yet (mrcp_request_id). */
+	apr_array_header_t *speak_requests;
+	/* Completion cause of the first chunk of the prompt which did not complete normally, -1 if none. */
+	int speak_cause;
+	/* Name of the last mark reached by the synthesizer, empty if none. */
+	char mark[SPEECH_CHANNEL_MARK_SIZE];
+	/* Voice activity detector of the recognizer input, NULL if disabled. */
+	energy_vad_t *vad;
+	/* Last event of the detector not polled yet, used by the writer only. */
+	energy_vad_event_t vad_event;
+	/* Ring of the audio written to a recognizer until it is processing, used by the writer only, NULL if disabled. */
+	audio_queue_t *preroll;
+	/* Number of bytes of the most recent audio replayed from the pre-roll ring. */
+	apr_size_t preroll_len;
 };
 typedef struct speech_channel_t speech_channel_t;
 
+/* Get the speech channel an MRCP session belongs to. */
+static APR_INLINE speech_channel_t *speech_channel_session_get(mrcp_session_t *session)
+{
+	speech_channel_handle_t *handle = (speech_channel_handle_t *)mrcp_application_session_object_get(session);
+
+	return (handle != NULL) ? handle->schannel : NULL;
+}
+
 /* Type of the grammar. */
 enum grammar_type_t {
 	GRAMMAR_TYPE_UNKNOWN,
@@ -162,11 +329,25 @@ struct recognizer_data_t {
 	const char *waveform_uri;
 	/* True, if voice has started. */
 	int start_of_input;
+	/* Time voice started, as reported by the recognizer or detected locally, from a monotonic clock, 0 if not yet. */
+	apr_time_t start_of_input_time;
 	/* True, if input timers have started. */
 	int timers_started;
+	/* Synthesizer channel silenced as soon as voice has started, NULL if none. */
+	speech_channel_t *bargein_channel;
+	/* Time the prompt was silenced on barge-in, from a monotonic clock, 0 if not yet. */
+	apr_time_t bargein_time;
 };
 typedef struct recognizer_data_t recognizer_data_t;
 
+/* Get the current channel state without locking the speech channel. This is 
+ * the only way the state is checked from UniMRCP media engine callbacks.
+ */
+static APR_INLINE speech_channel_state_t speech_channel_get_state(speech_channel_t *schannel)
+{
+	return (speech_channel_state_t)apr_atomic_read32(&schannel->state);
+}
+
 /* Use this function to set the current channel state without locking the 
  * speech channel.  Do this if you already have the speech channel locked.
  */
@@ -175,9 +356,44 @@ void speech_channel_set_state_unlocked(speech_channel_t *schannel, speech_channe
 /* Set the current channel state. */
 void speech_channel_set_state(speech_channel_t *schannel, speech_channel_state_t state);
 
+/* Start accounting for the SPEAK requests of a prompt split into chunks, 
+ * before the first one is sent, with the channel locked.
+ */
+void speech_channel_speak_start(speech_channel_t *schannel, apr_uint32_t chunks);
+
+/* Account for a SPEAK request accepted by the MRCP server, as IN-PROGRESS or PENDING. */
+void speech_channel_speak_accepted(speech_channel_t *schannel, mrcp_request_id request_id);
+
+/* Account for a SPEAK-COMPLETE event. Return FALSE while requests for more 
+ * chunks of the prompt are outstanding, -1 if the request is not one of them, 
+ * otherwise TRUE with the completion cause of the whole prompt in cause.
+ */
+int speech_channel_speak_completed(speech_channel_t *schannel, mrcp_request_id request_id, int *cause);
+
+/* Record the mark reached, from the Speech-Marker header of an event or a response. */
+void speech_channel_mark_reached(speech_channel_t *schannel, const apt_str_t *speech_marker);
+
+/* Get the name of the last mark reached. Return -1 if none was reached since the last request. */
+int speech_channel_mark_get(speech_channel_t *schannel, char *name, apr_size_t size);
+
 /* Send BARGE-IN-OCCURRED. */
 int speech_channel_bargeinoccurred(speech_channel_t *schannel);
 
+/* Get the time from a monotonic clock, for latency measurements. */
+apr_time_t speech_channel_clock(void);
+
+/* Start measuring the latencies of a SPEAK or RECOGNIZE request about to be sent. */
+void speech_channel_timing_request(speech_channel_t *schannel);
+
+/* Set the latencies of the last request as variables of the Asterisk channel. */
+void speech_channel_timing_export(speech_channel_t *schannel, struct ast_channel *chan);
+
+/* Create the slab speech channels are allocated from. */
+int speech_channel_slabs_create(apr_pool_t *pool);
+
+/* Forget the slab, its memory is released with the pool it was created from. */
+void speech_channel_slabs_destroy(void);
+
 /* Create a new speech channel. */
 speech_channel_t *speech_channel_create(
 						apr_pool_t *pool,
@@ -188,27 +404,142 @@ speech_channel_t *speech_channel_create(
 						const char *rec_file_path,
 						struct ast_channel *chan);
 
-/* Destroy the speech channel. */
+/* Destroy the speech channel, or return it to the session pool of its profile. */
 int speech_channel_destroy(speech_channel_t *schannel);
 
-/* Open the speech channel. */
+/* Create an idle channel with an established session for the session pool of the profile. */
+speech_channel_t *speech_channel_warm(
+						ast_mrcp_profile_t *profile,
+						ast_mrcp_application_t *app,
+						speech_channel_type_t type,
+						const char *codec,
+						apr_uint16_t rate);
+
+/* Create a channel not attached to a call with a session established with the 
+ * faster than realtime media engine of the profile, for batch jobs.
+ */
+speech_channel_t *speech_channel_batch(
+						ast_mrcp_profile_t *profile,
+						ast_mrcp_application_t *app,
+						speech_channel_type_t type,
+						const char *codec,
+						apr_uint16_t rate);
+
+/* Return the channels whose session was taken over more than grace ago to the slab. */
+void speech_channel_retired_reap(apr_interval_time_t grace);
+
+/* Start the thread tearing down speech channels. */
+int speech_channel_reaper_start(void);
+
+/* Stop the reaper thread and complete the pending teardowns. */
+void speech_channel_reaper_stop(void);
+
+/* Open the speech channel, taking over a session from the session pool if available. */
 int speech_channel_open(speech_channel_t *schannel, ast_mrcp_profile_t *profile);
 
+/* Start opening the speech channel without waiting for the session to be established. */
+int speech_channel_open_start(speech_channel_t *schannel, ast_mrcp_profile_t *profile);
+
+/* Wait for the speech channel being opened to be ready. */
+int speech_channel_open_wait(speech_channel_t *schannel);
+
+/* Open the speech channel unless it is open or being opened, and wait for it to be ready. */
+int speech_channel_open_ready(speech_channel_t *schannel, ast_mrcp_profile_t *profile);
+
+/* Set or clear debug flags (SPEECH_CHANNEL_DEBUG_*) of the speech channel. */
+int speech_channel_debug_set(speech_channel_t *schannel, apr_uint32_t flags, int enable);
+
 /* Stop SPEAK/RECOGNIZE request on speech channel. */
 int speech_channel_stop(speech_channel_t *schannel);
 
 /* Set parameters in an MRCP header. */
 int speech_channel_set_params(speech_channel_t *schannel, mrcp_message_t *msg, apr_hash_t *header_fields);
 
+/* Set the body of an MRCP message. The content of a file loaded by the channel 
+ * is not copied, but referenced until the message is destroyed.
+ */
+void speech_channel_body_set(speech_channel_t *schannel, mrcp_message_t *msg, const char *content);
+
 /* Read synthesized speech / speech to be recognized. */
 int speech_channel_read(speech_channel_t *schannel, void *data, apr_size_t *len, int block);
 
 /* Write synthesized speech / speech to be recognized. */
 int speech_channel_write(speech_channel_t *schannel, void *data, apr_size_t *len);
 
-/* Write synthesized speech to Asterisk. */
+/* Get and clear the last event of the voice activity detector, from the writer thread. */
+energy_vad_event_t speech_channel_vad_poll(speech_channel_t *schannel);
+
+/* Start detecting voice activity anew, from the writer thread. */
+void speech_channel_vad_reset(speech_channel_t *schannel);
+
+/* Discard the audio kept in the pre-roll ring, from the writer thread. */
+void speech_channel_preroll_clear(speech_channel_t *schannel);
+
+/* Queue synthesized speech for playout to Asterisk, called from the media engine. */
 int speech_channel_ast_write(speech_channel_t *schannel, void *data, apr_size_t len);
 
+/* Start playing out synthesized speech to the Asterisk channel. */
+int speech_channel_playout_start(speech_channel_t *schannel);
+
+/* Stop playing out synthesized speech and discard the queued audio. */
+void speech_channel_playout_stop(speech_channel_t *schannel);
+
+/* Whether queued synthesized speech is still being played out. */
+int speech_channel_playout_pending(speech_channel_t *schannel);
+
+/* Silence the playout at once, from any thread. */
+void speech_channel_playout_mute(speech_channel_t *schannel);
+
+/* Play out a prompt from the TTS cache, taking over the reference to the entry. */
+int speech_channel_playout_cached(speech_channel_t *schannel, tts_cache_entry_t *entry);
+
+/* Look up a prompt in the TTS cache. Return the key of a cacheable prompt in key. */
+tts_cache_entry_t *speech_channel_cache_lookup(speech_channel_t *schannel, ast_mrcp_profile_t *profile, const char *text, apr_hash_t *header_fields, const char **key);
+
+/* Capture the synthesized speech of the next SPEAK request for the TTS cache. */
+void speech_channel_cache_capture(speech_channel_t *schannel, const char *key);
+
+/* Mark the captured SPEAK request as successfully completed. */
+void speech_channel_cache_complete(speech_channel_t *schannel);
+
+/* Drain the synthesized speech of the SPEAK request sent on a channel not 
+ * attached to a call into its capture and the file, if any. Return 0 once the 
+ * request is no longer in progress.
+ */
+int speech_channel_drain(speech_channel_t *schannel, apr_interval_time_t timeout, FILE *file);
+
+/* Drain the synthesized speech of the SPEAK request sent on a channel not 
+ * attached to a call into its capture. Return 0 if the prompt was added to 
+ * the TTS cache.
+ */
+int speech_channel_cache_drain(speech_channel_t *schannel, apr_interval_time_t timeout);
+
+/* Capture the synthesized speech of the next SPEAK request sent on a channel 
+ * not attached to a call, for the prompt to be played out on another channel.
+ */
+int speech_channel_prefetch_capture(speech_channel_t *schannel, const char *key, apr_size_t max_len);
+
+/* Drain the synthesized speech of the captured SPEAK request. Return the 
+ * prompt, to be played out with speech_channel_playout_cached(), or NULL if 
+ * the request did not complete.
+ */
+tts_cache_entry_t *speech_channel_prefetch_drain(speech_channel_t *schannel, apr_interval_time_t timeout);
+
+/* Cancel the drain of the captured SPEAK request from another thread, without 
+ * waiting. The draining thread stops the request.
+ */
+void speech_channel_prefetch_cancel(speech_channel_t *schannel);
+
+/* Feed up to size bytes of recorded audio from a file, -1 for the rest of the 
+ * file, to the RECOGNIZE request sent on a channel not attached to a call, 
+ * followed by up to tail msec of silence. Return 0 once the request completed 
+ * by itself.
+ */
+int speech_channel_feed(speech_channel_t *schannel, FILE *file, apr_off_t size, apr_size_t tail, apr_interval_time_t timeout);
+
+/* Get the codec and rate of a raw audio file by its extension. */
+int speech_channel_file_format(const char *path, const char **codec, apr_uint16_t *rate);
+
 /* Convert channel status to string. */
 const char *speech_channel_status_to_string(speech_channel_status_t status);
 
@@ -221,6 +552,33 @@ const char *speech_channel_status_to_string(speech_channel_status_t status);
  */
 int determine_synth_content_type(speech_channel_t *schannel, const char *text, const char **content, const char **content_type);
 
+/* 
+ * Split a plain text or SSML prompt into chunks at sentence boundaries.
+ * @param schannel the speech channel to use
+ * @param content the prompt content
+ * @param content_type the prompt content type
+ * @param min_len the minimum length of a chunk, 0 not to split the prompt
+ * @param chunks the output array of chunks (const char*)
+ */
+int determine_synth_chunks(speech_channel_t *schannel, const char *content, const char *content_type, apr_size_t min_len, apr_array_header_t **chunks);
+
+/* 
+ * Determine whether a prompt is inline plain text or SSML, rather than a file or URI.
+ * @param text the input text
+ */
+int determine_synth_inline(const char *text);
+
+/* 
+ * Merge the leading compatible inline prompts into a single SSML document, 
+ * each prompt preceded by a mark. Return NULL if fewer than two prompts merge.
+ * @param pool the pool to allocate the document from
+ * @param prompts the prompts to merge
+ * @param marks the names of the marks preceding the prompts
+ * @param count the number of prompts in, the number of prompts merged out
+ * @param language the language of plain text prompts, NULL if unknown
+ */
+const char *merge_synth_prompts(apr_pool_t *pool, const char * const *prompts, const char * const *marks, int *count, const char *language);
+
 /* 
  * Determine grammar type by specified grammar data.
  * @param schannel the speech channel to use
@@ -244,6 +602,21 @@ struct ast_filestream* astchan_stream_file(struct ast_channel *chan, const char
 /* Create a grammar object to reference in recognition requests. */
 int grammar_create(grammar_t **grammar, const char *name, grammar_type_t type, const char *data, apr_pool_t *pool);
 
+/* Size of the buffer grammar_defined_get() formats the digest of a grammar, 
+ * a hexadecimal MD5 digest, into.
+ */
+#define GRAMMAR_DIGEST_BUFFER_SIZE (sizeof("grammar-") + 32)
+
+/* Get the Content-ID to define an inline grammar by in the MRCP session of a 
+ * recognizer, given the name of the grammar. Set defined to TRUE if the same 
+ * grammar is already defined by this Content-ID, and digest to the digest of 
+ * the grammar, formatted into buf of GRAMMAR_DIGEST_BUFFER_SIZE bytes. 
+ */
+const char *grammar_defined_get(speech_channel_t *schannel, const char *name, const char *mime_type, const char *data, int *defined, char *buf, const char **digest);
+
+/* Account for an inline grammar defined in the MRCP session by DEFINE-GRAMMAR. */
+void grammar_defined_set(speech_channel_t *schannel, const char *id, const char *digest);
+
 /* Get the MIME type for this grammar type. */
 const char *grammar_type_to_mime(grammar_type_t type, const ast_mrcp_profile_t *profile);
 
@@ -0,0 +1,244 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include "apt_pool.h"
+#include "stream_dump.h"
+
+/* Interval the writer thread drains the rings at. */
+#define STREAM_DUMP_INTERVAL   apr_time_from_msec(100)
+
+/* Size of the chunks the rings are drained by. */
+#define STREAM_DUMP_CHUNK_SIZE 4096
+
+/* Name of the files per direction. */
+static const char *stream_dump_suffixes[STREAM_DUMP_DIRECTIONS] = { "in", "out" };
+
+/* Dumps drained by the writer thread, synchronized by the writer mutex. */
+static stream_dump_t *dumps = NULL;
+/* Synchronizes the list of dumps and the writer thread. */
+static apr_thread_mutex_t *writer_mutex = NULL;
+/* Wakes up the writer thread. */
+static apr_thread_cond_t *writer_cond = NULL;
+/* The writer thread. */
+static apr_thread_t *writer_thread = NULL;
+/* True while the writer thread is running. */
+static int writer_running = 0;
+
+/* Write the audio queued in the rings of the dump to its files. Close the 
+ * files of a disabled dump once drained, so they can be collected.
+ */
+static void stream_dump_drain(stream_dump_t *dump)
+{
+	apr_byte_t chunk[STREAM_DUMP_CHUNK_SIZE];
+	apr_size_t len;
+	int i;
+
+	for (i = 0; i < STREAM_DUMP_DIRECTIONS; i++) {
+		while (audio_queue_inuse(dump->rings[i]) > 0) {
+			len = sizeof(chunk);
+			if (audio_queue_read(dump->rings[i], chunk, &len, 0) != 0)
+				break;
+
+			if (dump->files[i] == NULL) {
+				const char *filename = apr_psprintf(dump->pool, "%s-%s.raw", dump->path, stream_dump_suffixes[i]);
+				if ((dump->files[i] = fopen(filename, "ab")) == NULL) {
+					ast_log(LOG_WARNING, "Unable to open stream dump file for writing: %s\n", filename);
+					continue;
+				}
+				ast_log(LOG_DEBUG, "Dumping stream to %s\n", filename);
+			}
+
+			if (fwrite(chunk, 1, len, dump->files[i]) != len)
+				ast_log(LOG_WARNING, "Unable to write stream dump: %s-%s.raw\n", dump->path, stream_dump_suffixes[i]);
+		}
+
+		if ((dump->files[i] != NULL) && !apr_atomic_read32(&dump->enabled)) {
+			fclose(dump->files[i]);
+			dump->files[i] = NULL;
+		}
+	}
+}
+
+/* Create a disabled dump of streams of byte_rate bytes per second to files starting with path. */
+stream_dump_t *stream_dump_create(const char *path, apr_size_t byte_rate)
+{
+	apr_pool_t *pool;
+	stream_dump_t *dump;
+	char name[AUDIO_QUEUE_NAME_SIZE];
+	int i;
+
+	if ((pool = apt_pool_create()) == NULL) {
+		ast_log(LOG_ERROR, "Unable to create memory pool for stream dump\n");
+		return NULL;
+	}
+
+	dump = (stream_dump_t *)apr_pcalloc(pool, sizeof(stream_dump_t));
+	dump->pool = pool;
+	dump->path = apr_pstrdup(pool, path);
+	apr_atomic_set32(&dump->enabled, FALSE);
+
+	/* Hold about a second of audio, which the writer drains every 100 msec. */
+	for (i = 0; i < STREAM_DUMP_DIRECTIONS; i++) {
+		apr_snprintf(name, sizeof(name), "%s-%s", path, stream_dump_suffixes[i]);
+		if (audio_queue_create(&dump->rings[i], name, byte_rate) != 0) {
+			ast_log(LOG_ERROR, "Unable to create ring for stream dump %s\n", name);
+			while (--i >= 0)
+				audio_queue_destroy(dump->rings[i]);
+			apr_pool_destroy(pool);
+			return NULL;
+		}
+	}
+
+	if (writer_mutex != NULL) {
+		apr_thread_mutex_lock(writer_mutex);
+		dump->next = dumps;
+		dumps = dump;
+		apr_thread_mutex_unlock(writer_mutex);
+	}
+
+	return dump;
+}
+
+/* Destroy the dump, once the audio path no longer uses it. */
+void stream_dump_destroy(stream_dump_t *dump)
+{
+	stream_dump_t **prev;
+	int i;
+
+	if (dump == NULL)
+		return;
+
+	apr_atomic_set32(&dump->enabled, FALSE);
+
+	if (writer_mutex != NULL) {
+		apr_thread_mutex_lock(writer_mutex);
+		for (prev = &dumps; *prev != NULL; prev = &(*prev)->next) {
+			if (*prev == dump) {
+				*prev = dump->next;
+				break;
+			}
+		}
+		apr_thread_mutex_unlock(writer_mutex);
+	}
+
+	/* Write what is left, this also closes the files. */
+	stream_dump_drain(dump);
+
+	for (i = 0; i < STREAM_DUMP_DIRECTIONS; i++)
+		audio_queue_destroy(dump->rings[i]);
+
+	apr_pool_destroy(dump->pool);
+}
+
+/* Start or stop dumping the streams. */
+void stream_dump_enable(stream_dump_t *dump, int enable)
+{
+	if (dump != NULL)
+		apr_atomic_set32(&dump->enabled, enable ? TRUE : FALSE);
+}
+
+/* Copy audio of a stream to its ring, called from the audio path. */
+void stream_dump_write(stream_dump_t *dump, stream_dump_direction_t direction, const void *data, apr_size_t len)
+{
+	if ((dump == NULL) || (len == 0) || !apr_atomic_read32(&dump->enabled))
+		return;
+
+	/* Audio which does not fit is dropped and counted as an overflow of the ring. */
+	audio_queue_write(dump->rings[direction], (void *)data, &len);
+}
+
+/* The writer thread. */
+static void * APR_THREAD_FUNC stream_dump_writer_run(apr_thread_t *thread, void *data)
+{
+	stream_dump_t *dump;
+
+	apr_thread_mutex_lock(writer_mutex);
+	while (writer_running) {
+		apr_thread_cond_timedwait(writer_cond, writer_mutex, STREAM_DUMP_INTERVAL);
+
+		for (dump = dumps; dump != NULL; dump = dump->next)
+			stream_dump_drain(dump);
+	}
+	apr_thread_mutex_unlock(writer_mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Start the thread writing the dumps to files. */
+int stream_dump_writer_start(apr_pool_t *pool)
+{
+	if ((apr_thread_mutex_create(&writer_mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS) || (writer_mutex == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create stream dump mutex\n");
+		writer_mutex = NULL;
+		return -1;
+	}
+
+	if ((apr_thread_cond_create(&writer_cond, pool) != APR_SUCCESS) || (writer_cond == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create stream dump condition variable\n");
+		apr_thread_mutex_destroy(writer_mutex);
+		writer_mutex = NULL;
+		writer_cond = NULL;
+		return -1;
+	}
+
+	writer_running = 1;
+	if (apr_thread_create(&writer_thread, NULL, stream_dump_writer_run, NULL, pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create stream dump writer thread\n");
+		writer_running = 0;
+		writer_thread = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Stop the writer thread, once all the dumps are written. */
+void stream_dump_writer_stop(void)
+{
+	apr_status_t status;
+	stream_dump_t *dump;
+
+	if (writer_thread != NULL) {
+		apr_thread_mutex_lock(writer_mutex);
+		writer_running = 0;
+		apr_thread_cond_signal(writer_cond);
+		apr_thread_mutex_unlock(writer_mutex);
+
+		apr_thread_join(&status, writer_thread);
+		writer_thread = NULL;
+	}
+
+	if (writer_mutex != NULL) {
+		apr_thread_mutex_lock(writer_mutex);
+		for (dump = dumps; dump != NULL; dump = dump->next)
+			stream_dump_drain(dump);
+		dumps = NULL;
+		apr_thread_mutex_unlock(writer_mutex);
+	}
+
+	/* Released along with the pool they were created from. */
+	writer_mutex = NULL;
+	writer_cond = NULL;
+}
@@ -0,0 +1,79 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef STREAM_DUMP_H
+#define STREAM_DUMP_H
+
+#include <stdio.h>
+#include <apr_general.h>
+#include <apr_atomic.h>
+#include "audio_queue.h"
+
+/* Direction of a dumped stream. */
+enum stream_dump_direction_t {
+	/* Audio written to the speech channel. */
+	STREAM_DUMP_IN,
+	/* Audio read from the speech channel. */
+	STREAM_DUMP_OUT,
+
+	/* This MUST be the last value in this enum! */
+	STREAM_DUMP_DIRECTIONS
+};
+typedef enum stream_dump_direction_t stream_dump_direction_t;
+
+/* Dump of the audio streams of a speech channel to raw header-less files.
+ *
+ * The audio path only copies the streams into rings, one per direction, 
+ * which a background thread drains to the files, so no disk I/O is done 
+ * on the media engine tick. The audio path is the single producer and the 
+ * writer thread the single consumer of each ring.
+ */
+struct stream_dump_t {
+	/* Memory pool of the dump. */
+	apr_pool_t *pool;
+	/* Path of the files, without the direction and extension. */
+	const char *path;
+	/* True while the streams are dumped. */
+	volatile apr_uint32_t enabled;
+	/* Rings of the streams, per direction. */
+	audio_queue_t *rings[STREAM_DUMP_DIRECTIONS];
+	/* Files the streams are written to, used by the writer thread only. */
+	FILE *files[STREAM_DUMP_DIRECTIONS];
+	/* Next dump drained by the writer thread. */
+	struct stream_dump_t *next;
+};
+typedef struct stream_dump_t stream_dump_t;
+
+/* Create a disabled dump of streams of byte_rate bytes per second to files starting with path. */
+stream_dump_t *stream_dump_create(const char *path, apr_size_t byte_rate);
+
+/* Destroy the dump, once the audio path no longer uses it. */
+void stream_dump_destroy(stream_dump_t *dump);
+
+/* Start or stop dumping the streams. */
+void stream_dump_enable(stream_dump_t *dump, int enable);
+
+/* Copy audio of a stream to its ring, called from the audio path. */
+void stream_dump_write(stream_dump_t *dump, stream_dump_direction_t direction, const void *data, apr_size_t len);
+
+/* Start the thread writing the dumps to files. */
+int stream_dump_writer_start(apr_pool_t *pool);
+
+/* Stop the writer thread, once all the dumps are written. */
+void stream_dump_writer_stop(void);
+
+#endif /* STREAM_DUMP_H */
@@ -0,0 +1,566 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include <stdlib.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_atomic.h>
+#include <apr_thread_mutex.h>
+#include "apt_pool.h"
+#include "tts_cache.h"
+#include "tts_store.h"
+
+/* Size of the chunks the audio of a prompt is captured in. */
+#define TTS_CACHE_CHUNK_SIZE 16384
+
+/* Share of the cache a single prompt may take at most. */
+#define TTS_CACHE_MAX_ENTRY_SHARE 4
+
+/* Chunk of captured audio. */
+struct tts_cache_chunk_t {
+	/* Number of bytes used. */
+	apr_size_t len;
+	/* Next chunk. */
+	struct tts_cache_chunk_t *next;
+	/* The audio. */
+	apr_byte_t data[TTS_CACHE_CHUNK_SIZE];
+};
+typedef struct tts_cache_chunk_t tts_cache_chunk_t;
+
+/* Audio of a prompt being synthesized, written by a single thread. */
+struct tts_cache_capture_t {
+	/* Memory pool of the capture. */
+	apr_pool_t *pool;
+	/* Key of the prompt. */
+	const char *key;
+	/* First chunk. */
+	tts_cache_chunk_t *head;
+	/* Last chunk. */
+	tts_cache_chunk_t *tail;
+	/* Number of bytes captured. */
+	apr_size_t len;
+	/* Maximum number of bytes captured. */
+	apr_size_t max_len;
+	/* True if the prompt is too large to be captured. */
+	int overflow;
+	/* True once the synthesis has successfully completed. */
+	volatile apr_uint32_t complete;
+};
+
+/* The TTS cache, synchronized by its mutex. */
+static struct {
+	/* Synchronizes the cache. */
+	apr_thread_mutex_t *mutex;
+	/* Cached prompts by key. */
+	apr_hash_t *entries;
+	/* Most recently used entry. */
+	tts_cache_entry_t *head;
+	/* Least recently used entry. */
+	tts_cache_entry_t *tail;
+	/* Maximum size of a captured prompt in bytes. */
+	apr_size_t capture_max;
+	/* Counters. */
+	tts_cache_stats_t stats;
+} cache;
+
+/* Remove the entry from the list of entries. */
+static void tts_cache_unlink(tts_cache_entry_t *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache.head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache.tail = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+/* Insert the entry as the most recently used one. */
+static void tts_cache_link(tts_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache.head;
+	if (cache.head)
+		cache.head->prev = entry;
+	else
+		cache.tail = entry;
+	cache.head = entry;
+}
+
+/* Remove the entry from the cache. Return true if the entry is to be destroyed by the caller. */
+static int tts_cache_evict(tts_cache_entry_t *entry)
+{
+	apr_hash_set(cache.entries, entry->key, APR_HASH_KEY_STRING, NULL);
+	tts_cache_unlink(entry);
+	cache.stats.size -= entry->len;
+	cache.stats.entries--;
+	return (apr_atomic_dec32(&entry->refs) == 0);
+}
+
+/* Create the TTS cache holding up to max_size bytes of audio in memory, 0 
+ * disables the memory tier. Prompts are also looked up in and added to the 
+ * TTS store, if started before.
+ */
+int tts_cache_init(apr_pool_t *pool, apr_size_t max_size)
+{
+	tts_store_stats_t store_stats;
+
+	memset(&cache, 0, sizeof(cache));
+
+	tts_store_stats_get(&store_stats);
+	if ((max_size == 0) && (store_stats.max_size == 0))
+		return 0;
+
+	if ((apr_thread_mutex_create(&cache.mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS) || (cache.mutex == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create TTS cache mutex\n");
+		cache.mutex = NULL;
+		return -1;
+	}
+
+	cache.entries = apr_hash_make(pool);
+	cache.stats.max_size = max_size;
+	cache.capture_max = ((max_size > store_stats.max_size) ? max_size : store_stats.max_size) / TTS_CACHE_MAX_ENTRY_SHARE;
+	ast_log(LOG_DEBUG, "TTS cache of %"APR_SIZE_T_FMT" bytes created\n", max_size);
+	return 0;
+}
+
+/* Release the cached prompts. The prompts still played out are destroyed once 
+ * released by their players.
+ */
+void tts_cache_destroy(void)
+{
+	tts_cache_entry_t *entry;
+
+	if (cache.mutex == NULL)
+		return;
+
+	apr_thread_mutex_lock(cache.mutex);
+	while ((entry = cache.tail) != NULL) {
+		if (tts_cache_evict(entry))
+			apr_pool_destroy(entry->pool);
+	}
+	cache.stats.max_size = 0;
+	apr_thread_mutex_unlock(cache.mutex);
+
+	/* The mutex and the index are released along with the pool they were created from. */
+	cache.mutex = NULL;
+	cache.entries = NULL;
+}
+
+/* Whether the TTS cache is enabled. */
+int tts_cache_enabled(void)
+{
+	return (cache.mutex != NULL);
+}
+
+/* Append the text to the key with runs of white space collapsed to a single space. */
+static void tts_cache_key_append_normalized(char *key, apr_size_t *pos, const char *text)
+{
+	int space = FALSE;
+
+	while ((*text == ' ') || (*text == '\t') || (*text == '\r') || (*text == '\n'))
+		text++;
+
+	for (; *text != '\0'; text++) {
+		if ((*text == ' ') || (*text == '\t') || (*text == '\r') || (*text == '\n')) {
+			space = TRUE;
+			continue;
+		}
+		if (space) {
+			key[(*pos)++] = ' ';
+			space = FALSE;
+		}
+		key[(*pos)++] = *text;
+	}
+}
+
+/* Compare header fields by name. */
+static int tts_cache_field_compare(const void *a, const void *b)
+{
+	return strcasecmp(*(const char **)a, *(const char **)b);
+}
+
+/* Build the key of a prompt synthesized with the profile to the codec and rate. 
+ * The key holds the normalized content itself rather than a digest of it, so 
+ * different prompts never share an entry.
+ */
+const char *tts_cache_key(
+				apr_pool_t *pool,
+				const char *profile,
+				const char *codec,
+				apr_uint16_t rate,
+				const char *content_type,
+				apr_hash_t *header_fields,
+				const char *content)
+{
+	apr_array_header_t *fields = apr_array_make(pool, 8, sizeof(const char *));
+	const char *header = "";
+	apr_size_t pos;
+	char *key;
+
+	/* Header fields are ordered by name, as the hash does not keep the order they were given in. */
+	if (header_fields != NULL) {
+		apr_hash_index_t *hi;
+		int i;
+
+		for (hi = apr_hash_first(pool, header_fields); hi; hi = apr_hash_next(hi)) {
+			const void *name;
+			void *value;
+
+			apr_hash_this(hi, &name, NULL, &value);
+			APR_ARRAY_PUSH(fields, const char *) = apr_psprintf(pool, "%s:%s", (const char *)name, (const char *)value);
+		}
+		qsort(fields->elts, fields->nelts, sizeof(const char *), tts_cache_field_compare);
+
+		for (i = 0; i < fields->nelts; i++)
+			header = apr_pstrcat(pool, header, APR_ARRAY_IDX(fields, i, const char *), ";", NULL);
+	}
+
+	header = apr_psprintf(pool, "%s\n%s/%u\n%s\n%s\n", profile, codec, (unsigned int)rate, content_type, header);
+	pos = strlen(header);
+	key = apr_palloc(pool, pos + strlen(content) + 1);
+	memcpy(key, header, pos);
+	tts_cache_key_append_normalized(key, &pos, content);
+	key[pos] = '\0';
+	return key;
+}
+
+/* Index the entry, which the caller holds a reference to, as the most recently 
+ * used one and evict the least recently used prompts. The prompts still played 
+ * out are destroyed once released. Return the entry with the key, which is 
+ * another one if the prompt was cached meanwhile, or NULL if the entry does 
+ * not fit the memory tier.
+ */
+static tts_cache_entry_t *tts_cache_insert(tts_cache_entry_t *entry)
+{
+	tts_cache_entry_t *cached;
+	tts_cache_entry_t *evicted;
+	tts_cache_entry_t *released = NULL;
+
+	if (entry->len > cache.stats.max_size / TTS_CACHE_MAX_ENTRY_SHARE)
+		return NULL;
+
+	apr_thread_mutex_lock(cache.mutex);
+	if ((cached = apr_hash_get(cache.entries, entry->key, APR_HASH_KEY_STRING)) != NULL) {
+		apr_atomic_inc32(&cached->refs);
+		apr_thread_mutex_unlock(cache.mutex);
+		return cached;
+	}
+
+	apr_atomic_inc32(&entry->refs);
+	apr_hash_set(cache.entries, entry->key, APR_HASH_KEY_STRING, entry);
+	tts_cache_link(entry);
+	cache.stats.size += entry->len;
+	cache.stats.entries++;
+	cache.stats.inserts++;
+
+	while ((cache.stats.size > cache.stats.max_size) && ((evicted = cache.tail) != entry)) {
+		cache.stats.evictions++;
+		if (tts_cache_evict(evicted)) {
+			evicted->next = released;
+			released = evicted;
+		}
+	}
+	apr_thread_mutex_unlock(cache.mutex);
+
+	while ((evicted = released) != NULL) {
+		released = evicted->next;
+		apr_pool_destroy(evicted->pool);
+	}
+	return entry;
+}
+
+/* Map a prompt of the TTS store into an entry and take a reference to it, 
+ * NULL if not stored. The entry is added to the memory tier, so that the 
+ * next lookups do not hit the disk.
+ */
+static tts_cache_entry_t *tts_cache_store_open(const char *key)
+{
+	apr_pool_t *pool;
+	tts_cache_entry_t *entry;
+	tts_cache_entry_t *cached;
+	const apr_byte_t *data;
+	apr_size_t len;
+
+	if (!tts_store_enabled() || ((pool = apt_pool_create()) == NULL))
+		return NULL;
+
+	if (tts_store_open(pool, key, &data, &len) != 0) {
+		apr_pool_destroy(pool);
+		return NULL;
+	}
+
+	/* The audio is played out from the mapped file, which is unmapped along with the pool. */
+	entry = apr_pcalloc(pool, sizeof(tts_cache_entry_t));
+	entry->pool = pool;
+	entry->key = apr_pstrdup(pool, key);
+	entry->data = (apr_byte_t *)data;
+	entry->len = len;
+	apr_atomic_set32(&entry->refs, 1);
+
+	if (((cached = tts_cache_insert(entry)) != NULL) && (cached != entry)) {
+		apr_pool_destroy(pool);
+		return cached;
+	}
+	return entry;
+}
+
+/* Find a prompt in memory or in the TTS store and take a reference to it, NULL if not cached. */
+tts_cache_entry_t *tts_cache_lookup(const char *key)
+{
+	tts_cache_entry_t *entry;
+
+	if ((cache.mutex == NULL) || (key == NULL))
+		return NULL;
+
+	apr_thread_mutex_lock(cache.mutex);
+	if ((entry = apr_hash_get(cache.entries, key, APR_HASH_KEY_STRING)) != NULL) {
+		apr_atomic_inc32(&entry->refs);
+		tts_cache_unlink(entry);
+		tts_cache_link(entry);
+		cache.stats.hits++;
+	}
+	apr_thread_mutex_unlock(cache.mutex);
+
+	/* Keep the recency of the stored prompt in line with its use from memory. */
+	if (entry != NULL) {
+		tts_store_touch(key);
+		return entry;
+	}
+
+	/* The store is looked up without the mutex, as it may hit the disk. */
+	entry = tts_cache_store_open(key);
+
+	apr_thread_mutex_lock(cache.mutex);
+	if (entry != NULL)
+		cache.stats.store_hits++;
+	else
+		cache.stats.misses++;
+	apr_thread_mutex_unlock(cache.mutex);
+
+	return entry;
+}
+
+/* Release a reference to a prompt. The cache mutex is not needed, as the last 
+ * reference is never held by the cache, and the entry may outlive the cache.
+ */
+void tts_cache_entry_release(tts_cache_entry_t *entry)
+{
+	if ((entry != NULL) && (apr_atomic_dec32(&entry->refs) == 0))
+		apr_pool_destroy(entry->pool);
+}
+
+/* Start capturing the audio of a prompt being synthesized. */
+tts_cache_capture_t *tts_cache_capture_create(const char *key)
+{
+	apr_pool_t *pool;
+	tts_cache_capture_t *capture;
+
+	if ((cache.mutex == NULL) || (key == NULL))
+		return NULL;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return NULL;
+
+	capture = apr_pcalloc(pool, sizeof(tts_cache_capture_t));
+	capture->pool = pool;
+	capture->key = apr_pstrdup(pool, key);
+	capture->max_len = cache.capture_max;
+	apr_atomic_set32(&capture->complete, FALSE);
+	return capture;
+}
+
+/* Start capturing the audio of a prompt synthesized ahead of its playout, of 
+ * up to max_len bytes. The capture works with the cache disabled, and is added 
+ * to the cache as well if the key is not NULL.
+ */
+tts_cache_capture_t *tts_cache_prefetch_create(const char *key, apr_size_t max_len)
+{
+	apr_pool_t *pool;
+	tts_cache_capture_t *capture;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return NULL;
+
+	capture = apr_pcalloc(pool, sizeof(tts_cache_capture_t));
+	capture->pool = pool;
+	capture->key = (key != NULL) ? apr_pstrdup(pool, key) : NULL;
+	capture->max_len = max_len;
+	apr_atomic_set32(&capture->complete, FALSE);
+	return capture;
+}
+
+/* Append synthesized audio to the capture. */
+void tts_cache_capture_write(tts_cache_capture_t *capture, const void *data, apr_size_t len)
+{
+	const apr_byte_t *bytes = data;
+	apr_size_t n;
+
+	if ((capture == NULL) || capture->overflow)
+		return;
+
+	if (capture->len + len > capture->max_len) {
+		capture->overflow = TRUE;
+		return;
+	}
+
+	while (len > 0) {
+		if ((capture->tail == NULL) || (capture->tail->len == TTS_CACHE_CHUNK_SIZE)) {
+			tts_cache_chunk_t *chunk = apr_palloc(capture->pool, sizeof(tts_cache_chunk_t));
+			chunk->len = 0;
+			chunk->next = NULL;
+			if (capture->tail)
+				capture->tail->next = chunk;
+			else
+				capture->head = chunk;
+			capture->tail = chunk;
+		}
+
+		n = TTS_CACHE_CHUNK_SIZE - capture->tail->len;
+		if (n > len)
+			n = len;
+		memcpy(capture->tail->data + capture->tail->len, bytes, n);
+		capture->tail->len += n;
+		capture->len += n;
+		bytes += n;
+		len -= n;
+	}
+}
+
+/* Mark the synthesis of the captured prompt as successfully completed. */
+void tts_cache_capture_complete(tts_cache_capture_t *capture)
+{
+	if (capture != NULL)
+		apr_atomic_set32(&capture->complete, TRUE);
+}
+
+/* Turn the captured prompt into an entry holding a single reference if it is 
+ * complete, and destroy the capture. Return NULL if the prompt is incomplete.
+ */
+static tts_cache_entry_t *tts_cache_capture_entry(tts_cache_capture_t *capture, int complete)
+{
+	apr_pool_t *pool;
+	tts_cache_entry_t *entry;
+	tts_cache_chunk_t *chunk;
+	apr_byte_t *data;
+
+	if (!complete || !apr_atomic_read32(&capture->complete) || capture->overflow || (capture->len == 0)) {
+		if (cache.mutex != NULL) {
+			apr_thread_mutex_lock(cache.mutex);
+			cache.stats.rejects++;
+			apr_thread_mutex_unlock(cache.mutex);
+		}
+		apr_pool_destroy(capture->pool);
+		return NULL;
+	}
+
+	if ((pool = apt_pool_create()) == NULL) {
+		apr_pool_destroy(capture->pool);
+		return NULL;
+	}
+
+	entry = apr_pcalloc(pool, sizeof(tts_cache_entry_t));
+	entry->pool = pool;
+	entry->key = (capture->key != NULL) ? apr_pstrdup(pool, capture->key) : NULL;
+	entry->len = capture->len;
+	entry->data = data = apr_palloc(pool, capture->len);
+	apr_atomic_set32(&entry->refs, 1);
+	for (chunk = capture->head; chunk; chunk = chunk->next) {
+		memcpy(data, chunk->data, chunk->len);
+		data += chunk->len;
+	}
+	apr_pool_destroy(capture->pool);
+	return entry;
+}
+
+/* Add the captured prompt to the cache and the TTS store if it is complete, and 
+ * destroy the capture. Return 0 if the prompt was added.
+ */
+int tts_cache_capture_finish(tts_cache_capture_t *capture, int complete)
+{
+	tts_cache_entry_t *entry;
+	tts_cache_entry_t *cached;
+
+	if (capture == NULL)
+		return -1;
+
+	if (cache.mutex == NULL) {
+		apr_pool_destroy(capture->pool);
+		return -1;
+	}
+
+	if ((entry = tts_cache_capture_entry(capture, complete)) == NULL)
+		return -1;
+
+	/* The store writes a copy of the prompt in the background. */
+	tts_store_put(entry->key, entry->data, entry->len);
+
+	/* Drop the reference of the capture, the cache holds its own. */
+	if ((cached = tts_cache_insert(entry)) == entry)
+		tts_cache_entry_release(entry);
+	else {
+		if (cached != NULL)
+			tts_cache_entry_release(cached);
+		apr_pool_destroy(entry->pool);
+	}
+	return 0;
+}
+
+/* Turn the prompt captured ahead of its playout into an entry the caller holds 
+ * the reference to, if it is complete, and destroy the capture. The prompt is 
+ * added to the cache and the TTS store as well, if it has a key. Return NULL if 
+ * the prompt is incomplete.
+ */
+tts_cache_entry_t *tts_cache_prefetch_finish(tts_cache_capture_t *capture, int complete)
+{
+	tts_cache_entry_t *entry;
+	tts_cache_entry_t *cached;
+
+	if (capture == NULL)
+		return NULL;
+
+	if ((entry = tts_cache_capture_entry(capture, complete)) == NULL)
+		return NULL;
+
+	if ((entry->key != NULL) && (cache.mutex != NULL)) {
+		tts_store_put(entry->key, entry->data, entry->len);
+
+		/* Keep playing out the own entry if the prompt was cached meanwhile. */
+		if (((cached = tts_cache_insert(entry)) != NULL) && (cached != entry))
+			tts_cache_entry_release(cached);
+	}
+	return entry;
+}
+
+/* Get the counters of the cache. */
+void tts_cache_stats_get(tts_cache_stats_t *stats)
+{
+	if (cache.mutex == NULL) {
+		memset(stats, 0, sizeof(tts_cache_stats_t));
+		return;
+	}
+
+	apr_thread_mutex_lock(cache.mutex);
+	*stats = cache.stats;
+	apr_thread_mutex_unlock(cache.mutex);
+}
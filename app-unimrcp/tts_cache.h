@@ -0,0 +1,127 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef TTS_CACHE_H
+#define TTS_CACHE_H
+
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_atomic.h>
+#include <apr_time.h>
+
+/* Synthesized prompt kept in the TTS cache. */
+struct tts_cache_entry_t {
+	/* Memory pool of the entry. */
+	apr_pool_t *pool;
+	/* Key of the prompt. */
+	const char *key;
+	/* Audio of the prompt, in the codec and rate the key was built for, possibly mapped from the TTS store. */
+	apr_byte_t *data;
+	/* Size of the audio in bytes. */
+	apr_size_t len;
+	/* Number of references, one of which is held by the cache while the entry is indexed. 
+	 * Updated atomically, so that the entry outlives the cache while referenced. */
+	volatile apr_uint32_t refs;
+	/* Previous (more recently used) entry. */
+	struct tts_cache_entry_t *prev;
+	/* Next (less recently used) entry. */
+	struct tts_cache_entry_t *next;
+};
+typedef struct tts_cache_entry_t tts_cache_entry_t;
+
+typedef struct tts_cache_capture_t tts_cache_capture_t;
+
+/* Counters of the TTS cache. */
+struct tts_cache_stats_t {
+	/* Maximum size of the cached audio in bytes, 0 if the memory tier is disabled. */
+	apr_size_t max_size;
+	/* Size of the cached audio in bytes. */
+	apr_size_t size;
+	/* Number of cached prompts. */
+	apr_size_t entries;
+	/* Number of lookups which found the prompt in memory. */
+	apr_uint32_t hits;
+	/* Number of lookups which found the prompt in the TTS store only. */
+	apr_uint32_t store_hits;
+	/* Number of lookups which did not find the prompt. */
+	apr_uint32_t misses;
+	/* Number of prompts added. */
+	apr_uint32_t inserts;
+	/* Number of prompts evicted to make room. */
+	apr_uint32_t evictions;
+	/* Number of captured prompts not added, as incomplete or too large. */
+	apr_uint32_t rejects;
+};
+typedef struct tts_cache_stats_t tts_cache_stats_t;
+
+/* Create the TTS cache holding up to max_size bytes of audio in memory, 0 disables 
+ * the memory tier. The cache is disabled if the TTS store is not started either.
+ */
+int tts_cache_init(apr_pool_t *pool, apr_size_t max_size);
+
+/* Release the cached prompts. */
+void tts_cache_destroy(void);
+
+/* Whether the TTS cache is enabled. */
+int tts_cache_enabled(void);
+
+/* Build the key of a prompt synthesized with the profile to the codec and rate. */
+const char *tts_cache_key(
+				apr_pool_t *pool,
+				const char *profile,
+				const char *codec,
+				apr_uint16_t rate,
+				const char *content_type,
+				apr_hash_t *header_fields,
+				const char *content);
+
+/* Find a prompt in memory or in the TTS store and take a reference to it, NULL if not cached. */
+tts_cache_entry_t *tts_cache_lookup(const char *key);
+
+/* Release a reference to a prompt. */
+void tts_cache_entry_release(tts_cache_entry_t *entry);
+
+/* Start capturing the audio of a prompt being synthesized. */
+tts_cache_capture_t *tts_cache_capture_create(const char *key);
+
+/* Append synthesized audio to the capture. */
+void tts_cache_capture_write(tts_cache_capture_t *capture, const void *data, apr_size_t len);
+
+/* Mark the synthesis of the captured prompt as successfully completed. */
+void tts_cache_capture_complete(tts_cache_capture_t *capture);
+
+/* Add the captured prompt to the cache and the TTS store if it is complete, and 
+ * destroy the capture. Return 0 if the prompt was added.
+ */
+int tts_cache_capture_finish(tts_cache_capture_t *capture, int complete);
+
+/* Start capturing the audio of a prompt synthesized ahead of its playout, of 
+ * up to max_len bytes, also with the cache disabled. The prompt is added to 
+ * the cache as well if the key is not NULL.
+ */
+tts_cache_capture_t *tts_cache_prefetch_create(const char *key, apr_size_t max_len);
+
+/* Turn the prompt captured ahead of its playout into an entry the caller holds 
+ * the reference to, and destroy the capture. Return NULL if the prompt is 
+ * incomplete.
+ */
+tts_cache_entry_t *tts_cache_prefetch_finish(tts_cache_capture_t *capture, int complete);
+
+/* Get the counters of the cache. */
+void tts_cache_stats_get(tts_cache_stats_t *stats);
+
+#endif /* TTS_CACHE_H */
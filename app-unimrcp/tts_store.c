@@ -0,0 +1,747 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include <stdlib.h>
+#include <apr_lib.h>
+#include <apr_hash.h>
+#include <apr_tables.h>
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_file_info.h>
+#include <apr_mmap.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include "apt_pool.h"
+#include "tts_store.h"
+
+/* Interval the writer thread writes the pending prompts at. */
+#define TTS_STORE_INTERVAL       apr_time_from_sec(1)
+
+/* Interval the index is rewritten at, if the order of the prompts changed. */
+#define TTS_STORE_INDEX_INTERVAL apr_time_from_sec(30)
+
+/* Size of the prompts which may wait to be written, further prompts are dropped. */
+#define TTS_STORE_MAX_PENDING    (8 * 1024 * 1024)
+
+/* Share of the store a single prompt may take at most. */
+#define TTS_STORE_MAX_FILE_SHARE 4
+
+/* Length of the name of a stored prompt, the hex digest of its key. */
+#define TTS_STORE_NAME_LEN       16
+
+/* Magic of the stored prompts. */
+#define TTS_STORE_FILE_MAGIC     "UNITTS1"
+
+/* Magic of the index. */
+#define TTS_STORE_INDEX_MAGIC    "UNITTSI"
+
+/* Name of the index. */
+#define TTS_STORE_INDEX_NAME     "index"
+
+/* Header of a stored prompt, followed by the key and the audio. */
+struct tts_store_header_t {
+	/* TTS_STORE_FILE_MAGIC. */
+	char magic[8];
+	/* Length of the key. */
+	apr_uint32_t key_len;
+	/* Reserved, 0. */
+	apr_uint32_t reserved;
+	/* Length of the audio. */
+	apr_uint64_t data_len;
+};
+typedef struct tts_store_header_t tts_store_header_t;
+
+/* Header of the index, followed by the records of the prompts, most recently used first. */
+struct tts_store_index_header_t {
+	/* TTS_STORE_INDEX_MAGIC. */
+	char magic[8];
+	/* Number of records. */
+	apr_uint32_t count;
+	/* Reserved, 0. */
+	apr_uint32_t reserved;
+};
+typedef struct tts_store_index_header_t tts_store_index_header_t;
+
+/* Record of a prompt in the index. */
+struct tts_store_record_t {
+	/* Name of the prompt. */
+	char name[TTS_STORE_NAME_LEN];
+	/* Size of the file. */
+	apr_uint64_t size;
+	/* Time the prompt was last used. */
+	apr_int64_t used;
+};
+typedef struct tts_store_record_t tts_store_record_t;
+
+/* Stored prompt. */
+struct tts_store_file_t {
+	/* Name of the prompt, the hex digest of its key. */
+	char name[TTS_STORE_NAME_LEN + 1];
+	/* Size of the file. */
+	apr_size_t size;
+	/* Time the prompt was last used. */
+	apr_time_t used;
+	/* Previous (more recently used) prompt. */
+	struct tts_store_file_t *prev;
+	/* Next (less recently used) prompt, or next free record. */
+	struct tts_store_file_t *next;
+};
+typedef struct tts_store_file_t tts_store_file_t;
+
+/* Prompt waiting to be written. */
+struct tts_store_write_t {
+	/* Memory pool of the prompt. */
+	apr_pool_t *pool;
+	/* Name of the prompt. */
+	char name[TTS_STORE_NAME_LEN + 1];
+	/* Key of the prompt. */
+	const char *key;
+	/* Audio of the prompt. */
+	apr_byte_t *data;
+	/* Size of the audio in bytes. */
+	apr_size_t len;
+	/* True once written. */
+	int written;
+	/* Next prompt to be written. */
+	struct tts_store_write_t *next;
+};
+typedef struct tts_store_write_t tts_store_write_t;
+
+/* The TTS store, synchronized by its mutex. */
+static struct {
+	/* Memory pool the index is allocated from. */
+	apr_pool_t *pool;
+	/* Directory of the prompts. */
+	const char *dir;
+	/* Synchronizes the store and the writer thread. */
+	apr_thread_mutex_t *mutex;
+	/* Wakes up the writer thread. */
+	apr_thread_cond_t *cond;
+	/* The writer thread. */
+	apr_thread_t *thread;
+	/* True while the writer thread is running. */
+	int running;
+	/* Stored prompts by name. */
+	apr_hash_t *files;
+	/* Most recently used prompt. */
+	tts_store_file_t *head;
+	/* Least recently used prompt. */
+	tts_store_file_t *tail;
+	/* Records of removed prompts, for reuse. */
+	tts_store_file_t *free;
+	/* First prompt waiting to be written. */
+	tts_store_write_t *pending_head;
+	/* Last prompt waiting to be written. */
+	tts_store_write_t *pending_tail;
+	/* True if the index is to be rewritten. */
+	int dirty;
+	/* Time the index was last written. */
+	apr_time_t index_written;
+	/* Counters. */
+	tts_store_stats_t stats;
+} store;
+
+/* Name a prompt by the 64-bit FNV-1a digest of its key. */
+static void tts_store_name(char *name, const char *key)
+{
+	apr_uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *key != '\0'; key++) {
+		hash ^= (unsigned char)*key;
+		hash *= 0x100000001b3ULL;
+	}
+	apr_snprintf(name, TTS_STORE_NAME_LEN + 1, "%016" APR_UINT64_T_HEX_FMT, hash);
+}
+
+/* Whether the file name is the one of a stored prompt, without the extension. */
+static int tts_store_name_valid(const char *name)
+{
+	int i;
+
+	for (i = 0; i < TTS_STORE_NAME_LEN; i++) {
+		if (!apr_isxdigit(name[i]))
+			return FALSE;
+	}
+	return (strcmp(name + TTS_STORE_NAME_LEN, ".tts") == 0);
+}
+
+/* Path of a stored prompt. */
+static const char *tts_store_path(apr_pool_t *pool, const char *name, const char *extension)
+{
+	return apr_psprintf(pool, "%s/%s%s", store.dir, name, extension);
+}
+
+/* Remove the prompt from the list of prompts. */
+static void tts_store_unlink(tts_store_file_t *file)
+{
+	if (file->prev)
+		file->prev->next = file->next;
+	else
+		store.head = file->next;
+	if (file->next)
+		file->next->prev = file->prev;
+	else
+		store.tail = file->prev;
+	file->prev = NULL;
+	file->next = NULL;
+}
+
+/* Insert the prompt as the most recently used one. */
+static void tts_store_link(tts_store_file_t *file)
+{
+	file->prev = NULL;
+	file->next = store.head;
+	if (store.head)
+		store.head->prev = file;
+	else
+		store.tail = file;
+	store.head = file;
+}
+
+/* Mark the prompt as the most recently used one. */
+static void tts_store_use(tts_store_file_t *file)
+{
+	file->used = apr_time_now();
+	tts_store_unlink(file);
+	tts_store_link(file);
+	store.dirty = TRUE;
+}
+
+/* Add a prompt to the index, as the most recently used one. */
+static tts_store_file_t *tts_store_add(const char *name, apr_size_t size, apr_time_t used)
+{
+	tts_store_file_t *file;
+
+	if ((file = store.free) != NULL)
+		store.free = file->next;
+	else
+		file = apr_palloc(store.pool, sizeof(tts_store_file_t));
+
+	apr_cpystrn(file->name, name, sizeof(file->name));
+	file->size = size;
+	file->used = used;
+	apr_hash_set(store.files, file->name, APR_HASH_KEY_STRING, file);
+	tts_store_link(file);
+	store.stats.size += size;
+	store.stats.files++;
+	store.dirty = TRUE;
+	return file;
+}
+
+/* Remove a prompt from the index, and keep its record for reuse. */
+static void tts_store_remove(tts_store_file_t *file)
+{
+	apr_hash_set(store.files, file->name, APR_HASH_KEY_STRING, NULL);
+	tts_store_unlink(file);
+	store.stats.size -= file->size;
+	store.stats.files--;
+	store.dirty = TRUE;
+	file->next = store.free;
+	store.free = file;
+}
+
+/* Remove the least recently used prompts from the index until the store 
+ * fits its size. Return the names of the files to be removed by the caller.
+ */
+static apr_array_header_t *tts_store_evict(apr_pool_t *pool)
+{
+	apr_array_header_t *names = apr_array_make(pool, 4, sizeof(const char *));
+	tts_store_file_t *file;
+
+	while ((store.stats.size > store.stats.max_size) && ((file = store.tail) != NULL)) {
+		APR_ARRAY_PUSH(names, const char *) = apr_pstrdup(pool, file->name);
+		tts_store_remove(file);
+		store.stats.evictions++;
+	}
+	return names;
+}
+
+/* Remove the files of evicted prompts. */
+static void tts_store_evict_files(apr_pool_t *pool, apr_array_header_t *names)
+{
+	int i;
+
+	for (i = 0; i < names->nelts; i++)
+		apr_file_remove(tts_store_path(pool, APR_ARRAY_IDX(names, i, const char *), ".tts"), pool);
+}
+
+/* Write a file by writing a temporary file and renaming it, so that a 
+ * partially written file is never taken for a complete one.
+ */
+static int tts_store_write_file(apr_pool_t *pool, const char *path, const void *head, apr_size_t head_len, const void *key, apr_size_t key_len, const void *data, apr_size_t data_len)
+{
+	const char *tmp_path = apr_pstrcat(pool, path, ".tmp", NULL);
+	apr_file_t *file = NULL;
+	apr_status_t status;
+
+	if ((status = apr_file_open(&file, tmp_path, APR_FOPEN_WRITE | APR_FOPEN_CREATE | APR_FOPEN_TRUNCATE | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool)) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Unable to open %s\n", tmp_path);
+		return -1;
+	}
+
+	if ((status = apr_file_write_full(file, head, head_len, NULL)) == APR_SUCCESS) {
+		if ((key_len > 0) && ((status = apr_file_write_full(file, key, key_len, NULL)) == APR_SUCCESS) && (data_len > 0))
+			status = apr_file_write_full(file, data, data_len, NULL);
+	}
+	if (apr_file_close(file) != APR_SUCCESS)
+		status = APR_EGENERAL;
+
+	if ((status != APR_SUCCESS) || (apr_file_rename(tmp_path, path, pool) != APR_SUCCESS)) {
+		ast_log(LOG_WARNING, "Unable to write %s\n", path);
+		apr_file_remove(tmp_path, pool);
+		return -1;
+	}
+	return 0;
+}
+
+/* Write a pending prompt. Called by the writer thread without the mutex. */
+static int tts_store_write(tts_store_write_t *write)
+{
+	tts_store_header_t header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TTS_STORE_FILE_MAGIC, sizeof(header.magic));
+	header.key_len = (apr_uint32_t)strlen(write->key);
+	header.data_len = write->len;
+
+	return tts_store_write_file(write->pool, tts_store_path(write->pool, write->name, ".tts"),
+		&header, sizeof(header), write->key, header.key_len, write->data, write->len);
+}
+
+/* Write the index from a snapshot taken with the mutex held. */
+static void tts_store_write_index(apr_pool_t *pool, tts_store_record_t *records, apr_uint32_t count)
+{
+	tts_store_index_header_t header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TTS_STORE_INDEX_MAGIC, sizeof(header.magic));
+	header.count = count;
+
+	tts_store_write_file(pool, tts_store_path(pool, TTS_STORE_INDEX_NAME, ""),
+		&header, sizeof(header), records, count * sizeof(tts_store_record_t), NULL, 0);
+}
+
+/* Take a snapshot of the index, most recently used prompt first. Called with the mutex held. */
+static tts_store_record_t *tts_store_snapshot(apr_pool_t *pool, apr_uint32_t *count)
+{
+	tts_store_record_t *records = apr_pcalloc(pool, (store.stats.files + 1) * sizeof(tts_store_record_t));
+	tts_store_file_t *file;
+	apr_uint32_t i = 0;
+
+	for (file = store.head; file != NULL; file = file->next, i++) {
+		memcpy(records[i].name, file->name, TTS_STORE_NAME_LEN);
+		records[i].size = file->size;
+		records[i].used = file->used;
+	}
+	*count = i;
+	store.dirty = FALSE;
+	store.index_written = apr_time_now();
+	return records;
+}
+
+/* Write the pending prompts, evict the least recently used ones and rewrite 
+ * the index if due or forced. Called by the writer thread with the mutex 
+ * held, which is released while writing.
+ */
+static void tts_store_flush(int force)
+{
+	tts_store_write_t *pending;
+	tts_store_write_t *write;
+	apr_array_header_t *evicted;
+	tts_store_record_t *records = NULL;
+	apr_uint32_t count = 0;
+	apr_pool_t *pool;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return;
+
+	pending = store.pending_head;
+	store.pending_head = NULL;
+	store.pending_tail = NULL;
+
+	/* Write the prompts without the mutex, so that lookups are not blocked by the disk. */
+	apr_thread_mutex_unlock(store.mutex);
+	for (write = pending; write != NULL; write = write->next)
+		write->written = (tts_store_write(write) == 0);
+	apr_thread_mutex_lock(store.mutex);
+
+	while ((write = pending) != NULL) {
+		pending = write->next;
+		store.stats.pending -= write->len;
+		if (!write->written)
+			store.stats.failures++;
+		else if (apr_hash_get(store.files, write->name, APR_HASH_KEY_STRING) == NULL) {
+			tts_store_add(write->name, sizeof(tts_store_header_t) + strlen(write->key) + write->len, apr_time_now());
+			store.stats.writes++;
+		}
+		apr_pool_destroy(write->pool);
+	}
+	evicted = tts_store_evict(pool);
+
+	if (store.dirty && (force || (apr_time_now() - store.index_written >= TTS_STORE_INDEX_INTERVAL)))
+		records = tts_store_snapshot(pool, &count);
+
+	apr_thread_mutex_unlock(store.mutex);
+	tts_store_evict_files(pool, evicted);
+	if (records != NULL)
+		tts_store_write_index(pool, records, count);
+	apr_thread_mutex_lock(store.mutex);
+
+	apr_pool_destroy(pool);
+}
+
+/* Compare prompts by the time they were last used, most recent first. */
+static int tts_store_file_compare(const void *a, const void *b)
+{
+	const tts_store_file_t *file_a = *(const tts_store_file_t **)a;
+	const tts_store_file_t *file_b = *(const tts_store_file_t **)b;
+
+	if (file_a->used == file_b->used)
+		return 0;
+	return (file_a->used > file_b->used) ? -1 : 1;
+}
+
+/* Read the index into a hash of records by name. A missing or corrupt index yields an empty hash. */
+static apr_hash_t *tts_store_read_index(apr_pool_t *pool)
+{
+	apr_hash_t *records = apr_hash_make(pool);
+	tts_store_index_header_t header;
+	tts_store_record_t *record;
+	apr_file_t *file = NULL;
+	apr_uint32_t i;
+
+	if (apr_file_open(&file, tts_store_path(pool, TTS_STORE_INDEX_NAME, ""), APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool) != APR_SUCCESS)
+		return records;
+
+	if ((apr_file_read_full(file, &header, sizeof(header), NULL) != APR_SUCCESS) || (memcmp(header.magic, TTS_STORE_INDEX_MAGIC, sizeof(header.magic)) != 0)) {
+		ast_log(LOG_WARNING, "Ignoring invalid TTS store index in %s\n", store.dir);
+		apr_file_close(file);
+		return records;
+	}
+
+	for (i = 0; i < header.count; i++) {
+		record = apr_palloc(pool, sizeof(tts_store_record_t));
+		if (apr_file_read_full(file, record, sizeof(tts_store_record_t), NULL) != APR_SUCCESS)
+			break;
+		apr_hash_set(records, apr_pstrndup(pool, record->name, TTS_STORE_NAME_LEN), APR_HASH_KEY_STRING, record);
+	}
+	apr_file_close(file);
+	return records;
+}
+
+/* Load the prompts found in the directory. The index only restores the 
+ * order the prompts were used in, prompts missing from it (e.g. written 
+ * right before a crash) are taken as used when last modified.
+ */
+static void tts_store_load(apr_pool_t *pool)
+{
+	apr_array_header_t *files = apr_array_make(pool, 64, sizeof(tts_store_file_t *));
+	apr_hash_t *records = tts_store_read_index(pool);
+	apr_array_header_t *evicted;
+	apr_finfo_t finfo;
+	apr_dir_t *dir;
+	int i;
+
+	if (apr_dir_open(&dir, store.dir, pool) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Unable to open TTS store %s\n", store.dir);
+		return;
+	}
+
+	while (apr_dir_read(&finfo, APR_FINFO_NAME | APR_FINFO_TYPE | APR_FINFO_SIZE | APR_FINFO_MTIME, dir) == APR_SUCCESS) {
+		tts_store_record_t *record;
+		tts_store_file_t *file;
+
+		if ((finfo.filetype != APR_REG) || (finfo.name == NULL))
+			continue;
+
+		/* Left over by an interrupted write. */
+		if ((strlen(finfo.name) > 4) && (strcmp(finfo.name + strlen(finfo.name) - 4, ".tmp") == 0)) {
+			apr_file_remove(apr_pstrcat(pool, store.dir, "/", finfo.name, NULL), pool);
+			continue;
+		}
+
+		if (!tts_store_name_valid(finfo.name) || (finfo.size < (apr_off_t)sizeof(tts_store_header_t)))
+			continue;
+
+		file = apr_pcalloc(pool, sizeof(tts_store_file_t));
+		apr_cpystrn(file->name, finfo.name, sizeof(file->name));
+		file->size = (apr_size_t)finfo.size;
+		record = apr_hash_get(records, file->name, APR_HASH_KEY_STRING);
+		file->used = (record && (record->size == (apr_uint64_t)finfo.size)) ? (apr_time_t)record->used : finfo.mtime;
+		APR_ARRAY_PUSH(files, tts_store_file_t *) = file;
+	}
+	apr_dir_close(dir);
+
+	/* Add the least recently used prompts first, so that the most recently used one ends up in front. */
+	qsort(files->elts, files->nelts, sizeof(tts_store_file_t *), tts_store_file_compare);
+	for (i = files->nelts - 1; i >= 0; i--) {
+		tts_store_file_t *file = APR_ARRAY_IDX(files, i, tts_store_file_t *);
+		tts_store_add(file->name, file->size, file->used);
+	}
+
+	evicted = tts_store_evict(pool);
+	tts_store_evict_files(pool, evicted);
+	store.stats.evictions = 0;
+}
+
+/* The writer thread. */
+static void * APR_THREAD_FUNC tts_store_writer_run(apr_thread_t *thread, void *data)
+{
+	apr_thread_mutex_lock(store.mutex);
+	while (store.running) {
+		apr_thread_cond_timedwait(store.cond, store.mutex, TTS_STORE_INTERVAL);
+		tts_store_flush(FALSE);
+	}
+	apr_thread_mutex_unlock(store.mutex);
+
+	apr_thread_exit(thread, APR_SUCCESS);
+	return NULL;
+}
+
+/* Load the prompts stored in dir and start the thread writing new ones, 
+ * keeping up to max_size bytes. A NULL dir or 0 max_size disables the store.
+ */
+int tts_store_start(apr_pool_t *pool, const char *dir, apr_size_t max_size)
+{
+	apr_pool_t *tmp_pool;
+
+	memset(&store, 0, sizeof(store));
+
+	if (ast_strlen_zero(dir) || (max_size == 0))
+		return 0;
+
+	if (apr_dir_make_recursive(dir, APR_FPROT_OS_DEFAULT, pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create TTS store %s\n", dir);
+		return -1;
+	}
+
+	if ((apr_thread_mutex_create(&store.mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS) || (store.mutex == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create TTS store mutex\n");
+		store.mutex = NULL;
+		return -1;
+	}
+
+	if ((apr_thread_cond_create(&store.cond, pool) != APR_SUCCESS) || (store.cond == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create TTS store condition variable\n");
+		apr_thread_mutex_destroy(store.mutex);
+		store.mutex = NULL;
+		store.cond = NULL;
+		return -1;
+	}
+
+	store.pool = pool;
+	store.dir = apr_pstrdup(pool, dir);
+	store.files = apr_hash_make(pool);
+	store.stats.max_size = max_size;
+
+	if ((tmp_pool = apt_pool_create()) != NULL) {
+		tts_store_load(tmp_pool);
+		apr_pool_destroy(tmp_pool);
+	}
+	store.dirty = FALSE;
+	store.index_written = apr_time_now();
+	ast_log(LOG_DEBUG, "TTS store %s loaded with %"APR_SIZE_T_FMT" prompts of %"APR_SIZE_T_FMT" bytes\n", store.dir, store.stats.files, store.stats.size);
+
+	store.running = 1;
+	if (apr_thread_create(&store.thread, NULL, tts_store_writer_run, NULL, pool) != APR_SUCCESS) {
+		ast_log(LOG_ERROR, "Unable to create TTS store writer thread\n");
+		store.running = 0;
+		store.thread = NULL;
+		store.mutex = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Stop the writer thread, once the pending prompts and the index are written. */
+void tts_store_stop(void)
+{
+	apr_status_t status;
+
+	if (store.mutex == NULL)
+		return;
+
+	if (store.thread != NULL) {
+		apr_thread_mutex_lock(store.mutex);
+		store.running = 0;
+		apr_thread_cond_signal(store.cond);
+		apr_thread_mutex_unlock(store.mutex);
+
+		apr_thread_join(&status, store.thread);
+		store.thread = NULL;
+	}
+
+	apr_thread_mutex_lock(store.mutex);
+	tts_store_flush(TRUE);
+	store.stats.max_size = 0;
+	apr_thread_mutex_unlock(store.mutex);
+
+	/* Released along with the pool they were created from. */
+	store.mutex = NULL;
+	store.cond = NULL;
+	store.files = NULL;
+}
+
+/* Whether the TTS store is enabled. */
+int tts_store_enabled(void)
+{
+	return (store.mutex != NULL);
+}
+
+/* Map the stored prompt into memory released along with pool, return 0 if found. 
+ * The key stored along with the audio is compared, as different keys may have 
+ * the same name.
+ */
+int tts_store_open(apr_pool_t *pool, const char *key, const apr_byte_t **data, apr_size_t *len)
+{
+	char name[TTS_STORE_NAME_LEN + 1];
+	const tts_store_header_t *header;
+	tts_store_file_t *file;
+	apr_file_t *fd = NULL;
+	apr_mmap_t *mm = NULL;
+	apr_finfo_t finfo;
+	apr_size_t key_len;
+	int res = -1;
+
+	if ((store.mutex == NULL) || (key == NULL))
+		return -1;
+
+	tts_store_name(name, key);
+	key_len = strlen(key);
+
+	apr_thread_mutex_lock(store.mutex);
+	if ((file = apr_hash_get(store.files, name, APR_HASH_KEY_STRING)) != NULL)
+		tts_store_use(file);
+	apr_thread_mutex_unlock(store.mutex);
+
+	/* The file may be evicted meanwhile, a mapped file stays readable once removed. */
+	if ((file != NULL) &&
+		(apr_file_open(&fd, tts_store_path(pool, name, ".tts"), APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool) == APR_SUCCESS)) {
+		if ((apr_file_info_get(&finfo, APR_FINFO_SIZE, fd) == APR_SUCCESS) && (finfo.size >= (apr_off_t)sizeof(tts_store_header_t)) &&
+			(apr_mmap_create(&mm, fd, 0, (apr_size_t)finfo.size, APR_MMAP_READ, pool) == APR_SUCCESS)) {
+			header = (const tts_store_header_t *)mm->mm;
+			if ((memcmp(header->magic, TTS_STORE_FILE_MAGIC, sizeof(header->magic)) == 0) &&
+				(header->key_len == key_len) &&
+				(sizeof(tts_store_header_t) + key_len + header->data_len == (apr_uint64_t)finfo.size) &&
+				(memcmp((const char *)mm->mm + sizeof(tts_store_header_t), key, key_len) == 0)) {
+				*data = (const apr_byte_t *)mm->mm + sizeof(tts_store_header_t) + key_len;
+				*len = (apr_size_t)header->data_len;
+				res = 0;
+			}
+		}
+		apr_file_close(fd);
+	}
+
+	apr_thread_mutex_lock(store.mutex);
+	if (res == 0)
+		store.stats.hits++;
+	else
+		store.stats.misses++;
+	apr_thread_mutex_unlock(store.mutex);
+
+	return res;
+}
+
+/* Mark the stored prompt as used, as it was played out from memory, so that 
+ * the prompts played most are not evicted from the store.
+ */
+void tts_store_touch(const char *key)
+{
+	char name[TTS_STORE_NAME_LEN + 1];
+	tts_store_file_t *file;
+
+	if ((store.mutex == NULL) || (key == NULL))
+		return;
+
+	tts_store_name(name, key);
+
+	apr_thread_mutex_lock(store.mutex);
+	if ((file = apr_hash_get(store.files, name, APR_HASH_KEY_STRING)) != NULL)
+		tts_store_use(file);
+	apr_thread_mutex_unlock(store.mutex);
+}
+
+/* Queue a copy of a prompt to be written by the writer thread. */
+void tts_store_put(const char *key, const apr_byte_t *data, apr_size_t len)
+{
+	char name[TTS_STORE_NAME_LEN + 1];
+	tts_store_write_t *write;
+	apr_pool_t *pool;
+	int queue;
+
+	if ((store.mutex == NULL) || (key == NULL) || (len == 0) || (len > store.stats.max_size / TTS_STORE_MAX_FILE_SHARE))
+		return;
+
+	tts_store_name(name, key);
+
+	apr_thread_mutex_lock(store.mutex);
+	queue = (apr_hash_get(store.files, name, APR_HASH_KEY_STRING) == NULL);
+	if (queue && (store.stats.pending + len > TTS_STORE_MAX_PENDING)) {
+		store.stats.drops++;
+		queue = FALSE;
+	}
+	if (queue)
+		store.stats.pending += len;
+	apr_thread_mutex_unlock(store.mutex);
+
+	if (!queue)
+		return;
+
+	/* Copied without the mutex, the pending size is reserved already. */
+	if ((pool = apt_pool_create()) == NULL) {
+		apr_thread_mutex_lock(store.mutex);
+		store.stats.pending -= len;
+		apr_thread_mutex_unlock(store.mutex);
+		return;
+	}
+
+	write = apr_palloc(pool, sizeof(tts_store_write_t));
+	write->pool = pool;
+	memcpy(write->name, name, sizeof(write->name));
+	write->key = apr_pstrdup(pool, key);
+	write->data = apr_pmemdup(pool, data, len);
+	write->len = len;
+	write->written = FALSE;
+	write->next = NULL;
+
+	apr_thread_mutex_lock(store.mutex);
+	if (store.pending_tail)
+		store.pending_tail->next = write;
+	else
+		store.pending_head = write;
+	store.pending_tail = write;
+	apr_thread_cond_signal(store.cond);
+	apr_thread_mutex_unlock(store.mutex);
+}
+
+/* Get the counters of the store. */
+void tts_store_stats_get(tts_store_stats_t *stats)
+{
+	if (store.mutex == NULL) {
+		memset(stats, 0, sizeof(tts_store_stats_t));
+		return;
+	}
+
+	apr_thread_mutex_lock(store.mutex);
+	*stats = store.stats;
+	apr_thread_mutex_unlock(store.mutex);
+}
@@ -0,0 +1,71 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef TTS_STORE_H
+#define TTS_STORE_H
+
+#include <apr_general.h>
+
+/* Counters of the TTS store. */
+struct tts_store_stats_t {
+	/* Maximum size of the stored prompts in bytes, 0 if the store is disabled. */
+	apr_size_t max_size;
+	/* Size of the stored prompts in bytes. */
+	apr_size_t size;
+	/* Number of stored prompts. */
+	apr_size_t files;
+	/* Size of the prompts waiting to be written in bytes. */
+	apr_size_t pending;
+	/* Number of lookups which found the prompt. */
+	apr_uint32_t hits;
+	/* Number of lookups which did not find the prompt. */
+	apr_uint32_t misses;
+	/* Number of prompts written. */
+	apr_uint32_t writes;
+	/* Number of prompts which could not be written or read. */
+	apr_uint32_t failures;
+	/* Number of prompts not queued for writing, as too many were pending. */
+	apr_uint32_t drops;
+	/* Number of prompts removed to make room. */
+	apr_uint32_t evictions;
+};
+typedef struct tts_store_stats_t tts_store_stats_t;
+
+/* Load the prompts stored in dir and start the thread writing new ones, 
+ * keeping up to max_size bytes. A NULL dir or 0 max_size disables the store.
+ */
+int tts_store_start(apr_pool_t *pool, const char *dir, apr_size_t max_size);
+
+/* Stop the writer thread, once the pending prompts and the index are written. */
+void tts_store_stop(void);
+
+/* Whether the TTS store is enabled. */
+int tts_store_enabled(void);
+
+/* Map the stored prompt into memory released along with pool, return 0 if found. */
+int tts_store_open(apr_pool_t *pool, const char *key, const apr_byte_t **data, apr_size_t *len);
+
+/* Mark the stored prompt as used, as it was played out from memory. */
+void tts_store_touch(const char *key);
+
+/* Queue a copy of a prompt to be written by the writer thread. */
+void tts_store_put(const char *key, const apr_byte_t *data, apr_size_t len);
+
+/* Get the counters of the store. */
+void tts_store_stats_get(tts_store_stats_t *stats);
+
+#endif /* TTS_STORE_H */
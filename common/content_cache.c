@@ -0,0 +1,337 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+/* Asterisk includes. */
+#include "ast_compat_defs.h"
+
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <apr_atomic.h>
+#include <apr_file_io.h>
+#include <apr_thread_mutex.h>
+#include "apt_pool.h"
+#include "content_cache.h"
+
+/* Share of the cache a single file may take at most. */
+#define CONTENT_CACHE_MAX_ENTRY_SHARE 4
+
+/* The content cache, synchronized by its mutex. */
+static struct {
+	/* Synchronizes the cache. */
+	apr_thread_mutex_t *mutex;
+	/* Cached files by path. */
+	apr_hash_t *entries;
+	/* Most recently used entry. */
+	content_cache_entry_t *head;
+	/* Least recently used entry. */
+	content_cache_entry_t *tail;
+	/* Counters. */
+	content_cache_stats_t stats;
+} cache;
+
+/* File information the cached content is validated by. */
+#define CONTENT_CACHE_FINFO_WANTED (APR_FINFO_SIZE | APR_FINFO_MTIME | APR_FINFO_IDENT)
+
+/* Whether the content of the entry was read from the file as it is now: the 
+ * same file, not one replaced by a rename, with the same modification time 
+ * and size.
+ */
+static int content_cache_entry_current(const content_cache_entry_t *entry, const apr_finfo_t *finfo)
+{
+	return (entry->device == finfo->device) && (entry->inode == finfo->inode) && 
+		(entry->mtime == finfo->mtime) && (entry->len == (apr_size_t)finfo->size);
+}
+
+/* Remove the entry from the list of entries. */
+static void content_cache_unlink(content_cache_entry_t *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache.head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache.tail = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+/* Insert the entry as the most recently used one. */
+static void content_cache_link(content_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache.head;
+	if (cache.head)
+		cache.head->prev = entry;
+	else
+		cache.tail = entry;
+	cache.head = entry;
+}
+
+/* Remove the entry from the cache. Return true if the entry is to be destroyed by the caller. */
+static int content_cache_evict(content_cache_entry_t *entry)
+{
+	apr_hash_set(cache.entries, entry->path, APR_HASH_KEY_STRING, NULL);
+	content_cache_unlink(entry);
+	cache.stats.size -= entry->len;
+	cache.stats.entries--;
+	return (apr_atomic_dec32(&entry->refs) == 0);
+}
+
+/* Create the content cache holding up to max_size bytes of file content, 0 
+ * disables the cache.
+ */
+int content_cache_init(apr_pool_t *pool, apr_size_t max_size)
+{
+	memset(&cache, 0, sizeof(cache));
+
+	if (max_size == 0)
+		return 0;
+
+	if ((apr_thread_mutex_create(&cache.mutex, APR_THREAD_MUTEX_DEFAULT, pool) != APR_SUCCESS) || (cache.mutex == NULL)) {
+		ast_log(LOG_ERROR, "Unable to create content cache mutex\n");
+		cache.mutex = NULL;
+		return -1;
+	}
+
+	cache.entries = apr_hash_make(pool);
+	cache.stats.max_size = max_size;
+	ast_log(LOG_DEBUG, "Content cache of %"APR_SIZE_T_FMT" bytes created\n", max_size);
+	return 0;
+}
+
+/* Release the cached files. */
+void content_cache_destroy(void)
+{
+	content_cache_entry_t *entry;
+
+	if (cache.mutex == NULL)
+		return;
+
+	apr_thread_mutex_lock(cache.mutex);
+	while ((entry = cache.tail) != NULL) {
+		if (content_cache_evict(entry))
+			apr_pool_destroy(entry->pool);
+	}
+	cache.stats.max_size = 0;
+	apr_thread_mutex_unlock(cache.mutex);
+
+	/* The mutex and the index are released along with the pool they were created from. */
+	cache.mutex = NULL;
+	cache.entries = NULL;
+}
+
+/* Read a copy of a file into a new entry the caller holds the reference to, 
+ * NULL on failure. The copy, unlike a mapping of the file, is not affected by 
+ * the file being rewritten or truncated later on.
+ */
+static content_cache_entry_t *content_cache_read(const char *path)
+{
+	apr_pool_t *pool;
+	content_cache_entry_t *entry;
+	apr_file_t *file;
+	apr_finfo_t finfo;
+	apr_size_t len;
+	char *data;
+
+	if ((pool = apt_pool_create()) == NULL)
+		return NULL;
+
+	if (apr_file_open(&file, path, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Could not open file to read: %s\n", path);
+		apr_pool_destroy(pool);
+		return NULL;
+	}
+
+	if (apr_file_info_get(&finfo, CONTENT_CACHE_FINFO_WANTED, file) != APR_SUCCESS) {
+		ast_log(LOG_WARNING, "Failed to get file info: %s\n", path);
+		apr_file_close(file);
+		apr_pool_destroy(pool);
+		return NULL;
+	}
+
+	entry = apr_pcalloc(pool, sizeof(content_cache_entry_t));
+	entry->pool = pool;
+	entry->path = apr_pstrdup(pool, path);
+	entry->len = (apr_size_t)finfo.size;
+	entry->mtime = finfo.mtime;
+	entry->device = finfo.device;
+	entry->inode = finfo.inode;
+	entry->refs = 1;
+
+	data = apr_palloc(pool, entry->len + 1);
+	len = entry->len;
+	if ((len > 0) && (apr_file_read_full(file, data, len, &len) != APR_SUCCESS)) {
+		ast_log(LOG_WARNING, "Failed to read content from file: %s, size: %"APR_OFF_T_FMT"\n", path, finfo.size);
+		apr_file_close(file);
+		apr_pool_destroy(pool);
+		return NULL;
+	}
+	data[len] = '\0';
+	entry->data = data;
+
+	apr_file_close(file);
+	return entry;
+}
+
+/* Add the entry the caller holds a reference to to the cache, evicting the 
+ * least recently used entries to make room. Return the entry to use, which 
+ * is an equal entry added meanwhile, if any, or the entry itself, cached or 
+ * not. The caller holds a reference to the returned entry.
+ */
+static content_cache_entry_t *content_cache_insert(content_cache_entry_t *entry)
+{
+	content_cache_entry_t *cached;
+	content_cache_entry_t *evicted;
+	content_cache_entry_t *released = NULL;
+
+	if (entry->len > cache.stats.max_size / CONTENT_CACHE_MAX_ENTRY_SHARE)
+		return entry;
+
+	apr_thread_mutex_lock(cache.mutex);
+	if ((cached = apr_hash_get(cache.entries, entry->path, APR_HASH_KEY_STRING)) != NULL) {
+		if ((cached->device == entry->device) && (cached->inode == entry->inode) && 
+			(cached->mtime == entry->mtime) && (cached->len == entry->len)) {
+			apr_atomic_inc32(&cached->refs);
+			apr_thread_mutex_unlock(cache.mutex);
+			content_cache_entry_release(entry);
+			return cached;
+		}
+
+		/* Replace the content read before the file was modified. */
+		if (content_cache_evict(cached)) {
+			cached->next = released;
+			released = cached;
+		}
+	}
+
+	apr_atomic_inc32(&entry->refs);
+	apr_hash_set(cache.entries, entry->path, APR_HASH_KEY_STRING, entry);
+	content_cache_link(entry);
+	cache.stats.size += entry->len;
+	cache.stats.entries++;
+
+	while ((cache.stats.size > cache.stats.max_size) && ((evicted = cache.tail) != entry)) {
+		cache.stats.evictions++;
+		if (content_cache_evict(evicted)) {
+			evicted->next = released;
+			released = evicted;
+		}
+	}
+	apr_thread_mutex_unlock(cache.mutex);
+
+	while ((evicted = released) != NULL) {
+		released = evicted->next;
+		apr_pool_destroy(evicted->pool);
+	}
+	return entry;
+}
+
+/* Get the content of a file and take a reference to it, NULL if the file 
+ * cannot be read. The cached content is only used if the file is the same, 
+ * by its device and inode, with the same modification time and size.
+ */
+content_cache_entry_t *content_cache_load(apr_pool_t *pool, const char *path)
+{
+	content_cache_entry_t *entry = NULL;
+	content_cache_entry_t *stale = NULL;
+	apr_finfo_t finfo;
+
+	if (path == NULL)
+		return NULL;
+
+	if (cache.mutex != NULL) {
+		/* The file is checked without the mutex, as it may hit the disk. */
+		if (apr_stat(&finfo, path, CONTENT_CACHE_FINFO_WANTED, pool) != APR_SUCCESS) {
+			ast_log(LOG_WARNING, "Could not open file to read: %s\n", path);
+			return NULL;
+		}
+
+		apr_thread_mutex_lock(cache.mutex);
+		if ((entry = apr_hash_get(cache.entries, path, APR_HASH_KEY_STRING)) != NULL) {
+			if (content_cache_entry_current(entry, &finfo)) {
+				apr_atomic_inc32(&entry->refs);
+				content_cache_unlink(entry);
+				content_cache_link(entry);
+				cache.stats.hits++;
+			} else {
+				cache.stats.reloads++;
+				if (content_cache_evict(entry))
+					stale = entry;
+				entry = NULL;
+			}
+		} else
+			cache.stats.misses++;
+		apr_thread_mutex_unlock(cache.mutex);
+
+		if (stale != NULL)
+			apr_pool_destroy(stale->pool);
+		if (entry != NULL)
+			return entry;
+	}
+
+	if ((entry = content_cache_read(path)) == NULL)
+		return NULL;
+
+	if (cache.mutex == NULL)
+		return entry;
+
+	return content_cache_insert(entry);
+}
+
+/* Take another reference to the content of a file. */
+void content_cache_entry_ref(content_cache_entry_t *entry)
+{
+	if (entry != NULL)
+		apr_atomic_inc32(&entry->refs);
+}
+
+/* Release a reference to the content of a file. The last reference may be 
+ * released from any thread, e.g. along with the pool of an MRCP message.
+ */
+void content_cache_entry_release(content_cache_entry_t *entry)
+{
+	if ((entry != NULL) && (apr_atomic_dec32(&entry->refs) == 0))
+		apr_pool_destroy(entry->pool);
+}
+
+/* Release the reference held by a pool. */
+static apr_status_t content_cache_entry_cleanup(void *data)
+{
+	content_cache_entry_release((content_cache_entry_t *)data);
+	return APR_SUCCESS;
+}
+
+/* Hand a reference over to a pool, to be released along with the pool. */
+void content_cache_entry_attach(content_cache_entry_t *entry, apr_pool_t *pool)
+{
+	apr_pool_cleanup_register(pool, entry, content_cache_entry_cleanup, apr_pool_cleanup_null);
+}
+
+/* Get the counters of the cache. */
+void content_cache_stats_get(content_cache_stats_t *stats)
+{
+	if (cache.mutex == NULL) {
+		memset(stats, 0, sizeof(content_cache_stats_t));
+		return;
+	}
+
+	apr_thread_mutex_lock(cache.mutex);
+	*stats = cache.stats;
+	apr_thread_mutex_unlock(cache.mutex);
+}
@@ -85,6 +85,7 @@ static APR_INLINE const char *ast_channel_name(const struct ast_channel *chan)
 typedef struct ast_format ast_format_compat;
 #if AST_VERSION_AT_LEAST(13,0,0)
 #include "asterisk/format_cache.h"
+#include "asterisk/format_cap.h"
 #else /* < 13 */
 static APR_INLINE unsigned int ast_format_get_sample_rate(const ast_format_compat *format)
 {
@@ -411,6 +412,22 @@ static APR_INLINE void ast_frame_set_format(struct ast_frame *f, ast_format_comp
 #endif
 }
 
+/**
+ * Get the packetization time (msec) of the audio written to the channel, 0 if unknown.
+ */
+static APR_INLINE unsigned int ast_channel_get_write_framing(struct ast_channel *chan)
+{
+#if AST_VERSION_AT_LEAST(13,0,0)
+	unsigned int framing;
+	ast_channel_lock(chan);
+	framing = ast_format_cap_get_format_framing(ast_channel_nativeformats(chan), ast_channel_rawwriteformat(chan));
+	ast_channel_unlock(chan);
+	return framing;
+#else
+	return 0;
+#endif
+}
+
 /**
  * Backward compatible URI encode function.
  */
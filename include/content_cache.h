@@ -0,0 +1,96 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ *
+ * Please follow coding guidelines 
+ * http://svn.digium.com/view/asterisk/trunk/doc/CODING-GUIDELINES
+ */
+
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <apr_general.h>
+#include <apr_pools.h>
+#include <apr_time.h>
+#include <apr_file_info.h>
+
+/* Content of a grammar or SSML file kept in the content cache. */
+struct content_cache_entry_t {
+	/* Memory pool of the entry. */
+	apr_pool_t *pool;
+	/* Path of the file. */
+	const char *path;
+	/* Copy of the content of the file followed by a NUL. */
+	const char *data;
+	/* Size of the content in bytes. */
+	apr_size_t len;
+	/* Modification time of the file the content was read at. */
+	apr_time_t mtime;
+	/* Device of the file the content was read from. */
+	apr_dev_t device;
+	/* Inode of the file the content was read from. */
+	apr_ino_t inode;
+	/* Number of references, one of which is held by the cache while the entry is indexed. */
+	volatile apr_uint32_t refs;
+	/* Previous (more recently used) entry. */
+	struct content_cache_entry_t *prev;
+	/* Next (less recently used) entry. */
+	struct content_cache_entry_t *next;
+};
+typedef struct content_cache_entry_t content_cache_entry_t;
+
+/* Counters of the content cache. */
+struct content_cache_stats_t {
+	/* Maximum size of the cached content in bytes, 0 if the cache is disabled. */
+	apr_size_t max_size;
+	/* Size of the cached content in bytes. */
+	apr_size_t size;
+	/* Number of cached files. */
+	apr_size_t entries;
+	/* Number of lookups which found the file unchanged in the cache. */
+	apr_uint32_t hits;
+	/* Number of lookups which did not find the file. */
+	apr_uint32_t misses;
+	/* Number of lookups which found the file modified or replaced since it was cached. */
+	apr_uint32_t reloads;
+	/* Number of files evicted to make room. */
+	apr_uint32_t evictions;
+};
+typedef struct content_cache_stats_t content_cache_stats_t;
+
+/* Create the content cache holding up to max_size bytes of file content, 0 
+ * disables the cache.
+ */
+int content_cache_init(apr_pool_t *pool, apr_size_t max_size);
+
+/* Release the cached files. */
+void content_cache_destroy(void);
+
+/* Get the content of a file and take a reference to it, NULL if the file 
+ * cannot be read. The cached content is only used if the file is the same, 
+ * by its device and inode, with the same modification time and size.
+ */
+content_cache_entry_t *content_cache_load(apr_pool_t *pool, const char *path);
+
+/* Take another reference to the content of a file. */
+void content_cache_entry_ref(content_cache_entry_t *entry);
+
+/* Release a reference to the content of a file. */
+void content_cache_entry_release(content_cache_entry_t *entry);
+
+/* Hand a reference over to a pool, to be released along with the pool. */
+void content_cache_entry_attach(content_cache_entry_t *entry, apr_pool_t *pool);
+
+/* Get the counters of the cache. */
+void content_cache_stats_get(content_cache_stats_t *stats);
+
+#endif /* CONTENT_CACHE_H */
@@ -53,6 +53,9 @@ ASTERISK_REGISTER_FILE()
 #include <apt_pool.h>
 #include <apt_log.h>
 
+/* Grammar file cache shared with app_unimrcp. */
+#include "content_cache.h"
+
 
 #define UNI_ENGINE_NAME "unimrcp"
 #define UNI_ENGINE_CONFIG "res-speech-unimrcp.conf"
@@ -123,6 +126,8 @@ struct uni_engine_t {
 
 	/* Grammars to be preloaded with each MRCP session, if specified in config [grammars] */
 	apr_table_t           *grammars;
+	/* Memory cap of the grammar file cache (bytes), 0 if disabled */
+	apr_size_t             content_cache_size;
 	/* MRCPv2 properties (header fields) loaded from config */
 	mrcp_message_header_t *v2_properties;
 	/* MRCPv1 properties (header fields) loaded from config */
@@ -372,7 +377,7 @@ static int uni_recog_load_grammar(struct ast_speech *speech, ast_compat_const ch
 	const char *content_type = NULL;
 	apt_bool_t inline_content = FALSE;
 	char *tmp;
-	apr_file_t *file;
+	content_cache_entry_t *content;
 	apt_str_t *body = NULL;
 
 	mrcp_message = mrcp_application_message_create(
@@ -419,19 +424,13 @@ static int uni_recog_load_grammar(struct ast_speech *speech, ast_compat_const ch
 		apt_string_assign(body,grammar_path,mrcp_message->pool);
 	}
 	else {
-		if(apr_file_open(&file,grammar_path,APR_FOPEN_READ|APR_FOPEN_BINARY,0,mrcp_message->pool) == APR_SUCCESS) {
-			apr_finfo_t finfo;
-			if(apr_file_info_get(&finfo,APR_FINFO_SIZE,file) == APR_SUCCESS) {
-				/* Read message body */
-				body = &mrcp_message->body;
-				body->buf = apr_palloc(mrcp_message->pool,finfo.size+1);
-				body->length = (apr_size_t)finfo.size;
-				if(apr_file_read(file,body->buf,&body->length) != APR_SUCCESS) {
-					ast_log(LOG_WARNING, "(%s) Failed to read grammar file %s\n",uni_speech->name,grammar_path);
-				}
-				body->buf[body->length] = '\0';
-			}
-			apr_file_close(file);
+		content = content_cache_load(mrcp_message->pool,grammar_path);
+		if(content) {
+			/* Reference the file content as message body, until the message is destroyed */
+			content_cache_entry_attach(content,mrcp_message->pool);
+			body = &mrcp_message->body;
+			apt_string_set(body,content->data);
+			body->length = content->len;
 		}
 		else {
 			ast_log(LOG_WARNING, "(%s) No such grammar file available %s\n",uni_speech->name,grammar_path);
@@ -1337,6 +1336,11 @@ static apt_bool_t uni_engine_config_load(apr_pool_t *pool)
 		uni_engine.log_output = atoi(value);
 	}
 
+	if((value = ast_variable_retrieve(cfg, "general", "content-cache-size")) != NULL) {
+		ast_log(LOG_DEBUG, "general.content-cache-size=%s\n", value);
+		uni_engine.content_cache_size = (apr_size_t)atol(value) * 1024;
+	}
+
 	uni_engine.grammars = uni_engine_grammars_load(cfg,"grammars",pool);
 
 	uni_engine.v2_properties = uni_engine_properties_load(cfg,"mrcpv2-properties",MRCP_VERSION_2,pool);
@@ -1354,6 +1358,9 @@ static apt_bool_t uni_engine_unload()
 		uni_engine.client = NULL;
 	}
 
+	/* Release the cached grammar files */
+	content_cache_destroy();
+
 	/* Destroy singleton logger */
 	apt_log_instance_destroy();
 
@@ -1391,6 +1398,7 @@ static apt_bool_t uni_engine_load()
 	uni_engine.log_level = APT_PRIO_INFO;
 	uni_engine.log_output = APT_LOG_OUTPUT_CONSOLE | APT_LOG_OUTPUT_FILE;
 	uni_engine.grammars = NULL;
+	uni_engine.content_cache_size = 0;
 	uni_engine.v2_properties = NULL;
 	uni_engine.v1_properties = NULL;
 	uni_engine.mutex = NULL;
@@ -1418,6 +1426,11 @@ static apt_bool_t uni_engine_load()
 		uni_engine.profile = "uni2";
 	}
 
+	/* Set up the cache of grammar files, files are always read otherwise */
+	if(content_cache_init(pool,uni_engine.content_cache_size) != 0) {
+		ast_log(LOG_WARNING, "Failed to set up grammar file cache\n");
+	}
+
 	dir_layout = apt_default_dir_layout_create(UNIMRCP_DIR_LOCATION,pool);
 	/* Create singleton logger */
 	apt_log_instance_create(uni_engine.log_output, uni_engine.log_level, pool);